@@ -0,0 +1,150 @@
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include "pgenAsyncWriter.h"
+#include "pgenException.h"
+#include "pgenIO.h"
+
+namespace pgenlib {
+
+    typedef struct PgenAsyncBatch {
+        const int32_t *allele_codes;
+        const unsigned char *phase_bytes;
+        const int32_t *allele_cts;
+        uint32_t variant_ct;
+    } PgenAsyncBatch;
+
+    struct PgenAsyncWriter {
+        const PgenContext *pGenContext;
+        std::mutex mutex;
+        std::condition_variable cond;       // signalled whenever a batch is queued or consumed, or on shutdown
+        std::deque<PgenAsyncBatch> queue;   // the batch at the front is the one being written
+        uint32_t queue_depth;
+        bool stopping;
+        bool failed;                        // once set, queued batches are discarded rather than written
+        std::string error_message;
+        std::thread worker;
+    };
+
+    static void RunAsyncWriter(PgenAsyncWriter *asyncp);
+
+    /**
+     * Start a worker thread that appends batches submitted via AsyncWriterSubmit to pGenContext. Throws
+     * PgenException on failure.
+     *
+     * @param pGenContext - the PgenContext for the writer. Once the async writer is started, all appends to
+     * pGenContext must go through AsyncWriterSubmit.
+     * @param queue_depth - the maximum number of batches that may be queued (including the one being written)
+     * before AsyncWriterSubmit blocks. Must be > 0.
+     * @return a PgenAsyncWriter, which must eventually be released via CleanupPgenAsyncWriter
+     */
+    PgenAsyncWriter *InitPgenAsyncWriter(const PgenContext *const pGenContext, const uint32_t queue_depth) {
+        if (queue_depth < 1) {
+            throw PgenException("Invalid async queue depth: 0. The queue depth must be at least 1.");
+        }
+        PgenAsyncWriter *asyncp = new PgenAsyncWriter();
+        asyncp->pGenContext = pGenContext;
+        asyncp->queue_depth = queue_depth;
+        asyncp->stopping = false;
+        asyncp->failed = false;
+        try {
+            asyncp->worker = std::thread(RunAsyncWriter, asyncp);
+        } catch (const std::system_error &) {
+            delete asyncp;
+            throw PgenException("Native code failure starting the async pgen writer thread");
+        }
+        return asyncp;
+    }
+
+    /**
+     * Queue a batch (see AppendAllelesBatch for the layout) to be appended by the worker thread. Blocks while the
+     * queue is full. If a previously submitted batch failed, the error from that batch is thrown here, and this
+     * batch is not queued.
+     */
+    void AsyncWriterSubmit(
+            PgenAsyncWriter *asyncp,
+            const int32_t *allele_codes,
+            const unsigned char *phase_bytes,
+            const int32_t *allele_cts,
+            const uint32_t variant_ct) {
+        std::unique_lock<std::mutex> lock(asyncp->mutex);
+        asyncp->cond.wait(lock, [asyncp] {
+            return asyncp->failed || (asyncp->queue.size() < asyncp->queue_depth);
+        });
+        if (asyncp->failed) {
+            throw PgenException(asyncp->error_message.c_str());
+        }
+        asyncp->queue.push_back(PgenAsyncBatch{allele_codes, phase_bytes, allele_cts, variant_ct});
+        asyncp->cond.notify_all();
+    }
+
+    /**
+     * Wait until every submitted batch has been consumed. Throws the error from the first failed batch, if any.
+     */
+    void AsyncWriterDrain(PgenAsyncWriter *asyncp) {
+        std::unique_lock<std::mutex> lock(asyncp->mutex);
+        asyncp->cond.wait(lock, [asyncp] { return asyncp->queue.empty(); });
+        if (asyncp->failed) {
+            throw PgenException(asyncp->error_message.c_str());
+        }
+    }
+
+    /**
+     * Stop and join the worker thread, and free asyncp. Batches that are still queued are discarded (call
+     * AsyncWriterDrain first to write them). asyncp is no longer valid after this call.
+     */
+    void CleanupPgenAsyncWriter(PgenAsyncWriter *asyncp) {
+        {
+            std::lock_guard<std::mutex> lock(asyncp->mutex);
+            asyncp->stopping = true;
+            asyncp->cond.notify_all();
+        }
+        asyncp->worker.join();
+        delete asyncp;
+    }
+
+    void RunAsyncWriter(PgenAsyncWriter *asyncp) {
+        std::unique_lock<std::mutex> lock(asyncp->mutex);
+        while (true) {
+            asyncp->cond.wait(lock, [asyncp] { return asyncp->stopping || !asyncp->queue.empty(); });
+            if (asyncp->stopping) {
+                return;
+            }
+            const PgenAsyncBatch batch = asyncp->queue.front();
+            if (!asyncp->failed) {
+                lock.unlock();
+                try {
+                    AppendAllelesBatch(
+                            asyncp->pGenContext,
+                            batch.allele_codes,
+                            batch.phase_bytes,
+                            batch.allele_cts,
+                            batch.variant_ct);
+                    lock.lock();
+                } catch (const PgenException &e) {
+                    lock.lock();
+                    asyncp->failed = true;
+                    asyncp->error_message = e.what();
+                } catch (const std::exception &e) {
+                    // anything escaping the worker thread would terminate the process, so every failure is recorded
+                    lock.lock();
+                    asyncp->failed = true;
+                    asyncp->error_message = std::string("Native code failure in the async pgen writer thread: ") + e.what();
+                } catch (...) {
+                    lock.lock();
+                    asyncp->failed = true;
+                    asyncp->error_message = "Native code failure in the async pgen writer thread";
+                }
+            }
+            // the batch is only removed once it has been consumed, so the caller can't reuse its buffer too soon
+            asyncp->queue.pop_front();
+            asyncp->cond.notify_all();
+        }
+    }
+
+}
@@ -0,0 +1,173 @@
+#include <cstdio>
+#include <vector>
+
+#include "pgenException.h"
+#include "pgenReader.h"
+#include "pgenConcat.h"
+#include "pgenRecordCopy.h"
+
+namespace pgenlib {
+    static const int kErrMessageBufSize = 1024;
+
+    // what the output needs to know about each input pgen before any records are copied
+    typedef struct ConcatInput {
+        uint32_t variant_ct;
+        uint32_t nonref_flags_storage;
+    } ConcatInput;
+
+    // Open one of the input pgens. Allele counts aren't needed, since the multiallelic tracks are only ever copied.
+    static PgenReaderContext *OpenConcatInput(const char *cFilename, const uint32_t readFlags) {
+        return OpenPgenReader(cFilename, nullptr, nullptr, 0, readFlags, nullptr, 0);
+    }
+
+    static void CopyConcatInput(
+            PgenRecordWriter *const pRecordWriter,
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t outputNonrefFlagsStorage);
+
+    /**
+     * Concatenate pgens into a new .pgen, with the variants of each pgen following those of the previous one. The
+     * variant records are copied (in large blocks) rather than decoded and re-encoded, so concatenation is mostly
+     * bounded by disk bandwidth; only the header and index are rebuilt. The few LD-compressed records that can't be
+     * copied as they are (those that would start a new output vblock, and the rest of their LD run) have their
+     * hardcall track re-encoded without LD compression.
+     *
+     * Every input must have the same samples (in the same order), which is only checked as far as the sample count.
+     * If the inputs have different nonref flag storage modes, the output stores explicit nonref flags, which are set
+     * for the variants of the inputs with explicit flags that are set, or with all nonref flags; inputs without
+     * nonref flags contribute unset flags.
+     *
+     * The companion .pvar and .psam files aren't written.
+     *
+     * @param pgenFilenames - the input pgens, in output order. a pgen written with a separate index must have its
+     * index in the default location (the pgen file name with .pgi appended).
+     * @param pgenCount - the number of input pgens
+     * @param cOutFilename - the pgen file to write
+     * @param pgenWriteModeInt - the plink2::PgenWriteMode to write with (as for OpenPgen)
+     * @param readFlags - the read flags for the inputs (as for OpenPgenReader). With kReadFlagMemoryMap, the
+     * records are copied straight from the mapped inputs.
+     */
+    void ConcatPgens(
+            const char *const *pgenFilenames,
+            const uint32_t pgenCount,
+            const char *cOutFilename,
+            const uint32_t pgenWriteModeInt,
+            const uint32_t readFlags) {
+        if (pgenCount == 0) {
+            throw PgenException("At least one pgen is required for concatenation");
+        }
+
+        // read the header of each input, to size and lay out the output
+        std::vector<ConcatInput> inputs(pgenCount);
+        uint64_t variant_ct = 0;
+        uint32_t sample_ct = 0;
+        uint32_t allele_ct_upper_bound = 2;
+        plink2::PgenGlobalFlags phase_dosage_gflags = plink2::kfPgenGlobal0;
+        for (uint32_t input_idx = 0; input_idx != pgenCount; ++input_idx) {
+            PgenReaderContext *const pReaderContext = OpenConcatInput(pgenFilenames[input_idx], readFlags);
+            const plink2::PgenFileInfo *const pgfip = pReaderContext->pgfip;
+            const uint32_t input_sample_ct = pReaderContext->raw_sample_ct;
+            inputs[input_idx].variant_ct = pReaderContext->raw_variant_ct;
+            inputs[input_idx].nonref_flags_storage = pReaderContext->nonref_flags_storage;
+            const plink2::PgenGlobalFlags gflags = pgfip->gflags;
+            ClosePgenReader(pReaderContext);
+
+            if (input_idx == 0) {
+                sample_ct = input_sample_ct;
+            } else if (input_sample_ct != sample_ct) {
+                char errMessageBuff[kErrMessageBufSize];
+                snprintf(errMessageBuff,
+                         kErrMessageBufSize,
+                         "The pgen %s has %u samples, but %s has %u; concatenated pgens must have the same samples",
+                         pgenFilenames[input_idx],
+                         input_sample_ct,
+                         pgenFilenames[0],
+                         sample_ct);
+                throw PgenException(errMessageBuff); // PgenException makes a copy of errMessageBuff
+            }
+            variant_ct += inputs[input_idx].variant_ct;
+            if (gflags & plink2::kfPgenGlobalMultiallelicHardcallFound) {
+                // the allele counts aren't stored, so allow for the longest multiallelic records
+                allele_ct_upper_bound = plink2::kPglMaxAlleleCt;
+            }
+            phase_dosage_gflags |= gflags & (plink2::kfPgenGlobalHardcallPhasePresent |
+                                             plink2::kfPgenGlobalDosagePresent |
+                                             plink2::kfPgenGlobalDosagePhasePresent);
+        }
+        if (variant_ct > plink2::kPglMaxVariantCt) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "The concatenated pgens have %llu variants, which exceeds the maximum (%u)",
+                     static_cast<unsigned long long>(variant_ct),
+                     plink2::kPglMaxVariantCt);
+            throw PgenException(errMessageBuff); // PgenException makes a copy of errMessageBuff
+        }
+        // keep the inputs' nonref flag storage mode if they agree on one that doesn't need per-variant flags
+        uint32_t nonref_flags_storage = inputs[0].nonref_flags_storage;
+        for (const ConcatInput &input : inputs) {
+            if (input.nonref_flags_storage != nonref_flags_storage) {
+                nonref_flags_storage = 3;
+            }
+        }
+
+        PgenRecordWriter *const pRecordWriter = OpenPgenRecordWriter(
+                cOutFilename,
+                pgenWriteModeInt,
+                static_cast<uint32_t>(variant_ct),
+                sample_ct,
+                allele_ct_upper_bound,
+                phase_dosage_gflags,
+                nonref_flags_storage);
+        try {
+            for (uint32_t input_idx = 0; input_idx != pgenCount; ++input_idx) {
+                PgenReaderContext *const pReaderContext = OpenConcatInput(pgenFilenames[input_idx], readFlags);
+                if (pReaderContext->raw_variant_ct != inputs[input_idx].variant_ct) {
+                    ClosePgenReader(pReaderContext);
+                    char errMessageBuff[kErrMessageBufSize];
+                    snprintf(errMessageBuff,
+                             kErrMessageBufSize,
+                             "The pgen %s changed during concatenation",
+                             pgenFilenames[input_idx]);
+                    throw PgenException(errMessageBuff); // PgenException makes a copy of errMessageBuff
+                }
+                try {
+                    CopyConcatInput(pRecordWriter, pReaderContext, nonref_flags_storage);
+                } catch (const PgenException &) {
+                    ClosePgenReader(pReaderContext);
+                    throw;
+                }
+                ClosePgenReader(pReaderContext);
+            }
+        } catch (const PgenException &) {
+            AbandonPgenRecordWriter(pRecordWriter);
+            throw;
+        }
+        ClosePgenRecordWriter(pRecordWriter);
+    }
+
+    // Append all of the records of an input pgen to the output, and its nonref flags, if the output has explicit
+    // flags.
+    static void CopyConcatInput(
+            PgenRecordWriter *const pRecordWriter,
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t outputNonrefFlagsStorage) {
+        const uint32_t out_vidx_start = GetRecordWriterVariantCount(pRecordWriter);
+        const uint32_t variant_ct = pReaderContext->raw_variant_ct;
+        if (outputNonrefFlagsStorage == 3) {
+            uintptr_t *const explicit_nonref_flags = pRecordWriter->explicit_nonref_flags;
+            if (pReaderContext->nonref_flags_storage == 2) {
+                plink2::FillBitsNz(out_vidx_start, out_vidx_start + variant_ct, explicit_nonref_flags);
+            } else if (pReaderContext->nonref_flags_storage == 3) {
+                const uintptr_t *const nonref_flags = pReaderContext->nonref_flags;
+                for (uint32_t vidx = 0; vidx != variant_ct; ++vidx) {
+                    if (plink2::IsSet(nonref_flags, vidx)) {
+                        plink2::SetBit(out_vidx_start + vidx, explicit_nonref_flags);
+                    }
+                }
+            }
+        }
+        AppendPgenRecords(pRecordWriter, pReaderContext, 0, variant_ct);
+    }
+
+}
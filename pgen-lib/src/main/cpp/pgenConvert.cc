@@ -0,0 +1,229 @@
+#include "pgenConvert.h"
+
+namespace pgenlib {
+
+    // Pack the phase bytes for (up to) one genovec word's worth of samples into a halfword, with bit i set when
+    // phase_bytes[i] is nonzero.
+    static inline plink2::Halfword PackPhaseBytes(const unsigned char *phase_bytes, const uint32_t subgroup_len) {
+#ifdef __LP64__
+        if (subgroup_len == plink2::kBitsPerWordD2) {
+            const plink2::VecUc vzero = plink2::vecuc_setzero();
+            uint32_t unphased_bits = 0;
+            for (uint32_t vidx = 0; vidx != plink2::kBitsPerWordD2 / plink2::kBytesPerVec; ++vidx) {
+                const plink2::VecUc vv = plink2::vecuc_loadu(&(phase_bytes[vidx * plink2::kBytesPerVec]));
+                unphased_bits |= plink2::vecuc_movemask(vv == vzero) << (vidx * plink2::kBytesPerVec);
+            }
+            return static_cast<plink2::Halfword>(~unphased_bits);
+        }
+#endif
+        // the last (partial) word, and non-vector builds
+        plink2::Halfword phased_hw = 0;
+        for (uint32_t uii = 0; uii != subgroup_len; ++uii) {
+            phased_hw |= static_cast<plink2::Halfword>(phase_bytes[uii] != 0) << uii;
+        }
+        return phased_hw;
+    }
+
+#ifdef USE_SSE2
+    // Convert one genovec word's worth (kBitsPerWordD2 samples) of biallelic allele codes, 16 samples at a time: the
+    // int32 codes are narrowed to bytes with saturating packs (which maps any code outside of {0, 1, -9} to a byte
+    // outside of that set as well), and the genotypes and phaseinfo bits are then extracted with byte compares and
+    // movemasks. Returns false, without writing anything, if any code other than 0/1 or a missing (-9, -9) pair is
+    // present, in which case the caller falls back to the scalar (multiallelic) conversion.
+    static inline bool ConvertBiallelicWord(
+            const int32_t *allele_codes,
+            uintptr_t *geno_word_ptr,
+            plink2::Halfword *phaseinfo_hw_ptr) {
+        const __m128i *codes_iter = reinterpret_cast<const __m128i *>(allele_codes);
+        const __m128i vzero = _mm_setzero_si128();
+        const __m128i vone = _mm_set1_epi8(1);
+        const __m128i vmissing = _mm_set1_epi8(-9);
+        uint32_t geno_lo_bits = 0;
+        uint32_t geno_hi_bits = 0;
+        uint32_t phaseinfo_bits = 0;
+        for (uint32_t chunk_idx = 0; chunk_idx != plink2::kBitsPerWordD2 / 16; ++chunk_idx) {
+            __m128i code_pairs[2];
+            for (uint32_t half_idx = 0; half_idx != 2; ++half_idx) {
+                const __m128i codes0 = _mm_loadu_si128(&(codes_iter[0]));
+                const __m128i codes1 = _mm_loadu_si128(&(codes_iter[1]));
+                const __m128i codes2 = _mm_loadu_si128(&(codes_iter[2]));
+                const __m128i codes3 = _mm_loadu_si128(&(codes_iter[3]));
+                code_pairs[half_idx] = _mm_packs_epi16(_mm_packs_epi32(codes0, codes1), _mm_packs_epi32(codes2, codes3));
+                codes_iter = &(codes_iter[4]);
+            }
+            // each 16-bit lane of code_pairs holds one sample's first (low byte) and second (high byte) code
+            const __m128i first = _mm_packs_epi16(
+                    _mm_srai_epi16(_mm_slli_epi16(code_pairs[0], 8), 8),
+                    _mm_srai_epi16(_mm_slli_epi16(code_pairs[1], 8), 8));
+            const __m128i second = _mm_packs_epi16(_mm_srai_epi16(code_pairs[0], 8), _mm_srai_epi16(code_pairs[1], 8));
+            const __m128i first_missing = _mm_cmpeq_epi8(first, vmissing);
+            const __m128i both_01 = _mm_and_si128(
+                    _mm_cmpeq_epi8(_mm_min_epu8(first, vone), first),
+                    _mm_cmpeq_epi8(_mm_min_epu8(second, vone), second));
+            const __m128i both_missing = _mm_and_si128(first_missing, _mm_cmpeq_epi8(second, vmissing));
+            if (_mm_movemask_epi8(_mm_or_si128(both_01, both_missing)) != 0xffff) {
+                return false;
+            }
+            // 0/1 codes sum to the genotype, and since -9 is odd, a missing pair sums to 2, which is or'ed up to 3
+            const __m128i geno = _mm_or_si128(
+                    _mm_add_epi8(_mm_and_si128(first, vone), _mm_and_si128(second, vone)),
+                    _mm_and_si128(first_missing, vone));
+            const uint32_t shift = chunk_idx * 16;
+            geno_lo_bits |= static_cast<uint32_t>(_mm_movemask_epi8(_mm_slli_epi16(geno, 7))) << shift;
+            geno_hi_bits |= static_cast<uint32_t>(_mm_movemask_epi8(_mm_slli_epi16(geno, 6))) << shift;
+            const __m128i alt_first = _mm_and_si128(_mm_cmpeq_epi8(first, vone), _mm_cmpeq_epi8(second, vzero));
+            phaseinfo_bits |= static_cast<uint32_t>(_mm_movemask_epi8(alt_first)) << shift;
+        }
+        *geno_word_ptr = plink2::UnpackHalfwordToWord(geno_lo_bits) | plink2::UnpackHalfwordToWordShift1(geno_hi_bits);
+        *phaseinfo_hw_ptr = static_cast<plink2::Halfword>(phaseinfo_bits);
+        return true;
+    }
+#endif
+
+    // The per-sample (scalar) logic below mirrors plink2::ConvertMultiAlleleCodesUnsafe (pgenlib_ffi_support.cc), and
+    // should be kept in sync with it. Full words of biallelic samples take the ConvertBiallelicWord fast path instead,
+    // which produces the same genovec and phaseinfo bits (a biallelic word has no patch entries or het_2 bits).
+    int32_t ConvertAlleleCodes(
+            const int32_t *allele_codes,
+            const unsigned char *phase_bytes,
+            const uint32_t sample_ct,
+            uintptr_t *genovec,
+            uintptr_t *patch_01_set,
+            plink2::AlleleCode *patch_01_vals,
+            uintptr_t *patch_10_set,
+            plink2::AlleleCode *patch_10_vals,
+            uint32_t *patch_01_ctp,
+            uint32_t *patch_10_ctp,
+            uintptr_t *phasepresent,
+            uintptr_t *phaseinfo,
+            uint32_t *het_ctp,
+            uint32_t *phased_het_ctp) {
+        const uint32_t sample_ctl = plink2::DivUp(sample_ct, plink2::kBitsPerWord);
+        const uint32_t word_ct_m1 = (sample_ct - 1) / plink2::kBitsPerWordD2;
+        uint32_t subgroup_len = plink2::kBitsPerWordD2;
+        const uint32_t *read_alias = reinterpret_cast<const uint32_t *>(allele_codes);
+        const unsigned char *phase_bytes_iter = phase_bytes;
+        plink2::Halfword *phasepresent_alias = reinterpret_cast<plink2::Halfword *>(phasepresent);
+        plink2::Halfword *phaseinfo_alias = reinterpret_cast<plink2::Halfword *>(phaseinfo);
+        plink2::ZeroWArr(sample_ctl, patch_01_set);
+        plink2::ZeroWArr(sample_ctl, patch_10_set);
+        uint32_t max_allele_code = 1;
+        plink2::Halfword *patch_01_set_alias = reinterpret_cast<plink2::Halfword *>(patch_01_set);
+        plink2::Halfword *patch_10_set_alias = reinterpret_cast<plink2::Halfword *>(patch_10_set);
+        plink2::AlleleCode *patch_01_iter = patch_01_vals;
+        plink2::AlleleCode *patch_10_iter = patch_10_vals;
+        uint32_t het_ct = 0;
+        uint32_t phased_het_ct = 0;
+        for (uint32_t widx = 0; ; ++widx) {
+            if (widx >= word_ct_m1) {
+                if (widx > word_ct_m1) {
+                    if (max_allele_code >= plink2::kPglMaxAlleleCt) {
+                        return -1;
+                    }
+                    *patch_01_ctp = patch_01_iter - patch_01_vals;
+                    *patch_10_ctp = (patch_10_iter - patch_10_vals) >> 1;
+                    *het_ctp = het_ct;
+                    *phased_het_ctp = phased_het_ct;
+                    return static_cast<int32_t>(max_allele_code + 1);
+                }
+                subgroup_len = plink2::ModNz(sample_ct, plink2::kBitsPerWordD2);
+            }
+            uintptr_t geno_write_word = 0;
+            plink2::Halfword phaseinfo_write_hw = 0;
+            plink2::Halfword het_2_hw = 0;
+            bool converted = false;
+#ifdef USE_SSE2
+            if (subgroup_len == plink2::kBitsPerWordD2) {
+                converted = ConvertBiallelicWord(
+                        reinterpret_cast<const int32_t *>(read_alias), &geno_write_word, &phaseinfo_write_hw);
+            }
+#endif
+            if (converted) {
+                read_alias = &(read_alias[2 * plink2::kBitsPerWordD2]);
+            } else {
+                for (uint32_t uii = 0; uii != subgroup_len; ++uii) {
+                    // 0,0 -> 0
+                    // 0,x or x,0 -> 1
+                    // x,y -> 2
+                    // -9,-9 -> 3
+                    const uint32_t first_code = *read_alias++;
+                    const uint32_t second_code = *read_alias++;
+                    uintptr_t cur_geno = 0;
+                    if (first_code == 0) {
+                        if (second_code != 0) {
+                            cur_geno = 1;
+                            if (second_code > 1) {
+                                if (second_code > max_allele_code) {
+                                    max_allele_code = second_code;
+                                }
+                                patch_01_set_alias[widx] |= 1U << uii;
+                                // out-of-range codes are harmlessly truncated here, and rejected before returning
+                                *patch_01_iter++ = static_cast<plink2::AlleleCode>(second_code);
+                            }
+                        }
+                    } else if (first_code == 0xfffffff7U) {
+                        if (second_code != 0xfffffff7U) {
+                            return -1;
+                        }
+                        cur_geno = 3;
+                    } else {
+                        // first_code >= 1
+                        if (second_code == 0) {
+                            cur_geno = 1;
+                            phaseinfo_write_hw |= 1U << uii;
+                            if (first_code > 1) {
+                                if (first_code > max_allele_code) {
+                                    max_allele_code = first_code;
+                                }
+                                patch_01_set_alias[widx] |= 1U << uii;
+                                *patch_01_iter++ = static_cast<plink2::AlleleCode>(first_code);
+                            }
+                        } else {
+                            cur_geno = 2;
+                            if (first_code <= second_code) {
+                                if (second_code > 1) {
+                                    if (second_code > max_allele_code) {
+                                        max_allele_code = second_code;
+                                    }
+                                    patch_10_set_alias[widx] |= 1U << uii;
+                                    *patch_10_iter++ = static_cast<plink2::AlleleCode>(first_code);
+                                    *patch_10_iter++ = static_cast<plink2::AlleleCode>(second_code);
+                                    if (first_code != second_code) {
+                                        het_2_hw |= 1U << uii;
+                                    }
+                                }
+                            } else {
+                                // first_code > second_code
+                                if (first_code > max_allele_code) {
+                                    max_allele_code = first_code;
+                                }
+                                phaseinfo_write_hw |= 1U << uii;
+                                patch_10_set_alias[widx] |= 1U << uii;
+                                het_2_hw |= 1U << uii;
+                                *patch_10_iter++ = static_cast<plink2::AlleleCode>(second_code);
+                                *patch_10_iter++ = static_cast<plink2::AlleleCode>(first_code);
+                            }
+                        }
+                    }
+                    geno_write_word |= (cur_geno << (uii * 2));
+                }
+            }
+            genovec[widx] = geno_write_word;
+            const uintptr_t het_1_word = geno_write_word & (~(geno_write_word >> 1)) & plink2::kMask5555;
+            const plink2::Halfword het_hw = het_2_hw | plink2::PackWordToHalfword(het_1_word);
+            het_ct += plink2::PopcountWord(het_hw);
+            if (phase_bytes) {
+                // phase bytes are packed here, while this word's worth of them is still in cache, rather than in
+                // a separate pass up front
+                const plink2::Halfword phasepresent_hw = PackPhaseBytes(phase_bytes_iter, subgroup_len) & het_hw;
+                phase_bytes_iter = &(phase_bytes_iter[subgroup_len]);
+                phasepresent_alias[widx] = phasepresent_hw;
+                phased_het_ct += plink2::PopcountWord(phasepresent_hw);
+            }
+            if (phaseinfo_alias) {
+                phaseinfo_alias[widx] = phaseinfo_write_hw;
+            }
+        }
+    }
+
+}
@@ -0,0 +1,340 @@
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "pgenException.h"
+#include "pgenUtils.h"
+#include "pgenReader.h"
+#include "pgenExtract.h"
+#include "pgenMTWriter.h"
+#include "pgenRecordCopy.h"
+#include "pgenVariantSlices.h"
+
+namespace pgenlib {
+    static const int kErrMessageBufSize = 1024;
+
+    // the decode buffers are bounded by this many bytes per thread (or this many variants per thread, for narrow
+    // cohorts), so wide cohorts are decoded a few variants at a time; the writer's chunks of staged (uncompressed)
+    // variants are capped at the same size
+    static constexpr uintptr_t kExtractThreadBufferBytes = 16 * 1024 * 1024;
+    static constexpr uint32_t kExtractThreadBatchVariantCt = 1024;
+
+    // the layout (in words) of the decode buffer for one variant; the patch buffers are only needed for multiallelic
+    // variants
+    struct ExtractSlotLayout {
+        ExtractSlotLayout(const uint32_t sample_ct, const bool multiallelic) :
+                bitvec_stride(plink2::BitCtToAlignedWordCt(sample_ct)),
+                genovec_offset(0),
+                phasepresent_offset(genovec_offset + plink2::NypCtToAlignedWordCt(sample_ct)),
+                phaseinfo_offset(phasepresent_offset + bitvec_stride),
+                patch_01_set_offset(phaseinfo_offset + bitvec_stride),
+                patch_01_vals_offset(patch_01_set_offset + (multiallelic ? bitvec_stride : 0)),
+                patch_10_set_offset(patch_01_vals_offset + (multiallelic ? AlleleCodeAlignedWordCt(sample_ct) : 0)),
+                patch_10_vals_offset(patch_10_set_offset + (multiallelic ? bitvec_stride : 0)),
+                word_ct(patch_10_vals_offset + (multiallelic ? AlleleCodeAlignedWordCt(2 * sample_ct) : 0)) {}
+
+        static uintptr_t AlleleCodeAlignedWordCt(const uintptr_t code_ct) {
+            return plink2::RoundUpPow2(
+                    plink2::DivUp(code_ct * sizeof(plink2::AlleleCode), plink2::kBytesPerWord), plink2::kWordsPerVec);
+        }
+
+        const uintptr_t bitvec_stride;
+        const uintptr_t genovec_offset;
+        const uintptr_t phasepresent_offset;
+        const uintptr_t phaseinfo_offset;
+        const uintptr_t patch_01_set_offset;
+        const uintptr_t patch_01_vals_offset;
+        const uintptr_t patch_10_set_offset;
+        const uintptr_t patch_10_vals_offset;
+        const uintptr_t word_ct;
+    };
+
+    // the counts that go with one decoded variant
+    typedef struct ExtractedVariant {
+        uint32_t allele_ct;
+        uint32_t patch_01_ct;
+        uint32_t patch_10_ct;
+        uint32_t phasepresent_ct;
+    } ExtractedVariant;
+
+    static void CopyExtractRecords(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t *variantIndices,
+            const uint32_t variantCount,
+            const char *cOutFilename,
+            const uint32_t pgenWriteModeInt);
+    static void ReencodeExtractRecords(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t *variantIndices,
+            const uint32_t variantCount,
+            const char *cOutFilename,
+            const uint32_t pgenWriteModeInt,
+            const uint32_t threadCount);
+
+    /**
+     * Write the listed variants of a PGEN reader to a new .pgen. If the reader reads every sample, the variant records
+     * are copied (mostly verbatim, see AppendPgenRecordList) rather than decoded, so the allele counts aren't needed.
+     * If the reader was opened with a sample subset, only the subset samples are written: the variants are decoded
+     * (PgrGetMP) on threadCount threads, and re-encoded on threadCount writer threads. Only hardcalls, including
+     * multiallelic hardcalls (which require the allele counts) and hardcall phase, can be sample subset; a pgen with
+     * dosages can only have its variants extracted.
+     *
+     * A sample subset uses up to about 3 * 16 MiB of uncompressed buffers per thread (one for decoding, and two for
+     * the writer's staged and compressing chunks; see pgenMTWriter.h), plus a write buffer per thread that holds the
+     * compressed records of the thread's current vblock (of up to 65536 variants) until it's written. The write
+     * buffers aren't bounded by the uncompressed buffers; they're about the size of the output's vblocks.
+     *
+     * The output has the nonref flag storage mode of the source, with the explicit nonref flags (if any) of the
+     * extracted variants. The companion .pvar and .psam files aren't written.
+     *
+     * @param pReaderContext - the PgenReaderContext for the source pgen
+     * @param variantIndices - the indices of the variants to extract, in strictly increasing order
+     * @param variantCount - the number of variants to extract (at least 1)
+     * @param cOutFilename - the pgen file to write
+     * @param pgenWriteModeInt - the plink2::PgenWriteMode to write with (as for OpenPgen)
+     * @param threadCount - the number of threads to decode (and re-encode) a sample subset with
+     */
+    void ExtractPgen(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t *variantIndices,
+            const uint32_t variantCount,
+            const char *cOutFilename,
+            const uint32_t pgenWriteModeInt,
+            const uint32_t threadCount) {
+        if (variantCount == 0) {
+            throw PgenException("At least one variant is required for extraction");
+        }
+        if (threadCount == 0) {
+            throw PgenException("Invalid thread count (0); must be at least 1");
+        }
+        if (pgenWriteModeInt > plink2::kPgenWriteAndCopy) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff, kErrMessageBufSize, "Invalid pgen write mode: %u", pgenWriteModeInt);
+            throw PgenException(errMessageBuff); // PgenException makes a copy of errMessageBuff
+        }
+        for (uint32_t idx = 0; idx != variantCount; ++idx) {
+            const uint32_t vidx = variantIndices[idx];
+            if ((vidx >= pReaderContext->raw_variant_ct) || ((idx != 0) && (vidx <= variantIndices[idx - 1]))) {
+                char errMessageBuff[kErrMessageBufSize];
+                snprintf(errMessageBuff,
+                         kErrMessageBufSize,
+                         "Invalid variant index %u at position %u. Variant indices must be strictly increasing, and less than the variant count (%u)",
+                         vidx,
+                         idx,
+                         pReaderContext->raw_variant_ct);
+                throw PgenException(errMessageBuff); // PgenException makes a copy of errMessageBuff
+            }
+        }
+
+        if (pReaderContext->sample_include == nullptr) {
+            CopyExtractRecords(pReaderContext, variantIndices, variantCount, cOutFilename, pgenWriteModeInt);
+        } else {
+            ReencodeExtractRecords(
+                    pReaderContext, variantIndices, variantCount, cOutFilename, pgenWriteModeInt, threadCount);
+        }
+    }
+
+    // Set the explicit nonref flags of the extracted variants, for a source with explicit nonref flags.
+    static void SetExtractNonrefFlags(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t *variantIndices,
+            const uint32_t variantCount,
+            uintptr_t *explicit_nonref_flags) {
+        for (uint32_t idx = 0; idx != variantCount; ++idx) {
+            if (plink2::IsSet(pReaderContext->nonref_flags, variantIndices[idx])) {
+                plink2::SetBit(idx, explicit_nonref_flags);
+            }
+        }
+    }
+
+    // the largest allele count of the extracted variants, or kPglMaxAlleleCt if it isn't known
+    static uint32_t ExtractAlleleCtUpperBound(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t *variantIndices,
+            const uint32_t variantCount) {
+        if (!(pReaderContext->pgfip->gflags & plink2::kfPgenGlobalMultiallelicHardcallFound)) {
+            return 2;
+        }
+        if (pReaderContext->allele_idx_offsets == nullptr) {
+            return plink2::kPglMaxAlleleCt;
+        }
+        uint32_t allele_ct_upper_bound = 2;
+        for (uint32_t idx = 0; idx != variantCount; ++idx) {
+            allele_ct_upper_bound =
+                    std::max(allele_ct_upper_bound, GetReaderAlleleCount(pReaderContext, variantIndices[idx]));
+        }
+        return allele_ct_upper_bound;
+    }
+
+    static void CopyExtractRecords(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t *variantIndices,
+            const uint32_t variantCount,
+            const char *cOutFilename,
+            const uint32_t pgenWriteModeInt) {
+        const plink2::PgenGlobalFlags gflags = pReaderContext->pgfip->gflags;
+        PgenRecordWriter *const pRecordWriter = OpenPgenRecordWriter(
+                cOutFilename,
+                pgenWriteModeInt,
+                variantCount,
+                pReaderContext->raw_sample_ct,
+                ExtractAlleleCtUpperBound(pReaderContext, variantIndices, variantCount),
+                gflags & (plink2::kfPgenGlobalHardcallPhasePresent |
+                          plink2::kfPgenGlobalDosagePresent |
+                          plink2::kfPgenGlobalDosagePhasePresent),
+                pReaderContext->nonref_flags_storage);
+        try {
+            if (pRecordWriter->explicit_nonref_flags != nullptr) {
+                SetExtractNonrefFlags(
+                        pReaderContext, variantIndices, variantCount, pRecordWriter->explicit_nonref_flags);
+            }
+            AppendPgenRecordList(pRecordWriter, pReaderContext, variantIndices, variantCount);
+        } catch (const PgenException &) {
+            AbandonPgenRecordWriter(pRecordWriter);
+            throw;
+        }
+        ClosePgenRecordWriter(pRecordWriter);
+    }
+
+    static void ReencodeExtractRecords(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t *variantIndices,
+            const uint32_t variantCount,
+            const char *cOutFilename,
+            const uint32_t pgenWriteModeInt,
+            const uint32_t threadCount) {
+        const plink2::PgenGlobalFlags gflags = pReaderContext->pgfip->gflags;
+        if (gflags & plink2::kfPgenGlobalDosagePresent) {
+            throwOnPglErr(plink2::kPglRetNotYetSupported,
+                          "Extracting a sample subset of a pgen with dosages is not implemented");
+        }
+        // multiallelic records can only be decoded if the allele counts are known
+        uint32_t allele_ct_upper_bound = 2;
+        for (uint32_t idx = 0; idx != variantCount; ++idx) {
+            allele_ct_upper_bound =
+                    std::max(allele_ct_upper_bound, RequireReadableVariant(pReaderContext, variantIndices[idx]));
+        }
+        std::vector<uintptr_t> explicit_nonref_flags;
+        if (pReaderContext->nonref_flags_storage == 3) {
+            explicit_nonref_flags.resize(plink2::BitCtToWordCt(variantCount));
+            SetExtractNonrefFlags(pReaderContext, variantIndices, variantCount, explicit_nonref_flags.data());
+        }
+
+        const uint32_t sample_ct = pReaderContext->sample_ct;
+        const ExtractSlotLayout layout(sample_ct, allele_ct_upper_bound > 2);
+        const uint32_t thread_batch_variant_ct = static_cast<uint32_t>(std::max<uintptr_t>(
+                1, std::min<uintptr_t>(
+                        kExtractThreadBatchVariantCt,
+                        kExtractThreadBufferBytes / (layout.word_ct * plink2::kBytesPerWord))));
+        const uint32_t round_variant_ct = static_cast<uint32_t>(std::min<uint64_t>(
+                variantCount, static_cast<uint64_t>(thread_batch_variant_ct) * threadCount));
+        uintptr_t *slot_buffer;
+        if (plink2::cachealigned_malloc(
+                static_cast<uintptr_t>(round_variant_ct) * layout.word_ct * plink2::kBytesPerWord, &slot_buffer)) {
+            throw PgenException("Native code failure (cachealigned_malloc) allocating extract decode buffers");
+        }
+        std::unique_ptr<uintptr_t, void (*)(void *)> slot_buffer_owner(slot_buffer, plink2::aligned_free);
+        std::vector<ExtractedVariant> extracted(round_variant_ct);
+
+        uint32_t max_vrec_len;
+        PgenMTWriter *const mtpgwp = InitPgenMTWriter(
+                cOutFilename,
+                static_cast<plink2::PgenWriteMode>(pgenWriteModeInt),
+                gflags & plink2::kfPgenGlobalHardcallPhasePresent,
+                variantCount,
+                sample_ct,
+                allele_ct_upper_bound,
+                threadCount,
+                &max_vrec_len,
+                explicit_nonref_flags.empty() ? nullptr : explicit_nonref_flags.data(),
+                pReaderContext->nonref_flags_storage,
+                kExtractThreadBufferBytes);
+        try {
+            for (uint32_t round_start = 0; round_start < variantCount; round_start += round_variant_ct) {
+                const uint32_t round_end = std::min(variantCount, round_start + round_variant_ct);
+                // the slices are of positions in variantIndices, rather than of variant indices
+                ForEachVariantSlice(
+                        pReaderContext,
+                        round_start,
+                        round_end,
+                        threadCount,
+                        "Error reading variant to extract (PgrGetMP)",
+                        [&](const uint32_t, PgenThreadReader *pThreadReader, const uint32_t begin, const uint32_t end) {
+                            plink2::PgenVariant pgv;
+                            // the patch buffers are only written for multiallelic variants
+                            pgv.patch_01_set = pThreadReader->pgv.patch_01_set;
+                            pgv.patch_01_vals = pThreadReader->pgv.patch_01_vals;
+                            pgv.patch_10_set = pThreadReader->pgv.patch_10_set;
+                            pgv.patch_10_vals = pThreadReader->pgv.patch_10_vals;
+                            for (uint32_t idx = begin; idx != end; ++idx) {
+                                uintptr_t *const slot = &slot_buffer[(idx - round_start) * layout.word_ct];
+                                const uint32_t vidx = variantIndices[idx];
+                                ExtractedVariant &variant = extracted[idx - round_start];
+                                variant.allele_ct = GetReaderAlleleCount(pReaderContext, vidx);
+                                pgv.genovec = &slot[layout.genovec_offset];
+                                pgv.phasepresent = &slot[layout.phasepresent_offset];
+                                pgv.phaseinfo = &slot[layout.phaseinfo_offset];
+                                if (variant.allele_ct > 2) {
+                                    pgv.patch_01_set = &slot[layout.patch_01_set_offset];
+                                    pgv.patch_01_vals =
+                                            reinterpret_cast<plink2::AlleleCode *>(&slot[layout.patch_01_vals_offset]);
+                                    pgv.patch_10_set = &slot[layout.patch_10_set_offset];
+                                    pgv.patch_10_vals =
+                                            reinterpret_cast<plink2::AlleleCode *>(&slot[layout.patch_10_vals_offset]);
+                                }
+                                const plink2::PglErr reterr = plink2::PgrGetMP(
+                                        pReaderContext->sample_include,
+                                        pThreadReader->pssi,
+                                        sample_ct,
+                                        vidx,
+                                        pThreadReader->pgrp,
+                                        &pgv);
+                                if (reterr != plink2::kPglRetSuccess) {
+                                    return reterr;
+                                }
+                                // the writer requires zeroed trailing genotypes and phasepresent bits
+                                plink2::ZeroTrailingNyps(sample_ct, pgv.genovec);
+                                variant.patch_01_ct = (variant.allele_ct > 2) ? pgv.patch_01_ct : 0;
+                                variant.patch_10_ct = (variant.allele_ct > 2) ? pgv.patch_10_ct : 0;
+                                variant.phasepresent_ct = pgv.phasepresent_ct;
+                                if (variant.phasepresent_ct != 0) {
+                                    plink2::ZeroTrailingBits(sample_ct, pgv.phasepresent);
+                                }
+                            }
+                            return plink2::kPglRetSuccess;
+                        });
+
+                // stage the decoded variants in order; the writer compresses each full vblock on its own thread
+                for (uint32_t idx = round_start; idx != round_end; ++idx) {
+                    const uintptr_t *const slot = &slot_buffer[(idx - round_start) * layout.word_ct];
+                    const ExtractedVariant &variant = extracted[idx - round_start];
+                    const bool multiallelic = (variant.patch_01_ct != 0) || (variant.patch_10_ct != 0);
+                    const bool phased = variant.phasepresent_ct != 0;
+                    MTWriterAppend(
+                            mtpgwp,
+                            &slot[layout.genovec_offset],
+                            multiallelic ? &slot[layout.patch_01_set_offset] : nullptr,
+                            multiallelic ?
+                                    reinterpret_cast<const plink2::AlleleCode *>(&slot[layout.patch_01_vals_offset]) :
+                                    nullptr,
+                            multiallelic ? &slot[layout.patch_10_set_offset] : nullptr,
+                            multiallelic ?
+                                    reinterpret_cast<const plink2::AlleleCode *>(&slot[layout.patch_10_vals_offset]) :
+                                    nullptr,
+                            phased ? &slot[layout.phasepresent_offset] : nullptr,
+                            phased ? &slot[layout.phaseinfo_offset] : nullptr,
+                            variant.allele_ct,
+                            variant.patch_01_ct,
+                            variant.patch_10_ct);
+                }
+            }
+            MTWriterFinish(mtpgwp);
+        } catch (const PgenException &) {
+            CleanupPgenMTWriter(mtpgwp);
+            throw;
+        }
+        CleanupPgenMTWriter(mtpgwp);
+    }
+
+}
@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "pgenException.h"
+#include "pgenUtils.h"
+#include "pgenReader.h"
+#include "pgenGrm.h"
+#include "pgenVariantSlices.h"
+
+namespace pgenlib {
+    static const int kErrMessageBufSize = 1024;
+
+    // the number of standardized variants each thread accumulates into its rows at a time
+    static constexpr uint32_t kGrmBatchVariantCt = 32;
+    // the number of columns of a row accumulated at a time, so the batch's columns (kGrmBatchVariantCt *
+    // kGrmColumnBlockCt doubles) stay in cache while they're multiplied into each row
+    static constexpr uint32_t kGrmColumnBlockCt = 256;
+
+    static void AccumulateGrmBatch(
+            const double *standardized,
+            const uintptr_t standardized_stride,
+            const uint32_t batch_ct,
+            const uint32_t rowBegin,
+            const uint32_t rowEnd,
+            const uint32_t columnEnd,
+            double *grm_rows);
+
+    /**
+     * Compute a tile of the genomic relationship matrix of the reader's samples (see GetReaderSampleCount), over the
+     * variants in [variantStart, variantEnd). Entry (j, k) of the matrix is the mean, over the variants, of
+     * z_ij * z_ik, where z_ij = (x_ij - 2p_i) / sqrt(2p_i(1 - p_i)) is sample j's standardized non-reference allele
+     * count (hardcall) for variant i, and p_i is the variant's non-reference allele frequency over the reader's
+     * non-missing samples, as for plink2 --make-rel. A missing genotype has a standardized value of 0 (it's mean
+     * imputed), and monomorphic variants, which have no variance, are skipped.
+     *
+     * The tile is the rows [rowStart, rowEnd) of the matrix, truncated to the columns [0, columnEnd). Each thread
+     * reads every variant in the range for its rows, so the cost of reading the pgen is repeated for each tile (and
+     * thread), but is small next to the cost of the tile itself once a tile has more than a few rows.
+     * @param pReaderContext - the PgenReaderContext for the reader
+     * @param variantStart - the first variant to include
+     * @param variantEnd - one past the last variant to include
+     * @param threadCount - the number of threads to compute with; each thread opens its own reader, and computes its
+     * own rows of the tile
+     * @param rowStart - the first row of the tile
+     * @param rowEnd - one past the last row of the tile
+     * @param columnEnd - one past the last column of the tile
+     * @param grm - receives the tile, row major: entry (j, k) of the matrix is entry (j - rowStart) * columnEnd + k
+     * @return the number of (polymorphic) variants the matrix was computed from, or 0 if the tile is empty
+     */
+    uint32_t ComputeGrmTile(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t threadCount,
+            const uint32_t rowStart,
+            const uint32_t rowEnd,
+            const uint32_t columnEnd,
+            double *grm) {
+        RequireValidVariantRange(pReaderContext, variantStart, variantEnd);
+        if (threadCount == 0) {
+            throw PgenException("Invalid thread count (0); must be at least 1");
+        }
+        const uint32_t sample_ct = pReaderContext->sample_ct;
+        if ((rowStart > rowEnd) || (rowEnd > sample_ct) || (columnEnd > sample_ct)) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Invalid GRM tile: rows %u..%u, columns 0..%u. The reader has %u samples.",
+                     rowStart,
+                     rowEnd,
+                     columnEnd,
+                     sample_ct);
+            throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+        }
+        std::fill(grm, grm + static_cast<uintptr_t>(rowEnd - rowStart) * columnEnd, 0.0);
+        if ((rowStart == rowEnd) || (columnEnd == 0)) {
+            return 0;
+        }
+
+        // each thread needs the standardized values of its rows as well as of every column
+        const uint32_t standardized_ct = std::max(rowEnd, columnEnd);
+        // the lookup decodes two samples at a time, so each variant's standardized values are padded to an even
+        // number of samples
+        const uintptr_t standardized_stride = plink2::RoundUpPow2(standardized_ct, 2);
+        const uint32_t thread_ct = SliceThreadCount(rowStart, rowEnd, threadCount);
+        std::vector<std::vector<double>> standardized_batches(
+                thread_ct, std::vector<double>(kGrmBatchVariantCt * standardized_stride));
+        std::vector<uint32_t> used_variant_cts(thread_ct, 0);
+
+        // the rows are sliced like a variant range, with one "variant" per row
+        ForEachVariantSlice(
+                pReaderContext,
+                rowStart,
+                rowEnd,
+                threadCount,
+                "Error reading pgen genotypes for GRM (PgrGet)",
+                [&](const uint32_t tidx, PgenThreadReader *pThreadReader, const uint32_t begin, const uint32_t end) {
+                    plink2::PgenVariant &pgv = pThreadReader->pgv;
+                    double *const standardized = standardized_batches[tidx].data();
+                    double *const grm_rows = &grm[static_cast<uintptr_t>(begin - rowStart) * columnEnd];
+                    double table16x8bx2[32];
+                    STD_ARRAY_DECL(uint32_t, 4, genocounts);
+                    uint32_t batch_ct = 0;
+                    uint32_t used_variant_ct = 0;
+                    for (uint32_t vidx = variantStart; vidx != variantEnd; ++vidx) {
+                        // the hardcalls only need the allele counts to skip over the multi-allelic part of a record
+                        const plink2::PglErr reterr = plink2::PgrGet(
+                                pReaderContext->sample_include,
+                                pThreadReader->pssi,
+                                sample_ct,
+                                vidx,
+                                pThreadReader->pgrp,
+                                pgv.genovec);
+                        if (reterr != plink2::kPglRetSuccess) {
+                            return reterr;
+                        }
+                        // the genotype counts read whole genovec words
+                        plink2::ZeroTrailingNyps(sample_ct, pgv.genovec);
+                        plink2::GenoarrCountFreqsUnsafe(pgv.genovec, sample_ct, genocounts);
+                        const uint32_t nonmissing_ct = genocounts[0] + genocounts[1] + genocounts[2];
+                        if (nonmissing_ct == 0) {
+                            continue;
+                        }
+                        const double twice_freq = (genocounts[1] + 2.0 * genocounts[2]) / nonmissing_ct;
+                        const double variance = twice_freq * (1.0 - 0.5 * twice_freq);
+                        if (variance <= 0.0) {
+                            continue;
+                        }
+                        ++used_variant_ct;
+                        // per genotype (0, 1 or 2 non-reference alleles, or missing) standardized values
+                        const double recip_sd = 1.0 / std::sqrt(variance);
+                        table16x8bx2[0] = -twice_freq * recip_sd;
+                        table16x8bx2[2] = (1.0 - twice_freq) * recip_sd;
+                        table16x8bx2[4] = (2.0 - twice_freq) * recip_sd;
+                        table16x8bx2[6] = 0.0;
+                        plink2::InitLookup16x8bx2(table16x8bx2);
+                        plink2::GenoarrLookup16x8bx2(
+                                pgv.genovec,
+                                table16x8bx2,
+                                standardized_ct,
+                                &standardized[batch_ct * standardized_stride]);
+                        if (++batch_ct == kGrmBatchVariantCt) {
+                            AccumulateGrmBatch(
+                                    standardized, standardized_stride, batch_ct, begin, end, columnEnd, grm_rows);
+                            batch_ct = 0;
+                        }
+                    }
+                    if (batch_ct != 0) {
+                        AccumulateGrmBatch(standardized, standardized_stride, batch_ct, begin, end, columnEnd, grm_rows);
+                    }
+                    used_variant_cts[tidx] = used_variant_ct;
+                    return plink2::kPglRetSuccess;
+                });
+
+        // every thread reads the same variants, so they all skip the same monomorphic variants
+        const uint32_t used_variant_ct = used_variant_cts[0];
+        if (used_variant_ct != 0) {
+            const double recip_variant_ct = 1.0 / used_variant_ct;
+            for (uintptr_t i = 0; i != static_cast<uintptr_t>(rowEnd - rowStart) * columnEnd; ++i) {
+                grm[i] *= recip_variant_ct;
+            }
+        }
+        return used_variant_ct;
+    }
+
+    /**
+     * Write the genomic relationship matrix (see ComputeGrmTile) of the reader's samples, over the variants in
+     * [variantStart, variantEnd), in the binary format of plink2 --make-rel triangle bin4 (and GCTA --make-grm-bin):
+     * the lower triangle of the matrix, including the diagonal, as native byte order 32-bit floats, one row after
+     * the other. The matrix is computed tileRowCount rows at a time, so at most tileRowCount * GetReaderSampleCount
+     * doubles are held in memory. Only the .grm.bin is written; the sample IDs for the companion .grm.id are in the
+     * .psam, and the per pair variant counts of a .grm.N.bin would all be the returned variant count.
+     * @param pReaderContext - the PgenReaderContext for the reader
+     * @param variantStart - the first variant to include
+     * @param variantEnd - one past the last variant to include
+     * @param threadCount - the number of threads to compute each tile with
+     * @param tileRowCount - the maximum number of rows in each tile
+     * @param grmBinFilename - the .grm.bin file to write; it's overwritten if it already exists
+     * @return the number of (polymorphic) variants the matrix was computed from
+     */
+    uint32_t WriteGrmBin(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t threadCount,
+            const uint32_t tileRowCount,
+            const char *grmBinFilename) {
+        RequireValidVariantRange(pReaderContext, variantStart, variantEnd);
+        if ((threadCount == 0) || (tileRowCount == 0)) {
+            throw PgenException("Invalid GRM thread count or tile row count (0); both must be at least 1");
+        }
+        const uint32_t sample_ct = pReaderContext->sample_ct;
+        FILE *grm_file = fopen(grmBinFilename, "wb");
+        if (grm_file == nullptr) {
+            throwOnPglErr(plink2::kPglRetOpenFail, "Error opening GRM file for writing");
+        }
+        uint32_t used_variant_ct = 0;
+        try {
+            std::vector<double> tile;
+            std::vector<float> row(sample_ct);
+            uint32_t tile_end;
+            for (uint32_t tile_start = 0; tile_start != sample_ct; tile_start = tile_end) {
+                tile_end = tile_start + std::min(tileRowCount, sample_ct - tile_start);
+                // the tile only needs the columns up to (and including) its last row
+                tile.resize(static_cast<uintptr_t>(tile_end - tile_start) * tile_end);
+                used_variant_ct = ComputeGrmTile(
+                        pReaderContext, variantStart, variantEnd, threadCount, tile_start, tile_end, tile_end, tile.data());
+                for (uint32_t j = tile_start; j != tile_end; ++j) {
+                    const double *tile_row = &tile[static_cast<uintptr_t>(j - tile_start) * tile_end];
+                    std::copy(tile_row, tile_row + j + 1, row.begin());
+                    if (fwrite(row.data(), sizeof(float), j + 1, grm_file) != j + 1) {
+                        throwOnPglErr(plink2::kPglRetWriteFail, "Error writing GRM file");
+                    }
+                }
+            }
+        } catch (const PgenException &) {
+            fclose(grm_file);
+            throw;
+        }
+        if (fclose(grm_file) != 0) {
+            throwOnPglErr(plink2::kPglRetWriteFail, "Error closing GRM file");
+        }
+        return used_variant_ct;
+    }
+
+    // Add the outer products of a batch of standardized variants to the rows [rowBegin, rowEnd) of a GRM tile (the
+    // first of which is grm_rows), truncated to the columns [0, columnEnd). The columns are accumulated a block at a
+    // time, and four rows at a time, so each block of the batch is read from cache once for every four rows, and the
+    // innermost loops (over the columns of a block) are contiguous and vectorizable.
+    static void AccumulateGrmBatch(
+            const double *standardized,
+            const uintptr_t standardized_stride,
+            const uint32_t batch_ct,
+            const uint32_t rowBegin,
+            const uint32_t rowEnd,
+            const uint32_t columnEnd,
+            double *grm_rows) {
+        for (uint32_t column_start = 0; column_start < columnEnd; column_start += kGrmColumnBlockCt) {
+            const uint32_t column_ct = std::min(kGrmColumnBlockCt, columnEnd - column_start);
+            uint32_t row = rowBegin;
+            for (; row + 4 <= rowEnd; row += 4) {
+                double *out0 = &grm_rows[static_cast<uintptr_t>(row - rowBegin) * columnEnd + column_start];
+                double *out1 = out0 + columnEnd;
+                double *out2 = out1 + columnEnd;
+                double *out3 = out2 + columnEnd;
+                for (uint32_t bidx = 0; bidx != batch_ct; ++bidx) {
+                    const double *variant_values = &standardized[bidx * standardized_stride];
+                    const double z0 = variant_values[row];
+                    const double z1 = variant_values[row + 1];
+                    const double z2 = variant_values[row + 2];
+                    const double z3 = variant_values[row + 3];
+                    const double *column_values = &variant_values[column_start];
+                    for (uint32_t cidx = 0; cidx != column_ct; ++cidx) {
+                        const double z = column_values[cidx];
+                        out0[cidx] += z0 * z;
+                        out1[cidx] += z1 * z;
+                        out2[cidx] += z2 * z;
+                        out3[cidx] += z3 * z;
+                    }
+                }
+            }
+            for (; row != rowEnd; ++row) {
+                double *out = &grm_rows[static_cast<uintptr_t>(row - rowBegin) * columnEnd + column_start];
+                for (uint32_t bidx = 0; bidx != batch_ct; ++bidx) {
+                    const double *variant_values = &standardized[bidx * standardized_stride];
+                    const double z_row = variant_values[row];
+                    if (z_row == 0.0) {
+                        continue;
+                    }
+                    const double *column_values = &variant_values[column_start];
+                    for (uint32_t cidx = 0; cidx != column_ct; ++cidx) {
+                        out[cidx] += z_row * column_values[cidx];
+                    }
+                }
+            }
+        }
+    }
+
+}
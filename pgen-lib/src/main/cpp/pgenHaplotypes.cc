@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "pgenException.h"
+#include "pgenUtils.h"
+#include "pgenReader.h"
+#include "pgenHaplotypes.h"
+#include "pgenVariantSlices.h"
+
+namespace pgenlib {
+
+    // the number of variants each thread decodes and transposes at a time
+    static constexpr uint32_t kHapBatchVariantCt = plink2::kPglNypTransposeBatch;
+
+    // the layout (in words) of the per thread buffers used by ReadHaplotypes
+    struct HapBufferLayout {
+        explicit HapBufferLayout(const uint32_t sample_ct) :
+                genovec_stride(plink2::NypCtToAlignedWordCt(sample_ct)),
+                bitvec_stride(plink2::BitCtToAlignedWordCt(sample_ct)),
+                genovec_batch_offset(0),
+                phaseinfo_batch_offset(genovec_batch_offset + kHapBatchVariantCt * genovec_stride),
+                phasepresent_offset(phaseinfo_batch_offset + kHapBatchVariantCt * bitvec_stride),
+                all_hets_offset(phasepresent_offset + bitvec_stride),
+                genovec_transposed_offset(all_hets_offset + bitvec_stride),
+                phaseinfo_transposed_offset(
+                        genovec_transposed_offset + plink2::kPglNypTransposeBatch * plink2::kPglNypTransposeWords),
+                transpose_buf_offset(
+                        phaseinfo_transposed_offset + plink2::kPglNypTransposeBatch * plink2::kPglBitTransposeWords),
+                word_ct(transpose_buf_offset +
+                        std::max(plink2::kPglNypTransposeBufbytes, plink2::kPglBitTransposeBufbytes) /
+                        plink2::kBytesPerWord) {}
+
+        const uintptr_t genovec_stride;     // one row of kHapBatchVariantCt decoded genovecs
+        const uintptr_t bitvec_stride;      // one row of kHapBatchVariantCt decoded phaseinfo bitvecs
+        const uintptr_t genovec_batch_offset;
+        const uintptr_t phaseinfo_batch_offset;
+        const uintptr_t phasepresent_offset;
+        const uintptr_t all_hets_offset;
+        const uintptr_t genovec_transposed_offset;
+        const uintptr_t phaseinfo_transposed_offset;
+        const uintptr_t transpose_buf_offset;
+        const uintptr_t word_ct;
+    };
+
+    /**
+     * Read the haplotypes of each variant in the range [variantStart, variantEnd) into two haplotype matrices, one
+     * for each haplotype of each sample. The matrices are haplotype major: the codes for sample i start at entry
+     * i * (variantEnd - variantStart), with one code per variant. A code is 0 for the reference allele, 1 for an alt
+     * allele (any alt allele, for a multi-allelic variant), or -9 for a missing genotype. The alleles of a phased
+     * heterozygous genotype are placed as phased; an unphased heterozygous genotype always has the reference allele
+     * on haplotype 0, as for plink2. Only the reader's samples (see GetReaderSampleCount) are read.
+     * @param pReaderContext - the PgenReaderContext for the reader
+     * @param variantStart - the first variant to read
+     * @param variantEnd - one past the last variant to read
+     * @param threadCount - the number of threads to read with; each thread opens its own reader
+     * @param hap0_codes - receives the haplotype 0 matrix (GetReaderSampleCount * (variantEnd - variantStart) entries)
+     * @param hap1_codes - receives the haplotype 1 matrix (GetReaderSampleCount * (variantEnd - variantStart) entries)
+     */
+    void ReadHaplotypes(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t threadCount,
+            int32_t *hap0_codes,
+            int32_t *hap1_codes) {
+        RequireValidVariantRange(pReaderContext, variantStart, variantEnd);
+        if (threadCount == 0) {
+            throw PgenException("Invalid thread count (0); must be at least 1");
+        }
+        // multi-allelic records can only be parsed (for their het phase) if the allele counts are known
+        if (pReaderContext->allele_idx_offsets == nullptr) {
+            for (uint32_t vidx = variantStart; vidx != variantEnd; ++vidx) {
+                RequireReadableVariant(pReaderContext, vidx);
+            }
+        }
+        const uint32_t sample_ct = pReaderContext->sample_ct;
+        if (sample_ct == 0) {
+            return;
+        }
+        const uintptr_t variant_ct = variantEnd - variantStart;
+        const HapBufferLayout layout(sample_ct);
+        const uint32_t thread_ct = SliceThreadCount(variantStart, variantEnd, threadCount);
+        std::vector<std::unique_ptr<uintptr_t, void (*)(void *)>> buffers;
+        for (uint32_t tidx = 0; tidx != thread_ct; ++tidx) {
+            uintptr_t *buffer;
+            if (plink2::cachealigned_malloc(layout.word_ct * sizeof(uintptr_t), &buffer)) {
+                throw PgenException("Native code failure (cachealigned_malloc) allocating haplotype buffers");
+            }
+            buffers.emplace_back(buffer, plink2::aligned_free);
+        }
+
+        ForEachVariantSlice(
+                pReaderContext,
+                variantStart,
+                variantEnd,
+                threadCount,
+                "Error reading pgen haplotypes (PgrGetP)",
+                [&](const uint32_t tidx, PgenThreadReader *pThreadReader, const uint32_t begin, const uint32_t end) {
+                    uintptr_t *const buffer = buffers[tidx].get();
+                    uintptr_t *const genovec_batch = &buffer[layout.genovec_batch_offset];
+                    uintptr_t *const phaseinfo_batch = &buffer[layout.phaseinfo_batch_offset];
+                    uintptr_t *const phasepresent = &buffer[layout.phasepresent_offset];
+                    uintptr_t *const all_hets = &buffer[layout.all_hets_offset];
+                    uintptr_t *const genovec_transposed = &buffer[layout.genovec_transposed_offset];
+                    uintptr_t *const phaseinfo_transposed = &buffer[layout.phaseinfo_transposed_offset];
+                    plink2::VecW *const transpose_buf =
+                            reinterpret_cast<plink2::VecW *>(&buffer[layout.transpose_buf_offset]);
+                    const uint32_t sample_ctl = plink2::BitCtToWordCt(sample_ct);
+                    for (uint32_t batch_start = begin; batch_start < end; batch_start += kHapBatchVariantCt) {
+                        const uint32_t batch_ct = std::min(end - batch_start, kHapBatchVariantCt);
+                        for (uint32_t bidx = 0; bidx != batch_ct; ++bidx) {
+                            uintptr_t *const genovec = &genovec_batch[bidx * layout.genovec_stride];
+                            uintptr_t *const phaseinfo = &phaseinfo_batch[bidx * layout.bitvec_stride];
+                            uint32_t phasepresent_ct;
+                            const plink2::PglErr reterr = plink2::PgrGetP(
+                                    pReaderContext->sample_include,
+                                    pThreadReader->pssi,
+                                    sample_ct,
+                                    batch_start + bidx,
+                                    pThreadReader->pgrp,
+                                    genovec,
+                                    phasepresent,
+                                    phaseinfo,
+                                    &phasepresent_ct);
+                            if (reterr != plink2::kPglRetSuccess) {
+                                return reterr;
+                            }
+                            // GenoarrPhasedToHapCodes requires the phaseinfo bit to be clear for every genotype
+                            // other than a phased ref/alt het; plink2 only defines phaseinfo where phasepresent is
+                            // set, and (for a multi-allelic variant) phasepresent also covers alt/alt hets
+                            if (phasepresent_ct == 0) {
+                                std::fill(phaseinfo, phaseinfo + sample_ctl, 0);
+                            } else {
+                                plink2::PgrDetectGenoarrHets(genovec, sample_ct, all_hets);
+                                for (uint32_t widx = 0; widx != sample_ctl; ++widx) {
+                                    phaseinfo[widx] &= phasepresent[widx] & all_hets[widx];
+                                }
+                            }
+                        }
+                        const uintptr_t hap_offset = batch_start - variantStart;
+                        for (uint32_t block_start = 0; block_start < sample_ct;
+                             block_start += plink2::kPglNypTransposeBatch) {
+                            const uint32_t block_ct =
+                                    std::min<uint32_t>(sample_ct - block_start, plink2::kPglNypTransposeBatch);
+                            plink2::TransposeNypblock(
+                                    &genovec_batch[block_start / plink2::kBitsPerWordD2],
+                                    layout.genovec_stride,
+                                    plink2::kPglNypTransposeWords,
+                                    batch_ct,
+                                    block_ct,
+                                    genovec_transposed,
+                                    transpose_buf);
+                            plink2::TransposeBitblock(
+                                    &phaseinfo_batch[block_start / plink2::kBitsPerWord],
+                                    layout.bitvec_stride,
+                                    plink2::kPglBitTransposeWords,
+                                    batch_ct,
+                                    block_ct,
+                                    phaseinfo_transposed,
+                                    transpose_buf);
+                            for (uint32_t sidx = 0; sidx != block_ct; ++sidx) {
+                                const uintptr_t row = (block_start + sidx) * variant_ct + hap_offset;
+                                plink2::GenoarrPhasedToHapCodes(
+                                        &genovec_transposed[sidx * plink2::kPglNypTransposeWords],
+                                        &phaseinfo_transposed[sidx * plink2::kPglBitTransposeWords],
+                                        batch_ct,
+                                        &hap0_codes[row],
+                                        &hap1_codes[row]);
+                            }
+                        }
+                    }
+                    return plink2::kPglRetSuccess;
+                });
+    }
+
+}
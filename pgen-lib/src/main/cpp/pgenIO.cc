@@ -1,6 +1,8 @@
 #include <cmath>
 
+#include "pgenAsyncWriter.h"
 #include "pgenContext.h"
+#include "pgenConvert.h"
 #include "pgenException.h"
 #include "pgenMissingVariantsException.h"
 #include "pgenEmptyPgenException.h"
@@ -22,22 +24,23 @@ namespace pgenlib {
             const uint32_t writeFlags,
             const long variantCount,
             const int sampleCount,
-            const int maxAltAlleles);
+            const int maxAltAlleles,
+            const int threadCount);
 
-    static bool GetAllPhased(const PgenContext *pGenContext, const unsigned char *phase_bytes);
-
-    static void AppendAllelesPartiallyPhased(
+    static void AppendConvertedAlleles(
             const PgenContext *const pGenContext,
-            const int32_t *allele_codes,
-            const unsigned char *phase_bytes,
-            const int32_t allele_ct);
+            const uint32_t write_allele_ct,
+            const uint32_t patch_01_ct,
+            const uint32_t patch_10_ct,
+            const bool hphase);
 
-    static void AppendAllelesAllOrNonePhased(
-            const PgenContext *const pGenContext,
-            const int32_t *allele_codes,
-            const unsigned char *phase_bytes,
-            const int32_t allele_ct,
-            const bool allPhased);
+    static uint32_t ValidateDosageAppend(const PgenContext *const pGenContext, const double hardCallThreshold);
+
+    static void AppendConvertedDosages(const PgenContext *const pGenContext, const uint32_t dosage_ct);
+
+    static void StopAsyncAppends(const PgenContext *const pGenContext);
+
+    static void AbandonPgenContext(const PgenContext *const pGenContext);
 
     /**
      * Start a new PGEN write session, and return a pointer to a PgenContext for the writer.
@@ -74,10 +77,11 @@ namespace pgenlib {
      * values of plink2::PgenWriteMode (1, 2 or 3). An exception will be thrown if any other value is provided. this
      * determines the pgen file mode that is used (i.e, whether there is a separate .pgi index)
      * @param writeFlags - unsigned integer bitwise write flags, with valid values drawn from {kWriteFlagPreservePhasing,
-     * kWriteFlagMultiAllelic}. kWriteFlagPreservePhasing should only be used if phasing information is present in the
-     * source genotypes and a phasing track must be provided when calling appendAlleles. kWriteFlagMultiAllelic should
-     * be included if multi-allelic genotypes are present. kWriteFlagMultiAllelic should only be used when
-     * kWriteFlagPreservePhasing is used (!).
+     * kWriteFlagMultiAllelic, kWriteFlagDosage}. kWriteFlagPreservePhasing should only be used if phasing information is
+     * present in the source genotypes and a phasing track must be provided when calling appendAlleles.
+     * kWriteFlagMultiAllelic should be included if multi-allelic genotypes are present. kWriteFlagMultiAllelic should
+     * only be used when kWriteFlagPreservePhasing is used (!). kWriteFlagDosage must be included in order to use
+     * AppendDosages.
      * @param variantCount - the number of variants to be written. if fewer variants are written, an exception will
      * be thrown when the writer is closed by a call to closePgen. must be in the range 1..plink2::kPglMaxVariantCt
      * @param sampleCount - the number of samples (genotypes) in the data set. Must be > 0.
@@ -86,6 +90,10 @@ namespace pgenlib {
      * in the range 2..plink2::kPglMaxAltAlleleCt. If the variant count is unknown when the writer is created, use
      * the value pgenlib::kVariantCountUnknown (although in this case, write mode
      * plink2::PgenWriteMode::kPgenWriteBackwardSeek (3) may not be used).
+     * @param threadCount - the number of threads to use to compress variants. If > 1, variants are compressed in
+     * blocks of plink2::kPglVblockSize variants per thread using the plink2 MTPgenWriter, which requires a known
+     * variantCount (kVariantCountUnknown may not be used), and buffers up to threadCount blocks of variants in
+     * memory. The resulting file is identical to the one written with a single thread. Defaults to 1.
      *
      * @return a PgenContext
      */
@@ -95,7 +103,8 @@ namespace pgenlib {
             const uint32_t writeFlags,
             const long variantCount,
             const int sampleCount,
-            const int maxAltAlleles) {
+            const int maxAltAlleles,
+            const int threadCount) {
 
         // validate the requested pgen write mode, and sample and variant counts
         plink2::PgenWriteMode pgenWriteMode = ValidatePgenWriteMode(pgenWriteModeInt, variantCount);
@@ -136,6 +145,21 @@ namespace pgenlib {
                      maxAltAlleles,
                      plink2::kPglMaxAltAlleleCt);
             throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+        } else if (threadCount < 1) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Invalid thread count: %d. At least 1 thread is required.",
+                     threadCount);
+            throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+        } else if ((threadCount > 1) && (variantCount == static_cast<long>(pgenlib::kVariantCountUnknown))) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "A thread count > 1 (%d) requires a known variant count, and cannot be used with the unknown variant count sentinel value (%d)",
+                     threadCount,
+                     plink2::kPglMaxVariantCt);
+            throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
         }
 
         // Round tripping multi-allelic data doesn't seem to work if the kWriteFlagMultiAllelic is set, unless
@@ -157,7 +181,7 @@ namespace pgenlib {
                     "The multi-allelic write flag should only be used if phasing information is also provided (even if the underlying data is multiallelic).");
         }
 
-        return InitPgenContext(cFilename, pgenWriteMode, writeFlags, variantCount, sampleCount, maxAltAlleles);
+        return InitPgenContext(cFilename, pgenWriteMode, writeFlags, variantCount, sampleCount, maxAltAlleles, threadCount);
     }
 
     PgenContext *InitPgenContext(
@@ -166,18 +190,15 @@ namespace pgenlib {
             const uint32_t writeFlags,
             const long variantCount,
             const int sampleCount,
-            const int maxAltAlleles) {
+            const int maxAltAlleles,
+            const int threadCount) {
 
         PgenContext *pGenContext = static_cast<PgenContext *const>(malloc(sizeof(PgenContext)));
         if (pGenContext == nullptr) {
             throw PgenException("Native code failure allocating PgenContext");
         }
-        pGenContext->spgwp = static_cast<plink2::STPgenWriter *>(malloc(sizeof(plink2::STPgenWriter)));
-        if (pGenContext->spgwp == nullptr) {
-            free(pGenContext);
-            throw PgenException("Native code failure allocating STPgenWriter");
-        }
         pGenContext->write_flags = writeFlags;
+        pGenContext->asyncp = nullptr;
 
         // convert sampleCount and variantCount to the types plink uses
         pGenContext->sample_count = static_cast<uint32_t>(sampleCount);
@@ -187,20 +208,46 @@ namespace pgenlib {
 
         uint32_t bitvec_cacheline_ct = plink2::DivUp(pGenContext->sample_count, plink2::kBitsPerCacheline);
         uintptr_t alloc_cacheline_ct = 0;
-        const plink2::PglErr init1Result = plink2::SpgwInitPhase1(
-                cFilename,
-                nullptr,  // allele index offsets (for reading multi allele ?)
-                nullptr, // non-ref flags
-                variant_ct,
-                pGenContext->sample_count,
-                pGenContext->allele_ct_limit,
-                pgenWriteMode,
-                PgenlibFlagsToPlink2Flags(pGenContext->write_flags),
-                1, // non-ref flags storage
-                pGenContext->spgwp,
-                &alloc_cacheline_ct,
-                &pGenContext->max_vrec_len);
-        throwOnPglErr(init1Result, "plink2 initialization (SpgwInitPhase1 failed)");
+        if (threadCount > 1) {
+            // the multi-threaded writer manages its own plink2 arena, so spgw_alloc only needs to hold the
+            // conversion buffers below
+            pGenContext->spgwp = nullptr;
+            try {
+                pGenContext->mtpgwp = InitPgenMTWriter(
+                        cFilename,
+                        pgenWriteMode,
+                        PgenlibFlagsToPlink2Flags(pGenContext->write_flags),
+                        variant_ct,
+                        pGenContext->sample_count,
+                        pGenContext->allele_ct_limit,
+                        static_cast<uint32_t>(threadCount),
+                        &pGenContext->max_vrec_len);
+            } catch (const PgenException &) {
+                free(pGenContext);
+                throw;
+            }
+        } else {
+            pGenContext->mtpgwp = nullptr;
+            pGenContext->spgwp = static_cast<plink2::STPgenWriter *>(malloc(sizeof(plink2::STPgenWriter)));
+            if (pGenContext->spgwp == nullptr) {
+                free(pGenContext);
+                throw PgenException("Native code failure allocating STPgenWriter");
+            }
+            const plink2::PglErr init1Result = plink2::SpgwInitPhase1(
+                    cFilename,
+                    nullptr,  // allele index offsets (for reading multi allele ?)
+                    nullptr, // non-ref flags
+                    variant_ct,
+                    pGenContext->sample_count,
+                    pGenContext->allele_ct_limit,
+                    pgenWriteMode,
+                    PgenlibFlagsToPlink2Flags(pGenContext->write_flags),
+                    1, // non-ref flags storage
+                    pGenContext->spgwp,
+                    &alloc_cacheline_ct,
+                    &pGenContext->max_vrec_len);
+            throwOnPglErr(init1Result, "plink2 initialization (SpgwInitPhase1 failed)");
+        }
 
         uint32_t genovec_cacheline_ct = plink2::DivUp(pGenContext->sample_count, plink2::kNypsPerCacheline);
         uint32_t patch_01_vals_cacheline_ct = plink2::DivUp(pGenContext->sample_count * sizeof(plink2::AlleleCode),
@@ -208,6 +255,10 @@ namespace pgenlib {
         uint32_t patch_10_vals_cacheline_ct = plink2::DivUp(pGenContext->sample_count * 2 * sizeof(plink2::AlleleCode),
                                                             plink2::kCacheline);
         uint32_t dosage_main_cacheline_ct = plink2::DivUp(pGenContext->sample_count, (2 * plink2::kInt32PerCacheline));
+        // sized for the longest difflist that plink2 accepts, plus the sample id terminator it requires
+        const uint32_t max_difflist_len = MaxDifflistLen(pGenContext->sample_count);
+        uint32_t raregeno_cacheline_ct = plink2::DivUp(max_difflist_len + 1, plink2::kNypsPerCacheline);
+        uint32_t difflist_sample_ids_cacheline_ct = plink2::DivUp(max_difflist_len + 1, plink2::kInt32PerCacheline);
 
         // There are two copies of pgenlib.pyx in the plink2 build, and they have many differences. One uses +3 for
         // this calculation, and one uses +5. Prefer the one in src (since thats the one that is the template for this
@@ -215,11 +266,14 @@ namespace pgenlib {
         // Keep the pointer to the arena block in pGenContext so we can free it at the end.
         if (plink2::cachealigned_malloc(
                 (alloc_cacheline_ct + genovec_cacheline_ct + 5 * bitvec_cacheline_ct + patch_01_vals_cacheline_ct +
-                 patch_10_vals_cacheline_ct + dosage_main_cacheline_ct) *
+                 patch_10_vals_cacheline_ct + dosage_main_cacheline_ct + raregeno_cacheline_ct +
+                 difflist_sample_ids_cacheline_ct) *
                 plink2::kCacheline, &pGenContext->spgw_alloc)) {
             throw PgenException("Native code failure (cachealigned_malloc) allocating spgw_alloc");
         }
-        SpgwInitPhase2(pGenContext->max_vrec_len, pGenContext->spgwp, pGenContext->spgw_alloc);
+        if (pGenContext->spgwp != nullptr) {
+            SpgwInitPhase2(pGenContext->max_vrec_len, pGenContext->spgwp, pGenContext->spgw_alloc);
+        }
 
         unsigned char *spgw_alloc_iter = &(pGenContext->spgw_alloc[alloc_cacheline_ct * plink2::kCacheline]);
 
@@ -249,6 +303,10 @@ namespace pgenlib {
         pGenContext->dosage_present = (uintptr_t *) spgw_alloc_iter;
         spgw_alloc_iter = &(spgw_alloc_iter[bitvec_cacheline_ct * plink2::kCacheline]);
         pGenContext->dosage_main = (uint16_t *) spgw_alloc_iter;
+        spgw_alloc_iter = &(spgw_alloc_iter[dosage_main_cacheline_ct * plink2::kCacheline]);
+        pGenContext->raregeno = (uintptr_t *) spgw_alloc_iter;
+        spgw_alloc_iter = &(spgw_alloc_iter[raregeno_cacheline_ct * plink2::kCacheline]);
+        pGenContext->difflist_sample_ids = (uint32_t *) spgw_alloc_iter;
 
         //    # bugfix (16 Apr 2023): SpgwAppendBiallelicGenovec[Hphase] assumes
         //    # trailing bits are clear
@@ -259,14 +317,8 @@ namespace pgenlib {
         return pGenContext;
     }
 
-    // Since this code is ported from the plink2 python code, we try to retain the same structure as that
-    // code in order to make it  easier to find and integrate changes as they are made to plink2. However, currently
-    // the python code doesn't seem to be quite right, specifically, although there appears to be a single unified
-    // code path for handing non-phased, mixed phase and all-phased data that works (in the generic "appendAlleles"
-    // function), that function doesn't seem to work in the case where you have mixed phase. Until that is resolved,
-    // we have to retain two very similar, but slightly different functions from python ("appendAlleles",
-    // named "appendAllelesNotPartiallyPhased" here, and "appendAllelesPartiallyPhased", named
-    // "appendAllelesPartiallyPhased") here. The top-level "appendAlleles" function decides which of those to call.
+    // cpdef append_alleles(self, np.ndarray[np.int32_t,mode="c"] allele_int32, bint all_phased = False, object allele_ct = None):
+    // cpdef append_partially_phased(self, np.ndarray[np.int32_t,mode="c"] allele_int32, np.ndarray[np.uint8_t,cast=True] phasepresent, object allele_ct = None):
     /**
      * Append one variant's worth of allele code (genotypes) to a pgen file.
      * @param pGenContext - the PgenContext for the writer
@@ -281,40 +333,21 @@ namespace pgenlib {
             const int32_t *allele_codes,
             const unsigned char *phase_bytes,
             const int32_t allele_ct) {
-
-        // determine up front whether all the genotypes are phased so we can take the right code path through plink
-        //TODO: we could probably skip this pass through the phasing track altogether if we required the caller to
-        // keep track of the "allPhased" state while assembling the phasing data, and then provide it via a parameter
-        bool allPhased = GetAllPhased(pGenContext, phase_bytes);
-        if (pGenContext->write_flags & kWriteFlagPreservePhasing && !allPhased) {
-            // there is a phasing track, but the genotypes are either mixed phase or all un-phased
-            AppendAllelesPartiallyPhased(
-                    pGenContext,
-                    allele_codes,
-                    phase_bytes,
-                    allele_ct);
-        } else {
-            // there is either no phasing track, or there is a phasing track and all the genotypes are phased
-            AppendAllelesAllOrNonePhased(
-                    pGenContext,
-                    allele_codes,
-                    phase_bytes,
-                    allele_ct,
-                    allPhased);
+        const bool preservePhasing = (pGenContext->write_flags & kWriteFlagPreservePhasing) != 0;
+        if (preservePhasing && phase_bytes == nullptr) {
+            throw PgenException("A phasing track is required since kWriteFlagPreservePhasing was specified");
         }
-    }
 
-    //cpdef append_partially_phased(self, np.ndarray[np.int32_t,mode="c"] allele_int32, np.ndarray[np.uint8_t,cast=True] phasepresent, object allele_ct = None):
-    void AppendAllelesPartiallyPhased(
-            const PgenContext *const pGenContext,
-            const int32_t *allele_codes,
-            const unsigned char *phase_bytes,
-            const int32_t allele_ct) {
+        // the python code takes one of two paths (append_alleles or append_partially_phased) depending on whether
+        // all of the genotypes are phased; ConvertAlleleCodes packs the phasing track and counts the phased hets in
+        // the same pass that converts the allele codes, so we don't need a separate up-front scan to choose
         uint32_t patch_01_ct;
         uint32_t patch_10_ct;
-        int32_t observed_allele_ct = plink2::ConvertMultiAlleleCodesUnsafe(
+        uint32_t het_ct;
+        uint32_t phased_het_ct;
+        int32_t observed_allele_ct = ConvertAlleleCodes(
                 allele_codes,
-                phase_bytes, //  may be null
+                preservePhasing ? phase_bytes : nullptr,
                 pGenContext->sample_count,
                 pGenContext->genovec,
                 pGenContext->patch_01_set,
@@ -324,7 +357,9 @@ namespace pgenlib {
                 &patch_01_ct,
                 &patch_10_ct,
                 pGenContext->phasepresent,
-                pGenContext->phaseinfo);
+                pGenContext->phaseinfo,
+                &het_ct,
+                &phased_het_ct);
         if (observed_allele_ct == -1) {
             // it would be nice if we could determine what the invalid code is
             throw PgenException("Attempt to append invalid allele code (plink2::ConvertMultiAlleleCodesUnsafe)");
@@ -361,90 +396,436 @@ namespace pgenlib {
         }
         write_allele_ct = unsigned_allele_ct;
 
-        plink2::PglErr pglErr;
-        if ((patch_01_ct == 0) and (patch_10_ct == 0)) {
-            pglErr = SpgwAppendBiallelicGenovecHphase(
-                    pGenContext->genovec,
-                    pGenContext->phasepresent,
-                    pGenContext->phaseinfo,
-                    pGenContext->spgwp);
-        } else {
-            pglErr = SpgwAppendMultiallelicGenovecHphase(
-                    pGenContext->genovec,
-                    pGenContext->patch_01_set,
-                    pGenContext->patch_01_vals,
-                    pGenContext->patch_10_set,
-                    pGenContext->patch_10_vals,
-                    pGenContext->phasepresent,
-                    pGenContext->phaseinfo,
-                    write_allele_ct,
-                    patch_01_ct,
-                    patch_10_ct,
-                    pGenContext->spgwp);
-        }
-        throwOnPglErr(pglErr, "appendAlleles");
+        // a variant with no phased hets has an empty phasing track, which plink2 writes the same way as no track at
+        // all, so it can take the cheaper unphased path
+        AppendConvertedAlleles(pGenContext, write_allele_ct, patch_01_ct, patch_10_ct, phased_het_ct != 0);
     }
 
-    // cpdef append_alleles(self, np.ndarray[np.int32_t,mode="c"] allele_int32, bint all_phased = False, object allele_ct = None):
-    void AppendAllelesAllOrNonePhased(
+    /**
+     * Append several variants' worth of allele codes (genotypes) to a pgen file in a single call. This is equivalent
+     * to calling AppendAlleles once for each variant, but allows callers (i.e., the JNI layer) to amortize the
+     * per-call overhead across a batch of variants.
+     *
+     * @param pGenContext - the PgenContext for the writer
+     * @param allele_codes - array of allele codes for all variants in the batch, variant-major (variant_ct * sample
+     * count * 2 entries)
+     * @param phase_bytes - phasing bytes for all variants in the batch, variant-major (variant_ct * sample count
+     * entries). must be present when kWriteFlagPreservePhasing was used to create the PgenWriter, otherwise ignored
+     * (may be null)
+     * @param allele_cts - array of variant_ct allele counts, one for each variant in the batch (see AppendAlleles).
+     * An allele count of kAlleleCtGenotypeBytes indicates that the variant's allele code slot instead starts with
+     * sample count genotype bytes, which are written via AppendGenotypeBytes. An allele count of
+     * kAlleleCtSparseGenotypes indicates that the slot instead holds a sparse genotype list for a site where all
+     * other samples are homozygous ref: a genotype count n, then n sample ids (as int32), then n genotype bytes,
+     * which are written via AppendSparseGenotypes.
+     * @param variant_ct - the number of variants in the batch
+     */
+    void AppendAllelesBatch(
             const PgenContext *const pGenContext,
             const int32_t *allele_codes,
             const unsigned char *phase_bytes,
-            const int32_t allele_ct,
-            const bool allPhased) {
-        uint32_t patch_01_ct;
-        uint32_t patch_10_ct;
-        int32_t observed_allele_ct = plink2::ConvertMultiAlleleCodesUnsafe(
-                allele_codes,
-                phase_bytes, //  may be null
-                pGenContext->sample_count,
-                pGenContext->genovec,
-                pGenContext->patch_01_set,
-                pGenContext->patch_01_vals,
-                pGenContext->patch_10_set,
-                pGenContext->patch_10_vals,
-                &patch_01_ct,
-                &patch_10_ct,
-                pGenContext->phasepresent,
-                pGenContext->phaseinfo);
-        if (observed_allele_ct == -1) {
-            // it would be nice if we could determine what the invalid code is
-            throw PgenException("Attempt to append invalid allele code (plink2::ConvertMultiAlleleCodesUnsafe)");
+            const int32_t *allele_cts,
+            const uint32_t variant_ct) {
+        const uint32_t sample_ct = pGenContext->sample_count;
+        for (uint32_t i = 0; i < variant_ct; i++) {
+            const int32_t *variant_allele_codes = &(allele_codes[static_cast<uintptr_t>(i) * sample_ct * 2]);
+            if (allele_cts[i] == kAlleleCtGenotypeBytes) {
+                AppendGenotypeBytes(pGenContext, reinterpret_cast<const int8_t *>(variant_allele_codes));
+                continue;
+            } else if (allele_cts[i] == kAlleleCtSparseGenotypes) {
+                const uint32_t genotype_ct = static_cast<uint32_t>(variant_allele_codes[0]);
+                if (genotype_ct > sample_ct) {
+                    char errMessageBuff[kErrMessageBufSize];
+                    snprintf(errMessageBuff,
+                             kErrMessageBufSize,
+                             "Sparse genotype count (%u) exceeds the sample count (%u) in AppendAllelesBatch",
+                             genotype_ct,
+                             sample_ct);
+                    throw PgenException(errMessageBuff);
+                }
+                AppendSparseGenotypes(
+                        pGenContext,
+                        reinterpret_cast<const uint32_t *>(&variant_allele_codes[1]),
+                        reinterpret_cast<const int8_t *>(&variant_allele_codes[1 + genotype_ct]),
+                        genotype_ct);
+                continue;
+            }
+            AppendAlleles(
+                    pGenContext,
+                    variant_allele_codes,
+                    phase_bytes == nullptr ? nullptr : &(phase_bytes[static_cast<uintptr_t>(i) * sample_ct]),
+                    allele_cts[i]);
         }
-        uint32_t write_allele_ct = static_cast<uint32_t>(observed_allele_ct);
-        uint32_t unsigned_allele_ct = static_cast<uint32_t>(allele_ct);
-        if (write_allele_ct > pGenContext->allele_ct_limit) {
+    }
+
+    /**
+     * Append one unphased biallelic variant, given as one alt allele count per sample. This is a compact alternative
+     * to AppendAlleles for biallelic sites, since the genotype bytes map directly onto the 2-bit genotype vector
+     * without the multi-allelic patch bookkeeping. Like AppendAlleles, this must not be called directly while async
+     * appends are active (use AppendAllelesBatchAsync with kAlleleCtGenotypeBytes instead).
+     *
+     * @param pGenContext - the PgenContext for the writer
+     * @param genotype_bytes - array of sample count alt allele counts: 0, 1 or 2, or -9 for a missing genotype
+     */
+    void AppendGenotypeBytes(const PgenContext *const pGenContext, const int8_t *genotype_bytes) {
+        const uint32_t sample_ct = pGenContext->sample_count;
+        bool invalid = false;
+        for (uint32_t i = 0; i < sample_ct; i++) {
+            const int8_t genotype_byte = genotype_bytes[i];
+            invalid |= (static_cast<uint8_t>(genotype_byte) > 2) & (genotype_byte != -9);
+        }
+        if (invalid) {
+            uint32_t i = 0;
+            while ((static_cast<uint8_t>(genotype_bytes[i]) <= 2) || (genotype_bytes[i] == -9)) {
+                i++;
+            }
             char errMessageBuff[kErrMessageBufSize];
             snprintf(errMessageBuff,
                      kErrMessageBufSize,
-                     "plink2::ConvertMultiAlleleCodesUnsafe found more allele codes (%u) than specified in allele_ct_limit (%u); you may need to construct the PgenWriter with a higher allele_ct_limit setting",
-                     write_allele_ct,
-                     pGenContext->allele_ct_limit);
+                     "Attempt to append invalid genotype byte: %d for sample %u (genotype bytes must be 0, 1, 2 or -9)",
+                     genotype_bytes[i],
+                     i);
             throw PgenException(errMessageBuff);
         }
-        if (unsigned_allele_ct < write_allele_ct) {
+        // BytesToGenoarrUnsafe only writes as much of the genotype vector as is needed to hold sample_ct samples, but
+        // the plink2 writer assumes the trailing bits of the last word are clear
+        pGenContext->genovec[(sample_ct - 1) / plink2::kBitsPerWordD2] = 0;
+        plink2::BytesToGenoarrUnsafe(genotype_bytes, sample_ct, pGenContext->genovec);
+        AppendConvertedAlleles(pGenContext, 2, 0, 0, false);
+    }
+
+    /**
+     * Append one unphased biallelic variant given as a sparse list of the samples whose genotype differs from a
+     * default genotype. Lists of up to MaxDifflistLen(sample count) genotypes are written through the plink2 difflist
+     * writer, so the cost of the append scales with the length of the list rather than with the number of samples.
+     * Like AppendAlleles, this must not be called directly while async appends are active (use
+     * AppendAllelesBatchAsync with kAlleleCtSparseGenotypes instead).
+     *
+     * @param pGenContext - the PgenContext for the writer
+     * @param sample_ids - array of genotype_ct sample indices, in strictly increasing order
+     * @param genotype_bytes - array of genotype_ct genotypes (0, 1 or 2 alt alleles, or -9 for missing), one for each
+     * entry in sample_ids. each must differ from default_genotype_byte
+     * @param genotype_ct - the number of entries in sample_ids and genotype_bytes
+     * @param default_genotype_byte - the genotype of every sample not in sample_ids (0, 1, 2 or -9). defaults to 0
+     */
+    void AppendSparseGenotypes(
+            const PgenContext *const pGenContext,
+            const uint32_t *sample_ids,
+            const int8_t *genotype_bytes,
+            const uint32_t genotype_ct,
+            const int8_t default_genotype_byte) {
+        const uint32_t sample_ct = pGenContext->sample_count;
+        if ((static_cast<uint8_t>(default_genotype_byte) > 2) && (default_genotype_byte != -9)) {
             char errMessageBuff[kErrMessageBufSize];
             snprintf(errMessageBuff,
                      kErrMessageBufSize,
-                     "plink2::ConvertMultiAlleleCodesUnsafe called with more alleles (%u) than stated in allele_ct (%u)",
-                     write_allele_ct,
-                     unsigned_allele_ct);
+                     "Attempt to append invalid default genotype byte: %d (genotype bytes must be 0, 1, 2 or -9)",
+                     default_genotype_byte);
             throw PgenException(errMessageBuff);
-        } else if (unsigned_allele_ct > pGenContext->allele_ct_limit) {
-            // hm, this branch is actually not dependent on the call to ConvertMultiAlleleCodesUnsafe, and could
-            // be done right at the start of the function, but I'll keep it here to match the flow of the python code
+        }
+        for (uint32_t i = 0; i < genotype_ct; i++) {
+            const int8_t genotype_byte = genotype_bytes[i];
+            if (((static_cast<uint8_t>(genotype_byte) > 2) && (genotype_byte != -9)) ||
+                (genotype_byte == default_genotype_byte)) {
+                char errMessageBuff[kErrMessageBufSize];
+                snprintf(errMessageBuff,
+                         kErrMessageBufSize,
+                         "Attempt to append invalid sparse genotype byte: %d for sample %u (genotype bytes must be 0, 1, 2 or -9, and differ from the default genotype %d)",
+                         genotype_byte,
+                         sample_ids[i],
+                         default_genotype_byte);
+                throw PgenException(errMessageBuff);
+            } else if ((sample_ids[i] >= sample_ct) || (i && (sample_ids[i] <= sample_ids[i - 1]))) {
+                char errMessageBuff[kErrMessageBufSize];
+                snprintf(errMessageBuff,
+                         kErrMessageBufSize,
+                         "Sparse genotype sample id %u at position %u is out of order or out of range (sample count %u)",
+                         sample_ids[i],
+                         i,
+                         sample_ct);
+                throw PgenException(errMessageBuff);
+            }
+        }
+
+        // -9 (missing) maps to genotype code 3
+        const uint32_t default_geno = static_cast<uint32_t>(default_genotype_byte) & 3;
+        if (genotype_ct > MaxDifflistLen(sample_ct)) {
+            // too dense for plink2's difflist writer
+            uintptr_t *genovec = pGenContext->genovec;
+            const uint32_t genovec_word_ct = plink2::NypCtToWordCt(sample_ct);
+            const uintptr_t default_word = default_geno * plink2::kMask5555;
+            for (uint32_t widx = 0; widx < genovec_word_ct; widx++) {
+                genovec[widx] = default_word;
+            }
+            plink2::ZeroTrailingNyps(sample_ct, genovec);
+            for (uint32_t i = 0; i < genotype_ct; i++) {
+                const uint32_t sample_id = sample_ids[i];
+                const uintptr_t geno = static_cast<uintptr_t>(genotype_bytes[i]) & 3;
+                const uint32_t shift = 2 * (sample_id % plink2::kBitsPerWordD2);
+                genovec[sample_id / plink2::kBitsPerWordD2] ^= (geno ^ default_geno) << shift;
+            }
+            AppendConvertedAlleles(pGenContext, 2, 0, 0, false);
+            return;
+        }
+
+        uintptr_t *raregeno = pGenContext->raregeno;
+        uint32_t *difflist_sample_ids = pGenContext->difflist_sample_ids;
+        const uint32_t raregeno_word_ct = plink2::NypCtToWordCt(genotype_ct);
+        for (uint32_t widx = 0; widx < raregeno_word_ct; widx++) {
+            raregeno[widx] = 0;
+        }
+        for (uint32_t i = 0; i < genotype_ct; i++) {
+            const uintptr_t geno = static_cast<uintptr_t>(genotype_bytes[i]) & 3;
+            raregeno[i / plink2::kBitsPerWordD2] |= geno << (2 * (i % plink2::kBitsPerWordD2));
+            difflist_sample_ids[i] = sample_ids[i];
+        }
+        difflist_sample_ids[genotype_ct] = sample_ct;
+        if (pGenContext->mtpgwp != nullptr) {
+            MTWriterAppendDifflist(pGenContext->mtpgwp, raregeno, difflist_sample_ids, default_geno, genotype_ct);
+            return;
+        }
+        throwOnPglErr(
+                plink2::SpgwAppendBiallelicDifflistLimited(
+                        raregeno, difflist_sample_ids, default_geno, genotype_ct, pGenContext->spgwp),
+                "AppendSparseGenotypes");
+    }
+
+    /**
+     * Append one biallelic variant given as a caller supplied 2-bit packed genotype vector (the same layout as
+     * PgenContext::genovec: 0, 1 or 2 alt alleles, or 3 for missing, sample_ct entries packed 32 to a word), with an
+     * optional phasing track. The vectors are handed directly to the plink2 writer, so there is no conversion step.
+     * If async appends are active, they are drained first.
+     *
+     * @param pGenContext - the PgenContext for the writer
+     * @param genovec - the packed genotype vector. the trailing bits of the last word must be zero
+     * @param phasepresent - bitarray marking which het calls are phased, or null if all het calls are phased. only
+     * het calls may be marked, and the trailing bits of the last word must be zero. ignored if phaseinfo is null
+     * @param phaseinfo - bitarray with the phase of each phased het call (set for 1|0), or null if the variant is
+     * unphased. requires kWriteFlagPreservePhasing
+     */
+    void AppendGenovec(
+            const PgenContext *const pGenContext,
+            const uintptr_t *genovec,
+            const uintptr_t *phasepresent,
+            const uintptr_t *phaseinfo) {
+        const uint32_t sample_ct = pGenContext->sample_count;
+        const uint32_t last_widx = (sample_ct - 1) / plink2::kBitsPerWordD2;
+        const uint32_t trailing_sample_ct = sample_ct % plink2::kBitsPerWordD2;
+        if (trailing_sample_ct && (genovec[last_widx] >> (2 * trailing_sample_ct))) {
+            throw PgenException("The trailing bits of the genotype vector passed to AppendGenovec must be zero");
+        }
+        if (phaseinfo == nullptr) {
+            phasepresent = nullptr;
+        } else if (!(pGenContext->write_flags & kWriteFlagPreservePhasing)) {
+            throw PgenException("A phased genotype vector can only be appended when kWriteFlagPreservePhasing is used");
+        } else if (phasepresent != nullptr) {
+            // the plink2 writer requires phasepresent to be a subset of the het calls
+            const plink2::Halfword *phasepresent_alias = reinterpret_cast<const plink2::Halfword *>(phasepresent);
+            plink2::Halfword non_het_phasepresent = 0;
+            for (uint32_t widx = 0; widx <= last_widx; widx++) {
+                const uintptr_t geno_word = genovec[widx];
+                const plink2::Halfword het_hw = plink2::PackWordToHalfwordMask5555(geno_word & (~(geno_word >> 1)));
+                non_het_phasepresent |= phasepresent_alias[widx] & (~het_hw);
+            }
+            if (non_het_phasepresent) {
+                throw PgenException("AppendGenovec phasepresent marks a call that is not heterozygous");
+            }
+        }
+        if (pGenContext->asyncp != nullptr) {
+            AsyncWriterDrain(pGenContext->asyncp);
+        }
+
+        if (pGenContext->mtpgwp != nullptr) {
+            MTWriterAppend(
+                    pGenContext->mtpgwp,
+                    genovec,
+                    nullptr,
+                    nullptr,
+                    nullptr,
+                    nullptr,
+                    phasepresent,
+                    phaseinfo,
+                    2,
+                    0,
+                    0);
+            return;
+        }
+        const plink2::PglErr pglErr = phaseinfo == nullptr ?
+                SpgwAppendBiallelicGenovec(genovec, pGenContext->spgwp) :
+                SpgwAppendBiallelicGenovecHphase(genovec, phasepresent, phaseinfo, pGenContext->spgwp);
+        throwOnPglErr(pglErr, "AppendGenovec");
+    }
+
+    /**
+     * Append one biallelic variant's worth of (unphased) alt allele dosages to a pgen file. The pgen file must have
+     * been opened with kWriteFlagDosage. Hardcalls are derived from the dosages: a dosage within hardCallThreshold of
+     * 0, 1 or 2 is written with the corresponding hardcall, and any other dosage is written with a missing hardcall.
+     *
+     * If async appends have been started, any queued batches are written first.
+     *
+     * @param pGenContext - the PgenContext for the writer
+     * @param dosages - array of sample count alt allele dosages, in the range 0..2. Any value outside of that range
+     * (i.e., -9 or NaN) is treated as missing.
+     * @param hardCallThreshold - must be in the range 0..0.5. Defaults to kDefaultHardCallThreshold.
+     */
+    void AppendDosages(const PgenContext *const pGenContext, const float *dosages, const double hardCallThreshold) {
+        const uint32_t hard_call_halfdist = ValidateDosageAppend(pGenContext, hardCallThreshold);
+        uint32_t dosage_ct;
+        plink2::FloatsToDosage16(
+                dosages,
+                pGenContext->sample_count,
+                hard_call_halfdist,
+                pGenContext->genovec,
+                pGenContext->dosage_present,
+                pGenContext->dosage_main,
+                &dosage_ct);
+        AppendConvertedDosages(pGenContext, dosage_ct);
+    }
+
+    /**
+     * Same as the float version of AppendDosages above, but for double precision dosages.
+     */
+    void AppendDosages(const PgenContext *const pGenContext, const double *dosages, const double hardCallThreshold) {
+        const uint32_t hard_call_halfdist = ValidateDosageAppend(pGenContext, hardCallThreshold);
+        uint32_t dosage_ct;
+        plink2::DoublesToDosage16(
+                dosages,
+                pGenContext->sample_count,
+                hard_call_halfdist,
+                pGenContext->genovec,
+                pGenContext->dosage_present,
+                pGenContext->dosage_main,
+                &dosage_ct);
+        AppendConvertedDosages(pGenContext, dosage_ct);
+    }
+
+    // Check that pGenContext can accept dosages, and return the plink2 hard call "halfdist" (the minimum distance,
+    // in 1/16384 units, from a 0.5 boundary that is required for a hardcall) for hardCallThreshold.
+    uint32_t ValidateDosageAppend(const PgenContext *const pGenContext, const double hardCallThreshold) {
+        if (!(pGenContext->write_flags & kWriteFlagDosage)) {
+            throw PgenException("AppendDosages requires a PgenContext that was opened with kWriteFlagDosage");
+        } else if (!((hardCallThreshold >= 0.0) && (hardCallThreshold <= 0.5))) {
             char errMessageBuff[kErrMessageBufSize];
             snprintf(errMessageBuff,
                      kErrMessageBufSize,
-                     "plink2::ConvertMultiAlleleCodesUnsafe called with allele_ct (%u) > allele_ct_limit (%u)",
-                     unsigned_allele_ct,
-                     pGenContext->allele_ct_limit);
-            throw PgenException(errMessageBuff);
+                     "Invalid hard call threshold: %g. The hard call threshold must be in the range 0..0.5.",
+                     hardCallThreshold);
+            throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+        }
+        if (pGenContext->asyncp != nullptr) {
+            // appends must be written in order, so let the async writer catch up
+            AsyncWriterDrain(pGenContext->asyncp);
+        }
+        // dosages are stored in units of 1/16384 (kDosageMid), so a halfdist of 8192 means an exact hardcall
+        return 8192 - static_cast<uint32_t>(hardCallThreshold * 16384 + 0.5);
+    }
+
+    void AppendConvertedDosages(const PgenContext *const pGenContext, const uint32_t dosage_ct) {
+        if (pGenContext->mtpgwp != nullptr) {
+            MTWriterAppendDosage(
+                    pGenContext->mtpgwp,
+                    pGenContext->genovec,
+                    pGenContext->dosage_present,
+                    pGenContext->dosage_main,
+                    dosage_ct);
+            return;
+        }
+        throwOnPglErr(
+                plink2::SpgwAppendBiallelicGenovecDosage16(
+                        pGenContext->genovec,
+                        pGenContext->dosage_present,
+                        pGenContext->dosage_main,
+                        dosage_ct,
+                        pGenContext->spgwp),
+                "appendDosages");
+    }
+
+    /**
+     * Switch a PgenContext to asynchronous appends. A native worker thread is started, and subsequent batches must
+     * be appended via AppendAllelesBatchAsync, which hands each batch off to the worker and returns without waiting
+     * for it to be written. Throws PgenException on failure.
+     *
+     * @param pGenContext - the PgenContext for the writer
+     * @param queueDepth - the maximum number of batches that can be pending (including the one being written) before
+     * AppendAllelesBatchAsync blocks. Must be > 0. Since the caller can't reuse a batch buffer until it has been
+     * consumed, a caller that cycles through a fixed set of batch buffers needs queueDepth + 1 of them.
+     */
+    void StartAsyncAppends(PgenContext *const pGenContext, const int queueDepth) {
+        if (pGenContext->asyncp != nullptr) {
+            throw PgenException("Async appends have already been started for this PgenContext");
+        } else if (queueDepth < 1) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Invalid async queue depth: %d. The queue depth must be at least 1.",
+                     queueDepth);
+            throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+        }
+        pGenContext->asyncp = InitPgenAsyncWriter(pGenContext, static_cast<uint32_t>(queueDepth));
+    }
+
+    /**
+     * Queue a batch of variants (with the same layout as for AppendAllelesBatch) to be appended by the async worker
+     * started by StartAsyncAppends. Blocks only when the queue is full. The buffers must remain valid and unmodified
+     * until the batch has been consumed, which is guaranteed once queueDepth further batches have been submitted,
+     * or after a call to GetNumberOfVariantsWritten or ClosePgen.
+     *
+     * Errors are reported asynchronously: a failure appending a batch is thrown (as a PgenException) from the next
+     * call to AppendAllelesBatchAsync, GetNumberOfVariantsWritten or ClosePgen, and all subsequent batches are
+     * discarded.
+     */
+    void AppendAllelesBatchAsync(
+            const PgenContext *const pGenContext,
+            const int32_t *allele_codes,
+            const unsigned char *phase_bytes,
+            const int32_t *allele_cts,
+            const uint32_t variant_ct) {
+        if (pGenContext->asyncp == nullptr) {
+            throw PgenException("AppendAllelesBatchAsync requires a prior call to StartAsyncAppends");
+        }
+        AsyncWriterSubmit(pGenContext->asyncp, allele_codes, phase_bytes, allele_cts, variant_ct);
+    }
+
+    // wait for any pending async batches to be written, then stop the async worker; rethrows any async append error
+    void StopAsyncAppends(const PgenContext *const pGenContext) {
+        PgenAsyncWriter *asyncp = pGenContext->asyncp;
+        const_cast<PgenContext *>(pGenContext)->asyncp = nullptr;
+        try {
+            AsyncWriterDrain(asyncp);
+        } catch (const PgenException &) {
+            CleanupPgenAsyncWriter(asyncp);
+            throw;
+        }
+        CleanupPgenAsyncWriter(asyncp);
+    }
+
+    // Write the variant that has been converted into the pGenContext buffers, either directly via the
+    // STPgenWriter, or by staging it for the multi-threaded writer. hphase determines whether the phasing track
+    // in phasepresent/phaseinfo is written.
+    void AppendConvertedAlleles(
+            const PgenContext *const pGenContext,
+            const uint32_t write_allele_ct,
+            const uint32_t patch_01_ct,
+            const uint32_t patch_10_ct,
+            const bool hphase) {
+        if (pGenContext->mtpgwp != nullptr) {
+            MTWriterAppend(
+                    pGenContext->mtpgwp,
+                    pGenContext->genovec,
+                    pGenContext->patch_01_set,
+                    pGenContext->patch_01_vals,
+                    pGenContext->patch_10_set,
+                    pGenContext->patch_10_vals,
+                    hphase ? pGenContext->phasepresent : nullptr,
+                    hphase ? pGenContext->phaseinfo : nullptr,
+                    write_allele_ct,
+                    patch_01_ct,
+                    patch_10_ct);
+            return;
         }
-        write_allele_ct = unsigned_allele_ct;
 
         plink2::PglErr pglErr;
-        if (!allPhased) {
+        if (!hphase) {
             if ((patch_01_ct == 0) and (patch_10_ct == 0)) {
                 pglErr = SpgwAppendBiallelicGenovec(pGenContext->genovec, pGenContext->spgwp);
             } else {
@@ -493,8 +874,19 @@ namespace pgenlib {
      * initially opened. otherwise a pgenlib::PGenException will be thrown.
      */
     void ClosePgen(const PgenContext *const pGenContext, const long numVariantsDropped) {
-        const uint32_t declaredVariantCt = plink2::SpgwGetVariantCt(pGenContext->spgwp);
-        const uint32_t writtenVariantCt = plink2::SpgwGetVidx(pGenContext->spgwp);
+        if (pGenContext->asyncp != nullptr) {
+            try {
+                StopAsyncAppends(pGenContext);
+            } catch (const PgenException &) {
+                // an async append failure leaves the file incomplete, so release the writer without finishing it
+                AbandonPgenContext(pGenContext);
+                throw;
+            }
+        }
+        const uint32_t declaredVariantCt = pGenContext->mtpgwp != nullptr ?
+                MTWriterGetVariantCt(pGenContext->mtpgwp) :
+                plink2::SpgwGetVariantCt(pGenContext->spgwp);
+        const uint32_t writtenVariantCt = static_cast<uint32_t>(GetNumberOfVariantsWritten(pGenContext));
         const uint32_t droppedVariantCt = static_cast<uint32_t>(numVariantsDropped);
 
         if ((declaredVariantCt != static_cast<long>(pgenlib::kVariantCountUnknown)) &&
@@ -515,7 +907,26 @@ namespace pgenlib {
             // writer can catch and handle that case without propagating it, because throwing from the Closeable
             // "close" method, when the writer is created within a try-with-resources statement can mask other
             // exceptions
+            if (pGenContext->mtpgwp != nullptr) {
+                // the multi-threaded writer may own running threads, so release it even though we're bailing
+                CleanupPgenMTWriter(pGenContext->mtpgwp);
+                plink2::aligned_free(pGenContext->spgw_alloc);
+                free(reinterpret_cast<void *>(const_cast<PgenContext *>(pGenContext)));
+            }
             throw PgenMissingVariantsException(errMessage);
+        } else if (pGenContext->mtpgwp != nullptr) {
+            // always release the multi-threaded writer, since it may own running threads
+            try {
+                if (writtenVariantCt != 0) {
+                    MTWriterFinish(pGenContext->mtpgwp);
+                }
+            } catch (const PgenException &) {
+                CleanupPgenMTWriter(pGenContext->mtpgwp);
+                plink2::aligned_free(pGenContext->spgw_alloc);
+                free(reinterpret_cast<void *>(const_cast<PgenContext *>(pGenContext)));
+                throw;
+            }
+            CleanupPgenMTWriter(pGenContext->mtpgwp);
         } else if (writtenVariantCt != 0) {
             // guard against calling the plink2 finish/cleanup methods in the case where no writes have been made
             // because doing so triggers asserts in the plink code, presumably because downstream code paths can't
@@ -533,7 +944,7 @@ namespace pgenlib {
             }
         }
 
-        free(pGenContext->spgwp);
+        free(pGenContext->spgwp); // null for the multi-threaded writer
         plink2::aligned_free(pGenContext->spgw_alloc);
         free(reinterpret_cast<void *>(const_cast<PgenContext *>(pGenContext)));
 
@@ -543,7 +954,41 @@ namespace pgenlib {
         }
     }
 
+    /**
+     * Release a pGenContext without finishing the pgen, for a writer whose appends have failed (so the variants
+     * written no longer match the caller's other outputs). Any async batches that are still queued are discarded.
+     * The output file(s) are closed but are not valid. Doesn't throw. The pGenContext is no longer valid after this
+     * call.
+     *
+     * @param pGenContext - the pgen context for this writer
+     */
+    void AbandonPgen(const PgenContext *const pGenContext) {
+        if (pGenContext->asyncp != nullptr) {
+            CleanupPgenAsyncWriter(pGenContext->asyncp);
+        }
+        AbandonPgenContext(pGenContext);
+    }
+
+    // close the output file(s) and free pGenContext without finishing the pgen (the output is not valid)
+    void AbandonPgenContext(const PgenContext *const pGenContext) {
+        if (pGenContext->mtpgwp != nullptr) {
+            CleanupPgenMTWriter(pGenContext->mtpgwp);
+        } else {
+            plink2::PglErr cleanupErr = plink2::kPglRetSuccess;
+            CleanupSpgw(pGenContext->spgwp, &cleanupErr);
+            free(pGenContext->spgwp);
+        }
+        plink2::aligned_free(pGenContext->spgw_alloc);
+        free(reinterpret_cast<void *>(const_cast<PgenContext *>(pGenContext)));
+    }
+
     long GetNumberOfVariantsWritten(const PgenContext *const pGenContext) {
+        if (pGenContext->asyncp != nullptr) {
+            AsyncWriterDrain(pGenContext->asyncp);
+        }
+        if (pGenContext->mtpgwp != nullptr) {
+            return MTWriterGetVidx(pGenContext->mtpgwp);
+        }
         return plink2::SpgwGetVidx(pGenContext->spgwp);
     }
 
@@ -582,26 +1027,10 @@ namespace pgenlib {
         if (pgenlibFlags & pgenlib::kWriteFlagPreservePhasing) {
             plinkFlags |= plink2::kfPgenGlobalHardcallPhasePresent;
         }
-        return plinkFlags;
-    }
-
-    // In order to take the correct code path through plink, we need to determine up front whether all
-    // the genotypes are phased. If there is no phasing track at all, allPhased = false, but otherwise,
-    // start out assuming all are phased and then bail as soon as we find one unphased genotype.
-    bool GetAllPhased(const PgenContext *pGenContext, const unsigned char *phase_bytes) {
-        bool allPhased = false;
-        if (pGenContext->write_flags & kWriteFlagPreservePhasing) {
-            if (phase_bytes == nullptr) {
-                throw PgenException("A phasing track is required since kWriteFlagPreservePhasing was specified");
-            }
-            allPhased = true;
-            for (int i = 0; i < pGenContext->sample_count; i++) {
-                if (!phase_bytes[i]) {
-                    return false;
-                }
-            }
+        if (pgenlibFlags & pgenlib::kWriteFlagDosage) {
+            plinkFlags |= plink2::kfPgenGlobalDosagePresent;
         }
-        return allPhased;
+        return plinkFlags;
     }
 
 /***********************************************************************************************************
@@ -0,0 +1,434 @@
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include "pgenException.h"
+#include "pgenUtils.h"
+#include "pgenReader.h"
+#include "pgenLd.h"
+#include "pgenVariantSlices.h"
+
+namespace pgenlib {
+
+    // the bit planes of a decoded variant
+    enum LdPlane : uint32_t {
+        kLdPlaneHet,
+        kLdPlaneHomAlt,
+        kLdPlaneNonmissing,
+        kLdPlaneHap0,       // the alt allele is on haplotype 0 (phased variants only)
+        kLdPlaneHap1,       // the alt allele is on haplotype 1 (phased variants only)
+        kLdPlaneCt
+    };
+
+    // a set of slots, each of which holds the bit planes of one decoded variant
+    struct LdVariantPlanes {
+        LdVariantPlanes(const uint32_t sample_ct, const uint32_t slot_ct) :
+                plane_word_ct(plink2::BitCtToWordCt(sample_ct)),
+                words(static_cast<uintptr_t>(slot_ct) * kLdPlaneCt * plane_word_ct),
+                phased(slot_ct) {}
+
+        uintptr_t *Plane(const uint32_t slot, const LdPlane plane) {
+            return &words[(static_cast<uintptr_t>(slot) * kLdPlaneCt + plane) * plane_word_ct];
+        }
+        const uintptr_t *Plane(const uint32_t slot, const LdPlane plane) const {
+            return &words[(static_cast<uintptr_t>(slot) * kLdPlaneCt + plane) * plane_word_ct];
+        }
+
+        const uintptr_t plane_word_ct;
+        std::vector<uintptr_t> words;
+        // whether the haplotype planes of each slot are valid (every het of the variant is phased)
+        std::vector<unsigned char> phased;
+    };
+
+    static void RequireValidLdThreadCount(const uint32_t threadCount);
+    static plink2::PglErr DecodeLdVariant(
+            const PgenReaderContext *const pReaderContext,
+            PgenThreadReader *pThreadReader,
+            const uint32_t variantIndex,
+            const bool usePhase,
+            const uint32_t slot,
+            LdVariantPlanes *pPlanes);
+    static bool ComputeLdPair(
+            const LdVariantPlanes &planesA,
+            const uint32_t slotA,
+            const LdVariantPlanes &planesB,
+            const uint32_t slotB,
+            double *r2,
+            double *d_prime);
+
+    /**
+     * Find the pairs of variants in [variantStart, variantEnd), no more than windowVariantCount variants apart, with
+     * an r^2 of at least minR2. Variants are compared by their non-reference hardcalls (any alt allele, for a
+     * multi-allelic variant), over the samples that are non-missing for both.
+     *
+     * For a pair of phased variants (every het genotype phased, see the PGEN VrtypeHphase record type), r^2 and D'
+     * are computed from the haplotype counts. Otherwise r^2 is the squared correlation of the allele counts (as for
+     * plink 1.9 --r2), and D' is computed from the composite LD estimate of D (half the allele count covariance), so
+     * it's exact only under Hardy-Weinberg equilibrium. Pairs for which either variant is monomorphic are skipped.
+     * @param pReaderContext - the PgenReaderContext for the reader
+     * @param variantStart - the first variant to include
+     * @param variantEnd - one past the last variant to include
+     * @param windowVariantCount - the maximum distance (in variants) between the two variants of a pair
+     * @param minR2 - the minimum r^2 of a reported pair
+     * @param threadCount - the number of threads to compute with; each thread opens its own reader, and holds the
+     * bit planes of a window (up to windowVariantCount + 1 variants) in memory
+     * @param ldFlags - unsigned integer bitwise flags, with valid values drawn from {kLdFlagIgnorePhase}
+     * @param pairs - receives the pairs, ordered by their first and then their second variant; the first variant of
+     * each pair precedes the second
+     */
+    void ComputeWindowLd(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t windowVariantCount,
+            const double minR2,
+            const uint32_t threadCount,
+            const uint32_t ldFlags,
+            std::vector<LdPair> *pairs) {
+        RequireValidVariantRange(pReaderContext, variantStart, variantEnd);
+        RequireValidLdThreadCount(threadCount);
+        pairs->clear();
+        const uint32_t sample_ct = pReaderContext->sample_ct;
+        if ((variantEnd - variantStart < 2) || (windowVariantCount == 0) || (sample_ct == 0)) {
+            return;
+        }
+
+        // each thread decodes its variants (and those in the window after its last one) once, into a ring of slots
+        const uint32_t slot_ct = static_cast<uint32_t>(
+                std::min<uint64_t>(static_cast<uint64_t>(windowVariantCount) + 1, variantEnd - variantStart));
+        const uint32_t thread_ct = SliceThreadCount(variantStart, variantEnd, threadCount);
+        std::vector<LdVariantPlanes> thread_planes;
+        thread_planes.reserve(thread_ct);
+        for (uint32_t tidx = 0; tidx != thread_ct; ++tidx) {
+            thread_planes.emplace_back(sample_ct, slot_ct);
+        }
+        std::vector<std::vector<LdPair>> thread_pairs(thread_ct);
+        const bool use_phase = !(ldFlags & kLdFlagIgnorePhase);
+
+        ForEachVariantSlice(
+                pReaderContext,
+                variantStart,
+                variantEnd,
+                threadCount,
+                "Error reading pgen genotypes for LD (PgrGetP)",
+                [&](const uint32_t tidx, PgenThreadReader *pThreadReader, const uint32_t begin, const uint32_t end) {
+                    LdVariantPlanes &planes = thread_planes[tidx];
+                    std::vector<LdPair> &slice_pairs = thread_pairs[tidx];
+                    // the variants before decoded_end (back to decoded_end - slot_ct) are in their slots
+                    uint32_t decoded_end = begin;
+                    for (uint32_t vidx_a = begin; vidx_a != end; ++vidx_a) {
+                        const uint32_t window_end = vidx_a + 1 + std::min(windowVariantCount, variantEnd - 1 - vidx_a);
+                        for (; decoded_end != window_end; ++decoded_end) {
+                            const plink2::PglErr reterr = DecodeLdVariant(
+                                    pReaderContext, pThreadReader, decoded_end, use_phase, decoded_end % slot_ct, &planes);
+                            if (reterr != plink2::kPglRetSuccess) {
+                                return reterr;
+                            }
+                        }
+                        for (uint32_t vidx_b = vidx_a + 1; vidx_b != window_end; ++vidx_b) {
+                            double r2;
+                            double d_prime;
+                            if (ComputeLdPair(planes, vidx_a % slot_ct, planes, vidx_b % slot_ct, &r2, &d_prime) &&
+                                (r2 >= minR2)) {
+                                try {
+                                    slice_pairs.push_back(LdPair { vidx_a, vidx_b, r2, d_prime });
+                                } catch (const std::bad_alloc &) {
+                                    return plink2::kPglRetNomem;
+                                }
+                            }
+                        }
+                    }
+                    return plink2::kPglRetSuccess;
+                });
+
+        for (const std::vector<LdPair> &slice_pairs : thread_pairs) {
+            pairs->insert(pairs->end(), slice_pairs.begin(), slice_pairs.end());
+        }
+    }
+
+    /**
+     * Find the pairs of variants, one from [variantStartA, variantEndA) and one from [variantStartB, variantEndB),
+     * with an r^2 of at least minR2 (see ComputeWindowLd), such as the pairs of an index variant and the variants
+     * around it, for clumping. A variant is never paired with itself; if the ranges overlap, a pair of variants in
+     * both ranges is reported in both orders.
+     * @param pReaderContext - the PgenReaderContext for the reader
+     * @param variantStartA - the first variant of the first range
+     * @param variantEndA - one past the last variant of the first range
+     * @param variantStartB - the first variant of the second range
+     * @param variantEndB - one past the last variant of the second range
+     * @param minR2 - the minimum r^2 of a reported pair
+     * @param threadCount - the number of threads to compute with; each thread opens its own reader. The bit planes of
+     * every variant in the second range are held in memory, and shared by the threads.
+     * @param ldFlags - unsigned integer bitwise flags, with valid values drawn from {kLdFlagIgnorePhase}
+     * @param pairs - receives the pairs, ordered by their first (from the first range) and then their second variant
+     */
+    void ComputeCrossLd(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStartA,
+            const uint32_t variantEndA,
+            const uint32_t variantStartB,
+            const uint32_t variantEndB,
+            const double minR2,
+            const uint32_t threadCount,
+            const uint32_t ldFlags,
+            std::vector<LdPair> *pairs) {
+        RequireValidVariantRange(pReaderContext, variantStartA, variantEndA);
+        RequireValidVariantRange(pReaderContext, variantStartB, variantEndB);
+        RequireValidLdThreadCount(threadCount);
+        pairs->clear();
+        const uint32_t sample_ct = pReaderContext->sample_ct;
+        if ((variantStartA == variantEndA) || (variantStartB == variantEndB) || (sample_ct == 0)) {
+            return;
+        }
+        const bool use_phase = !(ldFlags & kLdFlagIgnorePhase);
+
+        // decode the second range once, in parallel, into one slot per variant
+        LdVariantPlanes planes_b(sample_ct, variantEndB - variantStartB);
+        ForEachVariantSlice(
+                pReaderContext,
+                variantStartB,
+                variantEndB,
+                threadCount,
+                "Error reading pgen genotypes for LD (PgrGetP)",
+                [&](const uint32_t, PgenThreadReader *pThreadReader, const uint32_t begin, const uint32_t end) {
+                    for (uint32_t vidx = begin; vidx != end; ++vidx) {
+                        const plink2::PglErr reterr = DecodeLdVariant(
+                                pReaderContext, pThreadReader, vidx, use_phase, vidx - variantStartB, &planes_b);
+                        if (reterr != plink2::kPglRetSuccess) {
+                            return reterr;
+                        }
+                    }
+                    return plink2::kPglRetSuccess;
+                });
+
+        const uint32_t thread_ct = SliceThreadCount(variantStartA, variantEndA, threadCount);
+        std::vector<LdVariantPlanes> thread_planes;
+        thread_planes.reserve(thread_ct);
+        for (uint32_t tidx = 0; tidx != thread_ct; ++tidx) {
+            thread_planes.emplace_back(sample_ct, 1);
+        }
+        std::vector<std::vector<LdPair>> thread_pairs(thread_ct);
+        ForEachVariantSlice(
+                pReaderContext,
+                variantStartA,
+                variantEndA,
+                threadCount,
+                "Error reading pgen genotypes for LD (PgrGetP)",
+                [&](const uint32_t tidx, PgenThreadReader *pThreadReader, const uint32_t begin, const uint32_t end) {
+                    LdVariantPlanes &planes_a = thread_planes[tidx];
+                    std::vector<LdPair> &slice_pairs = thread_pairs[tidx];
+                    for (uint32_t vidx_a = begin; vidx_a != end; ++vidx_a) {
+                        const plink2::PglErr reterr =
+                                DecodeLdVariant(pReaderContext, pThreadReader, vidx_a, use_phase, 0, &planes_a);
+                        if (reterr != plink2::kPglRetSuccess) {
+                            return reterr;
+                        }
+                        for (uint32_t vidx_b = variantStartB; vidx_b != variantEndB; ++vidx_b) {
+                            double r2;
+                            double d_prime;
+                            if ((vidx_b != vidx_a) &&
+                                ComputeLdPair(planes_a, 0, planes_b, vidx_b - variantStartB, &r2, &d_prime) &&
+                                (r2 >= minR2)) {
+                                try {
+                                    slice_pairs.push_back(LdPair { vidx_a, vidx_b, r2, d_prime });
+                                } catch (const std::bad_alloc &) {
+                                    return plink2::kPglRetNomem;
+                                }
+                            }
+                        }
+                    }
+                    return plink2::kPglRetSuccess;
+                });
+
+        for (const std::vector<LdPair> &slice_pairs : thread_pairs) {
+            pairs->insert(pairs->end(), slice_pairs.begin(), slice_pairs.end());
+        }
+    }
+
+    static void RequireValidLdThreadCount(const uint32_t threadCount) {
+        if (threadCount == 0) {
+            throw PgenException("Invalid thread count (0); must be at least 1");
+        }
+    }
+
+    // Decode a variant's hardcalls (and, if usePhase, its phase) into the bit planes of a slot. The haplotype planes
+    // are only filled in (and the slot marked as phased) if every het genotype of the variant is phased.
+    static plink2::PglErr DecodeLdVariant(
+            const PgenReaderContext *const pReaderContext,
+            PgenThreadReader *pThreadReader,
+            const uint32_t variantIndex,
+            const bool usePhase,
+            const uint32_t slot,
+            LdVariantPlanes *pPlanes) {
+        const uint32_t sample_ct = pReaderContext->sample_ct;
+        plink2::PgenVariant &pgv = pThreadReader->pgv;
+        const uint32_t vrtype = plink2::GetPgfiVrtype(pReaderContext->pgfip, variantIndex);
+        // the phase of a multi-allelic record can only be parsed if the allele counts are known
+        const bool read_phase = usePhase && plink2::VrtypeHphase(vrtype) &&
+                                (!plink2::VrtypeMultiallelicHc(vrtype) || (pReaderContext->allele_idx_offsets != nullptr));
+        uint32_t phasepresent_ct = 0;
+        const plink2::PglErr reterr = read_phase ?
+                plink2::PgrGetP(
+                        pReaderContext->sample_include,
+                        pThreadReader->pssi,
+                        sample_ct,
+                        variantIndex,
+                        pThreadReader->pgrp,
+                        pgv.genovec,
+                        pgv.phasepresent,
+                        pgv.phaseinfo,
+                        &phasepresent_ct) :
+                plink2::PgrGet(
+                        pReaderContext->sample_include,
+                        pThreadReader->pssi,
+                        sample_ct,
+                        variantIndex,
+                        pThreadReader->pgrp,
+                        pgv.genovec);
+        if (reterr != plink2::kPglRetSuccess) {
+            return reterr;
+        }
+        plink2::ZeroTrailingNyps(sample_ct, pgv.genovec);
+
+        // split each pair of genovec words (two bits per sample) into one word of each plane (one bit per sample)
+        const uintptr_t plane_word_ct = pPlanes->plane_word_ct;
+        const uint32_t geno_word_ct = plink2::NypCtToWordCt(sample_ct);
+        uintptr_t *het = pPlanes->Plane(slot, kLdPlaneHet);
+        uintptr_t *hom_alt = pPlanes->Plane(slot, kLdPlaneHomAlt);
+        uintptr_t *nonmissing = pPlanes->Plane(slot, kLdPlaneNonmissing);
+        for (uintptr_t widx = 0; widx != plane_word_ct; ++widx) {
+            uintptr_t het_word = 0;
+            uintptr_t hom_alt_word = 0;
+            uintptr_t missing_word = 0;
+            for (uint32_t half = 0; half != 2; ++half) {
+                const uintptr_t geno_widx = 2 * widx + half;
+                const uintptr_t geno_word = geno_widx < geno_word_ct ? pgv.genovec[geno_widx] : 0;
+                const uintptr_t lo = geno_word & plink2::kMask5555;
+                const uintptr_t hi = (geno_word >> 1) & plink2::kMask5555;
+                const uint32_t shift = half * plink2::kBitsPerWordD2;
+                het_word |= static_cast<uintptr_t>(plink2::PackWordToHalfwordMask5555(lo & (~hi))) << shift;
+                hom_alt_word |= static_cast<uintptr_t>(plink2::PackWordToHalfwordMask5555(hi & (~lo))) << shift;
+                missing_word |= static_cast<uintptr_t>(plink2::PackWordToHalfwordMask5555(lo & hi)) << shift;
+            }
+            het[widx] = het_word;
+            hom_alt[widx] = hom_alt_word;
+            nonmissing[widx] = ~missing_word;
+        }
+        plink2::ZeroTrailingBits(sample_ct, nonmissing);
+
+        // a variant without hets is trivially phased. For a multi-allelic variant, the hets here are the genovec
+        // (ref/alt) hets, since an alt/alt het collapses to hom alt in the planes; whether phasepresent can also mark
+        // alt/alt hets depends on the plink2 version (PgrGetP currently masks them out), so rather than comparing
+        // counts, require each of the genovec hets to be phased
+        const uint32_t het_ct = static_cast<uint32_t>(plink2::PopcountWords(het, plane_word_ct));
+        const bool phased = usePhase &&
+                            ((het_ct == 0) ||
+                             (read_phase && (phasepresent_ct != 0) &&
+                              (plink2::PopcountWordsIntersect(het, pgv.phasepresent, plane_word_ct) == het_ct)));
+        pPlanes->phased[slot] = phased;
+        if (phased) {
+            uintptr_t *hap0 = pPlanes->Plane(slot, kLdPlaneHap0);
+            uintptr_t *hap1 = pPlanes->Plane(slot, kLdPlaneHap1);
+            for (uintptr_t widx = 0; widx != plane_word_ct; ++widx) {
+                const uintptr_t phaseinfo_word = het_ct == 0 ? 0 : pgv.phaseinfo[widx];
+                hap0[widx] = hom_alt[widx] | (het[widx] & phaseinfo_word);
+                hap1[widx] = hom_alt[widx] | (het[widx] & (~phaseinfo_word));
+            }
+        }
+        return plink2::kPglRetSuccess;
+    }
+
+    // Compute r^2 and D' for a pair of decoded variants, over the samples that are non-missing for both. Returns
+    // false if either variant is monomorphic over those samples (or there are none), so r^2 is undefined.
+    static bool ComputeLdPair(
+            const LdVariantPlanes &planesA,
+            const uint32_t slotA,
+            const LdVariantPlanes &planesB,
+            const uint32_t slotB,
+            double *r2,
+            double *d_prime) {
+        const uintptr_t word_ct = planesA.plane_word_ct;
+        const uintptr_t *het_a = planesA.Plane(slotA, kLdPlaneHet);
+        const uintptr_t *hom_alt_a = planesA.Plane(slotA, kLdPlaneHomAlt);
+        const uintptr_t *nonmissing_a = planesA.Plane(slotA, kLdPlaneNonmissing);
+        const uintptr_t *het_b = planesB.Plane(slotB, kLdPlaneHet);
+        const uintptr_t *hom_alt_b = planesB.Plane(slotB, kLdPlaneHomAlt);
+        const uintptr_t *nonmissing_b = planesB.Plane(slotB, kLdPlaneNonmissing);
+        int64_t nonmissing_ct = 0;
+        int64_t het_ct_a = 0;
+        int64_t hom_alt_ct_a = 0;
+        int64_t het_ct_b = 0;
+        int64_t hom_alt_ct_b = 0;
+        int64_t het_het_ct = 0;
+        int64_t het_hom_alt_ct = 0;
+        int64_t hom_alt_het_ct = 0;
+        int64_t hom_alt_hom_alt_ct = 0;
+        for (uintptr_t widx = 0; widx != word_ct; ++widx) {
+            const uintptr_t nonmissing_word = nonmissing_a[widx] & nonmissing_b[widx];
+            const uintptr_t het_word_a = het_a[widx] & nonmissing_word;
+            const uintptr_t hom_alt_word_a = hom_alt_a[widx] & nonmissing_word;
+            const uintptr_t het_word_b = het_b[widx] & nonmissing_word;
+            const uintptr_t hom_alt_word_b = hom_alt_b[widx] & nonmissing_word;
+            nonmissing_ct += plink2::PopcountWord(nonmissing_word);
+            het_ct_a += plink2::PopcountWord(het_word_a);
+            hom_alt_ct_a += plink2::PopcountWord(hom_alt_word_a);
+            het_ct_b += plink2::PopcountWord(het_word_b);
+            hom_alt_ct_b += plink2::PopcountWord(hom_alt_word_b);
+            het_het_ct += plink2::PopcountWord(het_word_a & het_word_b);
+            het_hom_alt_ct += plink2::PopcountWord(het_word_a & hom_alt_word_b);
+            hom_alt_het_ct += plink2::PopcountWord(hom_alt_word_a & het_word_b);
+            hom_alt_hom_alt_ct += plink2::PopcountWord(hom_alt_word_a & hom_alt_word_b);
+        }
+        if (nonmissing_ct == 0) {
+            return false;
+        }
+        // the alt allele counts, and the number of (non-missing) haplotypes
+        const int64_t alt_ct_a = het_ct_a + 2 * hom_alt_ct_a;
+        const int64_t alt_ct_b = het_ct_b + 2 * hom_alt_ct_b;
+        const int64_t hap_ct = 2 * nonmissing_ct;
+        if ((alt_ct_a == 0) || (alt_ct_a == hap_ct) || (alt_ct_b == 0) || (alt_ct_b == hap_ct)) {
+            return false;
+        }
+
+        // D, in units of 1 / hap_ct^2
+        double d_scaled;
+        if (planesA.phased[slotA] && planesB.phased[slotB]) {
+            const uintptr_t *hap0_a = planesA.Plane(slotA, kLdPlaneHap0);
+            const uintptr_t *hap1_a = planesA.Plane(slotA, kLdPlaneHap1);
+            const uintptr_t *hap0_b = planesB.Plane(slotB, kLdPlaneHap0);
+            const uintptr_t *hap1_b = planesB.Plane(slotB, kLdPlaneHap1);
+            // the number of (non-missing) haplotypes with the alt allele of both variants
+            int64_t alt_alt_hap_ct = 0;
+            for (uintptr_t widx = 0; widx != word_ct; ++widx) {
+                const uintptr_t nonmissing_word = nonmissing_a[widx] & nonmissing_b[widx];
+                alt_alt_hap_ct += plink2::PopcountWord(hap0_a[widx] & hap0_b[widx] & nonmissing_word);
+                alt_alt_hap_ct += plink2::PopcountWord(hap1_a[widx] & hap1_b[widx] & nonmissing_word);
+            }
+            d_scaled = static_cast<double>(hap_ct * alt_alt_hap_ct - alt_ct_a * alt_ct_b);
+            *r2 = (d_scaled * d_scaled) /
+                  (static_cast<double>(alt_ct_a * (hap_ct - alt_ct_a)) * static_cast<double>(alt_ct_b * (hap_ct - alt_ct_b)));
+        } else {
+            // the allele count sums of squares and cross products
+            const int64_t alt_sq_a = het_ct_a + 4 * hom_alt_ct_a;
+            const int64_t alt_sq_b = het_ct_b + 4 * hom_alt_ct_b;
+            const int64_t alt_cross = het_het_ct + 2 * (het_hom_alt_ct + hom_alt_het_ct) + 4 * hom_alt_hom_alt_ct;
+            // the covariance and variances, in units of 1 / nonmissing_ct^2
+            const double cov_scaled = static_cast<double>(nonmissing_ct * alt_cross - alt_ct_a * alt_ct_b);
+            const double var_scaled_a = static_cast<double>(nonmissing_ct * alt_sq_a - alt_ct_a * alt_ct_a);
+            const double var_scaled_b = static_cast<double>(nonmissing_ct * alt_sq_b - alt_ct_b * alt_ct_b);
+            if ((var_scaled_a <= 0.0) || (var_scaled_b <= 0.0)) {
+                // every sample is het for one of the variants
+                return false;
+            }
+            *r2 = (cov_scaled * cov_scaled) / (var_scaled_a * var_scaled_b);
+            // the composite estimate of D is half the covariance
+            d_scaled = 2.0 * cov_scaled;
+        }
+        const double d_max_scaled = d_scaled > 0.0 ?
+                static_cast<double>(std::min(alt_ct_a * (hap_ct - alt_ct_b), (hap_ct - alt_ct_a) * alt_ct_b)) :
+                static_cast<double>(std::min(alt_ct_a * alt_ct_b, (hap_ct - alt_ct_a) * (hap_ct - alt_ct_b)));
+        *d_prime = std::max(-1.0, std::min(1.0, d_scaled / d_max_scaled));
+        return true;
+    }
+
+}
@@ -0,0 +1,644 @@
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "pgenException.h"
+#include "pgenUtils.h"
+#include "pgenMTWriter.h"
+#include "pgenlib_misc.h"
+#include "pgenlib_write.h"
+#include "pgenWriterInternals.h"
+
+namespace pgenlib {
+    static const int kErrMessageBufSize = 1024;
+
+    // each staged variant starts with these header words: allele_ct, patch_01_ct, patch_10_ct, dosage_ct (or the
+    // difflist length, for a kStagedDifflist variant), and the kStaged* flags below
+    static const uint32_t kStagedHeaderWordCt = 5;
+    static const uintptr_t kStagedPhaseinfo = 0x1;
+    static const uintptr_t kStagedPhasepresent = 0x2;
+    static const uintptr_t kStagedDosage = 0x4;
+    static const uintptr_t kStagedDifflist = 0x8;
+
+    // The staging area and compression state for one MTPgenWriter thread. Each block receives up to
+    // plink2::kPglVblockSize converted variants, which are staged (not yet compressed) in chunks. A chunk is
+    // compressed on a worker thread, appending to fwrite_buf, once it reaches the writer's chunk size limit, the
+    // block is full, or the writer is finished; the next chunk is staged while it's compressed.
+    typedef struct PgenMTBlock {
+        std::vector<uintptr_t> records;    // the chunk being staged
+        uint32_t variant_ct;               // the number of variants in records
+        uint64_t max_byte_ct;              // upper bound on the compressed size of the variants in records
+        uint32_t block_variant_ct;         // the number of variants assigned to the block so far (this round)
+        std::vector<uintptr_t> pending;    // the chunk being compressed by the worker
+        uint32_t pending_variant_ct;
+        unsigned char *fwrite_buf;
+        uint64_t fwrite_buf_byte_ct;
+
+        // the plink2 compression routines require vector-aligned input, so each staged variant is copied into
+        // these buffers before it is compressed
+        unsigned char *scratch_alloc;
+        uintptr_t *genovec;
+        uintptr_t *patch_01_set;
+        plink2::AlleleCode *patch_01_vals;
+        uintptr_t *patch_10_set;
+        plink2::AlleleCode *patch_10_vals;
+        uintptr_t *phasepresent;
+        uintptr_t *phaseinfo;
+        uintptr_t *dosage_present;
+        uint16_t *dosage_main;
+        uintptr_t *raregeno;
+        uint32_t *difflist_sample_ids;
+
+        std::thread worker;
+        plink2::PglErr reterr;             // only valid once the worker has been joined
+    } PgenMTBlock;
+
+    struct PgenMTWriter {
+        plink2::MTPgenWriter *mpgwp;
+        unsigned char *mpgw_alloc;
+        PgenMTBlock *blocks;                // thread_ct blocks, one per thread
+        plink2::PgenWriteMode write_mode;
+        plink2::PgenGlobalFlags phase_dosage_gflags;
+        uint32_t sample_ct;
+        uint32_t thread_ct;
+        uint32_t variant_ct;                // the declared variant count
+        uint32_t vidx;                      // the number of variants staged so far
+        uint64_t max_staged_chunk_bytes;    // the size at which a staged chunk is handed to its worker
+        bool flush_pending;                 // true if blocks have been compressed since the last MpgwFlush
+    };
+
+    static uint64_t MaxVrecLen(const uint32_t sample_ct, const uint32_t allele_ct,
+                               const plink2::PgenGlobalFlags phase_dosage_gflags);
+    static void StageWords(std::vector<uintptr_t> &records, const void *src, const uintptr_t byte_ct);
+    static PgenMTBlock &BeginStagedVariant(PgenMTWriter *mtpgwp);
+    static void EndStagedVariant(PgenMTWriter *mtpgwp, PgenMTBlock &block, const uint64_t max_byte_ct);
+    static void CompressBlock(plink2::PgenWriterCommon *pwcp, PgenMTBlock *blockp, const uint32_t sample_ct);
+    static void DispatchChunk(PgenMTWriter *mtpgwp, const uint32_t tidx);
+    static void JoinBlock(PgenMTBlock &block);
+    static void JoinAllBlocks(PgenMTWriter *mtpgwp);
+
+    /**
+     * Create a multi-threaded PGEN writer. Throws PgenException on failure.
+     *
+     * @param cFilename - the pgen file to write
+     * @param pgenWriteMode - the plink2 pgen write mode
+     * @param phaseDosageFlags - the plink2 global flags for the file
+     * @param variant_ct - the number of variants to be written. the multi-threaded writer requires a known variant
+     * count (although fewer variants may be written in modes other than kPgenWriteBackwardSeek)
+     * @param sample_ct - the number of samples
+     * @param allele_ct_limit - the maximum number of alleles for any variant
+     * @param thread_ct - the number of compression threads to use
+     * @param max_vrec_len_ptr - set to the maximum length of a single variant record
+     * @param explicit_nonref_flags - the nonref flags of the variants, for nonref_flags_storage 3 (otherwise null).
+     * plink2 writes them when the writer is finished, so they must be set (and stay allocated) until then.
+     * @param nonref_flags_storage - the nonref flag storage mode of the header (see plink2::SpgwInitPhase1)
+     * @param max_staged_chunk_bytes - the size at which a chunk of staged (uncompressed) variants is handed to the
+     * block's worker thread for compression. Each thread has at most two chunks (one being staged and one being
+     * compressed), plus its compressed block. Blocks that are larger than this (when there are many samples) are
+     * compressed a chunk at a time, with less overlap between the threads.
+     * @return a PgenMTWriter, which must eventually be released via CleanupPgenMTWriter
+     */
+    PgenMTWriter *InitPgenMTWriter(
+            const char *cFilename,
+            const plink2::PgenWriteMode pgenWriteMode,
+            const plink2::PgenGlobalFlags phaseDosageFlags,
+            const uint32_t variant_ct,
+            const uint32_t sample_ct,
+            const uint32_t allele_ct_limit,
+            const uint32_t thread_ct,
+            uint32_t *max_vrec_len_ptr,
+            uintptr_t *explicit_nonref_flags,
+            const uint32_t nonref_flags_storage,
+            const uint64_t max_staged_chunk_bytes) {
+
+        PgenMTWriter *mtpgwp = new PgenMTWriter();
+        mtpgwp->write_mode = pgenWriteMode;
+        mtpgwp->phase_dosage_gflags = phaseDosageFlags;
+        mtpgwp->sample_ct = sample_ct;
+        mtpgwp->variant_ct = variant_ct;
+        mtpgwp->vidx = 0;
+        mtpgwp->max_staged_chunk_bytes = max_staged_chunk_bytes;
+        mtpgwp->flush_pending = false;
+        // there's no point in having more threads than there are variant blocks
+        mtpgwp->thread_ct = std::min(thread_ct, static_cast<uint32_t>(plink2::DivUp(variant_ct, plink2::kPglVblockSize)));
+
+        uintptr_t alloc_base_cacheline_ct;
+        uint64_t alloc_per_thread_cacheline_ct;
+        uint32_t mt_vrec_len_byte_ct;
+        uint64_t vblock_cacheline_ct;
+        plink2::MpgwInitPhase1(
+                nullptr, // allele index offsets (the vblock write buffers are sized per block, below)
+                variant_ct,
+                sample_ct,
+                phaseDosageFlags,
+                &alloc_base_cacheline_ct,
+                &alloc_per_thread_cacheline_ct,
+                &mt_vrec_len_byte_ct,
+                &vblock_cacheline_ct);
+
+        // Use the same record length width that the single threaded writer would use for this allele_ct_limit,
+        // so that the output is identical regardless of the number of threads used.
+        const uint64_t max_vrec_len = MaxVrecLen(sample_ct, allele_ct_limit, phaseDosageFlags);
+        *max_vrec_len_ptr = static_cast<uint32_t>(max_vrec_len);
+        const uint32_t vrec_len_byte_ct = plink2::BytesToRepresentNzU32(static_cast<uint32_t>(max_vrec_len));
+        alloc_base_cacheline_ct = alloc_base_cacheline_ct -
+                plink2::DivUp(static_cast<uintptr_t>(variant_ct) * mt_vrec_len_byte_ct, plink2::kCacheline) +
+                plink2::DivUp(static_cast<uintptr_t>(variant_ct) * vrec_len_byte_ct, plink2::kCacheline);
+        // the vblock write buffers are allocated separately (see DispatchChunk), sized for the variants that are
+        // actually staged, rather than for the worst case
+        alloc_per_thread_cacheline_ct -= vblock_cacheline_ct;
+
+        mtpgwp->mpgwp = static_cast<plink2::MTPgenWriter *>(
+                malloc(sizeof(plink2::MTPgenWriter) + mtpgwp->thread_ct * sizeof(plink2::PgenWriterCommon *)));
+        if (mtpgwp->mpgwp == nullptr) {
+            CleanupPgenMTWriter(mtpgwp);
+            throw PgenException("Native code failure allocating MTPgenWriter");
+        }
+        plink2::PreinitMpgw(mtpgwp->mpgwp);
+        if (plink2::cachealigned_malloc(
+                (alloc_base_cacheline_ct + mtpgwp->thread_ct * alloc_per_thread_cacheline_ct) * plink2::kCacheline,
+                &mtpgwp->mpgw_alloc)) {
+            CleanupPgenMTWriter(mtpgwp);
+            throw PgenException("Native code failure (cachealigned_malloc) allocating mpgw_alloc");
+        }
+
+        mtpgwp->blocks = new PgenMTBlock[mtpgwp->thread_ct]();
+        const uintptr_t genovec_cacheline_ct = plink2::NypCtToCachelineCt(sample_ct);
+        const uintptr_t bitvec_cacheline_ct = plink2::BitCtToCachelineCt(sample_ct);
+        const uintptr_t patch_01_vals_cacheline_ct = plink2::DivUp(sample_ct * sizeof(plink2::AlleleCode),
+                                                                   plink2::kCacheline);
+        const uintptr_t patch_10_vals_cacheline_ct = plink2::DivUp(sample_ct * 2 * sizeof(plink2::AlleleCode),
+                                                                   plink2::kCacheline);
+        const uintptr_t dosage_main_cacheline_ct = plink2::DivUp(sample_ct * sizeof(uint16_t), plink2::kCacheline);
+        // a difflist is never longer than sample_ct (plus the sample id terminator)
+        const uintptr_t difflist_sample_ids_cacheline_ct = plink2::DivUp((sample_ct + 1) * sizeof(uint32_t),
+                                                                         plink2::kCacheline);
+        const uintptr_t scratch_cacheline_ct = 2 * genovec_cacheline_ct + 5 * bitvec_cacheline_ct +
+                patch_01_vals_cacheline_ct + patch_10_vals_cacheline_ct + dosage_main_cacheline_ct +
+                difflist_sample_ids_cacheline_ct;
+        for (uint32_t tidx = 0; tidx != mtpgwp->thread_ct; ++tidx) {
+            PgenMTBlock &block = mtpgwp->blocks[tidx];
+            block.variant_ct = 0;
+            block.max_byte_ct = 0;
+            block.block_variant_ct = 0;
+            block.pending_variant_ct = 0;
+            block.fwrite_buf = nullptr;
+            block.fwrite_buf_byte_ct = 0;
+            block.reterr = plink2::kPglRetSuccess;
+            if (plink2::cachealigned_malloc(scratch_cacheline_ct * plink2::kCacheline, &block.scratch_alloc)) {
+                block.scratch_alloc = nullptr;
+                CleanupPgenMTWriter(mtpgwp);
+                throw PgenException("Native code failure (cachealigned_malloc) allocating writer thread buffers");
+            }
+            // zero everything once, so that the trailing words of each buffer are well-defined
+            memset(block.scratch_alloc, 0, scratch_cacheline_ct * plink2::kCacheline);
+            unsigned char *scratch_iter = block.scratch_alloc;
+            block.genovec = reinterpret_cast<uintptr_t *>(scratch_iter);
+            scratch_iter = &(scratch_iter[genovec_cacheline_ct * plink2::kCacheline]);
+            block.patch_01_set = reinterpret_cast<uintptr_t *>(scratch_iter);
+            scratch_iter = &(scratch_iter[bitvec_cacheline_ct * plink2::kCacheline]);
+            block.patch_01_vals = reinterpret_cast<plink2::AlleleCode *>(scratch_iter);
+            scratch_iter = &(scratch_iter[patch_01_vals_cacheline_ct * plink2::kCacheline]);
+            block.patch_10_set = reinterpret_cast<uintptr_t *>(scratch_iter);
+            scratch_iter = &(scratch_iter[bitvec_cacheline_ct * plink2::kCacheline]);
+            block.patch_10_vals = reinterpret_cast<plink2::AlleleCode *>(scratch_iter);
+            scratch_iter = &(scratch_iter[patch_10_vals_cacheline_ct * plink2::kCacheline]);
+            block.phasepresent = reinterpret_cast<uintptr_t *>(scratch_iter);
+            scratch_iter = &(scratch_iter[bitvec_cacheline_ct * plink2::kCacheline]);
+            block.phaseinfo = reinterpret_cast<uintptr_t *>(scratch_iter);
+            scratch_iter = &(scratch_iter[bitvec_cacheline_ct * plink2::kCacheline]);
+            block.dosage_present = reinterpret_cast<uintptr_t *>(scratch_iter);
+            scratch_iter = &(scratch_iter[bitvec_cacheline_ct * plink2::kCacheline]);
+            block.dosage_main = reinterpret_cast<uint16_t *>(scratch_iter);
+            scratch_iter = &(scratch_iter[dosage_main_cacheline_ct * plink2::kCacheline]);
+            block.raregeno = reinterpret_cast<uintptr_t *>(scratch_iter);
+            scratch_iter = &(scratch_iter[genovec_cacheline_ct * plink2::kCacheline]);
+            block.difflist_sample_ids = reinterpret_cast<uint32_t *>(scratch_iter);
+        }
+
+        const plink2::PglErr init2Result = plink2::MpgwInitPhase2(
+                cFilename,
+                explicit_nonref_flags,
+                variant_ct,
+                sample_ct,
+                pgenWriteMode,
+                phaseDosageFlags,
+                nonref_flags_storage,
+                vrec_len_byte_ct,
+                0, // vblock write buffers are allocated separately
+                mtpgwp->thread_ct,
+                mtpgwp->mpgw_alloc,
+                mtpgwp->mpgwp);
+        if (init2Result) {
+            CleanupPgenMTWriter(mtpgwp);
+            throwOnPglErr(init2Result, "plink2 initialization (MpgwInitPhase2 failed)");
+        }
+        return mtpgwp;
+    }
+
+    /**
+     * Stage one converted variant. The variant is copied, so the caller's buffers can be reused as soon as this
+     * returns. Compression happens on a worker thread once a full chunk of variants has been staged. Errors from
+     * a worker thread are thrown from a later call to MTWriterAppend or MTWriterFinish.
+     *
+     * @param phasepresent - may be null (see PwcAppendBiallelicGenovecHphase)
+     * @param phaseinfo - if null, the variant is written without phasing
+     */
+    void MTWriterAppend(
+            PgenMTWriter *mtpgwp,
+            const uintptr_t *genovec,
+            const uintptr_t *patch_01_set,
+            const plink2::AlleleCode *patch_01_vals,
+            const uintptr_t *patch_10_set,
+            const plink2::AlleleCode *patch_10_vals,
+            const uintptr_t *phasepresent,
+            const uintptr_t *phaseinfo,
+            const uint32_t allele_ct,
+            const uint32_t patch_01_ct,
+            const uint32_t patch_10_ct) {
+        PgenMTBlock &block = BeginStagedVariant(mtpgwp);
+        const uint32_t sample_ct = mtpgwp->sample_ct;
+        const bool multiallelic = (patch_01_ct != 0) || (patch_10_ct != 0);
+        uintptr_t staged_flags = 0;
+        if (phaseinfo != nullptr) {
+            staged_flags |= kStagedPhaseinfo;
+            if (phasepresent != nullptr) {
+                staged_flags |= kStagedPhasepresent;
+            }
+        }
+        std::vector<uintptr_t> &records = block.records;
+        records.push_back(allele_ct);
+        records.push_back(patch_01_ct);
+        records.push_back(patch_10_ct);
+        records.push_back(0); // dosage_ct
+        records.push_back(staged_flags);
+        StageWords(records, genovec, plink2::NypCtToWordCt(sample_ct) * plink2::kBytesPerWord);
+        if (staged_flags & kStagedPhasepresent) {
+            StageWords(records, phasepresent, plink2::BitCtToWordCt(sample_ct) * plink2::kBytesPerWord);
+        }
+        if (staged_flags & kStagedPhaseinfo) {
+            StageWords(records, phaseinfo, plink2::BitCtToWordCt(sample_ct) * plink2::kBytesPerWord);
+        }
+        if (multiallelic) {
+            StageWords(records, patch_01_set, plink2::BitCtToWordCt(sample_ct) * plink2::kBytesPerWord);
+            StageWords(records, patch_01_vals, patch_01_ct * sizeof(plink2::AlleleCode));
+            StageWords(records, patch_10_set, plink2::BitCtToWordCt(sample_ct) * plink2::kBytesPerWord);
+            StageWords(records, patch_10_vals, patch_10_ct * 2 * sizeof(plink2::AlleleCode));
+        }
+        EndStagedVariant(mtpgwp, block, MaxVrecLen(sample_ct, multiallelic ? allele_ct : 2, mtpgwp->phase_dosage_gflags));
+    }
+
+    /**
+     * Stage one biallelic variant with (unphased) dosages. See MTWriterAppend, and SpgwAppendBiallelicGenovecDosage16
+     * for the parameters. The writer must have been created with plink2::kfPgenGlobalDosagePresent.
+     */
+    void MTWriterAppendDosage(
+            PgenMTWriter *mtpgwp,
+            const uintptr_t *genovec,
+            const uintptr_t *dosage_present,
+            const uint16_t *dosage_main,
+            const uint32_t dosage_ct) {
+        PgenMTBlock &block = BeginStagedVariant(mtpgwp);
+        const uint32_t sample_ct = mtpgwp->sample_ct;
+        std::vector<uintptr_t> &records = block.records;
+        records.push_back(2); // allele_ct
+        records.push_back(0); // patch_01_ct
+        records.push_back(0); // patch_10_ct
+        records.push_back(dosage_ct);
+        records.push_back(kStagedDosage);
+        StageWords(records, genovec, plink2::NypCtToWordCt(sample_ct) * plink2::kBytesPerWord);
+        StageWords(records, dosage_present, plink2::BitCtToWordCt(sample_ct) * plink2::kBytesPerWord);
+        StageWords(records, dosage_main, dosage_ct * sizeof(uint16_t));
+        EndStagedVariant(mtpgwp, block, MaxVrecLen(sample_ct, 2, mtpgwp->phase_dosage_gflags));
+    }
+
+    /**
+     * Stage one unphased biallelic variant given as a difflist. See MTWriterAppend, and
+     * SpgwAppendBiallelicDifflistLimited for the parameters (difflist_sample_ids must include the sample_ct
+     * terminator).
+     */
+    void MTWriterAppendDifflist(
+            PgenMTWriter *mtpgwp,
+            const uintptr_t *raregeno,
+            const uint32_t *difflist_sample_ids,
+            const uint32_t difflist_common_geno,
+            const uint32_t difflist_len) {
+        PgenMTBlock &block = BeginStagedVariant(mtpgwp);
+        std::vector<uintptr_t> &records = block.records;
+        records.push_back(2); // allele_ct
+        records.push_back(0); // patch_01_ct
+        records.push_back(0); // patch_10_ct
+        records.push_back(difflist_len);
+        records.push_back(kStagedDifflist);
+        records.push_back(difflist_common_geno);
+        StageWords(records, raregeno, plink2::NypCtToWordCt(difflist_len) * plink2::kBytesPerWord);
+        StageWords(records, difflist_sample_ids, (difflist_len + 1) * sizeof(uint32_t));
+        EndStagedVariant(mtpgwp, block, MaxVrecLen(mtpgwp->sample_ct, 2, mtpgwp->phase_dosage_gflags));
+    }
+
+    uint32_t MTWriterGetVariantCt(const PgenMTWriter *mtpgwp) {
+        return mtpgwp->variant_ct;
+    }
+
+    uint32_t MTWriterGetVidx(const PgenMTWriter *mtpgwp) {
+        return mtpgwp->vidx;
+    }
+
+    /**
+     * Compress any remaining staged variants, write them, and finish the pgen file (write the header/index).
+     * Must only be called if at least one variant has been staged.
+     */
+    void MTWriterFinish(PgenMTWriter *mtpgwp) {
+        const uint32_t vidx = mtpgwp->vidx;
+        const uint32_t last_tidx = ((vidx - 1) / plink2::kPglVblockSize) % mtpgwp->thread_ct;
+        if (mtpgwp->blocks[last_tidx].variant_ct != 0) {
+            // the final block is partial, and its last chunk hasn't been dispatched yet
+            DispatchChunk(mtpgwp, last_tidx);
+        }
+        JoinAllBlocks(mtpgwp);
+        if (vidx != mtpgwp->variant_ct) {
+            if (mtpgwp->write_mode == plink2::kPgenWriteBackwardSeek) {
+                // the header was sized for the declared variant count
+                char errMessageBuff[kErrMessageBufSize];
+                snprintf(errMessageBuff,
+                         kErrMessageBufSize,
+                         "The number of variants written (%u) must match the declared variant count (%u) when using pgenWriteMode kPgenWriteBackwardSeek",
+                         vidx,
+                         mtpgwp->variant_ct);
+                throw PgenException(errMessageBuff);
+            }
+            MpgwSetFinalVariantCt(mtpgwp->mpgwp, vidx);
+        }
+        throwOnPglErr(plink2::MpgwFlush(mtpgwp->mpgwp), "Error closing pgen file: MpgwFlush");
+        mtpgwp->flush_pending = false;
+    }
+
+    /**
+     * Wait for any running worker threads, close any open files and free all memory associated with mtpgwp.
+     * mtpgwp is no longer valid after this call.
+     */
+    void CleanupPgenMTWriter(PgenMTWriter *mtpgwp) {
+        if (mtpgwp->blocks != nullptr) {
+            for (uint32_t tidx = 0; tidx != mtpgwp->thread_ct; ++tidx) {
+                PgenMTBlock &block = mtpgwp->blocks[tidx];
+                if (block.worker.joinable()) {
+                    block.worker.join();
+                }
+                plink2::aligned_free_cond(block.fwrite_buf);
+                plink2::aligned_free_cond(block.scratch_alloc);
+            }
+            delete[] mtpgwp->blocks;
+        }
+        if (mtpgwp->mpgwp != nullptr) {
+            plink2::PglErr cleanupErr = plink2::kPglRetSuccess;
+            plink2::CleanupMpgw(mtpgwp->mpgwp, &cleanupErr);
+            free(mtpgwp->mpgwp);
+        }
+        plink2::aligned_free_cond(mtpgwp->mpgw_alloc);
+        delete mtpgwp;
+    }
+
+    // Mirrors the max_vrec_len computation in plink2::SpgwInitPhase1. Used both to choose the record length width
+    // for the file, and to bound the compressed size of a block of staged variants.
+    uint64_t MaxVrecLen(const uint32_t sample_ct, const uint32_t allele_ct,
+                        const plink2::PgenGlobalFlags phase_dosage_gflags) {
+        uint64_t max_vrec_len = plink2::NypCtToByteCt(sample_ct);
+        if (allele_ct > 2) {
+            max_vrec_len += 2 + sizeof(plink2::AlleleCode) + (sample_ct + 6) / 8 +
+                            plink2::GetAux1bAlleleEntryByteCt(allele_ct, sample_ct - 1);
+        }
+        if (phase_dosage_gflags & plink2::kfPgenGlobalHardcallPhasePresent) {
+            max_vrec_len += 2 * plink2::DivUp(sample_ct, CHAR_BIT);
+        }
+        if (phase_dosage_gflags & plink2::kfPgenGlobalDosagePresent) {
+            const uint32_t dphase_gflag = (phase_dosage_gflags / plink2::kfPgenGlobalDosagePhasePresent) & 1;
+            max_vrec_len += (1 + dphase_gflag) * plink2::DivUp(sample_ct, 8);
+            max_vrec_len += (2 + 2 * dphase_gflag) * static_cast<uint64_t>(sample_ct);
+        }
+        return std::min(max_vrec_len, static_cast<uint64_t>(plink2::kPglMaxBytesPerVariant));
+    }
+
+    // Return the block that the next variant is staged into.
+    PgenMTBlock &BeginStagedVariant(PgenMTWriter *mtpgwp) {
+        if (mtpgwp->vidx == mtpgwp->variant_ct) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Attempt to write more variants than the declared variant count (%u)",
+                     mtpgwp->variant_ct);
+            throw PgenException(errMessageBuff);
+        }
+        return mtpgwp->blocks[(mtpgwp->vidx / plink2::kPglVblockSize) % mtpgwp->thread_ct];
+    }
+
+    // Account for a variant that has just been staged into block, and dispatch the staged chunk if it's full, or if
+    // the block is.
+    void EndStagedVariant(PgenMTWriter *mtpgwp, PgenMTBlock &block, const uint64_t max_byte_ct) {
+        block.max_byte_ct += max_byte_ct;
+        ++block.variant_ct;
+        ++block.block_variant_ct;
+        ++mtpgwp->vidx;
+        const bool block_full = block.block_variant_ct == plink2::kPglVblockSize;
+        if (block_full || (block.records.size() * plink2::kBytesPerWord >= mtpgwp->max_staged_chunk_bytes)) {
+            DispatchChunk(mtpgwp, static_cast<uint32_t>(&block - mtpgwp->blocks));
+            if (block_full) {
+                block.block_variant_ct = 0;
+            }
+        }
+    }
+
+    void StageWords(std::vector<uintptr_t> &records, const void *src, const uintptr_t byte_ct) {
+        const uintptr_t start = records.size();
+        records.resize(start + plink2::DivUp(byte_ct, plink2::kBytesPerWord));
+        memcpy(&(records[start]), src, byte_ct);
+    }
+
+    // Runs on a worker thread: compress the pending chunk of *blockp, appending to pwcp's write buffer.
+    void CompressBlock(plink2::PgenWriterCommon *pwcp, PgenMTBlock *blockp, const uint32_t sample_ct) {
+        const uintptr_t genovec_word_ct = plink2::NypCtToWordCt(sample_ct);
+        const uintptr_t bitvec_word_ct = plink2::BitCtToWordCt(sample_ct);
+        const uintptr_t *records_iter = blockp->pending.data();
+        for (uint32_t variant_idx = 0; variant_idx != blockp->pending_variant_ct; ++variant_idx) {
+            const uint32_t allele_ct = static_cast<uint32_t>(records_iter[0]);
+            const uint32_t patch_01_ct = static_cast<uint32_t>(records_iter[1]);
+            const uint32_t patch_10_ct = static_cast<uint32_t>(records_iter[2]);
+            const uint32_t dosage_ct = static_cast<uint32_t>(records_iter[3]);
+            const uintptr_t staged_flags = records_iter[4];
+            records_iter = &(records_iter[kStagedHeaderWordCt]);
+
+            if (staged_flags & kStagedDifflist) {
+                const uint32_t difflist_len = dosage_ct;
+                const uint32_t difflist_common_geno = static_cast<uint32_t>(records_iter[0]);
+                records_iter = &(records_iter[1]);
+                const uintptr_t raregeno_word_ct = plink2::NypCtToWordCt(difflist_len);
+                memcpy(blockp->raregeno, records_iter, raregeno_word_ct * plink2::kBytesPerWord);
+                records_iter = &(records_iter[raregeno_word_ct]);
+                const uintptr_t sample_ids_byte_ct = (difflist_len + 1) * sizeof(uint32_t);
+                memcpy(blockp->difflist_sample_ids, records_iter, sample_ids_byte_ct);
+                records_iter = &(records_iter[plink2::DivUp(sample_ids_byte_ct, plink2::kBytesPerWord)]);
+                plink2::PwcAppendBiallelicDifflistLimited(
+                        blockp->raregeno, blockp->difflist_sample_ids, difflist_common_geno, difflist_len, pwcp);
+                continue;
+            }
+            memcpy(blockp->genovec, records_iter, genovec_word_ct * plink2::kBytesPerWord);
+            records_iter = &(records_iter[genovec_word_ct]);
+            if (staged_flags & kStagedDosage) {
+                memcpy(blockp->dosage_present, records_iter, bitvec_word_ct * plink2::kBytesPerWord);
+                records_iter = &(records_iter[bitvec_word_ct]);
+                const uintptr_t dosage_main_byte_ct = dosage_ct * sizeof(uint16_t);
+                memcpy(blockp->dosage_main, records_iter, dosage_main_byte_ct);
+                records_iter = &(records_iter[plink2::DivUp(dosage_main_byte_ct, plink2::kBytesPerWord)]);
+                if (plink2::PwcAppendBiallelicGenovecDosage16(
+                        blockp->genovec, blockp->dosage_present, blockp->dosage_main, dosage_ct, pwcp)) {
+                    blockp->reterr = plink2::kPglRetVarRecordTooLarge;
+                    return;
+                }
+                continue;
+            }
+            const uintptr_t *phasepresent = nullptr;
+            if (staged_flags & kStagedPhasepresent) {
+                memcpy(blockp->phasepresent, records_iter, bitvec_word_ct * plink2::kBytesPerWord);
+                records_iter = &(records_iter[bitvec_word_ct]);
+                phasepresent = blockp->phasepresent;
+            }
+            if (staged_flags & kStagedPhaseinfo) {
+                memcpy(blockp->phaseinfo, records_iter, bitvec_word_ct * plink2::kBytesPerWord);
+                records_iter = &(records_iter[bitvec_word_ct]);
+            }
+
+            if ((patch_01_ct == 0) && (patch_10_ct == 0)) {
+                if (staged_flags & kStagedPhaseinfo) {
+                    plink2::PwcAppendBiallelicGenovecHphase(blockp->genovec, phasepresent, blockp->phaseinfo, pwcp);
+                } else {
+                    plink2::PwcAppendBiallelicGenovec(blockp->genovec, pwcp);
+                }
+                continue;
+            }
+
+            memcpy(blockp->patch_01_set, records_iter, bitvec_word_ct * plink2::kBytesPerWord);
+            records_iter = &(records_iter[bitvec_word_ct]);
+            const uintptr_t patch_01_vals_byte_ct = patch_01_ct * sizeof(plink2::AlleleCode);
+            memcpy(blockp->patch_01_vals, records_iter, patch_01_vals_byte_ct);
+            records_iter = &(records_iter[plink2::DivUp(patch_01_vals_byte_ct, plink2::kBytesPerWord)]);
+            memcpy(blockp->patch_10_set, records_iter, bitvec_word_ct * plink2::kBytesPerWord);
+            records_iter = &(records_iter[bitvec_word_ct]);
+            const uintptr_t patch_10_vals_byte_ct = patch_10_ct * 2 * sizeof(plink2::AlleleCode);
+            memcpy(blockp->patch_10_vals, records_iter, patch_10_vals_byte_ct);
+            records_iter = &(records_iter[plink2::DivUp(patch_10_vals_byte_ct, plink2::kBytesPerWord)]);
+
+            plink2::BoolErr bErr;
+            if (staged_flags & kStagedPhaseinfo) {
+                bErr = plink2::PwcAppendMultiallelicGenovecHphase(
+                        blockp->genovec,
+                        blockp->patch_01_set,
+                        blockp->patch_01_vals,
+                        blockp->patch_10_set,
+                        blockp->patch_10_vals,
+                        phasepresent,
+                        blockp->phaseinfo,
+                        allele_ct,
+                        patch_01_ct,
+                        patch_10_ct,
+                        pwcp);
+            } else {
+                bErr = plink2::PwcAppendMultiallelicSparse(
+                        blockp->genovec,
+                        blockp->patch_01_set,
+                        blockp->patch_01_vals,
+                        blockp->patch_10_set,
+                        blockp->patch_10_vals,
+                        allele_ct,
+                        patch_01_ct,
+                        patch_10_ct,
+                        pwcp);
+            }
+            if (bErr) {
+                blockp->reterr = plink2::kPglRetVarRecordTooLarge;
+                return;
+            }
+        }
+    }
+
+    // Hand the staged chunk for thread tidx to a worker thread for compression, once the worker has finished
+    // compressing the thread's previous chunk.
+    void DispatchChunk(PgenMTWriter *mtpgwp, const uint32_t tidx) {
+        PgenMTBlock &block = mtpgwp->blocks[tidx];
+        // the staged chunk starts a block if every variant assigned to the block so far is in it
+        const bool block_start = block.variant_ct == block.block_variant_ct;
+        if (block_start && (tidx == 0) && mtpgwp->flush_pending) {
+            // starting a new round of blocks; the previous round has to be compressed and written first, since
+            // MpgwFlush advances each thread to its block in the next round
+            JoinAllBlocks(mtpgwp);
+            throwOnPglErr(plink2::MpgwFlush(mtpgwp->mpgwp), "Error writing pgen file: MpgwFlush");
+            mtpgwp->flush_pending = false;
+        }
+        if (block.worker.joinable()) {
+            JoinBlock(block);
+        }
+
+        plink2::PgenWriterCommon *pwcp = mtpgwp->mpgwp->pwcs[tidx];
+        const uint64_t fwrite_used_byte_ct = block_start ? 0 : PwcGetFwriteByteCt(pwcp);
+        // allow for the same slop that SpgwInitPhase2 allows for in the single threaded write buffer
+        const uint64_t fwrite_byte_ct = fwrite_used_byte_ct + block.max_byte_ct +
+                (5 + sizeof(plink2::AlleleCode)) * plink2::kPglDifflistGroupSize;
+        if (fwrite_byte_ct > block.fwrite_buf_byte_ct) {
+            // grow geometrically, since a large block may be compressed over many chunks
+            const uint64_t new_byte_ct = plink2::RoundUpPow2(
+                    std::max(fwrite_byte_ct, 2 * block.fwrite_buf_byte_ct), plink2::kCacheline);
+            unsigned char *new_fwrite_buf;
+            if (plink2::cachealigned_malloc(new_byte_ct, &new_fwrite_buf)) {
+                throw PgenException("Native code failure (cachealigned_malloc) allocating pgen vblock write buffer");
+            }
+            if (fwrite_used_byte_ct != 0) {
+                memcpy(new_fwrite_buf, block.fwrite_buf, fwrite_used_byte_ct);
+            }
+            plink2::aligned_free_cond(block.fwrite_buf);
+            block.fwrite_buf = new_fwrite_buf;
+            block.fwrite_buf_byte_ct = new_byte_ct;
+        }
+        PwcSetFwriteBuf(pwcp, block.fwrite_buf, fwrite_used_byte_ct);
+
+        block.pending.swap(block.records);
+        block.pending_variant_ct = block.variant_ct;
+        block.records.clear();
+        block.variant_ct = 0;
+        block.max_byte_ct = 0;
+        block.reterr = plink2::kPglRetSuccess;
+        try {
+            block.worker = std::thread(CompressBlock, pwcp, &block, mtpgwp->sample_ct);
+        } catch (const std::system_error &) {
+            throwOnPglErr(plink2::kPglRetThreadCreateFail, "Error starting pgen writer thread");
+        }
+        mtpgwp->flush_pending = true;
+    }
+
+    // Wait for the worker for this block, and release its chunk so it can be reused for staging.
+    void JoinBlock(PgenMTBlock &block) {
+        block.worker.join();
+        block.pending.clear();
+        block.pending_variant_ct = 0;
+        throwOnPglErr(block.reterr, "Error compressing pgen variant block");
+    }
+
+    void JoinAllBlocks(PgenMTWriter *mtpgwp) {
+        // join every thread before propagating an error from any of them
+        plink2::PglErr reterr = plink2::kPglRetSuccess;
+        for (uint32_t tidx = 0; tidx != mtpgwp->thread_ct; ++tidx) {
+            PgenMTBlock &block = mtpgwp->blocks[tidx];
+            if (block.worker.joinable()) {
+                block.worker.join();
+                block.pending.clear();
+                block.pending_variant_ct = 0;
+                if (block.reterr && !reterr) {
+                    reterr = block.reterr;
+                }
+            }
+        }
+        throwOnPglErr(reterr, "Error compressing pgen variant block");
+    }
+
+}
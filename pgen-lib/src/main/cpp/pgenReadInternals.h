@@ -0,0 +1,63 @@
+//
+
+#ifndef PGEN_LIB_PGENREADINTERNALS_H
+#define PGEN_LIB_PGENREADINTERNALS_H
+
+#include "pgenlib_read.h"
+
+// Private (not part of the public API) declarations of plink2 pgen reader internals. The variant record parsers (and
+// helpers) used by PgrValidate and the record copier have external linkage in pgenlib_read.cc, but aren't declared in
+// pgenlib_read.h, so their signatures must be re-verified when pgenlib is updated.
+namespace pgenlib {
+
+    // the vendored pgenlib version that the declarations below were verified against
+    constexpr uint32_t kReadInternalsPgenlibVernum = 1908;
+    static_assert(PGENLIB_INTERNAL_VERNUM == kReadInternalsPgenlibVernum,
+                  "the vendored pgenlib has changed; re-verify the declarations in pgenReadInternals.h");
+
+}
+
+namespace plink2 {
+    uint32_t CountNyp(const void *nyparr, uintptr_t nyp_word, uint32_t nyp_ct);
+    BoolErr InitReadPtrs(
+            uint32_t vidx,
+            PgenReaderMain *pgrp,
+            const unsigned char **fread_pp,
+            const unsigned char **fread_endp);
+    PglErr ReadRawGenovec(
+            uint32_t subsetting_required,
+            uint32_t vidx,
+            PgenReaderMain *pgrp,
+            const unsigned char **fread_pp,
+            const unsigned char **fread_endp,
+            uintptr_t *raw_genovec);
+    BoolErr ValidateGeno(
+            const unsigned char *fread_end,
+            uint32_t vidx,
+            PgenReaderMain *pgrp,
+            const unsigned char **fread_pp,
+            uintptr_t *genovec,
+            char *errstr_buf);
+    BoolErr ValidateMultiallelicHc(
+            const unsigned char *fread_end,
+            const uintptr_t *__restrict raw_genovec,
+            uint32_t vidx,
+            uint32_t allele_ct,
+            PgenReaderMain *pgrp,
+            const unsigned char **fread_pp,
+            uint32_t *__restrict het_ctp,
+            char *__restrict errstr_buf);
+    BoolErr ValidateHphase(
+            const unsigned char *fread_end,
+            uint32_t vidx,
+            uint32_t het_ct,
+            const unsigned char **fread_pp,
+            char *errstr_buf);
+    PglErr ValidateDosage16(
+            const unsigned char *fread_end,
+            uint32_t vidx,
+            PgenReaderMain *pgrp,
+            const unsigned char **fread_pp,
+            char *errstr_buf);
+}
+#endif //PGEN_LIB_PGENREADINTERNALS_H
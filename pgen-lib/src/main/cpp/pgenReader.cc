@@ -0,0 +1,765 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pgenException.h"
+#include "pgenUtils.h"
+#include "pgenReader.h"
+#include "pgenReaderContext.h"
+#include "pgenlib_ffi_support.h"
+#include "pgenlib_read.h"
+
+namespace pgenlib {
+    static const int kErrMessageBufSize = 1024;
+    // the value Dosage16ToFloatsMinus9 uses for a missing dosage
+    static const float kMissingDosage = -9.0f;
+
+    static void InitPgenReaderContext(
+            PgenReaderContext *const pReaderContext,
+            const char *cFilename,
+            const char *cPgiFilename,
+            const int32_t *alleleCounts,
+            const long alleleCountsLength,
+            const uint32_t readFlags,
+            const int32_t *sampleIndices,
+            const long sampleIndicesLength);
+
+    static void InitSampleSubset(
+            PgenReaderContext *const pReaderContext,
+            const int32_t *sampleIndices,
+            const long sampleIndicesLength);
+
+    static void MapPgenFile(PgenReaderContext *const pReaderContext, const char *cFilename);
+
+    static uint32_t DecodeDosages(PgenReaderContext *const pReaderContext, const uint32_t variantIndex);
+
+    static void ThrowNoDosagesToImpute(const uint32_t variantIndex);
+
+    static void ThrowOnPglErrWithErrstr(const plink2::PglErr pglErr, const char *errstr_buf, const char *message);
+
+    static void AbandonPgenReaderContext(PgenReaderContext *const pReaderContext);
+
+    /**
+     * Open a PGEN file for reading, and return a pointer to a PgenReaderContext for the reader.
+     *
+     * The reader decodes one variant at a time (PgrGetMP), either fread'ing each variant record, or decoding it in
+     * place from a memory mapped .pgen (see kReadFlagMemoryMap), and can be used to read the variants in any order.
+     * An example PGEN reader lifecycle is illustrated here:
+     *
+     *      pgenlib::PgenReaderContext *const reader_context = pgenlib::OpenPgenReader(file_name);
+     *      const uint32_t n_variants = pgenlib::GetReaderVariantCount(reader_context);
+     *      const uint32_t n_samples = pgenlib::GetReaderSampleCount(reader_context);
+     *      std::vector<int32_t> allele_codes(n_samples * 2);
+     *      std::vector<unsigned char> phase_bytes(n_samples);
+     *
+     *      for (uint32_t i = 0; i < n_variants; i++) {
+     *          pgenlib::ReadAlleles(reader_context, i, allele_codes.data(), phase_bytes.data());
+     *      }
+     *      pgenlib::ClosePgenReader(reader_context);
+     *
+     * plink2 doesn't store allele counts in the .pgen (they're implied by the ALT column of the .pvar), so a PGEN
+     * that contains multi-allelic variants can only be read if the allele counts for all variants are provided.
+     *
+     * @param cFilename - the pgen file to read
+     * @param cPgiFilename - the .pgen.pgi index file, for a pgen written with a separate index. may be null, in which
+     * case the .pgi name is the pgen file name with .pgi appended. ignored if the pgen doesn't have a separate index.
+     * @param alleleCounts - the number of alleles (including the reference allele) of each variant in the pgen, in
+     * the range 2..plink2::kPglMaxAlleleCt. may be null, in which case every variant is assumed to be biallelic,
+     * and an exception is thrown if a multi-allelic variant is read.
+     * @param alleleCountsLength - the number of entries in alleleCounts. must match the number of variants in the
+     * pgen if alleleCounts is not null.
+     * @param readFlags - unsigned integer bitwise read flags, with valid values drawn from {kReadFlagMemoryMap}. With
+     * kReadFlagMemoryMap, the .pgen is mapped into memory and each variant record is decoded in place (using the
+     * plink2 block-load mode with the whole file as the block), so a random variant fetch costs at most a page
+     * fault rather than a seek and a read. Otherwise, each record is fread into a per-reader buffer.
+     * @param sampleIndices - the (zero based) indices of the samples to read, in strictly increasing order. may be
+     * null, in which case all samples are read. When provided, genotypes are subset during decoding, and the per
+     * variant outputs of the reader hold only these samples (see GetReaderSampleCount), in pgen order.
+     * @param sampleIndicesLength - the number of entries in sampleIndices
+     *
+     * @return a PgenReaderContext
+     */
+    PgenReaderContext *OpenPgenReader(
+            const char *cFilename,
+            const char *cPgiFilename,
+            const int32_t *alleleCounts,
+            const long alleleCountsLength,
+            const uint32_t readFlags,
+            const int32_t *sampleIndices,
+            const long sampleIndicesLength) {
+        // zero the context, so a partially initialized context can always be released by AbandonPgenReaderContext
+        PgenReaderContext *pReaderContext = static_cast<PgenReaderContext *>(calloc(1, sizeof(PgenReaderContext)));
+        if (pReaderContext == nullptr) {
+            throw PgenException("Native code failure allocating PgenReaderContext");
+        }
+        pReaderContext->pgfip = static_cast<plink2::PgenFileInfo *>(malloc(sizeof(plink2::PgenFileInfo)));
+        pReaderContext->pgrp = static_cast<plink2::PgenReader *>(malloc(sizeof(plink2::PgenReader)));
+        if ((pReaderContext->pgfip == nullptr) || (pReaderContext->pgrp == nullptr)) {
+            AbandonPgenReaderContext(pReaderContext);
+            throw PgenException("Native code failure allocating PgenFileInfo/PgenReader");
+        }
+        plink2::PreinitPgfi(pReaderContext->pgfip);
+        plink2::PreinitPgr(pReaderContext->pgrp);
+        try {
+            InitPgenReaderContext(
+                    pReaderContext,
+                    cFilename,
+                    cPgiFilename,
+                    alleleCounts,
+                    alleleCountsLength,
+                    readFlags,
+                    sampleIndices,
+                    sampleIndicesLength);
+        } catch (const PgenException &) {
+            AbandonPgenReaderContext(pReaderContext);
+            throw;
+        }
+        return pReaderContext;
+    }
+
+    static void InitPgenReaderContext(
+            PgenReaderContext *const pReaderContext,
+            const char *cFilename,
+            const char *cPgiFilename,
+            const int32_t *alleleCounts,
+            const long alleleCountsLength,
+            const uint32_t readFlags,
+            const int32_t *sampleIndices,
+            const long sampleIndicesLength) {
+        char errstr_buf[plink2::kPglErrstrBufBlen];
+        errstr_buf[0] = '\0';
+        plink2::PgenFileInfo *const pgfip = pReaderContext->pgfip;
+
+        // the variant and sample counts are read from the pgen header
+        plink2::PgenHeaderCtrl header_ctrl;
+        uintptr_t pgfi_alloc_cacheline_ct;
+        ThrowOnPglErrWithErrstr(
+                plink2::PgfiInitPhase1(
+                        cFilename,
+                        cPgiFilename,
+                        UINT32_MAX,
+                        UINT32_MAX,
+                        &header_ctrl,
+                        pgfip,
+                        &pgfi_alloc_cacheline_ct,
+                        errstr_buf),
+                errstr_buf,
+                "plink2 initialization (PgfiInitPhase1 failed)");
+        pReaderContext->raw_variant_ct = pgfip->raw_variant_ct;
+        pReaderContext->raw_sample_ct = pgfip->raw_sample_ct;
+        pReaderContext->sample_ct = pgfip->raw_sample_ct;
+        const uint32_t raw_variant_ct = pReaderContext->raw_variant_ct;
+
+        if (plink2::cachealigned_malloc(pgfi_alloc_cacheline_ct * plink2::kCacheline, &pReaderContext->pgfi_alloc)) {
+            throw PgenException("Native code failure (cachealigned_malloc) allocating pgfi_alloc");
+        }
+
+        if (alleleCounts != nullptr) {
+            if (alleleCountsLength != static_cast<long>(raw_variant_ct)) {
+                char errMessageBuff[kErrMessageBufSize];
+                snprintf(errMessageBuff,
+                         kErrMessageBufSize,
+                         "The number of allele counts provided (%ld) doesn't match the number of variants in the pgen (%u)",
+                         alleleCountsLength,
+                         raw_variant_ct);
+                throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+            }
+            pReaderContext->allele_idx_offsets =
+                    static_cast<uintptr_t *>(malloc((raw_variant_ct + 1) * sizeof(uintptr_t)));
+            if (pReaderContext->allele_idx_offsets == nullptr) {
+                throw PgenException("Native code failure allocating allele_idx_offsets");
+            }
+            uintptr_t allele_idx_offset = 0;
+            uint32_t max_allele_ct = 2;
+            for (uint32_t vidx = 0; vidx < raw_variant_ct; vidx++) {
+                const int32_t allele_ct = alleleCounts[vidx];
+                if ((allele_ct < 2) || (allele_ct > plink2::kPglMaxAlleleCt)) {
+                    char errMessageBuff[kErrMessageBufSize];
+                    snprintf(errMessageBuff,
+                             kErrMessageBufSize,
+                             "Invalid allele count (%d) for variant %u; allele counts must be in the range 2..%d",
+                             allele_ct,
+                             vidx,
+                             plink2::kPglMaxAlleleCt);
+                    throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+                }
+                pReaderContext->allele_idx_offsets[vidx] = allele_idx_offset;
+                allele_idx_offset += static_cast<uint32_t>(allele_ct);
+                if (static_cast<uint32_t>(allele_ct) > max_allele_ct) {
+                    max_allele_ct = static_cast<uint32_t>(allele_ct);
+                }
+            }
+            pReaderContext->allele_idx_offsets[raw_variant_ct] = allele_idx_offset;
+            pgfip->allele_idx_offsets = pReaderContext->allele_idx_offsets;
+            // plink2 expects the caller to set max_allele_ct when allele_idx_offsets is preloaded
+            pgfip->max_allele_ct = max_allele_ct;
+        } else if ((header_ctrl >> 4) & 3) {
+            // the allele counts are stored in the header, so let PgfiInitPhase2 load them
+            pReaderContext->allele_idx_offsets =
+                    static_cast<uintptr_t *>(malloc((raw_variant_ct + 1) * sizeof(uintptr_t)));
+            if (pReaderContext->allele_idx_offsets == nullptr) {
+                throw PgenException("Native code failure allocating allele_idx_offsets");
+            }
+            pgfip->allele_idx_offsets = pReaderContext->allele_idx_offsets;
+        }
+        pReaderContext->nonref_flags_storage = header_ctrl >> 6;
+        if (pReaderContext->nonref_flags_storage == 3) {
+            // explicit nonref flags are stored in the header, and PgfiInitPhase2 requires a place to load them
+            pReaderContext->nonref_flags =
+                    static_cast<uintptr_t *>(malloc(plink2::BitCtToWordCt(raw_variant_ct) * sizeof(uintptr_t)));
+            if (pReaderContext->nonref_flags == nullptr) {
+                throw PgenException("Native code failure allocating nonref_flags");
+            }
+            pgfip->nonref_flags = pReaderContext->nonref_flags;
+        }
+
+        const bool use_mmap = (readFlags & kReadFlagMemoryMap) != 0;
+        uint32_t max_vrec_width;
+        uintptr_t pgr_alloc_cacheline_ct;
+        ThrowOnPglErrWithErrstr(
+                plink2::PgfiInitPhase2(
+                        header_ctrl,
+                        alleleCounts != nullptr, // allele counts already loaded
+                        0,  // nonref flags already loaded
+                        use_mmap,  // use_blockload (block mode over the mapped file, or single variant fread mode)
+                        0,  // vblock_idx_start
+                        raw_variant_ct,
+                        &max_vrec_width,
+                        pgfip,
+                        pReaderContext->pgfi_alloc,
+                        &pgr_alloc_cacheline_ct,
+                        errstr_buf),
+                errstr_buf,
+                "plink2 initialization (PgfiInitPhase2 failed)");
+
+        if (use_mmap) {
+            // the mapped file is the (one and only) block, so block offsets are file offsets. PgrInit requires the
+            // block base to be set, and a null file name, in block mode
+            MapPgenFile(pReaderContext, cFilename);
+            pgfip->block_base = pReaderContext->mmap_base;
+            pgfip->block_offset = 0;
+        }
+
+        pReaderContext->pgr_alloc_cacheline_ct = pgr_alloc_cacheline_ct;
+        pReaderContext->max_vrec_width = max_vrec_width;
+        pReaderContext->pgr_alloc = AllocPgenReaderArena(pReaderContext, &pReaderContext->pgv);
+        throwOnPglErr(
+                plink2::PgrInit(
+                        use_mmap ? nullptr : cFilename,
+                        max_vrec_width,
+                        pgfip,
+                        pReaderContext->pgrp,
+                        pReaderContext->pgr_alloc),
+                "plink2 initialization (PgrInit failed)");
+        plink2::PgrClearSampleSubsetIndex(pReaderContext->pgrp, &pReaderContext->pssi);
+        if (sampleIndices != nullptr) {
+            InitSampleSubset(pReaderContext, sampleIndices, sampleIndicesLength);
+        }
+
+        // keep a copy of the file name for readers (such as a PgenScan) that open the file themselves
+        pReaderContext->pgen_fname = strdup(cFilename);
+        if (pReaderContext->pgen_fname == nullptr) {
+            throw PgenException("Native code failure allocating pgen file name");
+        }
+    }
+
+    /**
+     * Allocate a plink2 reader arena (pgr_alloc) for the pgen. The arena also holds the PgenVariant decode buffers
+     * (genovec, patch_01/patch_10 sets and values, phasepresent and phaseinfo, dosage_present and dosage_main),
+     * which are assigned to pgvp. patch_01/patch_10 and the dosage buffers are always allocated (even if
+     * max_allele_ct == 2, or the pgen has no dosages), since they're cheap relative to the reader workspace. The caller owns the returned arena, and must release it with plink2::aligned_free.
+     */
+    unsigned char *AllocPgenReaderArena(const PgenReaderContext *const pReaderContext, plink2::PgenVariant *pgvp) {
+        const uint32_t raw_sample_ct = pReaderContext->raw_sample_ct;
+        const uintptr_t pgr_alloc_cacheline_ct = pReaderContext->pgr_alloc_cacheline_ct;
+        const uint32_t genovec_cacheline_ct = plink2::NypCtToCachelineCt(raw_sample_ct);
+        const uint32_t bitvec_cacheline_ct = plink2::BitCtToCachelineCt(raw_sample_ct);
+        const uint32_t patch_01_vals_cacheline_ct =
+                plink2::DivUp(raw_sample_ct * sizeof(plink2::AlleleCode), plink2::kCacheline);
+        const uint32_t patch_10_vals_cacheline_ct =
+                plink2::DivUp(raw_sample_ct * 2 * sizeof(plink2::AlleleCode), plink2::kCacheline);
+        const uint32_t dosage_main_cacheline_ct = plink2::DivUp(raw_sample_ct * sizeof(uint16_t), plink2::kCacheline);
+        unsigned char *pgr_alloc;
+        if (plink2::cachealigned_malloc(
+                (pgr_alloc_cacheline_ct + genovec_cacheline_ct + 5 * bitvec_cacheline_ct + patch_01_vals_cacheline_ct +
+                 patch_10_vals_cacheline_ct + dosage_main_cacheline_ct) * plink2::kCacheline,
+                &pgr_alloc)) {
+            throw PgenException("Native code failure (cachealigned_malloc) allocating pgr_alloc");
+        }
+
+        unsigned char *pgr_alloc_iter = &(pgr_alloc[pgr_alloc_cacheline_ct * plink2::kCacheline]);
+        pgvp->genovec = reinterpret_cast<uintptr_t *>(pgr_alloc_iter);
+        pgr_alloc_iter = &(pgr_alloc_iter[genovec_cacheline_ct * plink2::kCacheline]);
+        pgvp->patch_01_set = reinterpret_cast<uintptr_t *>(pgr_alloc_iter);
+        pgr_alloc_iter = &(pgr_alloc_iter[bitvec_cacheline_ct * plink2::kCacheline]);
+        pgvp->patch_01_vals = reinterpret_cast<plink2::AlleleCode *>(pgr_alloc_iter);
+        pgr_alloc_iter = &(pgr_alloc_iter[patch_01_vals_cacheline_ct * plink2::kCacheline]);
+        pgvp->patch_10_set = reinterpret_cast<uintptr_t *>(pgr_alloc_iter);
+        pgr_alloc_iter = &(pgr_alloc_iter[bitvec_cacheline_ct * plink2::kCacheline]);
+        pgvp->patch_10_vals = reinterpret_cast<plink2::AlleleCode *>(pgr_alloc_iter);
+        pgr_alloc_iter = &(pgr_alloc_iter[patch_10_vals_cacheline_ct * plink2::kCacheline]);
+        pgvp->phasepresent = reinterpret_cast<uintptr_t *>(pgr_alloc_iter);
+        pgr_alloc_iter = &(pgr_alloc_iter[bitvec_cacheline_ct * plink2::kCacheline]);
+        pgvp->phaseinfo = reinterpret_cast<uintptr_t *>(pgr_alloc_iter);
+        pgr_alloc_iter = &(pgr_alloc_iter[bitvec_cacheline_ct * plink2::kCacheline]);
+        pgvp->dosage_present = reinterpret_cast<uintptr_t *>(pgr_alloc_iter);
+        pgr_alloc_iter = &(pgr_alloc_iter[bitvec_cacheline_ct * plink2::kCacheline]);
+        pgvp->dosage_main = reinterpret_cast<uint16_t *>(pgr_alloc_iter);
+        return pgr_alloc;
+    }
+
+    /**
+     * Initialize a reader for a worker thread, with the pgen's sample subset. If fip has a block base (a memory
+     * mapped reader, or a caller that loads blocks itself), the reader is a block mode reader, otherwise it opens
+     * its own handle on the pgen file. A zeroed PgenThreadReader, including a partially initialized one, can always
+     * be released by CleanupThreadReader.
+     */
+    void InitThreadReader(
+            const PgenReaderContext *const pReaderContext,
+            plink2::PgenFileInfo *fip,
+            PgenThreadReader *pThreadReader) {
+        pThreadReader->pgrp = static_cast<plink2::PgenReader *>(malloc(sizeof(plink2::PgenReader)));
+        if (pThreadReader->pgrp == nullptr) {
+            throw PgenException("Native code failure allocating thread PgenReader");
+        }
+        plink2::PreinitPgr(pThreadReader->pgrp);
+        pThreadReader->pgr_alloc = AllocPgenReaderArena(pReaderContext, &pThreadReader->pgv);
+        const bool block_mode = fip->block_base != nullptr;
+        throwOnPglErr(
+                plink2::PgrInit(
+                        block_mode ? nullptr : pReaderContext->pgen_fname,
+                        pReaderContext->max_vrec_width,
+                        fip,
+                        pThreadReader->pgrp,
+                        pThreadReader->pgr_alloc),
+                "plink2 initialization (PgrInit failed for thread reader)");
+        if (pReaderContext->sample_include_cumulative_popcounts != nullptr) {
+            plink2::PgrSetSampleSubsetIndex(
+                    pReaderContext->sample_include_cumulative_popcounts, pThreadReader->pgrp, &pThreadReader->pssi);
+        } else {
+            plink2::PgrClearSampleSubsetIndex(pThreadReader->pgrp, &pThreadReader->pssi);
+        }
+    }
+
+    void CleanupThreadReader(PgenThreadReader *pThreadReader, plink2::PglErr *reterrp) {
+        if (pThreadReader->pgrp != nullptr) {
+            plink2::CleanupPgr(pThreadReader->pgrp, reterrp);
+            free(pThreadReader->pgrp);
+            pThreadReader->pgrp = nullptr;
+        }
+        plink2::aligned_free_cond(pThreadReader->pgr_alloc);
+        pThreadReader->pgr_alloc = nullptr;
+    }
+
+    uint32_t GetReaderVariantCount(const PgenReaderContext *const pReaderContext) {
+        return pReaderContext->raw_variant_ct;
+    }
+
+    // build the sample_include bitarray and its cumulative popcounts from the caller's sample indices. a subset
+    // that includes every sample is treated as no subset
+    static void InitSampleSubset(
+            PgenReaderContext *const pReaderContext,
+            const int32_t *sampleIndices,
+            const long sampleIndicesLength) {
+        const uint32_t raw_sample_ct = pReaderContext->raw_sample_ct;
+        if ((sampleIndicesLength < 1) || (sampleIndicesLength > static_cast<long>(raw_sample_ct))) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Invalid sample subset size (%ld); the subset must include between 1 and %u samples",
+                     sampleIndicesLength,
+                     raw_sample_ct);
+            throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+        }
+        for (long i = 0; i < sampleIndicesLength; i++) {
+            const int32_t sample_idx = sampleIndices[i];
+            if ((sample_idx < 0) || (sample_idx >= static_cast<int32_t>(raw_sample_ct))) {
+                char errMessageBuff[kErrMessageBufSize];
+                snprintf(errMessageBuff,
+                         kErrMessageBufSize,
+                         "Invalid sample index (%d) at position %ld; sample indices must be in the range 0..%u",
+                         sample_idx,
+                         i,
+                         raw_sample_ct - 1);
+                throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+            } else if ((i > 0) && (sample_idx <= sampleIndices[i - 1])) {
+                char errMessageBuff[kErrMessageBufSize];
+                snprintf(errMessageBuff,
+                         kErrMessageBufSize,
+                         "Sample indices must be in strictly increasing order, but %d follows %d at position %ld",
+                         sample_idx,
+                         sampleIndices[i - 1],
+                         i);
+                throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+            }
+        }
+        if (sampleIndicesLength == static_cast<long>(raw_sample_ct)) {
+            return;
+        }
+
+        // plink2 processes sample_include a vector at a time, so allocate and zero whole cachelines
+        const uint32_t raw_sample_ctl = plink2::BitCtToWordCt(raw_sample_ct);
+        const uintptr_t sample_include_bytes = plink2::BitCtToCachelineCt(raw_sample_ct) * plink2::kCacheline;
+        uintptr_t *sample_include;
+        if (plink2::cachealigned_malloc(sample_include_bytes, &sample_include)) {
+            throw PgenException("Native code failure (cachealigned_malloc) allocating sample_include");
+        }
+        pReaderContext->sample_include = sample_include;
+        memset(sample_include, 0, sample_include_bytes);
+        for (long i = 0; i < sampleIndicesLength; i++) {
+            plink2::SetBit(static_cast<uint32_t>(sampleIndices[i]), sample_include);
+        }
+        pReaderContext->sample_include_cumulative_popcounts =
+                static_cast<uint32_t *>(malloc(raw_sample_ctl * sizeof(uint32_t)));
+        if (pReaderContext->sample_include_cumulative_popcounts == nullptr) {
+            throw PgenException("Native code failure allocating sample_include_cumulative_popcounts");
+        }
+        plink2::FillCumulativePopcounts(sample_include, raw_sample_ctl, pReaderContext->sample_include_cumulative_popcounts);
+        const uint32_t raw_sample_ctv = plink2::BitCtToVecCt(raw_sample_ct);
+        if (plink2::cachealigned_malloc(
+                raw_sample_ctv * plink2::kBytesPerVec, &pReaderContext->sample_include_interleaved_vec)) {
+            throw PgenException("Native code failure (cachealigned_malloc) allocating sample_include_interleaved_vec");
+        }
+        plink2::FillInterleavedMaskVec(sample_include, raw_sample_ctv, pReaderContext->sample_include_interleaved_vec);
+        plink2::PgrSetSampleSubsetIndex(
+                pReaderContext->sample_include_cumulative_popcounts, pReaderContext->pgrp, &pReaderContext->pssi);
+        pReaderContext->sample_ct = static_cast<uint32_t>(sampleIndicesLength);
+    }
+
+    /**
+     * Return the number of samples decoded for each variant, which determines the size of the per variant outputs
+     * of the reader. This is the size of the sample subset if one was provided when the reader was opened, otherwise
+     * the number of samples in the pgen.
+     */
+    uint32_t GetReaderSampleCount(const PgenReaderContext *const pReaderContext) {
+        return pReaderContext->sample_ct;
+    }
+
+    /**
+     * Return the number of samples in the pgen, regardless of any sample subset.
+     */
+    uint32_t GetReaderRawSampleCount(const PgenReaderContext *const pReaderContext) {
+        return pReaderContext->raw_sample_ct;
+    }
+
+    /**
+     * Return the number of alleles (including the reference allele) for a variant. This is always 2 if no allele
+     * counts were provided when the reader was opened.
+     */
+    uint32_t GetReaderAlleleCount(const PgenReaderContext *const pReaderContext, const uint32_t variantIndex) {
+        if (variantIndex >= pReaderContext->raw_variant_ct) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Invalid variant index: %u. The pgen contains %u variants.",
+                     variantIndex,
+                     pReaderContext->raw_variant_ct);
+            throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+        }
+        const uintptr_t *allele_idx_offsets = pReaderContext->allele_idx_offsets;
+        if (allele_idx_offsets == nullptr) {
+            return 2;
+        }
+        return static_cast<uint32_t>(allele_idx_offsets[variantIndex + 1] - allele_idx_offsets[variantIndex]);
+    }
+
+    /**
+     * Return the total number of alleles of the variants before variantIndex, which may be the variant count. This
+     * is the offset of the variant's first allele in per allele outputs, such as those of ComputeAlleleCounts.
+     */
+    uint64_t GetReaderAlleleIndexOffset(const PgenReaderContext *const pReaderContext, const uint32_t variantIndex) {
+        if (variantIndex > pReaderContext->raw_variant_ct) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Invalid variant index: %u. The pgen contains %u variants.",
+                     variantIndex,
+                     pReaderContext->raw_variant_ct);
+            throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+        }
+        const uintptr_t *allele_idx_offsets = pReaderContext->allele_idx_offsets;
+        return allele_idx_offsets == nullptr ? 2 * static_cast<uint64_t>(variantIndex) : allele_idx_offsets[variantIndex];
+    }
+
+    /**
+     * Read one variant's worth of allele codes (genotypes) from a pgen file. This is the inverse of AppendAlleles.
+     * @param pReaderContext - the PgenReaderContext for the reader
+     * @param variantIndex - the (zero based) index of the variant to read
+     * @param allele_codes - receives two allele codes per sample (GetReaderSampleCount * 2 entries); missing genotypes
+     * are returned as a pair of -9 allele codes
+     * @param phase_bytes - receives one phase byte per sample (GetReaderSampleCount entries, may be null); 1 for a phased heterozygous genotype or
+     * a homozygous genotype, otherwise 0
+     * @return the number of alleles (including the reference allele) for the variant
+     */
+    uint32_t ReadAlleles(
+            PgenReaderContext *const pReaderContext,
+            const uint32_t variantIndex,
+            int32_t *allele_codes,
+            unsigned char *phase_bytes) {
+        const uint32_t allele_ct = RequireReadableVariant(pReaderContext, variantIndex);
+        throwOnPglErr(
+                DecodeAlleles(
+                        pReaderContext,
+                        pReaderContext->pgrp,
+                        pReaderContext->pssi,
+                        &pReaderContext->pgv,
+                        variantIndex,
+                        allele_codes,
+                        phase_bytes),
+                "Error reading variant from pgen file (PgrGetMP)");
+        return allele_ct;
+    }
+
+    /**
+     * Read the dosages of a range of variants from a pgen file, as floats. Each dosage is the ALT allele dosage (for
+     * a multi-allelic variant, the dosage of all non-reference alleles) of one sample, taken from the dosage track
+     * if the sample has a dosage, otherwise from its hardcall.
+     * @param pReaderContext - the PgenReaderContext for the reader
+     * @param variantStart - the (zero based) index of the first variant to read
+     * @param variantEnd - one past the index of the last variant to read
+     * @param dosageFlags - kDosageFlagMeanImpute to replace missing dosages with the mean dosage of the variant
+     * @param dosages - receives GetReaderSampleCount dosages for each variant, one variant after the other; missing
+     * dosages are returned as -9 unless they are mean imputed
+     */
+    void ReadDosages(
+            PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t dosageFlags,
+            float *dosages) {
+        RequireValidVariantRange(pReaderContext, variantStart, variantEnd);
+        const uint32_t sample_ct = pReaderContext->sample_ct;
+        if (sample_ct == 0) {
+            return;
+        }
+        const plink2::PgenVariant &pgv = pReaderContext->pgv;
+        for (uint32_t variantIndex = variantStart; variantIndex < variantEnd; variantIndex++) {
+            float *variant_dosages = &dosages[static_cast<uintptr_t>(variantIndex - variantStart) * sample_ct];
+            const uint32_t dosage_ct = DecodeDosages(pReaderContext, variantIndex);
+            plink2::Dosage16ToFloatsMinus9(
+                    pgv.genovec, pgv.dosage_present, pgv.dosage_main, sample_ct, dosage_ct, variant_dosages);
+            if (dosageFlags & kDosageFlagMeanImpute) {
+                // plink2 has no float version of Dosage16ToDoublesMeanimpute, so impute the converted dosages
+                double dosage_sum = 0.0;
+                uint32_t nonmissing_ct = 0;
+                for (uint32_t i = 0; i < sample_ct; i++) {
+                    if (variant_dosages[i] != kMissingDosage) {
+                        dosage_sum += variant_dosages[i];
+                        nonmissing_ct++;
+                    }
+                }
+                if (nonmissing_ct == 0) {
+                    ThrowNoDosagesToImpute(variantIndex);
+                }
+                if (nonmissing_ct != sample_ct) {
+                    const float mean_dosage = static_cast<float>(dosage_sum / nonmissing_ct);
+                    for (uint32_t i = 0; i < sample_ct; i++) {
+                        if (variant_dosages[i] == kMissingDosage) {
+                            variant_dosages[i] = mean_dosage;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * Read the dosages of a range of variants from a pgen file, as doubles. Identical to the float version of
+     * ReadDosages, except for the output type.
+     */
+    void ReadDosages(
+            PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t dosageFlags,
+            double *dosages) {
+        RequireValidVariantRange(pReaderContext, variantStart, variantEnd);
+        const uint32_t sample_ct = pReaderContext->sample_ct;
+        if (sample_ct == 0) {
+            return;
+        }
+        const plink2::PgenVariant &pgv = pReaderContext->pgv;
+        for (uint32_t variantIndex = variantStart; variantIndex < variantEnd; variantIndex++) {
+            double *variant_dosages = &dosages[static_cast<uintptr_t>(variantIndex - variantStart) * sample_ct];
+            const uint32_t dosage_ct = DecodeDosages(pReaderContext, variantIndex);
+            if (dosageFlags & kDosageFlagMeanImpute) {
+                // Dosage16ToDoublesMeanimpute counts genotypes a word at a time, so the trailing genovec bits must
+                // be zero
+                plink2::ZeroTrailingNyps(sample_ct, pgv.genovec);
+                if (plink2::Dosage16ToDoublesMeanimpute(
+                        pgv.genovec, pgv.dosage_present, pgv.dosage_main, sample_ct, dosage_ct, variant_dosages)) {
+                    ThrowNoDosagesToImpute(variantIndex);
+                }
+            } else {
+                plink2::Dosage16ToDoublesMinus9(
+                        pgv.genovec, pgv.dosage_present, pgv.dosage_main, sample_ct, dosage_ct, variant_dosages);
+            }
+        }
+    }
+
+    // throw if [variantStart, variantEnd) isn't a valid range of variants
+    void RequireValidVariantRange(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd) {
+        if ((variantStart > variantEnd) || (variantEnd > pReaderContext->raw_variant_ct)) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Invalid variant range: %u..%u. The pgen contains %u variants.",
+                     variantStart,
+                     variantEnd,
+                     pReaderContext->raw_variant_ct);
+            throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+        }
+    }
+
+    /**
+     * Throw if a variant can't be read; otherwise return its allele count. PgrGetMP requires allele counts to decode
+     * the multi-allelic part of a record, so a multi-allelic variant can't be read if no allele counts were provided
+     * when the reader was opened.
+     */
+    uint32_t RequireReadableVariant(const PgenReaderContext *const pReaderContext, const uint32_t variantIndex) {
+        const uint32_t allele_ct = GetReaderAlleleCount(pReaderContext, variantIndex);
+        if ((pReaderContext->allele_idx_offsets == nullptr) &&
+            plink2::VrtypeMultiallelicHc(plink2::GetPgfiVrtype(pReaderContext->pgfip, variantIndex))) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Variant %u is multi-allelic, but no allele counts were provided when the pgen reader was opened",
+                     variantIndex);
+            throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+        }
+        return allele_ct;
+    }
+
+    /**
+     * Decode one variant, which must be readable (see RequireReadableVariant), into allele codes and phase bytes,
+     * using the reader pgrp with its sample subset index pssi and decode buffers pgvp. The pgen's sample subset (if
+     * any) is applied. Doesn't throw, so it can be called on a worker thread.
+     */
+    plink2::PglErr DecodeAlleles(
+            const PgenReaderContext *const pReaderContext,
+            plink2::PgenReader *pgrp,
+            const plink2::PgrSampleSubsetIndex pssi,
+            plink2::PgenVariant *pgvp,
+            const uint32_t variantIndex,
+            int32_t *allele_codes,
+            unsigned char *phase_bytes) {
+        const uint32_t sample_ct = pReaderContext->sample_ct;
+        const plink2::PglErr reterr =
+                plink2::PgrGetMP(pReaderContext->sample_include, pssi, sample_ct, variantIndex, pgrp, pgvp);
+        if (reterr == plink2::kPglRetSuccess) {
+            plink2::GenoarrMPToAlleleCodesMinus9(pgvp, sample_ct, phase_bytes, allele_codes);
+        }
+        return reterr;
+    }
+
+    /**
+     * Decode the hardcalls and dosages of one variant into the reader's genovec, dosage_present and dosage_main
+     * buffers (PgrGetD), and return the number of samples with a dosage. The sample subset (if any) is applied.
+     */
+    static uint32_t DecodeDosages(PgenReaderContext *const pReaderContext, const uint32_t variantIndex) {
+        // a multi-allelic dosage record can only be parsed if its allele count is known
+        RequireReadableVariant(pReaderContext, variantIndex);
+        plink2::PgenVariant &pgv = pReaderContext->pgv;
+        uint32_t dosage_ct;
+        throwOnPglErr(
+                plink2::PgrGetD(
+                        pReaderContext->sample_include,
+                        pReaderContext->pssi,
+                        pReaderContext->sample_ct,
+                        variantIndex,
+                        pReaderContext->pgrp,
+                        pgv.genovec,
+                        pgv.dosage_present,
+                        pgv.dosage_main,
+                        &dosage_ct),
+                "Error reading variant dosages from pgen file (PgrGetD)");
+        return dosage_ct;
+    }
+
+    static void ThrowNoDosagesToImpute(const uint32_t variantIndex) {
+        char errMessageBuff[kErrMessageBufSize];
+        snprintf(errMessageBuff,
+                 kErrMessageBufSize,
+                 "Variant %u has no non-missing dosages, so its missing dosages can't be mean imputed",
+                 variantIndex);
+        throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+    }
+
+    // close the pgen and free pReaderContext, which is released even if this throws (so it must never be closed twice)
+    void ClosePgenReader(PgenReaderContext *const pReaderContext) {
+        plink2::PglErr reterr = plink2::kPglRetSuccess;
+        plink2::CleanupPgr(pReaderContext->pgrp, &reterr);
+        plink2::CleanupPgfi(pReaderContext->pgfip, &reterr);
+        AbandonPgenReaderContext(pReaderContext);
+        throwOnPglErr(reterr, "Error closing pgen file (CleanupPgr/CleanupPgfi)");
+    }
+
+    // map the entire .pgen read-only. the access pattern is assumed to be random, so readahead is disabled
+    static void MapPgenFile(PgenReaderContext *const pReaderContext, const char *cFilename) {
+        const int fd = open(cFilename, O_RDONLY);
+        if (fd == -1) {
+            throw PgenException("Native code failure opening pgen file for memory mapping");
+        }
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) == -1) {
+            close(fd);
+            throw PgenException("Native code failure getting the size of the pgen file for memory mapping");
+        }
+        const size_t file_size = static_cast<size_t>(file_stat.st_size);
+        void *const mmap_base = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // the mapping remains valid after the file is closed
+        close(fd);
+        if (mmap_base == MAP_FAILED) {
+            throw PgenException("Native code failure (mmap) memory mapping pgen file");
+        }
+        madvise(mmap_base, file_size, MADV_RANDOM);
+        pReaderContext->mmap_base = static_cast<unsigned char *>(mmap_base);
+        pReaderContext->mmap_size = file_size;
+    }
+
+    // plink2 reports most reader errors via errstr_buf (which includes a trailing newline), so prefer that to
+    // the bare PglErr name when it's available
+    static void ThrowOnPglErrWithErrstr(const plink2::PglErr pglErr, const char *errstr_buf, const char *message) {
+        if (pglErr && errstr_buf[0]) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff, kErrMessageBufSize, "%s: %s", message, errstr_buf);
+            const size_t message_len = strlen(errMessageBuff);
+            if (errMessageBuff[message_len - 1] == '\n') {
+                errMessageBuff[message_len - 1] = '\0';
+            }
+            throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+        }
+        throwOnPglErr(pglErr, message);
+    }
+
+    // release everything owned by the reader context, closing any files that are still open. used both when
+    // closing, and when the context can't be initialized
+    static void AbandonPgenReaderContext(PgenReaderContext *const pReaderContext) {
+        plink2::PglErr reterr = plink2::kPglRetSuccess;
+        if (pReaderContext->pgrp != nullptr) {
+            plink2::CleanupPgr(pReaderContext->pgrp, &reterr);
+            free(pReaderContext->pgrp);
+        }
+        if (pReaderContext->pgfip != nullptr) {
+            plink2::CleanupPgfi(pReaderContext->pgfip, &reterr);
+            free(pReaderContext->pgfip);
+        }
+        if (pReaderContext->mmap_base != nullptr) {
+            munmap(pReaderContext->mmap_base, pReaderContext->mmap_size);
+        }
+        plink2::aligned_free_cond(pReaderContext->sample_include);
+        free(pReaderContext->sample_include_cumulative_popcounts);
+        plink2::aligned_free_cond(pReaderContext->sample_include_interleaved_vec);
+        plink2::aligned_free_cond(pReaderContext->pgr_alloc);
+        plink2::aligned_free_cond(pReaderContext->pgfi_alloc);
+        free(pReaderContext->pgen_fname);
+        free(pReaderContext->allele_idx_offsets);
+        free(pReaderContext->nonref_flags);
+        free(pReaderContext);
+    }
+
+}
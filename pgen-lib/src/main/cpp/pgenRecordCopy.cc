@@ -0,0 +1,454 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "pgenException.h"
+#include "pgenUtils.h"
+#include "pgenReadInternals.h"
+#include "pgenRecordCopy.h"
+#include "pgenWriterInternals.h"
+
+namespace pgenlib {
+    static const int kErrMessageBufSize = 1024;
+
+    static_assert(plink2::kPglVblockSize == 65536, "AppendPgenRecords assumes 65536 variant vblocks");
+
+    // the file-scope accessor for the private plink2 reader state (see GET_PRIVATE in plink2_base.h); the private
+    // writer state is only accessed through pgenWriterInternals.h
+    static plink2::PgenReaderMain *GetPgrp(plink2::PgenReader *pgr_ptr) {
+        return &GET_PRIVATE(*pgr_ptr, m);
+    }
+
+    template <typename SourceVidxFn>
+    static void AppendRecords(
+            PgenRecordWriter *const pRecordWriter,
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t recordCount,
+            SourceVidxFn sourceVidx);
+    static void CopyRecordRun(
+            PgenRecordWriter *const pRecordWriter,
+            const PgenReaderContext *const pReaderContext,
+            FILE *ff,
+            const uint32_t runStart,
+            const uint32_t runEnd);
+    static void ReencodeRecord(
+            PgenRecordWriter *const pRecordWriter,
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t vidx);
+
+    /**
+     * Start writing a .pgen whose variant records are copied from other pgens (see AppendPgenRecords), and return a
+     * PgenRecordWriter for it.
+     *
+     * @param cFilename - the pgen file to write
+     * @param pgenWriteModeInt - the plink2::PgenWriteMode to write with (as for OpenPgen)
+     * @param variantCount - the number of variants that will be appended. must be exact for kPgenWriteBackwardSeek,
+     * and is otherwise an upper bound
+     * @param sampleCount - the number of samples in each variant record; every source pgen must have this many
+     * @param alleleCtUpperBound - the largest allele count of any variant (2 if every variant is biallelic). This
+     * bounds the length of the variant records the output can hold.
+     * @param phaseDosageGflags - the hardcall phase, dosage and dosage phase flags of the source pgens (a subset of
+     * plink2::PgenFileInfo::gflags), which determine the layout of the output index
+     * @param nonrefFlagsStorage - the nonref flag storage mode of the output header (0: none, 1: all ref, 2: all
+     * nonref, 3: explicit). For mode 3, the caller sets the flags in pRecordWriter->explicit_nonref_flags before the
+     * writer is closed.
+     * @return a PgenRecordWriter, which must be closed with ClosePgenRecordWriter, or abandoned with
+     * AbandonPgenRecordWriter
+     */
+    PgenRecordWriter *OpenPgenRecordWriter(
+            const char *cFilename,
+            const uint32_t pgenWriteModeInt,
+            const uint32_t variantCount,
+            const uint32_t sampleCount,
+            const uint32_t alleleCtUpperBound,
+            const plink2::PgenGlobalFlags phaseDosageGflags,
+            const uint32_t nonrefFlagsStorage) {
+        if (pgenWriteModeInt > plink2::kPgenWriteAndCopy) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff, kErrMessageBufSize, "Invalid pgen write mode: %u", pgenWriteModeInt);
+            throw PgenException(errMessageBuff); // PgenException makes a copy of errMessageBuff
+        }
+        if ((variantCount == 0) || (variantCount > plink2::kPglMaxVariantCt)) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Invalid variant count: %u. Variant count must be in the range 1..%u.",
+                     variantCount,
+                     plink2::kPglMaxVariantCt);
+            throw PgenException(errMessageBuff); // PgenException makes a copy of errMessageBuff
+        }
+        if (sampleCount == 0) {
+            throw PgenException("Invalid sample count: 0. At least 1 sample is required.");
+        }
+        if (nonrefFlagsStorage > 3) {
+            throw PgenException("Invalid nonref flag storage mode; must be in the range 0..3");
+        }
+
+        // zero the writer, so a partially initialized writer can always be released by AbandonPgenRecordWriter
+        PgenRecordWriter *pRecordWriter = static_cast<PgenRecordWriter *>(calloc(1, sizeof(PgenRecordWriter)));
+        if (pRecordWriter == nullptr) {
+            throw PgenException("Native code failure allocating PgenRecordWriter");
+        }
+        pRecordWriter->sample_ct = sampleCount;
+        pRecordWriter->write_mode = static_cast<plink2::PgenWriteMode>(pgenWriteModeInt);
+        try {
+            pRecordWriter->spgwp = static_cast<plink2::STPgenWriter *>(malloc(sizeof(plink2::STPgenWriter)));
+            if (pRecordWriter->spgwp == nullptr) {
+                throw PgenException("Native code failure allocating STPgenWriter");
+            }
+            plink2::PreinitSpgw(pRecordWriter->spgwp);
+            if (nonrefFlagsStorage == 3) {
+                // plink2 writes the last vblock's flags a byte at a time, so whole words are always enough
+                pRecordWriter->explicit_nonref_flags = static_cast<uintptr_t *>(
+                        calloc(plink2::BitCtToWordCt(variantCount), sizeof(uintptr_t)));
+                if (pRecordWriter->explicit_nonref_flags == nullptr) {
+                    throw PgenException("Native code failure allocating explicit_nonref_flags");
+                }
+            }
+            uintptr_t alloc_cacheline_ct;
+            throwOnPglErr(
+                    plink2::SpgwInitPhase1(
+                            cFilename,
+                            nullptr,  // allele index offsets (plink2 doesn't write them)
+                            pRecordWriter->explicit_nonref_flags,
+                            variantCount,
+                            sampleCount,
+                            std::max(alleleCtUpperBound, 2U),
+                            pRecordWriter->write_mode,
+                            phaseDosageGflags,
+                            nonrefFlagsStorage,
+                            pRecordWriter->spgwp,
+                            &alloc_cacheline_ct,
+                            &pRecordWriter->max_vrec_len),
+                    "plink2 initialization (SpgwInitPhase1 failed)");
+            const uint32_t genovec_cacheline_ct = plink2::NypCtToCachelineCt(sampleCount);
+            if (plink2::cachealigned_malloc(
+                    (alloc_cacheline_ct + genovec_cacheline_ct) * plink2::kCacheline,
+                    &pRecordWriter->spgw_alloc)) {
+                throw PgenException("Native code failure (cachealigned_malloc) allocating spgw_alloc");
+            }
+            plink2::SpgwInitPhase2(pRecordWriter->max_vrec_len, pRecordWriter->spgwp, pRecordWriter->spgw_alloc);
+            pRecordWriter->genovec = reinterpret_cast<uintptr_t *>(
+                    &pRecordWriter->spgw_alloc[alloc_cacheline_ct * plink2::kCacheline]);
+            // SpgwInitPhase2 sizes the fwrite buffer to hold a full write block plus the longest record (and a
+            // little slack, which isn't used here)
+            pRecordWriter->fwrite_buf_size = pRecordWriter->max_vrec_len + plink2::kPglFwriteBlockSize;
+        } catch (const PgenException &) {
+            AbandonPgenRecordWriter(pRecordWriter);
+            throw;
+        }
+        return pRecordWriter;
+    }
+
+    /**
+     * Append the variant records [variantStart, variantEnd) of a PGEN reader to the output, without decoding them.
+     *
+     * Runs of records are copied verbatim, in large blocks, with only their index entries rebuilt. An LD-compressed
+     * record is stored as a difference from the most recent record that isn't LD-compressed, so it's only copied
+     * verbatim when that record was also copied verbatim (in this call), and the record doesn't start an output
+     * vblock (where LD compression is prohibited). Otherwise, only its main (hardcall) track is decoded and
+     * re-encoded as a plain 2-bit genotype vector; the multiallelic, phase and dosage tracks are copied as they are,
+     * so allele counts aren't needed even for multiallelic records.
+     * @param pRecordWriter - the PgenRecordWriter for the output
+     * @param pReaderContext - the PgenReaderContext for the source pgen, which must have the same number of
+     * (unsubset) samples as the output
+     * @param variantStart - the index of the first variant record to append
+     * @param variantEnd - the index after the last variant record to append
+     */
+    void AppendPgenRecords(
+            PgenRecordWriter *const pRecordWriter,
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd) {
+        RequireValidVariantRange(pReaderContext, variantStart, variantEnd);
+        AppendRecords(
+                pRecordWriter,
+                pReaderContext,
+                variantEnd - variantStart,
+                [=](const uint32_t record_idx) { return variantStart + record_idx; });
+    }
+
+    /**
+     * Append the listed variant records of a PGEN reader to the output, without decoding them, as for
+     * AppendPgenRecords. Consecutive listed records are copied as a single run, and an LD-compressed record is also
+     * copied verbatim when the record it's based on is the most recent listed record that isn't LD-compressed (and
+     * was copied verbatim).
+     * @param variantIndices - the indices of the variant records to append, in strictly increasing order
+     * @param variantCount - the number of variant records to append
+     */
+    void AppendPgenRecordList(
+            PgenRecordWriter *const pRecordWriter,
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t *variantIndices,
+            const uint32_t variantCount) {
+        for (uint32_t record_idx = 0; record_idx != variantCount; ++record_idx) {
+            const uint32_t vidx = variantIndices[record_idx];
+            if ((vidx >= pReaderContext->raw_variant_ct) ||
+                ((record_idx != 0) && (vidx <= variantIndices[record_idx - 1]))) {
+                char errMessageBuff[kErrMessageBufSize];
+                snprintf(errMessageBuff,
+                         kErrMessageBufSize,
+                         "Invalid variant index %u at position %u. Variant indices must be strictly increasing, and less than the variant count (%u)",
+                         vidx,
+                         record_idx,
+                         pReaderContext->raw_variant_ct);
+                throw PgenException(errMessageBuff); // PgenException makes a copy of errMessageBuff
+            }
+        }
+        AppendRecords(
+                pRecordWriter,
+                pReaderContext,
+                variantCount,
+                [=](const uint32_t record_idx) { return variantIndices[record_idx]; });
+    }
+
+    // Whether every source record in (chainEnd, vidx) is LD-compressed, so that vidx is based on the same record as
+    // chainEnd.
+    static bool ContinuesLdChain(
+            const plink2::PgenFileInfo *const pgfip,
+            const uint32_t chainEnd,
+            const uint32_t vidx) {
+        for (uint32_t skipped_vidx = chainEnd + 1; skipped_vidx != vidx; ++skipped_vidx) {
+            if (!plink2::VrtypeLdCompressed(plink2::GetPgfiVrtype(pgfip, skipped_vidx))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Append recordCount source records, in increasing source order, where sourceVidx(i) is the source index of the
+    // i'th record.
+    template <typename SourceVidxFn>
+    static void AppendRecords(
+            PgenRecordWriter *const pRecordWriter,
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t recordCount,
+            SourceVidxFn sourceVidx) {
+        const plink2::PgenFileInfo *const pgfip = pReaderContext->pgfip;
+        if (pReaderContext->raw_sample_ct != pRecordWriter->sample_ct) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "The pgen %s has %u samples, but the output has %u",
+                     pReaderContext->pgen_fname,
+                     pReaderContext->raw_sample_ct,
+                     pRecordWriter->sample_ct);
+            throw PgenException(errMessageBuff); // PgenException makes a copy of errMessageBuff
+        }
+        if ((pgfip->const_vrtype != UINT32_MAX) && (pgfip->const_vrtype != 0)) {
+            // fixed-width 2-bit records are ordinary (type 0) records, but the other fixed-width formats aren't
+            throwOnPglErr(plink2::kPglRetNotYetSupported,
+                          "Copying records from fixed-width plink1 or dosage pgens is not implemented");
+        }
+        const uint32_t variant_ct_limit = SpgwGetVariantCtLimit(pRecordWriter->spgwp);
+        if (static_cast<uint64_t>(GetRecordWriterVariantCount(pRecordWriter)) + recordCount > variant_ct_limit) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Appending %u variant records would exceed the output variant count (%u)",
+                     recordCount,
+                     variant_ct_limit);
+            throw PgenException(errMessageBuff); // PgenException makes a copy of errMessageBuff
+        }
+
+        // the verbatim runs are read through a file of our own, so they don't disturb the reader, which is used to
+        // decode the records that are re-encoded; a memory mapped pgen is copied from directly
+        FILE *ff = nullptr;
+        if (pReaderContext->mmap_base == nullptr) {
+            ff = fopen(pReaderContext->pgen_fname, "rb");
+            if (ff == nullptr) {
+                throwOnPglErr(plink2::kPglRetOpenFail, "Error opening pgen file to copy variant records");
+            }
+        }
+        try {
+            // the most recent output record that isn't LD-compressed is a verbatim copy of source record
+            // ldbase_vidx (UINT32_MAX if it isn't a verbatim copy), and every source record in
+            // (ldbase_vidx, chain_end] is LD-compressed
+            uint32_t ldbase_vidx = UINT32_MAX;
+            uint32_t chain_end = 0;
+            uint32_t record_idx = 0;
+            while (record_idx != recordCount) {
+                // find the longest run of consecutive source records that can be copied verbatim
+                uint32_t run_end = record_idx;
+                uint32_t out_vidx = GetRecordWriterVariantCount(pRecordWriter);
+                for (; run_end != recordCount; ++run_end, ++out_vidx) {
+                    const uint32_t vidx = sourceVidx(run_end);
+                    if ((run_end != record_idx) && (vidx != sourceVidx(run_end - 1) + 1)) {
+                        break;
+                    }
+                    if (plink2::VrtypeLdCompressed(plink2::GetPgfiVrtype(pgfip, vidx))) {
+                        if ((ldbase_vidx == UINT32_MAX) || (!(out_vidx % plink2::kPglVblockSize))) {
+                            break;
+                        }
+                        if (!ContinuesLdChain(pgfip, chain_end, vidx)) {
+                            ldbase_vidx = UINT32_MAX;
+                            break;
+                        }
+                    } else {
+                        ldbase_vidx = vidx;
+                    }
+                    chain_end = vidx;
+                }
+                if (run_end != record_idx) {
+                    CopyRecordRun(
+                            pRecordWriter, pReaderContext, ff, sourceVidx(record_idx), sourceVidx(run_end - 1) + 1);
+                    record_idx = run_end;
+                } else {
+                    ReencodeRecord(pRecordWriter, pReaderContext, sourceVidx(record_idx));
+                    ldbase_vidx = UINT32_MAX;
+                    ++record_idx;
+                }
+            }
+        } catch (const PgenException &) {
+            if (ff != nullptr) {
+                fclose(ff);
+            }
+            throw;
+        }
+        if (ff != nullptr) {
+            fclose(ff);
+        }
+    }
+
+    // Store the index entries (record length, vrtype and, at the start of a vblock, file position) for the next
+    // output record, which starts at file position record_fpos.
+    static void AddRecordIndexEntry(
+            PgenRecordWriter *const pRecordWriter,
+            const uint32_t vrec_len,
+            const uint32_t vrtype,
+            const uint64_t record_fpos) {
+        if (vrec_len > pRecordWriter->max_vrec_len) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Variant record %u is longer (%u bytes) than the output allows (%u bytes)",
+                     GetRecordWriterVariantCount(pRecordWriter),
+                     vrec_len,
+                     pRecordWriter->max_vrec_len);
+            throw PgenException(errMessageBuff); // PgenException makes a copy of errMessageBuff
+        }
+        if (SpgwAppendRecordIndexEntry(pRecordWriter->spgwp, vrec_len, vrtype, record_fpos)) {
+            throw PgenException("Can't copy a phased or dosage variant record to an output without phase or dosages");
+        }
+    }
+
+    static void FlushRecordWriter(PgenRecordWriter *const pRecordWriter) {
+        if (plink2::SpgwFlush(pRecordWriter->spgwp)) {
+            throwOnPglErr(plink2::kPglRetWriteFail, "Error writing copied variant records");
+        }
+    }
+
+    // Copy the (consecutive) source records [runStart, runEnd) verbatim, through the writer's fwrite buffer.
+    static void CopyRecordRun(
+            PgenRecordWriter *const pRecordWriter,
+            const PgenReaderContext *const pReaderContext,
+            FILE *ff,
+            const uint32_t runStart,
+            const uint32_t runEnd) {
+        const plink2::PgenFileInfo *const pgfip = pReaderContext->pgfip;
+        plink2::STPgenWriter *const spgwp = pRecordWriter->spgwp;
+        const uint64_t run_fpos = plink2::GetPgfiFpos(pgfip, runStart);
+        const uint64_t out_run_fpos = SpgwGetNextRecordFpos(spgwp);
+        for (uint32_t vidx = runStart; vidx != runEnd; ++vidx) {
+            AddRecordIndexEntry(
+                    pRecordWriter,
+                    plink2::GetPgfiVrecWidth(pgfip, vidx),
+                    plink2::GetPgfiVrtype(pgfip, vidx),
+                    out_run_fpos + (plink2::GetPgfiFpos(pgfip, vidx) - run_fpos));
+        }
+
+        uint64_t fpos = run_fpos;
+        const uint64_t run_end_fpos = plink2::GetPgfiFpos(pgfip, runEnd);
+        if ((ff != nullptr) && fseeko(ff, static_cast<off_t>(fpos), SEEK_SET)) {
+            throwOnPglErr(plink2::kPglRetReadFail, "Error reading variant records to copy");
+        }
+        while (fpos != run_end_fpos) {
+            const uintptr_t byte_ct = static_cast<uintptr_t>(std::min<uint64_t>(
+                    run_end_fpos - fpos, pRecordWriter->fwrite_buf_size - SpgwGetFwriteByteCt(spgwp)));
+            if (ff == nullptr) {
+                memcpy(SpgwGetFwriteBufp(spgwp), &pReaderContext->mmap_base[fpos], byte_ct);
+            } else if (fread(SpgwGetFwriteBufp(spgwp), 1, byte_ct, ff) != byte_ct) {
+                throwOnPglErr(plink2::kPglRetReadFail, "Error reading variant records to copy");
+            }
+            SpgwAdvanceFwriteBufp(spgwp, byte_ct);
+            fpos += byte_ct;
+            FlushRecordWriter(pRecordWriter);
+        }
+    }
+
+    // Append a source record with its main track decoded and re-encoded as a plain 2-bit genotype vector, which
+    // doesn't depend on any other record.
+    static void ReencodeRecord(
+            PgenRecordWriter *const pRecordWriter,
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t vidx) {
+        const unsigned char *fread_ptr;
+        const unsigned char *fread_end;
+        uintptr_t *const genovec = pRecordWriter->genovec;
+        const uint32_t sample_ct = pRecordWriter->sample_ct;
+        throwOnPglErr(
+                plink2::ReadRawGenovec(0, vidx, GetPgrp(pReaderContext->pgrp), &fread_ptr, &fread_end, genovec),
+                "Error reading LD-compressed variant record to copy");
+        plink2::ZeroTrailingNyps(sample_ct, genovec);
+
+        plink2::STPgenWriter *const spgwp = pRecordWriter->spgwp;
+        const uint32_t genovec_byte_ct = plink2::NypCtToByteCt(sample_ct);
+        const uintptr_t other_tracks_byte_ct = fread_end - fread_ptr;
+        // the vrtype of a 2-bit main track is 0, and the other tracks keep their bits
+        AddRecordIndexEntry(
+                pRecordWriter,
+                static_cast<uint32_t>(genovec_byte_ct + other_tracks_byte_ct),
+                plink2::GetPgfiVrtype(pReaderContext->pgfip, vidx) & 0xf8,
+                SpgwGetNextRecordFpos(spgwp));
+        memcpy(SpgwGetFwriteBufp(spgwp), genovec, genovec_byte_ct);
+        SpgwAdvanceFwriteBufp(spgwp, genovec_byte_ct);
+        memcpy(SpgwGetFwriteBufp(spgwp), fread_ptr, other_tracks_byte_ct);
+        SpgwAdvanceFwriteBufp(spgwp, other_tracks_byte_ct);
+        FlushRecordWriter(pRecordWriter);
+    }
+
+    uint32_t GetRecordWriterVariantCount(const PgenRecordWriter *const pRecordWriter) {
+        return plink2::SpgwGetVidx(pRecordWriter->spgwp);
+    }
+
+    /**
+     * Write the header and index of the output, close it, and free pRecordWriter. For kPgenWriteBackwardSeek, the
+     * number of records appended must be the variant count the writer was opened with.
+     */
+    void ClosePgenRecordWriter(PgenRecordWriter *const pRecordWriter) {
+        const uint32_t written_ct = GetRecordWriterVariantCount(pRecordWriter);
+        const uint32_t declared_ct = SpgwGetVariantCtLimit(pRecordWriter->spgwp);
+        if ((written_ct == 0) ||
+            ((pRecordWriter->write_mode == plink2::kPgenWriteBackwardSeek) && (written_ct != declared_ct))) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Record writer closed with %u variant records written, but %u were declared",
+                     written_ct,
+                     declared_ct);
+            AbandonPgenRecordWriter(pRecordWriter);
+            throw PgenException(errMessageBuff); // PgenException makes a copy of errMessageBuff
+        }
+        plink2::PglErr reterr = plink2::SpgwFinish(pRecordWriter->spgwp);
+        // as in ClosePgen, SpgwFinish doesn't close the output files, so always clean up as well
+        plink2::CleanupSpgw(pRecordWriter->spgwp, &reterr);
+        free(pRecordWriter->spgwp);
+        pRecordWriter->spgwp = nullptr;
+        AbandonPgenRecordWriter(pRecordWriter);
+        throwOnPglErr(reterr, "Error closing pgen file: SpgwFinish");
+    }
+
+    // close the output file(s) and free pRecordWriter without finishing the pgen (the output is not valid)
+    void AbandonPgenRecordWriter(PgenRecordWriter *const pRecordWriter) {
+        if (pRecordWriter->spgwp != nullptr) {
+            plink2::PglErr cleanupErr = plink2::kPglRetSuccess;
+            plink2::CleanupSpgw(pRecordWriter->spgwp, &cleanupErr);
+            free(pRecordWriter->spgwp);
+        }
+        plink2::aligned_free_cond(pRecordWriter->spgw_alloc);
+        free(pRecordWriter->explicit_nonref_flags);
+        free(pRecordWriter);
+    }
+
+}
@@ -0,0 +1,488 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pgenException.h"
+#include "pgenUtils.h"
+#include "pgenReader.h"
+#include "pgenSampleMajor.h"
+#include "pgenVariantSlices.h"
+
+namespace pgenlib {
+    static const int kErrMessageBufSize = 1024;
+
+    // The sidecar layout (all integers in native byte order):
+    //   the SampleMajorHeader
+    //   block_ct + 1 uint64 file offsets, of each variant block and of the end of the file
+    //   for each variant block:
+    //     sample_ct + 1 uint64 offsets (from the start of the block) of each sample's row, and of the end of the block
+    //     (a block of a few million samples can exceed 4GB)
+    //     the sample rows, in sample order
+    // A row starts with its encoding (kSampleMajorRowRaw or kSampleMajorRowSparse) and, for a sparse row, the common
+    // genotype. A raw row continues with the packed 2-bit (plink2 genovec) genotypes of the block's variants; a sparse
+    // row with a uint16 (offset in the block << 2 | genotype) for each variant, in order, whose genotype isn't the
+    // common one.
+    static constexpr char kSampleMajorMagic[8] = { 'P', 'G', 'E', 'N', 'S', 'M', 'G', 1 };
+    // the number of variants in each block; small enough for a sparse row entry to fit a variant offset and a genotype
+    // in 16 bits, and a multiple of the transpose batch size
+    static constexpr uint32_t kSampleMajorBlockVariantCt = 4096;
+    static constexpr uint32_t kSampleMajorRowHeaderBytes = 2;
+    static constexpr uint32_t kSampleMajorMaxRowBytes =
+            kSampleMajorRowHeaderBytes + kSampleMajorBlockVariantCt / plink2::kBitsPerWordD2 * plink2::kBytesPerWord;
+    static constexpr unsigned char kSampleMajorRowRaw = 0;
+    static constexpr unsigned char kSampleMajorRowSparse = 1;
+    static_assert(kSampleMajorBlockVariantCt % plink2::kPglNypTransposeBatch == 0,
+                  "sample major blocks must be a multiple of the transpose batch size");
+    static_assert(kSampleMajorBlockVariantCt <= (1 << 14), "sample major block offsets must fit in 14 bits");
+
+    typedef struct SampleMajorHeader {
+        char magic[8];
+        uint32_t variant_ct;
+        uint32_t sample_ct;
+        uint32_t block_variant_ct;
+        uint32_t block_ct;
+    } SampleMajorHeader;
+    static_assert(sizeof(SampleMajorHeader) == 24, "SampleMajorHeader must not be padded");
+
+    struct SampleMajorReader {
+        FILE *ff;
+        std::string filename;
+        uint32_t variant_ct;
+        uint32_t sample_ct;
+        uint32_t block_ct;
+        std::vector<uint64_t> block_offsets;    // block_ct + 1 entries
+        // one row of a block, as read from the file, and the row's raw genotypes (word aligned) and genotype codes
+        std::vector<unsigned char> row_buf;
+        std::vector<uintptr_t> genovec;
+        std::vector<int8_t> genotype_buf;
+    };
+
+    // the (genovec) genotype codes returned by ReadSampleGenotypes
+    static constexpr int8_t kSampleMajorGenotypeCodes[4] = { 0, 1, 2, -9 };
+
+    static inline uint32_t SampleMajorBlockCount(const uint32_t variant_ct) {
+        return plink2::DivUp(variant_ct, kSampleMajorBlockVariantCt);
+    }
+
+    static uint32_t EncodeSampleRow(const uint32_t variant_ct, uintptr_t *row, unsigned char *out);
+    static void WriteSampleMajorBytes(FILE *ff, const void *buf, const size_t byteCount);
+
+    /**
+     * Write a sample major sidecar (see pgenSampleMajor.h) of the hardcalls of every variant in a PGEN, for the
+     * reader's samples (see GetReaderSampleCount). Multi-allelic hardcalls are stored as they're returned by PgrGet:
+     * as the number of non-reference alleles. Memory use is about 2KB per sample, for a block of decoded genotypes and
+     * the encoded rows of the block.
+     * @param pReaderContext - the PgenReaderContext for the reader
+     * @param cSidecarFilename - the sidecar file to write (by convention, the .pgen file name with
+     * kSampleMajorExtension appended)
+     * @param threadCount - the number of threads to decode and transpose each block with; each decoding thread opens
+     * its own reader, once for the whole file
+     */
+    void WriteSampleMajorSidecar(
+            const PgenReaderContext *const pReaderContext,
+            const char *cSidecarFilename,
+            const uint32_t threadCount) {
+        if (threadCount == 0) {
+            throw PgenException("Invalid thread count (0); must be at least 1");
+        }
+        const uint32_t variant_ct = pReaderContext->raw_variant_ct;
+        const uint32_t sample_ct = pReaderContext->sample_ct;
+        const uint32_t block_ct = SampleMajorBlockCount(variant_ct);
+        const uintptr_t genovec_stride = plink2::NypCtToAlignedWordCt(sample_ct);
+        const uint32_t row_word_ct = kSampleMajorBlockVariantCt / plink2::kBitsPerWordD2;
+        // the samples are transposed a batch (of up to kPglNypTransposeBatch samples) at a time
+        const uint32_t sample_batch_ct = plink2::DivUp(sample_ct, plink2::kPglNypTransposeBatch);
+        const uintptr_t sample_rows_word_ct = static_cast<uintptr_t>(plink2::kPglNypTransposeBatch) * row_word_ct;
+        const uintptr_t transposed_word_ct =
+                static_cast<uintptr_t>(plink2::kPglNypTransposeBatch) * plink2::kPglNypTransposeWords;
+        const uintptr_t thread_word_ct =
+                sample_rows_word_ct + transposed_word_ct + plink2::kPglNypTransposeBufbytes / plink2::kBytesPerWord;
+
+        // the decoded genotypes of a block (variant major), and the per thread transpose buffers
+        uintptr_t *genovec_block_buf;
+        if (plink2::cachealigned_malloc(
+                std::max<uintptr_t>(kSampleMajorBlockVariantCt * genovec_stride, 1) * sizeof(uintptr_t),
+                &genovec_block_buf)) {
+            throw PgenException("Native code failure (cachealigned_malloc) allocating sample major block buffer");
+        }
+        std::unique_ptr<uintptr_t, void (*)(void *)> genovec_block(genovec_block_buf, plink2::aligned_free);
+        std::vector<std::unique_ptr<uintptr_t, void (*)(void *)>> thread_bufs;
+        for (uint32_t tidx = 0; tidx != SliceThreadCount(0, sample_batch_ct, threadCount); ++tidx) {
+            uintptr_t *thread_buf;
+            if (plink2::cachealigned_malloc(thread_word_ct * sizeof(uintptr_t), &thread_buf)) {
+                throw PgenException("Native code failure (cachealigned_malloc) allocating sample major buffers");
+            }
+            thread_bufs.emplace_back(thread_buf, plink2::aligned_free);
+        }
+        // the encoded rows of a block; each sample's row has kSampleMajorMaxRowBytes reserved
+        std::vector<unsigned char> rows(static_cast<uintptr_t>(sample_ct) * kSampleMajorMaxRowBytes);
+        std::vector<uint64_t> row_offsets(sample_ct + 1);
+        std::vector<uint64_t> block_offsets(block_ct + 1);
+        // the decode readers are created once, rather than for each block
+        const uint32_t reader_ct = SliceThreadCount(0, std::min(variant_ct, kSampleMajorBlockVariantCt), threadCount);
+
+        FILE *ff = fopen(cSidecarFilename, "wb");
+        if (ff == nullptr) {
+            throwOnPglErr(plink2::kPglRetOpenFail, "Error opening sample major sidecar for writing");
+        }
+        std::unique_ptr<PgenThreadReader[]> readers;
+        try {
+            readers = InitThreadReaders(pReaderContext, reader_ct);
+            SampleMajorHeader header;
+            memcpy(header.magic, kSampleMajorMagic, sizeof(kSampleMajorMagic));
+            header.variant_ct = variant_ct;
+            header.sample_ct = sample_ct;
+            header.block_variant_ct = kSampleMajorBlockVariantCt;
+            header.block_ct = block_ct;
+            WriteSampleMajorBytes(ff, &header, sizeof(header));
+            // the block offsets are filled in once the blocks are written
+            WriteSampleMajorBytes(ff, block_offsets.data(), block_offsets.size() * sizeof(uint64_t));
+            uint64_t file_offset = sizeof(header) + block_offsets.size() * sizeof(uint64_t);
+
+            for (uint32_t block_idx = 0; block_idx != block_ct; ++block_idx) {
+                const uint32_t block_start = block_idx * kSampleMajorBlockVariantCt;
+                const uint32_t block_variant_ct = std::min(variant_ct - block_start, kSampleMajorBlockVariantCt);
+                ForEachSlice(
+                        block_start,
+                        block_start + block_variant_ct,
+                        threadCount,
+                        "Error reading pgen genotypes for sample major sidecar (PgrGet)",
+                        [&](const uint32_t tidx, const uint32_t begin, const uint32_t end) {
+                            PgenThreadReader *const pThreadReader = &readers[tidx];
+                            for (uint32_t vidx = begin; vidx != end; ++vidx) {
+                                const plink2::PglErr reterr = plink2::PgrGet(
+                                        pReaderContext->sample_include,
+                                        pThreadReader->pssi,
+                                        sample_ct,
+                                        vidx,
+                                        pThreadReader->pgrp,
+                                        &genovec_block.get()[(vidx - block_start) * genovec_stride]);
+                                if (reterr != plink2::kPglRetSuccess) {
+                                    return reterr;
+                                }
+                            }
+                            return plink2::kPglRetSuccess;
+                        });
+
+                // the sample batches are sliced across the threads, with no readers
+                ForEachSlice(
+                        0,
+                        sample_batch_ct,
+                        threadCount,
+                        "Error transposing pgen genotypes for sample major sidecar",
+                        [&](const uint32_t tidx, const uint32_t begin, const uint32_t end) {
+                            uintptr_t *const sample_rows = thread_bufs[tidx].get();
+                            uintptr_t *const transposed = &sample_rows[sample_rows_word_ct];
+                            plink2::VecW *const transpose_buf =
+                                    reinterpret_cast<plink2::VecW *>(&transposed[transposed_word_ct]);
+                            for (uint32_t batch_idx = begin; batch_idx != end; ++batch_idx) {
+                                const uint32_t sample_start = batch_idx * plink2::kPglNypTransposeBatch;
+                                const uint32_t batch_sample_ct =
+                                        std::min<uint32_t>(sample_ct - sample_start, plink2::kPglNypTransposeBatch);
+                                for (uint32_t offset = 0; offset < block_variant_ct;
+                                     offset += plink2::kPglNypTransposeBatch) {
+                                    const uint32_t batch_variant_ct =
+                                            std::min<uint32_t>(block_variant_ct - offset, plink2::kPglNypTransposeBatch);
+                                    plink2::TransposeNypblock(
+                                            &genovec_block.get()[offset * genovec_stride +
+                                                                 sample_start / plink2::kBitsPerWordD2],
+                                            genovec_stride,
+                                            plink2::kPglNypTransposeWords,
+                                            batch_variant_ct,
+                                            batch_sample_ct,
+                                            transposed,
+                                            transpose_buf);
+                                    const uint32_t batch_word_ct = plink2::NypCtToWordCt(batch_variant_ct);
+                                    for (uint32_t sidx = 0; sidx != batch_sample_ct; ++sidx) {
+                                        const uintptr_t *const transposed_row =
+                                                &transposed[sidx * plink2::kPglNypTransposeWords];
+                                        std::copy(transposed_row,
+                                                  transposed_row + batch_word_ct,
+                                                  &sample_rows[sidx * row_word_ct + offset / plink2::kBitsPerWordD2]);
+                                    }
+                                }
+                                for (uint32_t sidx = 0; sidx != batch_sample_ct; ++sidx) {
+                                    const uint32_t sample_idx = sample_start + sidx;
+                                    // the row byte counts are turned into offsets once every row is encoded
+                                    row_offsets[sample_idx + 1] = EncodeSampleRow(
+                                            block_variant_ct,
+                                            &sample_rows[sidx * row_word_ct],
+                                            &rows[static_cast<uintptr_t>(sample_idx) * kSampleMajorMaxRowBytes]);
+                                }
+                            }
+                            return plink2::kPglRetSuccess;
+                        });
+
+                row_offsets[0] = (static_cast<uint64_t>(sample_ct) + 1) * sizeof(uint64_t);
+                for (uint32_t sample_idx = 0; sample_idx != sample_ct; ++sample_idx) {
+                    row_offsets[sample_idx + 1] += row_offsets[sample_idx];
+                }
+                WriteSampleMajorBytes(ff, row_offsets.data(), row_offsets.size() * sizeof(uint64_t));
+                for (uint32_t sample_idx = 0; sample_idx != sample_ct; ++sample_idx) {
+                    WriteSampleMajorBytes(
+                            ff,
+                            &rows[static_cast<uintptr_t>(sample_idx) * kSampleMajorMaxRowBytes],
+                            row_offsets[sample_idx + 1] - row_offsets[sample_idx]);
+                }
+                block_offsets[block_idx] = file_offset;
+                file_offset += row_offsets[sample_ct];
+            }
+            block_offsets[block_ct] = file_offset;
+            if (fseeko(ff, sizeof(SampleMajorHeader), SEEK_SET) != 0) {
+                throwOnPglErr(plink2::kPglRetWriteFail, "Error writing sample major sidecar");
+            }
+            WriteSampleMajorBytes(ff, block_offsets.data(), block_offsets.size() * sizeof(uint64_t));
+        } catch (const PgenException &) {
+            if (readers) {
+                plink2::PglErr cleanup_err = plink2::kPglRetSuccess;
+                CleanupThreadReaders(readers.get(), reader_ct, &cleanup_err);
+            }
+            fclose(ff);
+            throw;
+        }
+        plink2::PglErr reterr = plink2::kPglRetSuccess;
+        CleanupThreadReaders(readers.get(), reader_ct, &reterr);
+        if (reterr != plink2::kPglRetSuccess) {
+            fclose(ff);
+            throwOnPglErr(reterr, "Error closing pgen readers for sample major sidecar");
+        }
+        if (fclose(ff) != 0) {
+            throwOnPglErr(plink2::kPglRetWriteFail, "Error closing sample major sidecar");
+        }
+    }
+
+    // Encode one sample's row of a block (the sample's genotypes for variant_ct variants), and return its size.
+    static uint32_t EncodeSampleRow(const uint32_t variant_ct, uintptr_t *row, unsigned char *out) {
+        // the transposed rows aren't zeroed past the last variant
+        plink2::ZeroTrailingNyps(variant_ct, row);
+        STD_ARRAY_DECL(uint32_t, 4, genocounts);
+        plink2::GenoarrCountFreqsUnsafe(row, variant_ct, genocounts);
+        uint32_t common_geno = 0;
+        for (uint32_t geno = 1; geno != 4; ++geno) {
+            if (genocounts[geno] > genocounts[common_geno]) {
+                common_geno = geno;
+            }
+        }
+        const uint32_t raw_byte_ct = plink2::NypCtToByteCt(variant_ct);
+        const uint32_t sparse_byte_ct = (variant_ct - genocounts[common_geno]) * sizeof(uint16_t);
+        if (sparse_byte_ct >= raw_byte_ct) {
+            out[0] = kSampleMajorRowRaw;
+            out[1] = 0;
+            memcpy(&out[kSampleMajorRowHeaderBytes], row, raw_byte_ct);
+            return kSampleMajorRowHeaderBytes + raw_byte_ct;
+        }
+        out[0] = kSampleMajorRowSparse;
+        out[1] = static_cast<unsigned char>(common_geno);
+        unsigned char *entry_iter = &out[kSampleMajorRowHeaderBytes];
+        const uintptr_t common_word = common_geno * plink2::kMask5555;
+        const uint32_t word_ct = plink2::NypCtToWordCt(variant_ct);
+        for (uint32_t widx = 0; widx != word_ct; ++widx) {
+            uintptr_t diff_word = row[widx] ^ common_word;
+            // the trailing (zeroed) genotypes of the last word differ from a common genotype other than 0
+            if (widx == word_ct - 1) {
+                const uint32_t trailing_nyp_ct = plink2::ModNz(variant_ct, plink2::kBitsPerWordD2);
+                if (trailing_nyp_ct != plink2::kBitsPerWordD2) {
+                    diff_word &= (plink2::k1LU << (2 * trailing_nyp_ct)) - 1;
+                }
+            }
+            while (diff_word) {
+                const uint32_t nyp_idx = plink2::ctzw(diff_word) / 2;
+                const uint32_t offset = widx * plink2::kBitsPerWordD2 + nyp_idx;
+                const uint16_t entry =
+                        static_cast<uint16_t>((offset << 2) | ((row[widx] >> (2 * nyp_idx)) & 3));
+                memcpy(entry_iter, &entry, sizeof(uint16_t));
+                entry_iter += sizeof(uint16_t);
+                diff_word &= ~(static_cast<uintptr_t>(3) << (2 * nyp_idx));
+            }
+        }
+        return kSampleMajorRowHeaderBytes + sparse_byte_ct;
+    }
+
+    static void WriteSampleMajorBytes(FILE *ff, const void *buf, const size_t byteCount) {
+        if ((byteCount != 0) && (fwrite(buf, byteCount, 1, ff) != 1)) {
+            throwOnPglErr(plink2::kPglRetWriteFail, "Error writing sample major sidecar");
+        }
+    }
+
+    static void ReadSampleMajorBytes(SampleMajorReader *const pSampleMajorReader,
+                                     const uint64_t offset,
+                                     const size_t byteCount,
+                                     void *buf) {
+        if ((fseeko(pSampleMajorReader->ff, static_cast<off_t>(offset), SEEK_SET) != 0) ||
+            (fread(buf, byteCount, 1, pSampleMajorReader->ff) != 1)) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Error reading %zu bytes at offset %llu of the sample major sidecar %s",
+                     byteCount,
+                     static_cast<unsigned long long>(offset),
+                     pSampleMajorReader->filename.c_str());
+            throw PgenException(errMessageBuff); // PgenException makes a copy of errMessageBuff
+        }
+    }
+
+    static void ThrowInvalidSampleMajor(const SampleMajorReader *const pSampleMajorReader, const char *problem) {
+        char errMessageBuff[kErrMessageBufSize];
+        snprintf(errMessageBuff,
+                 kErrMessageBufSize,
+                 "Invalid sample major sidecar %s: %s",
+                 pSampleMajorReader->filename.c_str(),
+                 problem);
+        throw PgenException(errMessageBuff); // PgenException makes a copy of errMessageBuff
+    }
+
+    /**
+     * Open a sample major sidecar (written by WriteSampleMajorSidecar) for reading. The reader isn't thread safe.
+     * @param cSidecarFilename - the sidecar file to read
+     * @return the reader, which must be closed with CloseSampleMajorReader
+     */
+    SampleMajorReader *OpenSampleMajorReader(const char *cSidecarFilename) {
+        std::unique_ptr<SampleMajorReader> reader(new SampleMajorReader());
+        reader->filename = cSidecarFilename;
+        reader->ff = fopen(cSidecarFilename, "rb");
+        if (reader->ff == nullptr) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Error opening the sample major sidecar %s for reading",
+                     cSidecarFilename);
+            throw PgenException(errMessageBuff); // PgenException makes a copy of errMessageBuff
+        }
+        try {
+            SampleMajorHeader header;
+            ReadSampleMajorBytes(reader.get(), 0, sizeof(header), &header);
+            if (memcmp(header.magic, kSampleMajorMagic, sizeof(kSampleMajorMagic)) != 0) {
+                ThrowInvalidSampleMajor(reader.get(), "unrecognized header (or unsupported version)");
+            }
+            if ((header.block_variant_ct != kSampleMajorBlockVariantCt) ||
+                (header.block_ct != SampleMajorBlockCount(header.variant_ct))) {
+                ThrowInvalidSampleMajor(reader.get(), "invalid variant block layout");
+            }
+            reader->variant_ct = header.variant_ct;
+            reader->sample_ct = header.sample_ct;
+            reader->block_ct = header.block_ct;
+            reader->block_offsets.resize(header.block_ct + 1);
+            ReadSampleMajorBytes(
+                    reader.get(),
+                    sizeof(header),
+                    reader->block_offsets.size() * sizeof(uint64_t),
+                    reader->block_offsets.data());
+            reader->row_buf.resize(kSampleMajorMaxRowBytes);
+            reader->genovec.resize(kSampleMajorBlockVariantCt / plink2::kBitsPerWordD2);
+            reader->genotype_buf.resize(kSampleMajorBlockVariantCt);
+        } catch (const PgenException &) {
+            fclose(reader->ff);
+            throw;
+        }
+        return reader.release();
+    }
+
+    uint32_t GetSampleMajorVariantCount(const SampleMajorReader *const pSampleMajorReader) {
+        return pSampleMajorReader->variant_ct;
+    }
+
+    uint32_t GetSampleMajorSampleCount(const SampleMajorReader *const pSampleMajorReader) {
+        return pSampleMajorReader->sample_ct;
+    }
+
+    /**
+     * Read the genotypes of one sample for each variant in the range [variantStart, variantEnd). Each genotype is
+     * the number of non-reference alleles (0, 1 or 2), or -9 for a missing genotype.
+     * @param pSampleMajorReader - the sample major reader
+     * @param sampleIndex - the index of the sample (among the samples the sidecar was written for)
+     * @param variantStart - the first variant to read
+     * @param variantEnd - one past the last variant to read
+     * @param genotypes - receives (variantEnd - variantStart) genotypes
+     */
+    void ReadSampleGenotypes(
+            SampleMajorReader *const pSampleMajorReader,
+            const uint32_t sampleIndex,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            int8_t *genotypes) {
+        const uint32_t variant_ct = pSampleMajorReader->variant_ct;
+        const uint32_t sample_ct = pSampleMajorReader->sample_ct;
+        if ((sampleIndex >= sample_ct) || (variantStart > variantEnd) || (variantEnd > variant_ct)) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Invalid sample index (%u) or variant range (%u..%u). The sample major sidecar has %u samples and %u variants.",
+                     sampleIndex,
+                     variantStart,
+                     variantEnd,
+                     sample_ct,
+                     variant_ct);
+            throw PgenException(errMessageBuff); // PgenException makes a copy of errMessageBuff
+        }
+        if (variantStart == variantEnd) {
+            return;
+        }
+        unsigned char *const row_buf = pSampleMajorReader->row_buf.data();
+        uintptr_t *const genovec = pSampleMajorReader->genovec.data();
+        int8_t *const genotype_buf = pSampleMajorReader->genotype_buf.data();
+        const uint32_t block_end = (variantEnd - 1) / kSampleMajorBlockVariantCt + 1;
+        for (uint32_t block_idx = variantStart / kSampleMajorBlockVariantCt; block_idx != block_end; ++block_idx) {
+            const uint32_t block_start = block_idx * kSampleMajorBlockVariantCt;
+            const uint32_t block_variant_ct = std::min(variant_ct - block_start, kSampleMajorBlockVariantCt);
+            // the part of the block that's in the range
+            const uint32_t lo = std::max(variantStart, block_start) - block_start;
+            const uint32_t hi = std::min(variantEnd, block_start + block_variant_ct) - block_start;
+            int8_t *const out = &genotypes[block_start + lo - variantStart];
+
+            const uint64_t block_offset = pSampleMajorReader->block_offsets[block_idx];
+            uint64_t row_offsets[2];
+            ReadSampleMajorBytes(
+                    pSampleMajorReader, block_offset + sampleIndex * sizeof(uint64_t), sizeof(row_offsets), row_offsets);
+            if ((row_offsets[1] < row_offsets[0]) || (row_offsets[1] - row_offsets[0] < kSampleMajorRowHeaderBytes) ||
+                (row_offsets[1] - row_offsets[0] > kSampleMajorMaxRowBytes)) {
+                ThrowInvalidSampleMajor(pSampleMajorReader, "invalid row offsets");
+            }
+            const uint32_t row_byte_ct = static_cast<uint32_t>(row_offsets[1] - row_offsets[0]);
+            ReadSampleMajorBytes(pSampleMajorReader, block_offset + row_offsets[0], row_byte_ct, row_buf);
+            const unsigned char *const payload = &row_buf[kSampleMajorRowHeaderBytes];
+            const uint32_t payload_byte_ct = row_byte_ct - kSampleMajorRowHeaderBytes;
+            if (row_buf[0] == kSampleMajorRowRaw) {
+                if (payload_byte_ct != plink2::NypCtToByteCt(block_variant_ct)) {
+                    ThrowInvalidSampleMajor(pSampleMajorReader, "invalid raw row size");
+                }
+                memcpy(genovec, payload, payload_byte_ct);
+                // GenoarrToBytesMinus9 converts whole words, so an unaligned start is converted via genotype_buf
+                if (lo % plink2::kBitsPerWordD2 == 0) {
+                    plink2::GenoarrToBytesMinus9(&genovec[lo / plink2::kBitsPerWordD2], hi - lo, out);
+                } else {
+                    plink2::GenoarrToBytesMinus9(genovec, hi, genotype_buf);
+                    std::copy(&genotype_buf[lo], &genotype_buf[hi], out);
+                }
+            } else if ((row_buf[0] == kSampleMajorRowSparse) && (row_buf[1] < 4) &&
+                       (payload_byte_ct % sizeof(uint16_t) == 0)) {
+                std::fill(out, out + (hi - lo), kSampleMajorGenotypeCodes[row_buf[1]]);
+                const uint32_t entry_ct = payload_byte_ct / sizeof(uint16_t);
+                for (uint32_t entry_idx = 0; entry_idx != entry_ct; ++entry_idx) {
+                    uint16_t entry;
+                    memcpy(&entry, &payload[entry_idx * sizeof(uint16_t)], sizeof(uint16_t));
+                    const uint32_t offset = entry >> 2;
+                    if (offset >= hi) {
+                        // the entries are in variant order
+                        break;
+                    } else if (offset >= lo) {
+                        out[offset - lo] = kSampleMajorGenotypeCodes[entry & 3];
+                    }
+                }
+            } else {
+                ThrowInvalidSampleMajor(pSampleMajorReader, "invalid row encoding");
+            }
+        }
+    }
+
+    void CloseSampleMajorReader(SampleMajorReader *const pSampleMajorReader) {
+        const int close_result = fclose(pSampleMajorReader->ff);
+        delete pSampleMajorReader;
+        if (close_result != 0) {
+            throwOnPglErr(plink2::kPglRetReadFail, "Error closing sample major sidecar");
+        }
+    }
+
+}
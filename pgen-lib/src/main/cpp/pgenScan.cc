@@ -0,0 +1,392 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "pgenException.h"
+#include "pgenUtils.h"
+#include "pgenReader.h"
+#include "pgenScan.h"
+
+namespace pgenlib {
+    static const int kErrMessageBufSize = 1024;
+
+    // One batch of variants, and the block buffer that holds their (not yet decoded) records.
+    typedef struct PgenScanBatch {
+        std::vector<uint32_t> variant_indices;
+        unsigned char *block_buf;           // unused for a memory mapped reader
+        uint64_t block_buf_byte_ct;
+        uint64_t block_offset;              // the file offset of the first byte in block_buf
+        bool loaded;                        // true once the variants are selected and their records are loaded
+    } PgenScanBatch;
+
+    // A plink2 block mode reader, and its decode buffers, for one scan thread.
+    typedef struct PgenScanThread {
+        PgenThreadReader reader;
+        std::thread worker;
+        plink2::PglErr reterr;              // only valid once the worker has been joined
+    } PgenScanThread;
+
+    struct PgenScan {
+        const PgenReaderContext *reader_context;
+        // a copy of the reader's file info, with its own file handle (unless the reader is memory mapped), that is
+        // used to load blocks
+        plink2::PgenFileInfo fi;
+        PgenScanThread *threads;            // thread_ct threads, each with its own reader
+        uint32_t thread_ct;
+        uintptr_t *variant_include;         // null to scan every variant in the range
+        uint32_t next_vidx;                 // the next variant to consider for a batch
+        uint32_t variant_end;
+        uint32_t batch_variant_ct;          // the maximum number of variants in a batch
+        PgenScanBatch batches[2];           // the current batch, and the next one (which is loaded during decode)
+        uint32_t cur_batch;
+    };
+
+    static void InitPgenScan(PgenScan *const pScan, const uintptr_t *variantInclude, const uint32_t variantIncludeWordCount);
+    static void PrepareBatch(PgenScan *const pScan, PgenScanBatch &batch);
+    static void DecodeBatchSlice(
+            PgenScan *const pScan,
+            PgenScanThread *threadp,
+            const PgenScanBatch *batchp,
+            const uint32_t begin,
+            const uint32_t end,
+            int32_t *allele_codes,
+            unsigned char *phase_bytes);
+    static plink2::PglErr JoinScanThreads(PgenScan *const pScan);
+    static void AbandonPgenScan(PgenScan *const pScan);
+
+    /**
+     * Start a parallel scan over the variants of an open PGEN reader. The scan returns the variants in the range
+     * [variantStart, variantEnd) that are included by variantInclude, in order, batchVariantCount variants at a time
+     * (see ScanReadAlleles). The reader's allele counts and sample subset apply to the scan. The reader can still
+     * be used while the scan is in progress, but it must not be closed until the scan is finished.
+     *
+     *      pgenlib::PgenScan *const scan = pgenlib::StartPgenScan(reader_context, nullptr, 0, 0, n_variants, 4, 1024);
+     *      uint32_t batch_ct;
+     *      while ((batch_ct = pgenlib::ScanReadAlleles(scan, variant_indices, allele_codes, phase_bytes, allele_cts))) {
+     *          ...
+     *      }
+     *      pgenlib::FinishPgenScan(scan);
+     *
+     * @param pReaderContext - the PgenReaderContext for the reader to scan
+     * @param variantInclude - a bitarray (bit i of word i/64) of the variants to include. may be null, in which case
+     * every variant in the range is included
+     * @param variantIncludeWordCount - the number of words in variantInclude. missing trailing words are treated as 0
+     * @param variantStart - the first variant in the range to scan
+     * @param variantEnd - one past the last variant in the range to scan
+     * @param threadCount - the number of decode threads
+     * @param batchVariantCount - the maximum number of variants returned by each call to ScanReadAlleles. the block
+     * buffers hold the records for roughly this many variants, so larger batches trade memory for fewer loads
+     * @return a PgenScan
+     */
+    PgenScan *StartPgenScan(
+            PgenReaderContext *const pReaderContext,
+            const uintptr_t *variantInclude,
+            const uint32_t variantIncludeWordCount,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t threadCount,
+            const uint32_t batchVariantCount) {
+        if ((variantStart > variantEnd) || (variantEnd > pReaderContext->raw_variant_ct)) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Invalid scan range: %u..%u. The pgen contains %u variants.",
+                     variantStart,
+                     variantEnd,
+                     pReaderContext->raw_variant_ct);
+            throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+        } else if ((threadCount == 0) || (batchVariantCount == 0)) {
+            char errMessageBuff[kErrMessageBufSize];
+            snprintf(errMessageBuff,
+                     kErrMessageBufSize,
+                     "Invalid scan thread count (%u) or batch size (%u); both must be at least 1",
+                     threadCount,
+                     batchVariantCount);
+            throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+        }
+
+        PgenScan *pScan = new PgenScan();
+        pScan->reader_context = pReaderContext;
+        pScan->next_vidx = variantStart;
+        pScan->variant_end = variantEnd;
+        pScan->batch_variant_ct = batchVariantCount;
+        // there's no point in having more threads than there are variants in a batch
+        pScan->thread_ct = std::min(threadCount, batchVariantCount);
+        try {
+            InitPgenScan(pScan, variantInclude, variantIncludeWordCount);
+        } catch (const PgenException &) {
+            AbandonPgenScan(pScan);
+            throw;
+        }
+        return pScan;
+    }
+
+    static void InitPgenScan(PgenScan *const pScan, const uintptr_t *variantInclude, const uint32_t variantIncludeWordCount) {
+        const PgenReaderContext *const pReaderContext = pScan->reader_context;
+        if (variantInclude != nullptr) {
+            // keep a zero padded copy; the plink2 bit scanning routines may read a word past the last variant
+            const uint32_t raw_variant_ctl = plink2::BitCtToWordCt(pReaderContext->raw_variant_ct);
+            const uintptr_t variant_include_bytes =
+                    plink2::BitCtToCachelineCt(pReaderContext->raw_variant_ct + 1) * plink2::kCacheline;
+            if (plink2::cachealigned_malloc(variant_include_bytes, &pScan->variant_include)) {
+                throw PgenException("Native code failure (cachealigned_malloc) allocating scan variant_include");
+            }
+            memset(pScan->variant_include, 0, variant_include_bytes);
+            memcpy(pScan->variant_include,
+                   variantInclude,
+                   std::min(variantIncludeWordCount, raw_variant_ctl) * sizeof(uintptr_t));
+            plink2::ZeroTrailingBits(pReaderContext->raw_variant_ct, pScan->variant_include);
+        }
+
+        plink2::PgenFileInfo *const fip = &pScan->fi;
+        *fip = *pReaderContext->pgfip;  // struct copy; the allele counts and file offsets are shared with the reader
+        fip->pgi_ff = nullptr;
+        fip->shared_ff = nullptr;
+        if (pReaderContext->mmap_base != nullptr) {
+            // the mapped file is the block for every batch
+            fip->block_base = pReaderContext->mmap_base;
+            fip->block_offset = 0;
+        } else {
+            fip->shared_ff = fopen(pReaderContext->pgen_fname, "rb");
+            if (fip->shared_ff == nullptr) {
+                throwOnPglErr(plink2::kPglRetOpenFail, "Error opening pgen file for scan");
+            }
+            // PgrInit requires a block base for a block mode reader; the block buffers are grown as needed
+            for (PgenScanBatch &batch : pScan->batches) {
+                if (plink2::cachealigned_malloc(plink2::kCacheline, &batch.block_buf)) {
+                    throw PgenException("Native code failure (cachealigned_malloc) allocating scan block buffer");
+                }
+                batch.block_buf_byte_ct = plink2::kCacheline;
+            }
+            fip->block_base = pScan->batches[0].block_buf;
+            fip->block_offset = 0;
+        }
+
+        pScan->threads = new PgenScanThread[pScan->thread_ct]();
+        for (uint32_t tidx = 0; tidx != pScan->thread_ct; ++tidx) {
+            InitThreadReader(pReaderContext, fip, &pScan->threads[tidx].reader);
+        }
+    }
+
+    uint32_t GetScanBatchVariantCount(const PgenScan *const pScan) {
+        return pScan->batch_variant_ct;
+    }
+
+    // the number of samples in each variant returned by the scan (see GetReaderSampleCount)
+    uint32_t GetScanSampleCount(const PgenScan *const pScan) {
+        return pScan->reader_context->sample_ct;
+    }
+
+    /**
+     * Read the next batch of variants from a scan. The outputs have the same layout as repeated calls to
+     * ReadAlleles, one variant after the other.
+     * @param pScan - the scan
+     * @param variant_indices - receives the index of each variant in the batch (batch size entries)
+     * @param allele_codes - receives the allele codes for each variant in the batch (batch size * sample count * 2
+     * entries, where the sample count is GetReaderSampleCount for the reader)
+     * @param phase_bytes - receives the phase bytes for each variant in the batch (batch size * sample count
+     * entries). may be null
+     * @param allele_cts - receives the allele count of each variant in the batch (batch size entries)
+     * @return the number of variants in the batch, which is less than the batch size only for the last batch, and
+     * 0 once the scan is complete
+     */
+    uint32_t ScanReadAlleles(
+            PgenScan *const pScan,
+            uint32_t *variant_indices,
+            int32_t *allele_codes,
+            unsigned char *phase_bytes,
+            uint32_t *allele_cts) {
+        PgenScanBatch &batch = pScan->batches[pScan->cur_batch];
+        if (!batch.loaded) {
+            PrepareBatch(pScan, batch);
+        }
+        const uint32_t variant_ct = static_cast<uint32_t>(batch.variant_indices.size());
+        if (variant_ct == 0) {
+            return 0;
+        }
+
+        // point every reader at the block for this batch, and decode a contiguous slice of the batch on each thread
+        const uint32_t thread_ct = std::min(pScan->thread_ct, variant_ct);
+        if (pScan->reader_context->mmap_base == nullptr) {
+            pScan->fi.block_base = batch.block_buf;
+            pScan->fi.block_offset = batch.block_offset;
+        }
+        for (uint32_t tidx = 0; tidx != thread_ct; ++tidx) {
+            PgenScanThread &thread = pScan->threads[tidx];
+            plink2::PgrCopyBaseAndOffset(&pScan->fi, 1, &thread.reader.pgrp);
+            thread.reterr = plink2::kPglRetSuccess;
+            try {
+                thread.worker = std::thread(
+                        DecodeBatchSlice,
+                        pScan,
+                        &thread,
+                        &batch,
+                        static_cast<uint32_t>((static_cast<uint64_t>(variant_ct) * tidx) / thread_ct),
+                        static_cast<uint32_t>((static_cast<uint64_t>(variant_ct) * (tidx + 1)) / thread_ct),
+                        allele_codes,
+                        phase_bytes);
+            } catch (const std::system_error &) {
+                JoinScanThreads(pScan);
+                throwOnPglErr(plink2::kPglRetThreadCreateFail, "Error starting pgen scan thread");
+            }
+        }
+
+        // load the next batch while this one is being decoded. join every thread before propagating an error
+        PgenScanBatch &next_batch = pScan->batches[pScan->cur_batch ^ 1];
+        try {
+            PrepareBatch(pScan, next_batch);
+        } catch (const PgenException &) {
+            JoinScanThreads(pScan);
+            throw;
+        }
+        throwOnPglErr(JoinScanThreads(pScan), "Error decoding pgen variant block");
+
+        for (uint32_t i = 0; i != variant_ct; ++i) {
+            const uint32_t vidx = batch.variant_indices[i];
+            variant_indices[i] = vidx;
+            allele_cts[i] = GetReaderAlleleCount(pScan->reader_context, vidx);
+        }
+        batch.loaded = false;
+        pScan->cur_batch ^= 1;
+        return variant_ct;
+    }
+
+    /**
+     * Wait for any running scan threads, close the scan's file and free all memory associated with the scan. pScan
+     * is no longer valid after this call.
+     */
+    void FinishPgenScan(PgenScan *const pScan) {
+        plink2::PglErr reterr = plink2::kPglRetSuccess;
+        JoinScanThreads(pScan);
+        plink2::CleanupPgfi(&pScan->fi, &reterr);
+        AbandonPgenScan(pScan);
+        throwOnPglErr(reterr, "Error closing pgen file for scan (CleanupPgfi)");
+    }
+
+    // Select the next batch of variants, validate them, and (unless the reader is memory mapped) load their records
+    // into the batch's block buffer. An empty batch marks the end of the scan.
+    static void PrepareBatch(PgenScan *const pScan, PgenScanBatch &batch) {
+        const PgenReaderContext *const pReaderContext = pScan->reader_context;
+        std::vector<uint32_t> &variant_indices = batch.variant_indices;
+        variant_indices.clear();
+        while ((pScan->next_vidx < pScan->variant_end) && (variant_indices.size() < pScan->batch_variant_ct)) {
+            uint32_t vidx = pScan->next_vidx;
+            if (pScan->variant_include != nullptr) {
+                vidx = plink2::AdvBoundedTo1Bit(pScan->variant_include, vidx, pScan->variant_end);
+                if (vidx == pScan->variant_end) {
+                    pScan->next_vidx = vidx;
+                    break;
+                }
+            }
+            RequireReadableVariant(pReaderContext, vidx);
+            variant_indices.push_back(vidx);
+            pScan->next_vidx = vidx + 1;
+        }
+        if (variant_indices.empty() || (pReaderContext->mmap_base != nullptr)) {
+            batch.loaded = true;
+            return;
+        }
+
+        // the block runs from the first variant's record (or from its LD base record, if the first record is LD
+        // compressed) to the end of the last variant's record
+        plink2::PgenFileInfo *const fip = &pScan->fi;
+        const uint32_t vidx_start = variant_indices.front();
+        const uint32_t vidx_end = variant_indices.back() + 1;
+        uint32_t load_vidx_start = vidx_start;
+        if (fip->vrtypes != nullptr) {
+            while ((load_vidx_start != 0) && ((fip->vrtypes[load_vidx_start] & 6) == 2)) {
+                --load_vidx_start;
+            }
+        }
+        const uint64_t block_byte_ct = plink2::GetPgfiFpos(fip, vidx_end) - plink2::GetPgfiFpos(fip, load_vidx_start);
+        if (block_byte_ct > batch.block_buf_byte_ct) {
+            plink2::aligned_free_cond(batch.block_buf);
+            batch.block_buf_byte_ct = plink2::RoundUpPow2(block_byte_ct, plink2::kCacheline);
+            if (plink2::cachealigned_malloc(batch.block_buf_byte_ct, &batch.block_buf)) {
+                batch.block_buf = nullptr;
+                batch.block_buf_byte_ct = 0;
+                throw PgenException("Native code failure (cachealigned_malloc) allocating scan block buffer");
+            }
+        }
+        fip->block_base = batch.block_buf;
+        throwOnPglErr(
+                plink2::PgfiMultiread(
+                        pScan->variant_include,
+                        vidx_start,
+                        vidx_end,
+                        static_cast<uint32_t>(variant_indices.size()),
+                        fip),
+                "Error loading pgen variant block (PgfiMultiread)");
+        batch.block_offset = fip->block_offset;
+        batch.loaded = true;
+    }
+
+    // Decode variants [begin, end) of a batch on a scan thread. Runs on a worker thread, so it doesn't throw.
+    static void DecodeBatchSlice(
+            PgenScan *const pScan,
+            PgenScanThread *threadp,
+            const PgenScanBatch *batchp,
+            const uint32_t begin,
+            const uint32_t end,
+            int32_t *allele_codes,
+            unsigned char *phase_bytes) {
+        const uintptr_t sample_ct = pScan->reader_context->sample_ct;
+        for (uint32_t i = begin; i != end; ++i) {
+            const plink2::PglErr reterr = DecodeAlleles(
+                    pScan->reader_context,
+                    threadp->reader.pgrp,
+                    threadp->reader.pssi,
+                    &threadp->reader.pgv,
+                    batchp->variant_indices[i],
+                    &allele_codes[i * sample_ct * 2],
+                    phase_bytes != nullptr ? &phase_bytes[i * sample_ct] : nullptr);
+            if (reterr != plink2::kPglRetSuccess) {
+                threadp->reterr = reterr;
+                return;
+            }
+        }
+    }
+
+    // Join any running scan threads, and return the first error reported by any of them.
+    static plink2::PglErr JoinScanThreads(PgenScan *const pScan) {
+        plink2::PglErr reterr = plink2::kPglRetSuccess;
+        if (pScan->threads == nullptr) {
+            return reterr;
+        }
+        for (uint32_t tidx = 0; tidx != pScan->thread_ct; ++tidx) {
+            PgenScanThread &thread = pScan->threads[tidx];
+            if (thread.worker.joinable()) {
+                thread.worker.join();
+                if (thread.reterr && !reterr) {
+                    reterr = thread.reterr;
+                }
+            }
+        }
+        return reterr;
+    }
+
+    // release everything owned by the scan, closing any files that are still open. used both when finishing, and
+    // when the scan can't be initialized
+    static void AbandonPgenScan(PgenScan *const pScan) {
+        plink2::PglErr reterr = plink2::kPglRetSuccess;
+        if (pScan->threads != nullptr) {
+            JoinScanThreads(pScan);
+            for (uint32_t tidx = 0; tidx != pScan->thread_ct; ++tidx) {
+                CleanupThreadReader(&pScan->threads[tidx].reader, &reterr);
+            }
+            delete[] pScan->threads;
+        }
+        if (pScan->fi.shared_ff != nullptr) {
+            plink2::CleanupPgfi(&pScan->fi, &reterr);
+        }
+        for (PgenScanBatch &batch : pScan->batches) {
+            plink2::aligned_free_cond(batch.block_buf);
+        }
+        plink2::aligned_free_cond(pScan->variant_include);
+        delete pScan;
+    }
+
+}
@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+#include <vector>
+
+#include "pgenException.h"
+#include "pgenUtils.h"
+#include "pgenReader.h"
+#include "pgenScore.h"
+#include "pgenVariantSlices.h"
+
+namespace pgenlib {
+    static const int kErrMessageBufSize = 1024;
+    // plink2 dosages are in units of 1/16384 allele copies
+    static constexpr double kRecipDosageMid = 1.0 / 16384;
+
+    static void AddGenoarrLookup16x8bx2(
+            const uintptr_t *genoarr,
+            const double *table16x8bx2,
+            const uint32_t sample_ct,
+            double *accumulators);
+
+    /**
+     * Compute one or more linear (polygenic) scores for each of the reader's samples (see GetReaderSampleCount).
+     * Each score is the sum, over the weighted alleles, of the weight times the sample's dosage of the allele
+     * (its dosage if it has one, otherwise its hardcall allele count). The weights may list the same variant more
+     * than once (for different alleles), and don't need to be in variant order.
+     * @param pReaderContext - the PgenReaderContext for the reader
+     * @param variantIndices - the variant of each weighted allele (weightCount entries)
+     * @param alleleIndices - the index of each weighted allele (0 for the reference allele) within its variant
+     * (weightCount entries)
+     * @param weights - scoreCount weights for each weighted allele, one allele after the other (weightCount *
+     * scoreCount entries)
+     * @param weightCount - the number of weighted alleles
+     * @param scoreCount - the number of scores to compute
+     * @param threadCount - the number of threads to score with; each thread opens its own reader, and has its own
+     * copy of the scores
+     * @param scoreFlags - unsigned integer bitwise flags, with valid values drawn from {kScoreFlagNoMeanImpute}. By
+     * default a missing genotype contributes the weight times the mean dosage of the allele over the variant's
+     * non-missing samples, as for plink2 --score.
+     * @param scores - receives the scores, score major: score s of sample i is entry s * GetReaderSampleCount + i
+     */
+    void ComputeScores(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t *variantIndices,
+            const uint32_t *alleleIndices,
+            const double *weights,
+            const uint32_t weightCount,
+            const uint32_t scoreCount,
+            const uint32_t threadCount,
+            const uint32_t scoreFlags,
+            double *scores) {
+        if (threadCount == 0) {
+            throw PgenException("Invalid thread count (0); must be at least 1");
+        }
+        for (uint32_t widx = 0; widx != weightCount; ++widx) {
+            // PgrGet1D requires allele counts to decode a multi-allelic variant
+            const uint32_t allele_ct = RequireReadableVariant(pReaderContext, variantIndices[widx]);
+            if (alleleIndices[widx] >= allele_ct) {
+                char errMessageBuff[kErrMessageBufSize];
+                snprintf(errMessageBuff,
+                         kErrMessageBufSize,
+                         "Invalid allele index %u for weighted variant %u, which has %u alleles",
+                         alleleIndices[widx],
+                         variantIndices[widx],
+                         allele_ct);
+                throw PgenException(errMessageBuff);  // PgenException makes a copy of errMessageBuff
+            }
+        }
+        const uint32_t sample_ct = pReaderContext->sample_ct;
+        std::fill(scores, scores + static_cast<uintptr_t>(scoreCount) * sample_ct, 0.0);
+        if ((weightCount == 0) || (scoreCount == 0) || (sample_ct == 0)) {
+            return;
+        }
+
+        // read the weighted variants in pgen order, so each thread reads its slice of the pgen sequentially
+        std::vector<uint32_t> weight_order(weightCount);
+        std::iota(weight_order.begin(), weight_order.end(), 0);
+        std::stable_sort(weight_order.begin(), weight_order.end(), [variantIndices](uint32_t a, uint32_t b) {
+            return variantIndices[a] < variantIndices[b];
+        });
+        // the lookup adds the scores of two samples at a time, so each score's accumulators are padded to an even
+        // number of samples
+        const uintptr_t accumulator_stride = plink2::RoundUpPow2(sample_ct, 2);
+        const uint32_t thread_ct = SliceThreadCount(0, weightCount, threadCount);
+        std::vector<std::vector<double>> accumulators(
+                thread_ct, std::vector<double>(accumulator_stride * scoreCount, 0.0));
+        const bool mean_impute = !(scoreFlags & kScoreFlagNoMeanImpute);
+
+        // the weights are sliced like a variant range, with one "variant" per weighted allele
+        ForEachVariantSlice(
+                pReaderContext,
+                0,
+                weightCount,
+                threadCount,
+                "Error reading pgen dosages for scoring (PgrGet1D)",
+                [&](const uint32_t tidx, PgenThreadReader *pThreadReader, const uint32_t begin, const uint32_t end) {
+                    plink2::PgenVariant &pgv = pThreadReader->pgv;
+                    double *const thread_accumulators = accumulators[tidx].data();
+                    double table16x8bx2[32];
+                    STD_ARRAY_DECL(uint32_t, 4, genocounts);
+                    for (uint32_t oidx = begin; oidx != end; ++oidx) {
+                        const uint32_t widx = weight_order[oidx];
+                        uint32_t dosage_ct;
+                        const plink2::PglErr reterr = plink2::PgrGet1D(
+                                pReaderContext->sample_include,
+                                pThreadReader->pssi,
+                                sample_ct,
+                                variantIndices[widx],
+                                static_cast<plink2::AlleleCode>(alleleIndices[widx]),
+                                pThreadReader->pgrp,
+                                pgv.genovec,
+                                pgv.dosage_present,
+                                pgv.dosage_main,
+                                &dosage_ct);
+                        if (reterr != plink2::kPglRetSuccess) {
+                            return reterr;
+                        }
+                        // the lookup and the genotype counts read whole genovec words
+                        plink2::ZeroTrailingNyps(sample_ct, pgv.genovec);
+
+                        // the value a missing genotype contributes (per unit of weight)
+                        double missing_dosage = 0.0;
+                        if (mean_impute) {
+                            uint64_t dosage_sum = 0;
+                            if (dosage_ct != 0) {
+                                // the hardcalls of samples with a dosage are superseded by the dosage
+                                plink2::GenoarrCountInvsubsetFreqs2(
+                                        pgv.genovec, pgv.dosage_present, sample_ct, sample_ct - dosage_ct, genocounts);
+                                for (uint32_t didx = 0; didx != dosage_ct; ++didx) {
+                                    dosage_sum += pgv.dosage_main[didx];
+                                }
+                            } else {
+                                plink2::GenoarrCountFreqsUnsafe(pgv.genovec, sample_ct, genocounts);
+                            }
+                            const uint32_t nonmissing_ct = genocounts[0] + genocounts[1] + genocounts[2] + dosage_ct;
+                            if (nonmissing_ct != 0) {
+                                missing_dosage = (genocounts[1] + 2.0 * genocounts[2] +
+                                                  static_cast<double>(dosage_sum) * kRecipDosageMid) / nonmissing_ct;
+                            }
+                        }
+
+                        for (uint32_t sidx = 0; sidx != scoreCount; ++sidx) {
+                            const double weight = weights[static_cast<uintptr_t>(widx) * scoreCount + sidx];
+                            if (weight == 0.0) {
+                                continue;
+                            }
+                            // per genotype (0, 1 or 2 copies of the allele, or missing) score contributions
+                            table16x8bx2[0] = 0.0;
+                            table16x8bx2[2] = weight;
+                            table16x8bx2[4] = 2.0 * weight;
+                            table16x8bx2[6] = weight * missing_dosage;
+                            const double geno_contributions[4] = {
+                                    table16x8bx2[0], table16x8bx2[2], table16x8bx2[4], table16x8bx2[6] };
+                            plink2::InitLookup16x8bx2(table16x8bx2);
+                            double *const score_accumulators = &thread_accumulators[sidx * accumulator_stride];
+                            AddGenoarrLookup16x8bx2(pgv.genovec, table16x8bx2, sample_ct, score_accumulators);
+                            if (dosage_ct != 0) {
+                                // replace the hardcall contributions of the samples with a dosage
+                                const uint16_t *dosage_main_iter = pgv.dosage_main;
+                                uintptr_t sample_idx_base = 0;
+                                uintptr_t cur_bits = pgv.dosage_present[0];
+                                for (uint32_t didx = 0; didx != dosage_ct; ++didx) {
+                                    const uintptr_t sample_idx =
+                                            plink2::BitIter1(pgv.dosage_present, &sample_idx_base, &cur_bits);
+                                    score_accumulators[sample_idx] +=
+                                            weight * (*dosage_main_iter++) * kRecipDosageMid -
+                                            geno_contributions[plink2::GetNyparrEntry(pgv.genovec, sample_idx)];
+                                }
+                            }
+                        }
+                    }
+                    return plink2::kPglRetSuccess;
+                });
+
+        for (const std::vector<double> &thread_accumulators : accumulators) {
+            for (uint32_t sidx = 0; sidx != scoreCount; ++sidx) {
+                const double *score_accumulators = &thread_accumulators[sidx * accumulator_stride];
+                double *sample_scores = &scores[static_cast<uintptr_t>(sidx) * sample_ct];
+                for (uint32_t i = 0; i != sample_ct; ++i) {
+                    sample_scores[i] += score_accumulators[i];
+                }
+            }
+        }
+    }
+
+    // Add the InitLookup16x8bx2 table entry for each sample's genotype to its accumulator, two samples (one genovec
+    // nibble) at a time. genoarr must have zeroed trailing bits, and accumulators must be padded to an even number of
+    // samples.
+    static void AddGenoarrLookup16x8bx2(
+            const uintptr_t *genoarr,
+            const double *table16x8bx2,
+            const uint32_t sample_ct,
+            double *accumulators) {
+        const uint32_t word_ct = plink2::NypCtToWordCt(sample_ct);
+        double *accumulator_iter = accumulators;
+        for (uint32_t widx = 0; widx != word_ct; ++widx) {
+            uintptr_t geno_word = genoarr[widx];
+            const uint32_t pair_ct = (widx + 1 == word_ct) ?
+                    plink2::DivUp(sample_ct - widx * plink2::kBitsPerWordD2, 2) :
+                    plink2::kBitsPerWordD2 / 2;
+            for (uint32_t pidx = 0; pidx != pair_ct; ++pidx) {
+                const double *pair = &table16x8bx2[2 * (geno_word & 15)];
+                accumulator_iter[0] += pair[0];
+                accumulator_iter[1] += pair[1];
+                accumulator_iter += 2;
+                geno_word >>= 4;
+            }
+        }
+    }
+
+}
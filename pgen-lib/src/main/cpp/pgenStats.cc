@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "pgenException.h"
+#include "pgenUtils.h"
+#include "pgenReader.h"
+#include "pgenStats.h"
+#include "pgenVariantSlices.h"
+
+namespace pgenlib {
+    // plink2 dosages are in units of 1/16384 allele copies
+    static constexpr double kRecipDosageMid = 1.0 / 16384;
+
+    // the offset of a variant's first allele, in per allele arrays (see GetReaderAlleleIndexOffset)
+    static inline uint64_t AlleleIdxOffset(const uintptr_t *allele_idx_offsets, const uint32_t vidx) {
+        return allele_idx_offsets == nullptr ? 2 * static_cast<uint64_t>(vidx) : allele_idx_offsets[vidx];
+    }
+
+    static uint32_t RequireValidStatsArgs(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t threadCount,
+            const bool needAlleleCounts);
+    static uintptr_t *AllocCachealignedBits(const uint32_t bit_ct);
+
+    // Per sample counters for a stream of bitarrays. The counters are bit-sliced: kPlaneCt words hold the counts for
+    // the 64 samples of each bitarray word, one bit of every count per word, so adding a bitarray costs a few
+    // word-wide and/xor ops per word (usually one, since carries rarely propagate, and none for an all-zero word)
+    // rather than an op per set bit. The counts are flushed to 32-bit totals before they can overflow the planes.
+    class BitSlicedCounter {
+        public:
+            explicit BitSlicedCounter(const uint32_t bit_ct) :
+                    bit_ct(bit_ct),
+                    planes(plink2::BitCtToWordCt(bit_ct) * kPlaneCt, 0),
+                    totals(bit_ct, 0),
+                    pending_ct(0) {}
+
+            void Add(const uintptr_t *bitarr) {
+                const uint32_t word_ct = plink2::BitCtToWordCt(bit_ct);
+                uintptr_t *plane_iter = planes.data();
+                for (uint32_t widx = 0; widx != word_ct; ++widx, plane_iter += kPlaneCt) {
+                    uintptr_t carry = bitarr[widx];
+                    for (uint32_t pidx = 0; carry; ++pidx) {
+                        const uintptr_t next_carry = plane_iter[pidx] & carry;
+                        plane_iter[pidx] ^= carry;
+                        carry = next_carry;
+                    }
+                }
+                if (++pending_ct == kMaxPendingCt) {
+                    Flush();
+                }
+            }
+
+            // add the pending counts to the totals, and return the totals
+            const std::vector<uint32_t> &Totals() {
+                Flush();
+                return totals;
+            }
+
+        private:
+            static constexpr uint32_t kPlaneCt = 8;
+            static constexpr uint32_t kMaxPendingCt = (1U << kPlaneCt) - 1;
+            const uint32_t bit_ct;
+            std::vector<uintptr_t> planes;   // kPlaneCt words per bitarray word
+            std::vector<uint32_t> totals;
+            uint32_t pending_ct;
+
+            void Flush() {
+                const uint32_t word_ct = plink2::BitCtToWordCt(bit_ct);
+                uintptr_t *plane_iter = planes.data();
+                for (uint32_t widx = 0; widx != word_ct; ++widx, plane_iter += kPlaneCt) {
+                    uintptr_t any_bits = 0;
+                    for (uint32_t pidx = 0; pidx != kPlaneCt; ++pidx) {
+                        any_bits |= plane_iter[pidx];
+                    }
+                    while (any_bits) {
+                        const uint32_t bidx = plink2::ctzw(any_bits);
+                        uint32_t count = 0;
+                        for (uint32_t pidx = 0; pidx != kPlaneCt; ++pidx) {
+                            count |= static_cast<uint32_t>((plane_iter[pidx] >> bidx) & 1) << pidx;
+                        }
+                        totals[widx * plink2::kBitsPerWord + bidx] += count;
+                        any_bits &= any_bits - 1;
+                    }
+                    std::fill(plane_iter, plane_iter + kPlaneCt, 0);
+                }
+                pending_ct = 0;
+            }
+    };
+
+    /**
+     * Count the genotypes, and the alleles, of each variant in the range [variantStart, variantEnd), without
+     * decoding the variants. Only the reader's samples (see GetReaderSampleCount) are counted.
+     * @param pReaderContext - the PgenReaderContext for the reader
+     * @param variantStart - the first variant to count
+     * @param variantEnd - one past the last variant to count
+     * @param threadCount - the number of threads to count with; each thread opens its own reader
+     * @param genotype_counts - receives 4 counts per variant (4 * (variantEnd - variantStart) entries): the number of
+     * hom ref genotypes, het genotypes with one ref allele, genotypes with two alt alleles (hom alt, or a het with two
+     * different alt alleles for a multi-allelic variant), and missing genotypes. Dosages (if any) are ignored.
+     * @param allele_dosages - receives the total dosage, in allele copies, of each allele of each variant (see
+     * GetReaderAlleleIndexOffset: variant v's alleles start at entry GetReaderAlleleIndexOffset(v) -
+     * GetReaderAlleleIndexOffset(variantStart)). These are hardcall allele counts unless the pgen has dosages,
+     * in which case they're the dosage sums that plink2 --freq reports. may be null.
+     */
+    void ComputeAlleleCounts(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t threadCount,
+            uint32_t *genotype_counts,
+            double *allele_dosages) {
+        RequireValidStatsArgs(pReaderContext, variantStart, variantEnd, threadCount, true);
+        const uintptr_t *allele_idx_offsets = pReaderContext->allele_idx_offsets;
+        const uint64_t allele_idx_start = AlleleIdxOffset(allele_idx_offsets, variantStart);
+        const uint32_t max_allele_ct = pReaderContext->pgfip->max_allele_ct;
+        ForEachVariantSlice(
+                pReaderContext,
+                variantStart,
+                variantEnd,
+                threadCount,
+                "Error counting pgen genotypes (PgrGetMDCounts)",
+                [&](const uint32_t, PgenThreadReader *pThreadReader, const uint32_t begin, const uint32_t end) {
+                    std::vector<uint64_t> all_dosages(max_allele_ct);
+                    STD_ARRAY_DECL(uint32_t, 4, genocounts);
+                    uint32_t het_ct;
+                    for (uint32_t vidx = begin; vidx != end; ++vidx) {
+                        const plink2::PglErr reterr = plink2::PgrGetMDCounts(
+                                pReaderContext->sample_include,
+                                pReaderContext->sample_include_interleaved_vec,
+                                pThreadReader->pssi,
+                                pReaderContext->sample_ct,
+                                vidx,
+                                0,  // is_minimac3_r2
+                                pThreadReader->pgrp,
+                                nullptr,
+                                &het_ct,
+                                genocounts,
+                                all_dosages.data());
+                        if (reterr != plink2::kPglRetSuccess) {
+                            return reterr;
+                        }
+                        std::copy(&genocounts[0], &genocounts[4], &genotype_counts[(vidx - variantStart) * 4]);
+                        if (allele_dosages != nullptr) {
+                            const uint64_t allele_idx = AlleleIdxOffset(allele_idx_offsets, vidx);
+                            const uint32_t allele_ct =
+                                    static_cast<uint32_t>(AlleleIdxOffset(allele_idx_offsets, vidx + 1) - allele_idx);
+                            double *variant_dosages = &allele_dosages[allele_idx - allele_idx_start];
+                            for (uint32_t aidx = 0; aidx != allele_ct; ++aidx) {
+                                variant_dosages[aidx] = static_cast<double>(all_dosages[aidx]) * kRecipDosageMid;
+                            }
+                        }
+                    }
+                    return plink2::kPglRetSuccess;
+                });
+    }
+
+    /**
+     * Count the missing genotypes of each variant, and of each sample, in the range [variantStart, variantEnd),
+     * without decoding the variants. Only the reader's samples (see GetReaderSampleCount) are counted.
+     * @param pReaderContext - the PgenReaderContext for the reader
+     * @param variantStart - the first variant to count
+     * @param variantEnd - one past the last variant to count
+     * @param threadCount - the number of threads to count with; each thread opens its own reader
+     * @param missingnessFlags - unsigned integer bitwise flags, with valid values drawn from
+     * {kMissingnessFlagDosage}. By default a genotype is missing if it has no hardcall, as for plink2 --missing;
+     * with kMissingnessFlagDosage, a genotype with a dosage (but no hardcall) isn't missing.
+     * @param variant_missing_cts - receives the number of missing genotypes of each variant (variantEnd -
+     * variantStart entries). may be null.
+     * @param sample_missing_cts - receives the number of variants in the range for which each sample is missing
+     * (GetReaderSampleCount entries). may be null.
+     */
+    void ComputeMissingness(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t threadCount,
+            const uint32_t missingnessFlags,
+            uint32_t *variant_missing_cts,
+            uint32_t *sample_missing_cts) {
+        const bool dosage_missingness = missingnessFlags & kMissingnessFlagDosage;
+        RequireValidStatsArgs(pReaderContext, variantStart, variantEnd, threadCount, dosage_missingness);
+        const uint32_t sample_ct = pReaderContext->sample_ct;
+        const uint32_t thread_ct = SliceThreadCount(variantStart, variantEnd, threadCount);
+
+        // PgrGetMissingnessD requires a sample_include, even if all samples are read
+        const uintptr_t *sample_include = pReaderContext->sample_include;
+        std::unique_ptr<uintptr_t, void (*)(void *)> all_samples(nullptr, plink2::aligned_free);
+        if (dosage_missingness && (sample_include == nullptr)) {
+            all_samples.reset(AllocCachealignedBits(sample_ct));
+            plink2::SetAllBits(sample_ct, all_samples.get());
+            sample_include = all_samples.get();
+        }
+        // the missingness bitarrays must be vector aligned, and zero padded to a whole word
+        std::vector<std::unique_ptr<uintptr_t, void (*)(void *)>> missingness;
+        std::vector<std::unique_ptr<BitSlicedCounter>> sample_counters;
+        for (uint32_t tidx = 0; tidx != thread_ct; ++tidx) {
+            missingness.emplace_back(AllocCachealignedBits(sample_ct), plink2::aligned_free);
+            if (sample_missing_cts != nullptr) {
+                sample_counters.emplace_back(new BitSlicedCounter(sample_ct));
+            }
+        }
+
+        ForEachVariantSlice(
+                pReaderContext,
+                variantStart,
+                variantEnd,
+                threadCount,
+                "Error reading pgen missingness (PgrGetMissingness)",
+                [&](const uint32_t tidx, PgenThreadReader *pThreadReader, const uint32_t begin, const uint32_t end) {
+                    uintptr_t *const thread_missingness = missingness[tidx].get();
+                    for (uint32_t vidx = begin; vidx != end; ++vidx) {
+                        const plink2::PglErr reterr = dosage_missingness ?
+                                plink2::PgrGetMissingnessD(
+                                        sample_include,
+                                        pThreadReader->pssi,
+                                        sample_ct,
+                                        vidx,
+                                        pThreadReader->pgrp,
+                                        nullptr,
+                                        thread_missingness,
+                                        nullptr,
+                                        pThreadReader->pgv.genovec) :
+                                plink2::PgrGetMissingness(
+                                        sample_include,
+                                        pThreadReader->pssi,
+                                        sample_ct,
+                                        vidx,
+                                        pThreadReader->pgrp,
+                                        thread_missingness,
+                                        pThreadReader->pgv.genovec);
+                        if (reterr != plink2::kPglRetSuccess) {
+                            return reterr;
+                        }
+                        if (variant_missing_cts != nullptr) {
+                            variant_missing_cts[vidx - variantStart] = static_cast<uint32_t>(
+                                    plink2::PopcountWords(thread_missingness, plink2::BitCtToWordCt(sample_ct)));
+                        }
+                        if (sample_missing_cts != nullptr) {
+                            sample_counters[tidx]->Add(thread_missingness);
+                        }
+                    }
+                    return plink2::kPglRetSuccess;
+                });
+
+        if (sample_missing_cts != nullptr) {
+            std::fill(sample_missing_cts, sample_missing_cts + sample_ct, 0);
+            for (const std::unique_ptr<BitSlicedCounter> &counter : sample_counters) {
+                const std::vector<uint32_t> &totals = counter->Totals();
+                for (uint32_t sidx = 0; sidx != sample_ct; ++sidx) {
+                    sample_missing_cts[sidx] += totals[sidx];
+                }
+            }
+        }
+    }
+
+    // allocate a zeroed, cacheline aligned bitarray; the caller must release it with plink2::aligned_free
+    static uintptr_t *AllocCachealignedBits(const uint32_t bit_ct) {
+        const uintptr_t byte_ct = plink2::BitCtToCachelineCt(bit_ct) * plink2::kCacheline;
+        uintptr_t *bitarr;
+        if (plink2::cachealigned_malloc(byte_ct, &bitarr)) {
+            throw PgenException("Native code failure (cachealigned_malloc) allocating bitarray");
+        }
+        memset(bitarr, 0, byte_ct);
+        return bitarr;
+    }
+
+    // Throw if the range or thread count isn't valid, or (if needAlleleCounts) the range contains a multi-allelic
+    // variant that can't be read; otherwise return the number of variants in the range.
+    static uint32_t RequireValidStatsArgs(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t threadCount,
+            const bool needAlleleCounts) {
+        RequireValidVariantRange(pReaderContext, variantStart, variantEnd);
+        if (threadCount == 0) {
+            throw PgenException("Invalid thread count (0); must be at least 1");
+        }
+        // the plink2 counting routines use the allele counts to parse multi-allelic records (missingness only needs
+        // them to skip over the multi-allelic part of a record to its dosages)
+        if (needAlleleCounts && (pReaderContext->allele_idx_offsets == nullptr)) {
+            for (uint32_t vidx = variantStart; vidx != variantEnd; ++vidx) {
+                RequireReadableVariant(pReaderContext, vidx);
+            }
+        }
+        return variantEnd - variantStart;
+    }
+
+}
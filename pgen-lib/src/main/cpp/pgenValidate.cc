@@ -0,0 +1,368 @@
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "pgenException.h"
+#include "pgenUtils.h"
+#include "pgenReader.h"
+#include "pgenReadInternals.h"
+#include "pgenValidate.h"
+#include "pgenVariantSlices.h"
+
+namespace pgenlib {
+    static_assert(plink2::kPglVblockSize == 65536, "ValidatePgenHeader assumes 65536 variant vblocks");
+
+    // the file-scope accessor for the private plink2 reader state (see GET_PRIVATE in plink2_base.h)
+    static plink2::PgenReaderMain *GetPgrp(plink2::PgenReader *pgr_ptr) {
+        return &GET_PRIVATE(*pgr_ptr, m);
+    }
+
+    static bool ValidatePgenHeader(
+            const PgenReaderContext *const pReaderContext,
+            FILE *ff,
+            PgenValidationResult *pResult);
+    static plink2::PglErr ValidateVariantSlice(
+            const PgenReaderContext *const pReaderContext,
+            PgenThreadReader *pThreadReader,
+            const uint32_t begin,
+            const uint32_t end,
+            std::atomic<uint32_t> *first_invalid_vidx,
+            PgenValidationResult *pResult);
+
+    /**
+     * Validate the reader's .pgen: the header and variant record index (as far as it isn't already validated when
+     * the reader is opened), and every variant record, as for plink2 --validate. The variant records are split across
+     * threads, and once a thread finds an invalid record, every thread skips the records that follow it, so an
+     * invalid file is usually rejected quickly; the first invalid record is the one reported.
+     *
+     * Multiallelic variant records can only be validated if the allele counts are known, so a .pgen with multiallelic
+     * variants must either store the allele counts in its header, or be opened with the allele counts.
+     * @param pReaderContext - the PgenReaderContext for the reader
+     * @param threadCount - the number of threads to validate the variant records with; each thread opens its own
+     * reader
+     * @param pResult - receives the first problem found, if the .pgen is invalid
+     * @return true if the .pgen is valid
+     */
+    bool ValidatePgen(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t threadCount,
+            PgenValidationResult *pResult) {
+        if (threadCount == 0) {
+            throw PgenException("Invalid thread count (0); must be at least 1");
+        }
+        pResult->variant_index = kValidateNoVariant;
+        pResult->byte_offset = 0;
+        pResult->message[0] = '\0';
+
+        FILE *ff = fopen(pReaderContext->pgen_fname, "rb");
+        if (ff == nullptr) {
+            throwOnPglErr(plink2::kPglRetOpenFail, "Error opening pgen file for validation");
+        }
+        bool header_valid;
+        try {
+            header_valid = ValidatePgenHeader(pReaderContext, ff, pResult);
+        } catch (const PgenException &) {
+            fclose(ff);
+            throw;
+        }
+        fclose(ff);
+        if (!header_valid) {
+            return false;
+        }
+
+        // each slice reports the first invalid record it finds in its own result, and lowers first_invalid_vidx (so
+        // the slices after it can stop); the lowest one is the first invalid record in the file
+        const uint32_t variant_ct = pReaderContext->raw_variant_ct;
+        std::atomic<uint32_t> first_invalid_vidx(kValidateNoVariant);
+        std::vector<PgenValidationResult> slice_results(SliceThreadCount(0, variant_ct, threadCount));
+        ForEachVariantSlice(
+                pReaderContext,
+                0,
+                variant_ct,
+                threadCount,
+                "Error reading variant records for validation",
+                [&](const uint32_t tidx,
+                    PgenThreadReader *pThreadReader,
+                    const uint32_t begin,
+                    const uint32_t end) -> plink2::PglErr {
+                    slice_results[tidx].variant_index = kValidateNoVariant;
+                    return ValidateVariantSlice(
+                            pReaderContext,
+                            pThreadReader,
+                            begin,
+                            end,
+                            &first_invalid_vidx,
+                            &slice_results[tidx]);
+                });
+        for (const PgenValidationResult &slice_result : slice_results) {
+            if (slice_result.variant_index != kValidateNoVariant) {
+                // the slices are in variant order
+                *pResult = slice_result;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Copy a plink2 validation message (errstr_buf) into pResult, without plink2's "Error: " prefix and trailing
+    // newline. Returns false, for the validators to return.
+    static bool ReportInvalid(
+            PgenValidationResult *pResult,
+            const uint32_t variantIndex,
+            const uint64_t byteOffset,
+            const char *errstr_buf) {
+        static const char kErrorPrefix[] = "Error: ";
+        if (strncmp(errstr_buf, kErrorPrefix, sizeof(kErrorPrefix) - 1) == 0) {
+            errstr_buf += sizeof(kErrorPrefix) - 1;
+        }
+        pResult->variant_index = variantIndex;
+        pResult->byte_offset = byteOffset;
+        snprintf(pResult->message, sizeof(pResult->message), "%s", errstr_buf);
+        const size_t message_len = strlen(pResult->message);
+        if ((message_len != 0) && (pResult->message[message_len - 1] == '\n')) {
+            pResult->message[message_len - 1] = '\0';
+        }
+        return false;
+    }
+
+    // lower the first invalid variant index to vidx, if it's lower
+    static void LowerFirstInvalidVariant(std::atomic<uint32_t> *first_invalid_vidx, const uint32_t vidx) {
+        uint32_t current = first_invalid_vidx->load();
+        while ((vidx < current) && !first_invalid_vidx->compare_exchange_weak(current, vidx)) {
+        }
+    }
+
+    static void ReadPgenHeaderBytes(FILE *ff, const uint64_t offset, const size_t byteCount, void *buf) {
+        if ((fseeko(ff, static_cast<off_t>(offset), SEEK_SET) != 0) || (fread(buf, byteCount, 1, ff) != 1)) {
+            throwOnPglErr(plink2::kPglRetReadFail, "Error reading pgen header for validation");
+        }
+    }
+
+    // The header and index checks of PgrValidate, which need only the header and the size of the file.
+    static bool ValidatePgenHeader(
+            const PgenReaderContext *const pReaderContext,
+            FILE *ff,
+            PgenValidationResult *pResult) {
+        const plink2::PgenFileInfo *const pgfip = pReaderContext->pgfip;
+        const uint32_t variant_ct = pgfip->raw_variant_ct;
+        const uint32_t const_vrtype = pgfip->const_vrtype;
+        char errstr_buf[plink2::kPglErrstrBufBlen];
+        if (const_vrtype != UINT32_MAX) {
+            // the fixed-width formats have no index; only their records (which are validated by slice) can be
+            // invalid
+            const uintptr_t *const allele_idx_offsets = pgfip->allele_idx_offsets;
+            if (allele_idx_offsets && (allele_idx_offsets[variant_ct] != 2 * variant_ct)) {
+                snprintf(errstr_buf,
+                         plink2::kPglErrstrBufBlen,
+                         "The allele counts include multiallelic variant(s), but the .%s file does not.",
+                         (const_vrtype == plink2::kPglVrtypePlink1) ? "bed" : "pgen");
+                return ReportInvalid(pResult, kValidateNoVariant, 0, errstr_buf);
+            }
+            if (const_vrtype && (const_vrtype != plink2::kPglVrtypePlink1)) {
+                throwOnPglErr(plink2::kPglRetNotYetSupported,
+                              "Validation of fixed-width dosage formats is not implemented");
+            }
+            return true;
+        }
+
+        const unsigned char *const vrtypes = pgfip->vrtypes;
+        for (uint32_t vidx = 0; vidx < variant_ct; vidx += plink2::kPglVblockSize) {
+            if (plink2::VrtypeLdCompressed(vrtypes[vidx])) {
+                snprintf(errstr_buf,
+                         plink2::kPglErrstrBufBlen,
+                         "(0-based) variant #%u is LD-compressed; this is prohibited when the variant index is a "
+                         "multiple of 65536.",
+                         vidx);
+                return ReportInvalid(pResult, vidx, plink2::GetPgfiFpos(pgfip, vidx), errstr_buf);
+            }
+        }
+        if (fseeko(ff, 0, SEEK_END) != 0) {
+            throwOnPglErr(plink2::kPglRetReadFail, "Error reading pgen file size for validation");
+        }
+        const uint64_t fsize = static_cast<uint64_t>(ftello(ff));
+        const uint64_t expected_fsize = plink2::GetPgfiFpos(pgfip, variant_ct);
+        if (expected_fsize != fsize) {
+            snprintf(errstr_buf,
+                     plink2::kPglErrstrBufBlen,
+                     ".pgen header indicates that file size should be %llu bytes, but actual file size is %llu bytes.",
+                     static_cast<unsigned long long>(expected_fsize),
+                     static_cast<unsigned long long>(fsize));
+            return ReportInvalid(pResult, kValidateNoVariant, std::min(expected_fsize, fsize), errstr_buf);
+        }
+
+        const uint32_t vblock_ct = plink2::DivUp(variant_ct, plink2::kPglVblockSize);
+        unsigned char header_ctrl;
+        ReadPgenHeaderBytes(ff, 11, 1, &header_ctrl);
+        std::vector<uint64_t> vblock_start_fpos(vblock_ct);
+        ReadPgenHeaderBytes(ff, 12, vblock_ct * sizeof(uint64_t), vblock_start_fpos.data());
+        for (uint32_t vblock_idx = 0; vblock_idx != vblock_ct; ++vblock_idx) {
+            if (vblock_start_fpos[vblock_idx] != plink2::GetPgfiFpos(pgfip, vblock_idx * plink2::kPglVblockSize)) {
+                snprintf(errstr_buf,
+                         plink2::kPglErrstrBufBlen,
+                         ".pgen header vblock-start index is inconsistent with variant record length index.");
+                return ReportInvalid(pResult, kValidateNoVariant, 12 + vblock_idx * sizeof(uint64_t), errstr_buf);
+            }
+        }
+
+        // the unused (trailing) bits of the last vblock's vrtypes must be zero
+        const uint32_t vrtype_and_fpos_storage = header_ctrl & 15;
+        const uint32_t alt_allele_ct_byte_ct = (header_ctrl >> 4) & 3;
+        uint64_t vblock_index_byte_ct =
+                plink2::kPglVblockSize * (1 + (vrtype_and_fpos_storage & 3) + alt_allele_ct_byte_ct);
+        if ((header_ctrl >> 6) == 3) {
+            vblock_index_byte_ct += plink2::kPglVblockSize / CHAR_BIT;
+        }
+        // the vrtypes of the last vblock start at last_vblock_index_fpos
+        uint64_t last_vrtype_byte_offset = 0;
+        uint32_t trailing_shift = 4;
+        if (vrtype_and_fpos_storage & 8) {
+            vblock_index_byte_ct += plink2::kPglVblockSize >> (10 - vrtype_and_fpos_storage);
+        } else if (!(vrtype_and_fpos_storage & 4)) {
+            vblock_index_byte_ct += plink2::kPglVblockSize / 2;
+        }
+        const uint64_t last_vblock_index_fpos =
+                20 + static_cast<uint64_t>(vblock_ct - 1) * (vblock_index_byte_ct + sizeof(int64_t));
+        if (vrtype_and_fpos_storage == 8) {
+            const uint32_t variant_ct_mod4 = variant_ct % 4;
+            if (variant_ct_mod4) {
+                last_vrtype_byte_offset = last_vblock_index_fpos + ((variant_ct % plink2::kPglVblockSize) / 4);
+                trailing_shift = variant_ct_mod4 * 2;
+            }
+        } else if (((vrtype_and_fpos_storage == 9) || !(vrtype_and_fpos_storage & 12)) && (variant_ct % 2)) {
+            last_vrtype_byte_offset = last_vblock_index_fpos + ((variant_ct % plink2::kPglVblockSize) / 2);
+        }
+        if (last_vrtype_byte_offset) {
+            unsigned char last_vrtype_byte;
+            ReadPgenHeaderBytes(ff, last_vrtype_byte_offset, 1, &last_vrtype_byte);
+            if (last_vrtype_byte >> trailing_shift) {
+                snprintf(errstr_buf, plink2::kPglErrstrBufBlen, "Nonzero trailing bits in last vrtype index byte.");
+                return ReportInvalid(pResult, kValidateNoVariant, last_vrtype_byte_offset, errstr_buf);
+            }
+        }
+        const uintptr_t *const nonref_flags = pgfip->nonref_flags;
+        if (nonref_flags && (variant_ct % CHAR_BIT)) {
+            if (nonref_flags[variant_ct / plink2::kBitsPerWord] >> (variant_ct % plink2::kBitsPerWord)) {
+                snprintf(errstr_buf, plink2::kPglErrstrBufBlen, "Nonzero trailing bits in last nonref_flags byte.");
+                return ReportInvalid(pResult, kValidateNoVariant, 0, errstr_buf);
+            }
+        }
+        return true;
+    }
+
+    // Validate the records of the variants in [begin, end) (the record loop of PgrValidate), and report the first
+    // invalid one in pResult. Runs on a worker thread, so it doesn't throw.
+    static plink2::PglErr ValidateVariantSlice(
+            const PgenReaderContext *const pReaderContext,
+            PgenThreadReader *pThreadReader,
+            const uint32_t begin,
+            const uint32_t end,
+            std::atomic<uint32_t> *first_invalid_vidx,
+            PgenValidationResult *pResult) {
+        plink2::PgenReaderMain *const pgrp = GetPgrp(pThreadReader->pgrp);
+        const plink2::PgenFileInfo *const pgfip = pReaderContext->pgfip;
+        const uint32_t sample_ct = pgfip->raw_sample_ct;
+        const uint32_t const_vrtype = pgfip->const_vrtype;
+        uintptr_t *const genovec = pThreadReader->pgv.genovec;
+        char errstr_buf[plink2::kPglErrstrBufBlen];
+
+        if (const_vrtype != UINT32_MAX) {
+            // a fixed-width hardcall record can only be invalid in the trailing bits of its last byte
+            const uint32_t dbl_sample_ct_mod4 = 2 * (sample_ct % 4);
+            if (!dbl_sample_ct_mod4) {
+                return plink2::kPglRetSuccess;
+            }
+            for (uint32_t vidx = begin; (vidx != end) && (vidx < first_invalid_vidx->load()); ++vidx) {
+                const unsigned char *fread_ptr;
+                const unsigned char *fread_end = nullptr;
+                if (plink2::InitReadPtrs(vidx, pgrp, &fread_ptr, &fread_end)) {
+                    return plink2::kPglRetReadFail;
+                }
+                if (fread_end[-1] >> dbl_sample_ct_mod4) {
+                    snprintf(errstr_buf,
+                             plink2::kPglErrstrBufBlen,
+                             "Last byte of (0-based) variant #%u has nonzero trailing bits.",
+                             vidx);
+                    ReportInvalid(pResult, vidx, plink2::GetPgfiFpos(pgfip, vidx), errstr_buf);
+                    LowerFirstInvalidVariant(first_invalid_vidx, vidx);
+                    return plink2::kPglRetSuccess;
+                }
+            }
+            return plink2::kPglRetSuccess;
+        }
+
+        // an LD-compressed record is validated against the genotypes of the record before it, so the slice starts
+        // at the last record before begin that isn't LD-compressed (the one at the start of the vblock, at worst);
+        // problems before begin belong to the previous slice, and aren't reported here
+        const unsigned char *const vrtypes = pgfip->vrtypes;
+        const uintptr_t *const allele_idx_offsets = pgfip->allele_idx_offsets;
+        uint32_t first_vidx = begin;
+        while ((first_vidx % plink2::kPglVblockSize) && plink2::VrtypeLdCompressed(vrtypes[first_vidx])) {
+            --first_vidx;
+        }
+        // force a seek when the first record is read
+        pgrp->fp_vidx = first_vidx + 1;
+        uint32_t allele_ct = 2;
+        for (uint32_t vidx = first_vidx; (vidx != end) && (vidx < first_invalid_vidx->load()); ++vidx) {
+            const unsigned char *fread_ptr;
+            const unsigned char *fread_end;
+            if (plink2::InitReadPtrs(vidx, pgrp, &fread_ptr, &fread_end)) {
+                return plink2::kPglRetReadFail;
+            }
+            const unsigned char *const fread_ptr_start = fread_ptr;
+            const uint32_t vrtype = vrtypes[vidx];
+            bool invalid = static_cast<bool>(plink2::ValidateGeno(fread_end, vidx, pgrp, &fread_ptr, genovec, errstr_buf));
+            if (!invalid) {
+                plink2::ZeroTrailingNyps(sample_ct, genovec);
+                uint32_t het_ct = plink2::CountNyp(genovec, plink2::kMask5555, sample_ct);
+                if (allele_idx_offsets) {
+                    allele_ct = allele_idx_offsets[vidx + 1] - allele_idx_offsets[vidx];
+                }
+                if (plink2::VrtypeMultiallelicHc(vrtype)) {
+                    invalid = static_cast<bool>(plink2::ValidateMultiallelicHc(
+                            fread_end, genovec, vidx, allele_ct, pgrp, &fread_ptr, &het_ct, errstr_buf));
+                }
+                if (!invalid && plink2::VrtypeHphase(vrtype)) {
+                    invalid = static_cast<bool>(plink2::ValidateHphase(fread_end, vidx, het_ct, &fread_ptr, errstr_buf));
+                }
+                if (!invalid && (vrtype & 0xe0)) {
+                    if ((vrtype & 0xe0) == 0x80) {
+                        snprintf(errstr_buf,
+                                 plink2::kPglErrstrBufBlen,
+                                 "Invalid record type for (0-based) variant #%u (phased dosage bit set, but main "
+                                 "dosage bits unset).",
+                                 vidx);
+                        invalid = true;
+                    } else {
+                        const plink2::PglErr reterr =
+                                plink2::ValidateDosage16(fread_end, vidx, pgrp, &fread_ptr, errstr_buf);
+                        if (reterr == plink2::kPglRetReadFail) {
+                            return reterr;
+                        }
+                        invalid = (reterr != plink2::kPglRetSuccess);
+                    }
+                }
+                if (!invalid && (fread_ptr != fread_end)) {
+                    snprintf(errstr_buf,
+                             plink2::kPglErrstrBufBlen,
+                             "Extra byte(s) in (0-based) variant record #%u. (record type = %u; expected length = "
+                             "%lu, actual = %lu)",
+                             vidx,
+                             vrtype,
+                             static_cast<unsigned long>(fread_ptr - fread_ptr_start),
+                             static_cast<unsigned long>(fread_end - fread_ptr_start));
+                    invalid = true;
+                }
+            }
+            if (invalid && (vidx >= begin)) {
+                ReportInvalid(pResult, vidx, plink2::GetPgfiFpos(pgfip, vidx), errstr_buf);
+                LowerFirstInvalidVariant(first_invalid_vidx, vidx);
+                return plink2::kPglRetSuccess;
+            }
+        }
+        return plink2::kPglRetSuccess;
+    }
+
+}
@@ -0,0 +1,106 @@
+//
+
+#ifndef PGEN_LIB_PGENWRITERINTERNALS_H
+#define PGEN_LIB_PGENWRITERINTERNALS_H
+
+#include "pgenlib_misc.h"
+#include "pgenlib_write.h"
+
+// Private (not part of the public API) accessors for plink2 pgen writer state that pgenlib_write.h doesn't expose
+// through its documented functions. All such access is made through this header, so a pgenlib update only needs to
+// be re-verified against these accessors (and the tests that exercise them). No other file should use GET_PRIVATE on
+// a pgen writer.
+namespace pgenlib {
+
+    // the vendored pgenlib version that the accessors below were verified against
+    constexpr uint32_t kWriterInternalsPgenlibVernum = 1908;
+    static_assert(PGENLIB_INTERNAL_VERNUM == kWriterInternalsPgenlibVernum,
+                  "the vendored pgenlib has changed; re-verify the accessors in pgenWriterInternals.h");
+
+    // Make the next MpgwFlush the last one, finishing the file with variant_ct variants (which must be no greater
+    // than the declared count, and not for kPgenWriteBackwardSeek, where the header is sized for the declared
+    // count). MpgwFlush recognizes the last flush by comparing the first thread's position to variant_ct_limit, and
+    // then writes that many variants into the index. Exercised by TestMultiThreadedDroppedVariants.
+    inline void MpgwSetFinalVariantCt(plink2::MTPgenWriter *mpgwp, const uint32_t variant_ct) {
+        mpgwp->pwcs[0]->variant_ct_limit = variant_ct;
+    }
+
+    // the number of bytes in a multi-threaded writer thread's fwrite buffer
+    inline uintptr_t PwcGetFwriteByteCt(const plink2::PgenWriterCommon *pwcp) {
+        return static_cast<uintptr_t>(pwcp->fwrite_bufp - pwcp->fwrite_buf);
+    }
+
+    // Replace a multi-threaded writer thread's fwrite buffer with fwrite_buf, whose first used_byte_ct bytes are
+    // already filled, so each block can be compressed into a buffer sized for it rather than for the largest possible
+    // block. MpgwFlush writes each thread's buffer from fwrite_buf to fwrite_bufp. Exercised by
+    // TestMultiThreadedChunkedStagingMatches.
+    inline void PwcSetFwriteBuf(
+            plink2::PgenWriterCommon *pwcp,
+            unsigned char *fwrite_buf,
+            const uintptr_t used_byte_ct) {
+        pwcp->fwrite_buf = fwrite_buf;
+        pwcp->fwrite_bufp = &fwrite_buf[used_byte_ct];
+    }
+
+    // Raw record appends for the single-threaded writer, which the record copier (pgenRecordCopy.cc) uses to write
+    // variant records that are already encoded: the record bytes are placed in the writer's fwrite buffer (and
+    // flushed with SpgwFlush, as the writer's own appends are), and the record's index entries are added with
+    // SpgwAppendRecordIndexEntry. Exercised by TestSpgwRawRecordAppend.
+
+    // the variant count the writer was opened with
+    inline uint32_t SpgwGetVariantCtLimit(const plink2::STPgenWriter *spgwp) {
+        return GET_PRIVATE(*spgwp, pwc).variant_ct_limit;
+    }
+
+    // the file position of the next record, i.e. of the first byte not yet placed in the fwrite buffer
+    inline uint64_t SpgwGetNextRecordFpos(const plink2::STPgenWriter *spgwp) {
+        const plink2::PgenWriterCommon &pwc = GET_PRIVATE(*spgwp, pwc);
+        return pwc.vblock_fpos_offset + static_cast<uintptr_t>(pwc.fwrite_bufp - pwc.fwrite_buf);
+    }
+
+    // the number of bytes in the fwrite buffer (SpgwFlush writes them out once there are at least
+    // kPglFwriteBlockSize), and where the next ones go
+    inline uintptr_t SpgwGetFwriteByteCt(const plink2::STPgenWriter *spgwp) {
+        const plink2::PgenWriterCommon &pwc = GET_PRIVATE(*spgwp, pwc);
+        return static_cast<uintptr_t>(pwc.fwrite_bufp - pwc.fwrite_buf);
+    }
+    inline unsigned char *SpgwGetFwriteBufp(plink2::STPgenWriter *spgwp) {
+        return GET_PRIVATE(*spgwp, pwc).fwrite_bufp;
+    }
+
+    // mark byte_ct bytes, placed at SpgwGetFwriteBufp, as added to the fwrite buffer
+    inline void SpgwAdvanceFwriteBufp(plink2::STPgenWriter *spgwp, const uintptr_t byte_ct) {
+        plink2::PgenWriterCommon &pwc = GET_PRIVATE(*spgwp, pwc);
+        pwc.fwrite_bufp = &pwc.fwrite_bufp[byte_ct];
+    }
+
+    // Add the index entries (record length, vrtype, and the vblock file position if the record starts a vblock) of
+    // the next record, which starts at file position record_fpos, and advance to the next variant. The caller checks
+    // that the writer's variant count and maximum record length aren't exceeded. Returns 1 (without adding anything)
+    // if the vrtype has phase or dosage bits, which a writer without phase or dosage tracks can't store.
+    inline plink2::BoolErr SpgwAppendRecordIndexEntry(
+            plink2::STPgenWriter *spgwp,
+            const uint32_t vrec_len,
+            const uint32_t vrtype,
+            const uint64_t record_fpos) {
+        plink2::PgenWriterCommon &pwc = GET_PRIVATE(*spgwp, pwc);
+        const uint32_t vidx = pwc.vidx;
+        if (!pwc.phase_dosage_gflags) {
+            if (vrtype & 0xf0) {
+                return 1;
+            }
+            pwc.vrtype_buf[vidx / plink2::kBitsPerWordD4] |=
+                    static_cast<uintptr_t>(vrtype) << (4 * (vidx % plink2::kBitsPerWordD4));
+        } else {
+            plink2::DowncastToUc(pwc.vrtype_buf)[vidx] = static_cast<unsigned char>(vrtype);
+        }
+        if (!(vidx % plink2::kPglVblockSize)) {
+            pwc.vblock_fpos[vidx / plink2::kPglVblockSize] = record_fpos;
+        }
+        plink2::SubU32Store(vrec_len, pwc.vrec_len_byte_ct, &pwc.vrec_len_buf[vidx * pwc.vrec_len_byte_ct]);
+        pwc.vidx = vidx + 1;
+        return 0;
+    }
+
+}
+#endif //PGEN_LIB_PGENWRITERINTERNALS_H
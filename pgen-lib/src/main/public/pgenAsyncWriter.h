@@ -0,0 +1,27 @@
+//
+
+#ifndef PGEN_LIB_PGENASYNCWRITER_H
+#define PGEN_LIB_PGENASYNCWRITER_H
+
+#include "pgenContext.h"
+
+// Asynchronous append support for a PgenContext. Batches of allele codes are handed to a native worker thread via
+// a bounded queue, so the caller can prepare the next batch while the previous ones are being converted,
+// compressed and written. The caller owns the batch buffers, and must not modify a submitted batch until it has
+// been consumed; with a queue depth of N, cycling through N + 1 buffers guarantees this.
+namespace pgenlib {
+
+    struct PgenAsyncWriter;
+
+    PgenAsyncWriter *InitPgenAsyncWriter(const PgenContext *const pGenContext, const uint32_t queue_depth);
+    void AsyncWriterSubmit(
+            PgenAsyncWriter *asyncp,
+            const int32_t *allele_codes,
+            const unsigned char *phase_bytes,
+            const int32_t *allele_cts,
+            const uint32_t variant_ct);
+    void AsyncWriterDrain(PgenAsyncWriter *asyncp);
+    void CleanupPgenAsyncWriter(PgenAsyncWriter *asyncp);
+
+}
+#endif //PGEN_LIB_PGENASYNCWRITER_H
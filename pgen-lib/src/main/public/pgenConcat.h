@@ -0,0 +1,20 @@
+//
+
+#ifndef PGEN_LIB_PGENCONCAT_H
+#define PGEN_LIB_PGENCONCAT_H
+
+#include <cstdint>
+
+// Concatenation of pgens with the same samples (for instance, the shards of a conversion that was split by genomic
+// region) into one .pgen, by copying their variant records without decoding them (see pgenRecordCopy.h).
+namespace pgenlib {
+
+    void ConcatPgens(
+            const char *const *pgenFilenames,
+            const uint32_t pgenCount,
+            const char *cOutFilename,
+            const uint32_t pgenWriteModeInt,
+            const uint32_t readFlags = 0);
+
+}
+#endif //PGEN_LIB_PGENCONCAT_H
@@ -5,9 +5,12 @@
 
 #include "pgenlib_write.h"
 #include "pgenlib_ffi_support.h"
+#include "pgenMTWriter.h"
 
 namespace pgenlib {
 
+    struct PgenAsyncWriter;
+
     typedef struct PgenContext {
         plink2::STPgenWriter* spgwp;
         uint32_t allele_ct_limit;
@@ -20,6 +23,8 @@ namespace pgenlib {
         uintptr_t* phaseinfo;
         uintptr_t* dosage_present;
         uint16_t* dosage_main;
+        uintptr_t* raregeno;                // sparse (difflist) genotypes, see AppendSparseGenotypes
+        uint32_t* difflist_sample_ids;
         uint32_t max_vrec_len;
 
         // (non-plink2) fields added for use by pgenlib code
@@ -27,6 +32,10 @@ namespace pgenlib {
         uint32_t write_flags; // keep track of whether the caller claims to have phasing data/multi-allelics
         // keep track of the arena memory so we can free it when we're finished
         unsigned char* spgw_alloc;
+        // multi-threaded writer; when this is non-null, spgwp is null and spgw_alloc only holds the buffers above
+        PgenMTWriter* mtpgwp;
+        // async append worker started by StartAsyncAppends; null when appends are synchronous
+        PgenAsyncWriter* asyncp;
     } PgenContext;
 
 }
@@ -0,0 +1,39 @@
+//
+#ifndef PGEN_LIB_PGENCONVERT_H
+#define PGEN_LIB_PGENCONVERT_H
+
+#include "pgenlib_misc.h"
+
+namespace pgenlib {
+
+    // Single pass replacement for the phase scan + plink2::ConvertMultiAlleleCodesUnsafe sequence used by
+    // AppendAlleles. The genovec, patch and phase outputs are bit-identical to those of
+    // plink2::ConvertMultiAlleleCodesUnsafe, but the phase bytes are packed (with SSE2/AVX2 compares) in the same
+    // pass that converts the allele codes, rather than in a separate pass, and the number of heterozygous and phased
+    // heterozygous calls is returned so callers can tell whether the variant is unphased, partially phased or fully
+    // phased without rescanning the phase bytes.
+    //
+    // phase_bytes may be null, in which case phasepresent is not written and *phased_het_ctp is set to 0; a nonzero
+    // phase byte marks the sample as phased. Like plink2::ConvertMultiAlleleCodesUnsafe, trailing bits of genovec,
+    // phasepresent and phaseinfo are not cleared.
+    //
+    // Returns max(2, 1 + max allele code) if allele_codes is valid, -1 if invalid.
+    int32_t ConvertAlleleCodes(
+            const int32_t *allele_codes,
+            const unsigned char *phase_bytes,
+            const uint32_t sample_ct,
+            uintptr_t *genovec,
+            uintptr_t *patch_01_set,
+            plink2::AlleleCode *patch_01_vals,
+            uintptr_t *patch_10_set,
+            plink2::AlleleCode *patch_10_vals,
+            uint32_t *patch_01_ctp,
+            uint32_t *patch_10_ctp,
+            uintptr_t *phasepresent,
+            uintptr_t *phaseinfo,
+            uint32_t *het_ctp,
+            uint32_t *phased_het_ctp);
+
+}
+
+#endif //PGEN_LIB_PGENCONVERT_H
@@ -0,0 +1,25 @@
+//
+
+#ifndef PGEN_LIB_PGENEXTRACT_H
+#define PGEN_LIB_PGENEXTRACT_H
+
+#include "pgenReaderContext.h"
+
+// Extraction of a subset of the variants (and, if the reader was opened with a sample subset, the samples) of an open
+// PGEN reader into a new .pgen. When every sample is extracted, the variant records are copied without being decoded
+// (see pgenRecordCopy.h); otherwise each thread decodes a slice of the variants (with its own plink2 reader), and the
+// subset records are re-encoded by a multithreaded writer (see pgenMTWriter.h). The uncompressed buffers of a sample
+// subset extraction are bounded per thread, but the writer also keeps each thread's compressed vblock in memory until
+// it's written (see ExtractPgen).
+namespace pgenlib {
+
+    void ExtractPgen(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t *variantIndices,
+            const uint32_t variantCount,
+            const char *cOutFilename,
+            const uint32_t pgenWriteModeInt,
+            const uint32_t threadCount);
+
+}
+#endif //PGEN_LIB_PGENEXTRACT_H
@@ -0,0 +1,31 @@
+//
+
+#ifndef PGEN_LIB_PGENGRM_H
+#define PGEN_LIB_PGENGRM_H
+
+#include "pgenReaderContext.h"
+
+// Genomic relationship matrices (as for plink2 --make-rel / GCTA --make-grm) for the samples of an open PGEN reader.
+// The matrix is computed a tile (a range of rows) at a time, so matrices that don't fit in memory can be written to
+// disk; the rows of a tile are split across threads, each with its own plink2 reader.
+namespace pgenlib {
+
+    uint32_t ComputeGrmTile(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t threadCount,
+            const uint32_t rowStart,
+            const uint32_t rowEnd,
+            const uint32_t columnEnd,
+            double *grm);
+    uint32_t WriteGrmBin(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t threadCount,
+            const uint32_t tileRowCount,
+            const char *grmBinFilename);
+
+}
+#endif //PGEN_LIB_PGENGRM_H
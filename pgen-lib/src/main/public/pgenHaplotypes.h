@@ -0,0 +1,22 @@
+//
+
+#ifndef PGEN_LIB_PGENHAPLOTYPES_H
+#define PGEN_LIB_PGENHAPLOTYPES_H
+
+#include "pgenReaderContext.h"
+
+// Haplotype matrix export for an open PGEN reader. Each thread decodes a slice of the variants (with its own plink2
+// reader) a batch at a time, transposes the batch's genotypes and phase to sample major order, and converts them to
+// haplotype codes with plink2 GenoarrPhasedToHapCodes.
+namespace pgenlib {
+
+    void ReadHaplotypes(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t threadCount,
+            int32_t *hap0_codes,
+            int32_t *hap1_codes);
+
+}
+#endif //PGEN_LIB_PGENHAPLOTYPES_H
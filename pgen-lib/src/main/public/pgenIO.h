@@ -13,6 +13,24 @@ namespace pgenlib {
     // write flag values
     constexpr uint32_t kWriteFlagPreservePhasing = 0x1;
     constexpr uint32_t kWriteFlagMultiAllelic = 0x2;
+    constexpr uint32_t kWriteFlagDosage = 0x4;
+
+    // allele count to use for an AppendAllelesBatch entry whose allele code slot holds sample count genotype bytes
+    // (see AppendGenotypeBytes) rather than allele codes
+    constexpr int32_t kAlleleCtGenotypeBytes = -1;
+    // allele count to use for an AppendAllelesBatch entry whose allele code slot holds a sparse genotype list (see
+    // AppendAllelesBatch) rather than allele codes
+    constexpr int32_t kAlleleCtSparseGenotypes = -2;
+
+    // the longest sparse genotype list that AppendSparseGenotypes hands to plink2 as a difflist; longer lists are
+    // expanded to a genotype vector first
+    inline uint32_t MaxDifflistLen(const uint32_t sample_ct) {
+        return 2 * (sample_ct / plink2::kPglMaxDifflistLenDivisor);
+    }
+
+    // dosages within this distance of a whole number are also written as a hardcall (the plink2 default for
+    // --hard-call-threshold)
+    constexpr double kDefaultHardCallThreshold = 0.1;
 
     PgenContext *OpenPgen(
             const char *cFilename,
@@ -20,14 +38,51 @@ namespace pgenlib {
             const uint32_t pgenWriteFlags,
             const long variantCount,
             const int sampleCount,
-            const int maxAltAlleles);
+            const int maxAltAlleles,
+            const int threadCount = 1);
     void AppendAlleles(
             const PgenContext *const pGenContext,
             const int32_t* allele_codes,
             const unsigned char* phase_bytes,
             const int32_t allele_ct);
+    void AppendAllelesBatch(
+            const PgenContext *const pGenContext,
+            const int32_t* allele_codes,
+            const unsigned char* phase_bytes,
+            const int32_t* allele_cts,
+            const uint32_t variant_ct);
+    void AppendGenotypeBytes(
+            const PgenContext *const pGenContext,
+            const int8_t* genotype_bytes);
+    void AppendSparseGenotypes(
+            const PgenContext *const pGenContext,
+            const uint32_t* sample_ids,
+            const int8_t* genotype_bytes,
+            const uint32_t genotype_ct,
+            const int8_t default_genotype_byte = 0);
+    void AppendGenovec(
+            const PgenContext *const pGenContext,
+            const uintptr_t* genovec,
+            const uintptr_t* phasepresent = nullptr,
+            const uintptr_t* phaseinfo = nullptr);
+    void AppendDosages(
+            const PgenContext *const pGenContext,
+            const float* dosages,
+            const double hardCallThreshold = kDefaultHardCallThreshold);
+    void AppendDosages(
+            const PgenContext *const pGenContext,
+            const double* dosages,
+            const double hardCallThreshold = kDefaultHardCallThreshold);
+    void StartAsyncAppends(PgenContext *const pGenContext, const int queueDepth);
+    void AppendAllelesBatchAsync(
+            const PgenContext *const pGenContext,
+            const int32_t* allele_codes,
+            const unsigned char* phase_bytes,
+            const int32_t* allele_cts,
+            const uint32_t variant_ct);
     long GetNumberOfVariantsWritten(const PgenContext *const pGenContext);
     void ClosePgen(const PgenContext *const pGenContext, const long nDroppedVariants);
+    void AbandonPgen(const PgenContext *const pGenContext);
 
 }
 #endif //PGEN_LIB_PGENIO_H
@@ -0,0 +1,49 @@
+//
+
+#ifndef PGEN_LIB_PGENLD_H
+#define PGEN_LIB_PGENLD_H
+
+#include <vector>
+
+#include "pgenReaderContext.h"
+
+// Pairwise linkage disequilibrium (r^2 and D') between the variants of an open PGEN reader. Each variant's hardcalls
+// are split into bit planes (het, hom alt, non-missing, and the alt allele of each haplotype for a phased variant),
+// so the counts for a pair of variants are ANDs and popcounts of the planes. The first variant of each pair is split
+// across threads, each with its own plink2 reader.
+namespace pgenlib {
+
+    // LD flag values
+    // use the unphased (genotype) estimates even for pairs of phased variants
+    constexpr uint32_t kLdFlagIgnorePhase = 0x1;
+
+    // one pair of variants in LD; d_prime is signed, with the sign of D
+    struct LdPair {
+        uint32_t variant_a;
+        uint32_t variant_b;
+        double r2;
+        double d_prime;
+    };
+
+    void ComputeWindowLd(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t windowVariantCount,
+            const double minR2,
+            const uint32_t threadCount,
+            const uint32_t ldFlags,
+            std::vector<LdPair> *pairs);
+    void ComputeCrossLd(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStartA,
+            const uint32_t variantEndA,
+            const uint32_t variantStartB,
+            const uint32_t variantEndB,
+            const double minR2,
+            const uint32_t threadCount,
+            const uint32_t ldFlags,
+            std::vector<LdPair> *pairs);
+
+}
+#endif //PGEN_LIB_PGENLD_H
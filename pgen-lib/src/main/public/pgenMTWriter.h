@@ -0,0 +1,64 @@
+//
+
+#ifndef PGEN_LIB_PGENMTWRITER_H
+#define PGEN_LIB_PGENMTWRITER_H
+
+#include "pgenlib_write.h"
+
+// Multi-threaded PGEN writer, layered on plink2's MTPgenWriter. Converted variants are assigned to blocks of
+// plink2::kPglVblockSize variants, one block per thread, and each block is compressed on its own worker thread
+// while the caller continues to stage the next one. A block's variants are staged (uncompressed) in chunks of at
+// most max_staged_chunk_bytes, each of which is handed to the block's worker as soon as it's full, so the staging
+// memory is bounded by about 2 * max_staged_chunk_bytes per thread regardless of the sample count. The blocks are
+// written to the .pgen in order, so the output is byte-identical to the output of the single threaded
+// (STPgenWriter) path.
+namespace pgenlib {
+
+    // the default limit on the uncompressed variants staged in each chunk of a block
+    constexpr uint64_t kMTWriterMaxStagedChunkBytes = 64 * 1024 * 1024;
+
+    struct PgenMTWriter;
+
+    PgenMTWriter *InitPgenMTWriter(
+            const char *cFilename,
+            const plink2::PgenWriteMode pgenWriteMode,
+            const plink2::PgenGlobalFlags phaseDosageFlags,
+            const uint32_t variant_ct,
+            const uint32_t sample_ct,
+            const uint32_t allele_ct_limit,
+            const uint32_t thread_ct,
+            uint32_t *max_vrec_len_ptr,
+            uintptr_t *explicit_nonref_flags = nullptr,
+            const uint32_t nonref_flags_storage = 1,
+            const uint64_t max_staged_chunk_bytes = kMTWriterMaxStagedChunkBytes);
+    void MTWriterAppend(
+            PgenMTWriter *mtpgwp,
+            const uintptr_t *genovec,
+            const uintptr_t *patch_01_set,
+            const plink2::AlleleCode *patch_01_vals,
+            const uintptr_t *patch_10_set,
+            const plink2::AlleleCode *patch_10_vals,
+            const uintptr_t *phasepresent,
+            const uintptr_t *phaseinfo,
+            const uint32_t allele_ct,
+            const uint32_t patch_01_ct,
+            const uint32_t patch_10_ct);
+    void MTWriterAppendDosage(
+            PgenMTWriter *mtpgwp,
+            const uintptr_t *genovec,
+            const uintptr_t *dosage_present,
+            const uint16_t *dosage_main,
+            const uint32_t dosage_ct);
+    void MTWriterAppendDifflist(
+            PgenMTWriter *mtpgwp,
+            const uintptr_t *raregeno,
+            const uint32_t *difflist_sample_ids,
+            const uint32_t difflist_common_geno,
+            const uint32_t difflist_len);
+    uint32_t MTWriterGetVariantCt(const PgenMTWriter *mtpgwp);
+    uint32_t MTWriterGetVidx(const PgenMTWriter *mtpgwp);
+    void MTWriterFinish(PgenMTWriter *mtpgwp);
+    void CleanupPgenMTWriter(PgenMTWriter *mtpgwp);
+
+}
+#endif //PGEN_LIB_PGENMTWRITER_H
@@ -0,0 +1,51 @@
+//
+
+#ifndef PGEN_LIB_PGENREADER_H
+#define PGEN_LIB_PGENREADER_H
+#include "pgenReaderContext.h"
+
+// the public interface to the PGEN reader
+namespace pgenlib {
+
+    // read flag values
+    // map the .pgen into memory, and decode variant records in place rather than fread'ing each one
+    constexpr uint32_t kReadFlagMemoryMap = 0x1;
+
+    // dosage flag values
+    // replace missing dosages with the mean dosage of the variant's non-missing samples
+    constexpr uint32_t kDosageFlagMeanImpute = 0x1;
+
+    PgenReaderContext *OpenPgenReader(
+            const char *cFilename,
+            const char *cPgiFilename = nullptr,
+            const int32_t *alleleCounts = nullptr,
+            const long alleleCountsLength = 0,
+            const uint32_t readFlags = 0,
+            const int32_t *sampleIndices = nullptr,
+            const long sampleIndicesLength = 0);
+    uint32_t GetReaderVariantCount(const PgenReaderContext *const pReaderContext);
+    uint32_t GetReaderSampleCount(const PgenReaderContext *const pReaderContext);
+    uint32_t GetReaderRawSampleCount(const PgenReaderContext *const pReaderContext);
+    uint32_t GetReaderAlleleCount(const PgenReaderContext *const pReaderContext, const uint32_t variantIndex);
+    uint64_t GetReaderAlleleIndexOffset(const PgenReaderContext *const pReaderContext, const uint32_t variantIndex);
+    uint32_t ReadAlleles(
+            PgenReaderContext *const pReaderContext,
+            const uint32_t variantIndex,
+            int32_t *allele_codes,
+            unsigned char *phase_bytes = nullptr);
+    void ReadDosages(
+            PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t dosageFlags,
+            float *dosages);
+    void ReadDosages(
+            PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t dosageFlags,
+            double *dosages);
+    void ClosePgenReader(PgenReaderContext *const pReaderContext);
+
+}
+#endif //PGEN_LIB_PGENREADER_H
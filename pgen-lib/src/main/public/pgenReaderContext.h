@@ -0,0 +1,80 @@
+//
+
+#ifndef PGEN_LIB_PGENREADERCONTEXT_H
+#define PGEN_LIB_PGENREADERCONTEXT_H
+
+#include "pgenlib_read.h"
+#include "pgenlib_ffi_support.h"
+
+namespace pgenlib {
+
+    typedef struct PgenReaderContext {
+        plink2::PgenFileInfo* pgfip;
+        plink2::PgenReader* pgrp;
+        plink2::PgrSampleSubsetIndex pssi;
+        // decode buffers (genovec, patch_01/patch_10 sets and values, phasepresent and phaseinfo) used by PgrGetMP
+        plink2::PgenVariant pgv;
+        uint32_t raw_variant_ct;
+        uint32_t raw_sample_ct;
+        // the maximum variant record width, which sizes the fread buffer of a (non block mode) plink2 reader
+        uint32_t max_vrec_width;
+        // the number of samples decoded for each variant; raw_sample_ct unless a sample subset was provided
+        uint32_t sample_ct;
+
+        // (non-plink2) fields added for use by pgenlib code
+        // allele index offsets, built from the allele counts provided when the reader was opened (plink2 doesn't
+        // store allele counts in the .pgen); null if no allele counts were provided
+        uintptr_t* allele_idx_offsets;
+        uintptr_t* nonref_flags;
+        // the nonref flag storage mode of the .pgen header (0: not stored, 1: all ref, 2: all nonref, 3: explicit
+        // nonref_flags)
+        uint32_t nonref_flags_storage;
+        // the sample subset provided when the reader was opened, and its cumulative popcounts (which plink2 uses to
+        // compact decoded genotypes to the subset); both null if all samples are read
+        uintptr_t* sample_include;
+        uint32_t* sample_include_cumulative_popcounts;
+        // the interleaved form of sample_include, used by the plink2 genotype counting routines; null if all samples
+        // are read
+        uintptr_t* sample_include_interleaved_vec;
+        // keep track of the arena memory so we can free it when we're finished
+        unsigned char* pgfi_alloc;
+        unsigned char* pgr_alloc;
+        // the size of the plink2 part of a reader arena (see AllocPgenReaderArena)
+        uintptr_t pgr_alloc_cacheline_ct;
+        char* pgen_fname;
+        // the mapped .pgen, when the reader was opened with kReadFlagMemoryMap; null otherwise
+        unsigned char* mmap_base;
+        size_t mmap_size;
+    } PgenReaderContext;
+
+    // A plink2 PgenReader, its arena, sample subset index and decode buffers, for use by one worker thread.
+    typedef struct PgenThreadReader {
+        plink2::PgenReader* pgrp;
+        unsigned char* pgr_alloc;
+        plink2::PgrSampleSubsetIndex pssi;
+        plink2::PgenVariant pgv;
+    } PgenThreadReader;
+
+    // helpers shared by the PGEN reader implementations
+    unsigned char *AllocPgenReaderArena(const PgenReaderContext *const pReaderContext, plink2::PgenVariant *pgvp);
+    void InitThreadReader(
+            const PgenReaderContext *const pReaderContext,
+            plink2::PgenFileInfo *fip,
+            PgenThreadReader *pThreadReader);
+    void CleanupThreadReader(PgenThreadReader *pThreadReader, plink2::PglErr *reterrp);
+    void RequireValidVariantRange(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd);
+    uint32_t RequireReadableVariant(const PgenReaderContext *const pReaderContext, const uint32_t variantIndex);
+    plink2::PglErr DecodeAlleles(
+            const PgenReaderContext *const pReaderContext,
+            plink2::PgenReader *pgrp,
+            const plink2::PgrSampleSubsetIndex pssi,
+            plink2::PgenVariant *pgvp,
+            const uint32_t variantIndex,
+            int32_t *allele_codes,
+            unsigned char *phase_bytes);
+
+}
+#endif //PGEN_LIB_PGENREADERCONTEXT_H
@@ -0,0 +1,53 @@
+//
+
+#ifndef PGEN_LIB_PGENRECORDCOPY_H
+#define PGEN_LIB_PGENRECORDCOPY_H
+
+#include "pgenlib_write.h"
+#include "pgenReaderContext.h"
+
+// Copying of (still encoded) variant records from open PGEN readers to a new .pgen, which is used to concatenate and
+// subset pgens without decoding and recompressing their genotypes. plink2's writer has no API for appending encoded
+// records, so the records are copied into the buffers of a plink2 single-threaded writer, which still writes the
+// header and index.
+namespace pgenlib {
+
+    typedef struct PgenRecordWriter {
+        plink2::STPgenWriter *spgwp;
+        unsigned char *spgw_alloc;
+        // the usable size of the writer's fwrite buffer
+        uintptr_t fwrite_buf_size;
+        uint32_t max_vrec_len;
+        uint32_t sample_ct;
+        plink2::PgenWriteMode write_mode;
+        // the explicit nonref flags for the output, to be filled in by the caller before the writer is closed; null
+        // unless the writer was opened with nonref flag storage mode 3
+        uintptr_t *explicit_nonref_flags;
+        // the decode buffer for records whose main (hardcall) track is re-encoded
+        uintptr_t *genovec;
+    } PgenRecordWriter;
+
+    PgenRecordWriter *OpenPgenRecordWriter(
+            const char *cFilename,
+            const uint32_t pgenWriteModeInt,
+            const uint32_t variantCount,
+            const uint32_t sampleCount,
+            const uint32_t alleleCtUpperBound,
+            const plink2::PgenGlobalFlags phaseDosageGflags,
+            const uint32_t nonrefFlagsStorage);
+    void AppendPgenRecords(
+            PgenRecordWriter *const pRecordWriter,
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd);
+    void AppendPgenRecordList(
+            PgenRecordWriter *const pRecordWriter,
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t *variantIndices,
+            const uint32_t variantCount);
+    uint32_t GetRecordWriterVariantCount(const PgenRecordWriter *const pRecordWriter);
+    void ClosePgenRecordWriter(PgenRecordWriter *const pRecordWriter);
+    void AbandonPgenRecordWriter(PgenRecordWriter *const pRecordWriter);
+
+}
+#endif //PGEN_LIB_PGENRECORDCOPY_H
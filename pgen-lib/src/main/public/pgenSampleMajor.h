@@ -0,0 +1,37 @@
+//
+
+#ifndef PGEN_LIB_PGENSAMPLEMAJOR_H
+#define PGEN_LIB_PGENSAMPLEMAJOR_H
+
+#include "pgenReaderContext.h"
+
+// Sample major genotype sidecar for a PGEN, for fast retrieval of all of the genotypes of one sample. The sidecar is
+// built from an open PGEN reader a block of variants at a time: each thread decodes a slice of the block's hardcalls
+// (with its own plink2 reader), and the block is then transposed to sample major order (with plink2
+// TransposeNypblock), a range of samples per thread. Each sample's row of a block is stored either as packed 2-bit
+// genotypes, or as a list of the genotypes that differ from the row's most common one, whichever is smaller, so a
+// sample's genotypes over a variant range can be read with two small reads per block.
+namespace pgenlib {
+
+    // the file name extension (appended to the .pgen file name) of a sidecar in the default location
+    constexpr const char *kSampleMajorExtension = ".smg";
+
+    struct SampleMajorReader;
+
+    void WriteSampleMajorSidecar(
+            const PgenReaderContext *const pReaderContext,
+            const char *cSidecarFilename,
+            const uint32_t threadCount);
+    SampleMajorReader *OpenSampleMajorReader(const char *cSidecarFilename);
+    uint32_t GetSampleMajorVariantCount(const SampleMajorReader *const pSampleMajorReader);
+    uint32_t GetSampleMajorSampleCount(const SampleMajorReader *const pSampleMajorReader);
+    void ReadSampleGenotypes(
+            SampleMajorReader *const pSampleMajorReader,
+            const uint32_t sampleIndex,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            int8_t *genotypes);
+    void CloseSampleMajorReader(SampleMajorReader *const pSampleMajorReader);
+
+}
+#endif //PGEN_LIB_PGENSAMPLEMAJOR_H
@@ -0,0 +1,35 @@
+//
+
+#ifndef PGEN_LIB_PGENSCAN_H
+#define PGEN_LIB_PGENSCAN_H
+
+#include "pgenReaderContext.h"
+
+// Parallel, in order scan over the variants of an open PGEN reader. Variants are read in batches: the records for a
+// batch are loaded with a single PgfiMultiread into a block buffer (or used in place, for a memory mapped reader),
+// and are then decoded concurrently by one plink2 PgenReader per thread. The records for the next batch are loaded
+// while the current batch is being decoded, so the decode of a batch overlaps the I/O for the next one.
+namespace pgenlib {
+
+    struct PgenScan;
+
+    PgenScan *StartPgenScan(
+            PgenReaderContext *const pReaderContext,
+            const uintptr_t *variantInclude,
+            const uint32_t variantIncludeWordCount,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t threadCount,
+            const uint32_t batchVariantCount);
+    uint32_t GetScanBatchVariantCount(const PgenScan *const pScan);
+    uint32_t GetScanSampleCount(const PgenScan *const pScan);
+    uint32_t ScanReadAlleles(
+            PgenScan *const pScan,
+            uint32_t *variant_indices,
+            int32_t *allele_codes,
+            unsigned char *phase_bytes,
+            uint32_t *allele_cts);
+    void FinishPgenScan(PgenScan *const pScan);
+
+}
+#endif //PGEN_LIB_PGENSCAN_H
@@ -0,0 +1,30 @@
+//
+
+#ifndef PGEN_LIB_PGENSCORE_H
+#define PGEN_LIB_PGENSCORE_H
+
+#include "pgenReaderContext.h"
+
+// Polygenic (linear) scores for the samples of an open PGEN reader. The weighted variants are split across threads,
+// each with its own plink2 reader and its own per sample score accumulators, which are summed once every thread has
+// finished.
+namespace pgenlib {
+
+    // score flag values
+    // a missing genotype contributes nothing to a score, rather than the variant's mean dosage (as for plink2 --score
+    // no-mean-imputation)
+    constexpr uint32_t kScoreFlagNoMeanImpute = 0x1;
+
+    void ComputeScores(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t *variantIndices,
+            const uint32_t *alleleIndices,
+            const double *weights,
+            const uint32_t weightCount,
+            const uint32_t scoreCount,
+            const uint32_t threadCount,
+            const uint32_t scoreFlags,
+            double *scores);
+
+}
+#endif //PGEN_LIB_PGENSCORE_H
@@ -0,0 +1,34 @@
+//
+
+#ifndef PGEN_LIB_PGENSTATS_H
+#define PGEN_LIB_PGENSTATS_H
+
+#include "pgenReaderContext.h"
+
+// Whole-file summary statistics for an open PGEN reader. These use the plink2 counting routines, which count
+// genotypes directly from the compressed variant records (taking shortcuts for difflist and LD compressed records)
+// rather than decoding each variant, and split the variants across threads, each with its own plink2 reader.
+namespace pgenlib {
+
+    // missingness flag values
+    // a genotype with a dosage, but no hardcall, isn't missing
+    constexpr uint32_t kMissingnessFlagDosage = 0x1;
+
+    void ComputeAlleleCounts(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t threadCount,
+            uint32_t *genotype_counts,
+            double *allele_dosages);
+    void ComputeMissingness(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t threadCount,
+            const uint32_t missingnessFlags,
+            uint32_t *variant_missing_cts,
+            uint32_t *sample_missing_cts);
+
+}
+#endif //PGEN_LIB_PGENSTATS_H
@@ -0,0 +1,32 @@
+//
+
+#ifndef PGEN_LIB_PGENVALIDATE_H
+#define PGEN_LIB_PGENVALIDATE_H
+
+#include "pgenReaderContext.h"
+
+// Full validation of the .pgen of an open PGEN reader: the checks done by plink2's PgrValidate (the header, the
+// variant record index, and every variant record), with the variant records split across threads, each with its own
+// plink2 reader.
+namespace pgenlib {
+
+    // the variant index reported for a problem in the header or index rather than in a variant record
+    constexpr uint32_t kValidateNoVariant = UINT32_MAX;
+
+    // the first problem found by ValidatePgen
+    typedef struct PgenValidationResult {
+        // the (0-based) index of the first invalid variant record, or kValidateNoVariant
+        uint32_t variant_index;
+        // the .pgen byte offset of the invalid variant record or header field, or 0 if it isn't known
+        uint64_t byte_offset;
+        // plink2's description of the problem
+        char message[plink2::kPglErrstrBufBlen];
+    } PgenValidationResult;
+
+    bool ValidatePgen(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t threadCount,
+            PgenValidationResult *pResult);
+
+}
+#endif //PGEN_LIB_PGENVALIDATE_H
@@ -0,0 +1,130 @@
+//
+
+#ifndef PGEN_LIB_PGENVARIANTSLICES_H
+#define PGEN_LIB_PGENVARIANTSLICES_H
+
+#include <algorithm>
+#include <memory>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "pgenUtils.h"
+#include "pgenReaderContext.h"
+
+// Helpers shared by the multithreaded whole-range operations on an open PGEN reader (see pgenStats.h), which split a
+// range of variants across threads, each with its own plink2 reader (or a range of other work, without readers).
+namespace pgenlib {
+
+    // the number of threads (and slices) that ForEachVariantSlice uses for a range
+    inline uint32_t SliceThreadCount(const uint32_t variantStart, const uint32_t variantEnd, const uint32_t threadCount) {
+        return std::min(threadCount, variantEnd - variantStart);
+    }
+
+    // Split [start, end) into thread_ct contiguous slices, and call sliceFn(tidx, begin, end) for each slice on its
+    // own thread. sliceFn runs on a worker thread, so it must not throw; it reports failure by returning a PglErr.
+    // Returns the first error once every thread has finished.
+    template <typename SliceFn>
+    plink2::PglErr RunSlices(const uint32_t start, const uint32_t end, const uint32_t thread_ct, SliceFn sliceFn) {
+        const uint32_t item_ct = end - start;
+        std::vector<std::thread> workers(thread_ct);
+        std::vector<plink2::PglErr> reterrs(thread_ct, plink2::kPglRetSuccess);
+        plink2::PglErr reterr = plink2::kPglRetSuccess;
+        for (uint32_t tidx = 0; tidx != thread_ct; ++tidx) {
+            const uint32_t begin = start + static_cast<uint32_t>((static_cast<uint64_t>(item_ct) * tidx) / thread_ct);
+            const uint32_t slice_end =
+                    start + static_cast<uint32_t>((static_cast<uint64_t>(item_ct) * (tidx + 1)) / thread_ct);
+            plink2::PglErr *const reterrp = &reterrs[tidx];
+            try {
+                workers[tidx] = std::thread([=]() { *reterrp = sliceFn(tidx, begin, slice_end); });
+            } catch (const std::system_error &) {
+                reterr = plink2::kPglRetThreadCreateFail;
+                break;
+            }
+        }
+        for (uint32_t tidx = 0; tidx != thread_ct; ++tidx) {
+            if (workers[tidx].joinable()) {
+                workers[tidx].join();
+                if (reterrs[tidx] && !reterr) {
+                    reterr = reterrs[tidx];
+                }
+            }
+        }
+        return reterr;
+    }
+
+    // Like ForEachVariantSlice, for work that doesn't read the PGEN: split [start, end) into contiguous slices, and
+    // call sliceFn(tidx, begin, end) for each slice on its own thread, without a reader.
+    template <typename SliceFn>
+    void ForEachSlice(
+            const uint32_t start,
+            const uint32_t end,
+            const uint32_t threadCount,
+            const char *message,
+            SliceFn sliceFn) {
+        if (start == end) {
+            return;
+        }
+        throwOnPglErr(RunSlices(start, end, SliceThreadCount(start, end, threadCount), sliceFn), message);
+    }
+
+    // Initialize a reader for each of thread_ct threads, for callers that read several ranges (with ForEachSlice) with
+    // the same readers, rather than initializing new ones for each range. The readers must be released by CleanupThreadReaders. Throws
+    // PgenException (with every reader released) if a reader can't be initialized.
+    inline std::unique_ptr<PgenThreadReader[]> InitThreadReaders(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t thread_ct) {
+        // zeroed, so every reader can be cleaned up whether or not it was initialized
+        std::unique_ptr<PgenThreadReader[]> readers(new PgenThreadReader[thread_ct]());
+        try {
+            for (uint32_t tidx = 0; tidx != thread_ct; ++tidx) {
+                InitThreadReader(pReaderContext, pReaderContext->pgfip, &readers[tidx]);
+            }
+        } catch (const PgenException &) {
+            plink2::PglErr reterr = plink2::kPglRetSuccess;
+            for (uint32_t tidx = 0; tidx != thread_ct; ++tidx) {
+                CleanupThreadReader(&readers[tidx], &reterr);
+            }
+            throw;
+        }
+        return readers;
+    }
+
+    // Release the readers from InitThreadReaders. The first cleanup error is stored in *reterrp, if it isn't already
+    // set.
+    inline void CleanupThreadReaders(PgenThreadReader *readers, const uint32_t thread_ct, plink2::PglErr *reterrp) {
+        for (uint32_t tidx = 0; tidx != thread_ct; ++tidx) {
+            CleanupThreadReader(&readers[tidx], reterrp);
+        }
+    }
+
+    // Split [variantStart, variantEnd) into contiguous slices, and call sliceFn(tidx, pThreadReader, begin, end) for
+    // each slice on its own thread (tidx < SliceThreadCount), with its own reader. sliceFn runs on a worker thread,
+    // so it must not throw; it reports failure by returning a PglErr, and the first one is thrown (with message)
+    // once every thread has finished.
+    template <typename SliceFn>
+    void ForEachVariantSlice(
+            const PgenReaderContext *const pReaderContext,
+            const uint32_t variantStart,
+            const uint32_t variantEnd,
+            const uint32_t threadCount,
+            const char *message,
+            SliceFn sliceFn) {
+        if (variantStart == variantEnd) {
+            return;
+        }
+        const uint32_t thread_ct = SliceThreadCount(variantStart, variantEnd, threadCount);
+        std::unique_ptr<PgenThreadReader[]> readers = InitThreadReaders(pReaderContext, thread_ct);
+        plink2::PglErr reterr = RunSlices(
+                variantStart,
+                variantEnd,
+                thread_ct,
+                [&](const uint32_t tidx, const uint32_t begin, const uint32_t end) {
+                    return sliceFn(tidx, &readers[tidx], begin, end);
+                });
+        CleanupThreadReaders(readers.get(), thread_ct, &reterr);
+        throwOnPglErr(reterr, message);
+    }
+
+}
+#endif //PGEN_LIB_PGENVARIANTSLICES_H
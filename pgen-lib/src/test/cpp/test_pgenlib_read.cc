@@ -0,0 +1,2274 @@
+#include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/test/data/test_case.hpp>
+#include <boost/array.hpp>
+#include "pgenConcat.h"
+#include "pgenException.h"
+#include "pgenExtract.h"
+#include "pgenGrm.h"
+#include "pgenHaplotypes.h"
+#include "pgenIO.h"
+#include "pgenLd.h"
+#include "pgenReader.h"
+#include "pgenSampleMajor.h"
+#include "pgenScan.h"
+#include "pgenScore.h"
+#include "pgenStats.h"
+#include "pgenValidate.h"
+
+using namespace boost::unit_test;
+using namespace pgenlib;
+
+// Unit level tests for the PGEN reader. The PGENs that are read are written using the pgenlib writer, and the
+// genotypes that are read back are compared with the genotypes that were written.
+
+//******************* Forward Declarations/Constants *******************
+static std::string CreateTempPgenFileName(const char* const nameTemplate);
+static void GenerateVariant(
+        const long variant,
+        const int n_samples,
+        std::vector<int32_t> &allele_codes,
+        std::vector<unsigned char> &phase_bytes,
+        int32_t &allele_ct);
+static void WriteReaderTestPgen(
+        const char* const fileName,
+        const uint32_t pgen_file_mode,
+        const uint32_t write_flags,
+        const long n_variants,
+        const int n_samples,
+        const int thread_count,
+        std::vector<int32_t> &allele_cts);
+static void RequireReadAllelesMatchesWritten(
+        PgenReaderContext *const reader_context,
+        const uint32_t write_flags,
+        const long n_variants,
+        const int n_samples);
+static void RequireScanMatchesReadAlleles(
+        PgenReaderContext *const reader_context,
+        PgenScan *const scan,
+        const std::vector<uint32_t> &expected_variant_indices);
+static void RequireAlleleCountsMatchReadAlleles(
+        PgenReaderContext *const reader_context,
+        const uint32_t variant_start,
+        const uint32_t variant_end,
+        const uint32_t thread_count);
+static void RequireMissingnessMatchesReadAlleles(
+        PgenReaderContext *const reader_context,
+        const uint32_t variant_start,
+        const uint32_t variant_end,
+        const uint32_t thread_count);
+static void RequireHaplotypesMatchReadAlleles(
+        PgenReaderContext *const reader_context,
+        const uint32_t variant_start,
+        const uint32_t variant_end,
+        const uint32_t thread_count);
+static void RequireScoresMatchReadAlleles(
+        PgenReaderContext *const reader_context,
+        const std::vector<uint32_t> &variant_indices,
+        const std::vector<uint32_t> &allele_indices,
+        const std::vector<double> &weights,
+        const uint32_t score_ct,
+        const uint32_t thread_count,
+        const uint32_t score_flags);
+static void RequireGrmTileMatchesReadAlleles(
+        PgenReaderContext *const reader_context,
+        const uint32_t variant_start,
+        const uint32_t variant_end,
+        const uint32_t thread_count,
+        const uint32_t row_start,
+        const uint32_t row_end,
+        const uint32_t column_end);
+static std::vector<double> ComputeExpectedGrm(
+        PgenReaderContext *const reader_context,
+        const uint32_t variant_start,
+        const uint32_t variant_end,
+        uint32_t &used_variant_ct);
+static void RequireLdPairsMatchReadAlleles(
+        PgenReaderContext *const reader_context,
+        const std::vector<LdPair> &pairs,
+        const std::vector<std::pair<uint32_t, uint32_t>> &candidate_pairs,
+        const double min_r2,
+        const uint32_t ld_flags);
+static void RemovePgenFiles(const std::string &fileName);
+constexpr uint32_t READER_TEST_FILE_MODE_BACKWARD_SEEK = static_cast<int>(plink2::PgenWriteMode::kPgenWriteBackwardSeek);
+constexpr uint32_t READER_TEST_FILE_MODE_WRITE_SEPARATE_INDEX = static_cast<int>(plink2::PgenWriteMode::kPgenWriteSeparateIndex);
+constexpr uint32_t READER_TEST_FILE_MODE_WRITE_AND_COPY = static_cast<int>(plink2::PgenWriteMode::kPgenWriteAndCopy);
+
+//******************* Tests *******************
+// write a multi-allelic, partially phased pgen once with each possible file write mode, and verify that every
+// variant reads back with the allele codes that were written
+constexpr boost::array<uint32_t, 3> s_readerFileMode {
+    READER_TEST_FILE_MODE_BACKWARD_SEEK,
+    READER_TEST_FILE_MODE_WRITE_SEPARATE_INDEX,
+    READER_TEST_FILE_MODE_WRITE_AND_COPY
+};
+BOOST_DATA_TEST_CASE(TestReadAllelesRoundTrip, s_readerFileMode) {
+    constexpr long n_variants = 300;
+    constexpr int n_samples = 77;
+    constexpr uint32_t write_flags = kWriteFlagMultiAllelic | kWriteFlagPreservePhasing;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(fileName.c_str(), sample, write_flags, n_variants, n_samples, 1, allele_cts);
+
+    PgenReaderContext *const reader_context =
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()));
+    BOOST_REQUIRE_EQUAL(GetReaderVariantCount(reader_context), n_variants);
+    BOOST_REQUIRE_EQUAL(GetReaderSampleCount(reader_context), n_samples);
+    RequireReadAllelesMatchesWritten(reader_context, write_flags, n_variants, n_samples);
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+// a pgen written by the multi-threaded writer spans several variant blocks, and reads back the same way
+BOOST_AUTO_TEST_CASE(TestReadAllelesMultiThreadedWriter) {
+    constexpr long n_variants = 2 * plink2::kPglVblockSize + 1001;
+    constexpr int n_samples = 35;
+    constexpr uint32_t write_flags = kWriteFlagMultiAllelic | kWriteFlagPreservePhasing;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(), READER_TEST_FILE_MODE_WRITE_AND_COPY, write_flags, n_variants, n_samples, 3, allele_cts);
+
+    PgenReaderContext *const reader_context =
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()));
+    RequireReadAllelesMatchesWritten(reader_context, write_flags, n_variants, n_samples);
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+// an unphased, biallelic pgen can be read without allele counts, and with or without phase bytes
+BOOST_AUTO_TEST_CASE(TestReadAllelesBiallelicWithoutAlleleCounts) {
+    constexpr long n_variants = 100;
+    constexpr int n_samples = 130;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(fileName.c_str(), READER_TEST_FILE_MODE_WRITE_AND_COPY, 0, n_variants, n_samples, 1, allele_cts);
+
+    PgenReaderContext *const reader_context = OpenPgenReader(fileName.c_str());
+    RequireReadAllelesMatchesWritten(reader_context, 0, n_variants, n_samples);
+    std::vector<int32_t> allele_codes(n_samples * 2);
+    std::vector<int32_t> allele_codes_with_phase(n_samples * 2);
+    std::vector<unsigned char> phase_bytes(n_samples);
+    for (uint32_t v = 0; v < n_variants; v++) {
+        BOOST_REQUIRE_EQUAL(ReadAlleles(reader_context, v, allele_codes.data()), 2);
+        ReadAlleles(reader_context, v, allele_codes_with_phase.data(), phase_bytes.data());
+        BOOST_REQUIRE(allele_codes == allele_codes_with_phase);
+    }
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+// a memory mapped reader decodes the same genotypes as an fread reader, for each possible file write mode
+BOOST_DATA_TEST_CASE(TestReadAllelesMemoryMapped, s_readerFileMode) {
+    constexpr long n_variants = 300;
+    constexpr int n_samples = 77;
+    constexpr uint32_t write_flags = kWriteFlagMultiAllelic | kWriteFlagPreservePhasing;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(fileName.c_str(), sample, write_flags, n_variants, n_samples, 1, allele_cts);
+
+    PgenReaderContext *const reader_context = OpenPgenReader(
+            fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()), kReadFlagMemoryMap);
+    BOOST_REQUIRE_EQUAL(GetReaderVariantCount(reader_context), n_variants);
+    BOOST_REQUIRE_EQUAL(GetReaderSampleCount(reader_context), n_samples);
+    RequireReadAllelesMatchesWritten(reader_context, write_flags, n_variants, n_samples);
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+// scattered (non-sequential) reads from a memory mapped reader match the same reads from an fread reader
+BOOST_AUTO_TEST_CASE(TestReadAllelesMemoryMappedRandomAccess) {
+    constexpr long n_variants = plink2::kPglVblockSize + 1001;
+    constexpr int n_samples = 35;
+    constexpr uint32_t write_flags = kWriteFlagMultiAllelic | kWriteFlagPreservePhasing;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(), READER_TEST_FILE_MODE_WRITE_AND_COPY, write_flags, n_variants, n_samples, 3, allele_cts);
+
+    PgenReaderContext *const fread_context =
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()));
+    PgenReaderContext *const mmap_context = OpenPgenReader(
+            fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()), kReadFlagMemoryMap);
+    std::vector<int32_t> fread_codes(n_samples * 2);
+    std::vector<unsigned char> fread_phase(n_samples);
+    std::vector<int32_t> mmap_codes(n_samples * 2);
+    std::vector<unsigned char> mmap_phase(n_samples);
+    for (long i = 0; i < n_variants; i++) {
+        const uint32_t v = static_cast<uint32_t>((i * 7919) % n_variants);
+        BOOST_REQUIRE_EQUAL(
+                ReadAlleles(mmap_context, v, mmap_codes.data(), mmap_phase.data()),
+                ReadAlleles(fread_context, v, fread_codes.data(), fread_phase.data()));
+        BOOST_REQUIRE(mmap_codes == fread_codes);
+        BOOST_REQUIRE(mmap_phase == fread_phase);
+    }
+    ClosePgenReader(fread_context);
+    ClosePgenReader(mmap_context);
+    RemovePgenFiles(fileName);
+}
+
+// a reader opened with a sample subset returns the same genotypes as a full width read filtered to the subset, in
+// both read modes
+constexpr boost::array<uint32_t, 2> s_readerReadFlags { 0, kReadFlagMemoryMap };
+BOOST_DATA_TEST_CASE(TestReadAllelesSampleSubset, s_readerReadFlags) {
+    constexpr long n_variants = 300;
+    constexpr int n_samples = 157;
+    constexpr uint32_t write_flags = kWriteFlagMultiAllelic | kWriteFlagPreservePhasing;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(), READER_TEST_FILE_MODE_WRITE_AND_COPY, write_flags, n_variants, n_samples, 1, allele_cts);
+
+    // include sample 0, the last sample, and an irregular pattern in between that spans several words
+    std::vector<int32_t> sample_indices;
+    for (int i = 0; i < n_samples; i++) {
+        if ((i == 0) || (i == n_samples - 1) || (i % 3 == 1) || ((i > 64) && (i < 70))) {
+            sample_indices.push_back(i);
+        }
+    }
+    PgenReaderContext *const full_context =
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()), sample);
+    PgenReaderContext *const subset_context = OpenPgenReader(
+            fileName.c_str(),
+            nullptr,
+            allele_cts.data(),
+            static_cast<long>(allele_cts.size()),
+            sample,
+            sample_indices.data(),
+            static_cast<long>(sample_indices.size()));
+    const uint32_t subset_ct = static_cast<uint32_t>(sample_indices.size());
+    BOOST_REQUIRE_EQUAL(GetReaderSampleCount(subset_context), subset_ct);
+    BOOST_REQUIRE_EQUAL(GetReaderRawSampleCount(subset_context), n_samples);
+
+    std::vector<int32_t> full_codes(n_samples * 2);
+    std::vector<unsigned char> full_phase(n_samples);
+    std::vector<int32_t> subset_codes(subset_ct * 2);
+    std::vector<unsigned char> subset_phase(subset_ct);
+    for (uint32_t v = 0; v < n_variants; v++) {
+        BOOST_REQUIRE_EQUAL(
+                ReadAlleles(subset_context, v, subset_codes.data(), subset_phase.data()),
+                ReadAlleles(full_context, v, full_codes.data(), full_phase.data()));
+        for (uint32_t i = 0; i < subset_ct; i++) {
+            const int32_t sample_idx = sample_indices[i];
+            BOOST_REQUIRE_EQUAL(subset_codes[i * 2], full_codes[sample_idx * 2]);
+            BOOST_REQUIRE_EQUAL(subset_codes[i * 2 + 1], full_codes[sample_idx * 2 + 1]);
+            BOOST_REQUIRE_EQUAL(subset_phase[i], full_phase[sample_idx]);
+        }
+    }
+    ClosePgenReader(full_context);
+    ClosePgenReader(subset_context);
+    RemovePgenFiles(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(TestRejectInvalidSampleSubset) {
+    constexpr long n_variants = 10;
+    constexpr int n_samples = 20;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(fileName.c_str(), READER_TEST_FILE_MODE_WRITE_AND_COPY, 0, n_variants, n_samples, 1, allele_cts);
+
+    const std::vector<int32_t> out_of_range { 1, 5, n_samples };
+    const char* const expectedRangeMessage = "Invalid sample index (20) at position 2";
+    BOOST_REQUIRE_EXCEPTION(
+            OpenPgenReader(fileName.c_str(), nullptr, nullptr, 0, 0, out_of_range.data(), 3),
+            PgenException,
+            [expectedRangeMessage](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedRangeMessage);
+            }
+    );
+    const std::vector<int32_t> unordered { 1, 5, 3 };
+    const char* const expectedOrderMessage = "strictly increasing order, but 3 follows 5";
+    BOOST_REQUIRE_EXCEPTION(
+            OpenPgenReader(fileName.c_str(), nullptr, nullptr, 0, 0, unordered.data(), 3),
+            PgenException,
+            [expectedOrderMessage](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedOrderMessage);
+            }
+    );
+    const char* const expectedSizeMessage = "Invalid sample subset size (0)";
+    BOOST_REQUIRE_EXCEPTION(
+            OpenPgenReader(fileName.c_str(), nullptr, nullptr, 0, 0, unordered.data(), 0),
+            PgenException,
+            [expectedSizeMessage](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedSizeMessage);
+            }
+    );
+    RemovePgenFiles(fileName);
+}
+
+// a parallel scan over every variant returns the same variants, in order, as sequential ReadAlleles calls, in both
+// read modes
+BOOST_DATA_TEST_CASE(TestScanAllVariants, s_readerReadFlags) {
+    constexpr long n_variants = plink2::kPglVblockSize + 1001;
+    constexpr int n_samples = 35;
+    constexpr uint32_t write_flags = kWriteFlagMultiAllelic | kWriteFlagPreservePhasing;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(), READER_TEST_FILE_MODE_WRITE_AND_COPY, write_flags, n_variants, n_samples, 3, allele_cts);
+
+    PgenReaderContext *const reader_context = OpenPgenReader(
+            fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()), sample);
+    PgenScan *const scan = StartPgenScan(reader_context, nullptr, 0, 0, n_variants, 4, 997);
+    std::vector<uint32_t> expected_variant_indices(n_variants);
+    for (uint32_t v = 0; v < n_variants; v++) {
+        expected_variant_indices[v] = v;
+    }
+    RequireScanMatchesReadAlleles(reader_context, scan, expected_variant_indices);
+    FinishPgenScan(scan);
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+// a scan honors the variant range, the variant include mask, and the reader's sample subset
+BOOST_DATA_TEST_CASE(TestScanVariantSubset, s_readerReadFlags) {
+    constexpr long n_variants = 3000;
+    constexpr int n_samples = 70;
+    constexpr uint32_t write_flags = kWriteFlagMultiAllelic | kWriteFlagPreservePhasing;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(), READER_TEST_FILE_MODE_WRITE_SEPARATE_INDEX, write_flags, n_variants, n_samples, 1, allele_cts);
+
+    std::vector<int32_t> sample_indices;
+    for (int i = 0; i < n_samples; i += 4) {
+        sample_indices.push_back(i);
+    }
+    PgenReaderContext *const reader_context = OpenPgenReader(
+            fileName.c_str(),
+            nullptr,
+            allele_cts.data(),
+            static_cast<long>(allele_cts.size()),
+            sample,
+            sample_indices.data(),
+            static_cast<long>(sample_indices.size()));
+
+    // every 5th variant, plus a run of consecutive variants, limited to [100, n_variants - 50)
+    constexpr uint32_t variant_start = 100;
+    constexpr uint32_t variant_end = n_variants - 50;
+    std::vector<uintptr_t> variant_include(plink2::BitCtToWordCt(n_variants));
+    std::vector<uint32_t> expected_variant_indices;
+    for (uint32_t v = 0; v < n_variants; v++) {
+        if ((v % 5 == 0) || ((v > 1000) && (v < 1300))) {
+            plink2::SetBit(v, variant_include.data());
+            if ((v >= variant_start) && (v < variant_end)) {
+                expected_variant_indices.push_back(v);
+            }
+        }
+    }
+    PgenScan *const scan = StartPgenScan(
+            reader_context,
+            variant_include.data(),
+            static_cast<uint32_t>(variant_include.size()),
+            variant_start,
+            variant_end,
+            3,
+            64);
+    RequireScanMatchesReadAlleles(reader_context, scan, expected_variant_indices);
+    FinishPgenScan(scan);
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(TestRejectInvalidScanArguments) {
+    constexpr long n_variants = 10;
+    constexpr int n_samples = 4;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(fileName.c_str(), READER_TEST_FILE_MODE_WRITE_AND_COPY, 0, n_variants, n_samples, 1, allele_cts);
+
+    PgenReaderContext *const reader_context = OpenPgenReader(fileName.c_str());
+    const char* const expectedRangeMessage = "Invalid scan range: 0..11";
+    BOOST_REQUIRE_EXCEPTION(
+            StartPgenScan(reader_context, nullptr, 0, 0, n_variants + 1, 1, 10),
+            PgenException,
+            [expectedRangeMessage](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedRangeMessage);
+            }
+    );
+    const char* const expectedThreadMessage = "Invalid scan thread count (0)";
+    BOOST_REQUIRE_EXCEPTION(
+            StartPgenScan(reader_context, nullptr, 0, 0, n_variants, 0, 10),
+            PgenException,
+            [expectedThreadMessage](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedThreadMessage);
+            }
+    );
+
+    // an empty range is valid, and returns no variants
+    PgenScan *const scan = StartPgenScan(reader_context, nullptr, 0, 5, 5, 2, 10);
+    BOOST_REQUIRE_EQUAL(ScanReadAlleles(scan, nullptr, nullptr, nullptr, nullptr), 0);
+    FinishPgenScan(scan);
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+// the genotype and allele counts computed from the compressed records match counts of the decoded genotypes, with
+// and without a sample subset, in both read modes
+BOOST_DATA_TEST_CASE(TestComputeAlleleCounts, s_readerReadFlags) {
+    constexpr long n_variants = plink2::kPglVblockSize + 700;
+    constexpr int n_samples = 83;
+    constexpr uint32_t write_flags = kWriteFlagMultiAllelic | kWriteFlagPreservePhasing;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(), READER_TEST_FILE_MODE_WRITE_AND_COPY, write_flags, n_variants, n_samples, 1, allele_cts);
+
+    PgenReaderContext *const full_context =
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()), sample);
+    RequireAlleleCountsMatchReadAlleles(full_context, 0, n_variants, 4);
+    RequireAlleleCountsMatchReadAlleles(full_context, 17, 1001, 1);
+    ClosePgenReader(full_context);
+
+    std::vector<int32_t> sample_indices;
+    for (int i = 0; i < n_samples; i++) {
+        if ((i % 3 != 0) || (i > 70)) {
+            sample_indices.push_back(i);
+        }
+    }
+    PgenReaderContext *const subset_context = OpenPgenReader(
+            fileName.c_str(),
+            nullptr,
+            allele_cts.data(),
+            static_cast<long>(allele_cts.size()),
+            sample,
+            sample_indices.data(),
+            static_cast<long>(sample_indices.size()));
+    RequireAlleleCountsMatchReadAlleles(subset_context, 0, n_variants, 3);
+    ClosePgenReader(subset_context);
+    RemovePgenFiles(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(TestRejectInvalidAlleleCountArguments) {
+    constexpr long n_variants = 15;
+    constexpr int n_samples = 20;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            kWriteFlagMultiAllelic | kWriteFlagPreservePhasing,
+            n_variants,
+            n_samples,
+            1,
+            allele_cts);
+
+    std::vector<uint32_t> genotype_counts(n_variants * 4);
+    PgenReaderContext *const reader_context =
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()));
+    const char* const expectedRangeMessage = "Invalid variant range: 0..16";
+    BOOST_REQUIRE_EXCEPTION(
+            ComputeAlleleCounts(reader_context, 0, n_variants + 1, 1, genotype_counts.data(), nullptr),
+            PgenException,
+            [expectedRangeMessage](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedRangeMessage);
+            }
+    );
+    const char* const expectedThreadMessage = "Invalid thread count (0)";
+    BOOST_REQUIRE_EXCEPTION(
+            ComputeAlleleCounts(reader_context, 0, n_variants, 0, genotype_counts.data(), nullptr),
+            PgenException,
+            [expectedThreadMessage](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedThreadMessage);
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            ComputeMissingness(reader_context, 2, 1, 1, 0, genotype_counts.data(), nullptr),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid variant range: 2..1");
+            }
+    );
+    ClosePgenReader(reader_context);
+
+    // without allele counts, the multi-allelic records can't be counted
+    PgenReaderContext *const biallelic_context = OpenPgenReader(fileName.c_str());
+    const char* const expectedMultiAllelicMessage = "no allele counts were provided";
+    BOOST_REQUIRE_EXCEPTION(
+            ComputeAlleleCounts(biallelic_context, 0, n_variants, 2, genotype_counts.data(), nullptr),
+            PgenException,
+            [expectedMultiAllelicMessage](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedMultiAllelicMessage);
+            }
+    );
+    ClosePgenReader(biallelic_context);
+    RemovePgenFiles(fileName);
+}
+
+// the per variant and per sample missing counts match counts of the decoded genotypes, with and without a sample
+// subset, in both read modes. there are enough variants to flush the per sample counters several times
+BOOST_DATA_TEST_CASE(TestComputeMissingness, s_readerReadFlags) {
+    constexpr long n_variants = 1900;
+    constexpr int n_samples = 211;
+    constexpr uint32_t write_flags = kWriteFlagMultiAllelic | kWriteFlagPreservePhasing;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(), READER_TEST_FILE_MODE_WRITE_AND_COPY, write_flags, n_variants, n_samples, 1, allele_cts);
+
+    PgenReaderContext *const full_context =
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()), sample);
+    RequireMissingnessMatchesReadAlleles(full_context, 0, n_variants, 4);
+    RequireMissingnessMatchesReadAlleles(full_context, 300, 301, 4);
+    ClosePgenReader(full_context);
+
+    std::vector<int32_t> sample_indices;
+    for (int i = 0; i < n_samples; i++) {
+        if ((i % 5 != 2) && (i != 64)) {
+            sample_indices.push_back(i);
+        }
+    }
+    PgenReaderContext *const subset_context = OpenPgenReader(
+            fileName.c_str(),
+            nullptr,
+            allele_cts.data(),
+            static_cast<long>(allele_cts.size()),
+            sample,
+            sample_indices.data(),
+            static_cast<long>(sample_indices.size()));
+    RequireMissingnessMatchesReadAlleles(subset_context, 11, n_variants - 3, 3);
+    ClosePgenReader(subset_context);
+
+    // missingness only depends on the hardcalls, so it doesn't need the allele counts
+    PgenReaderContext *const no_allele_cts_context = OpenPgenReader(fileName.c_str(), nullptr, nullptr, 0, sample);
+    PgenReaderContext *const allele_cts_context =
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()), sample);
+    std::vector<uint32_t> variant_missing_cts(n_variants);
+    std::vector<uint32_t> sample_missing_cts(n_samples);
+    std::vector<uint32_t> expected_variant_missing_cts(n_variants);
+    std::vector<uint32_t> expected_sample_missing_cts(n_samples);
+    ComputeMissingness(
+            no_allele_cts_context, 0, n_variants, 2, 0, variant_missing_cts.data(), sample_missing_cts.data());
+    ComputeMissingness(
+            allele_cts_context,
+            0,
+            n_variants,
+            2,
+            kMissingnessFlagDosage,  // there are no dosages, so this doesn't change the counts
+            expected_variant_missing_cts.data(),
+            expected_sample_missing_cts.data());
+    BOOST_REQUIRE(variant_missing_cts == expected_variant_missing_cts);
+    BOOST_REQUIRE(sample_missing_cts == expected_sample_missing_cts);
+    ClosePgenReader(no_allele_cts_context);
+    ClosePgenReader(allele_cts_context);
+    RemovePgenFiles(fileName);
+}
+
+// more samples and variants than fit in one transpose block, so the haplotypes of each thread's slice are assembled
+// from several blocks of each
+BOOST_DATA_TEST_CASE(TestReadHaplotypes, s_readerReadFlags) {
+    constexpr long n_variants = 1100;
+    constexpr int n_samples = 301;
+    constexpr uint32_t write_flags = kWriteFlagMultiAllelic | kWriteFlagPreservePhasing;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(), READER_TEST_FILE_MODE_WRITE_AND_COPY, write_flags, n_variants, n_samples, 1, allele_cts);
+
+    PgenReaderContext *const full_context =
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()), sample);
+    RequireHaplotypesMatchReadAlleles(full_context, 0, n_variants, 3);
+    RequireHaplotypesMatchReadAlleles(full_context, 257, 258, 3);
+    ClosePgenReader(full_context);
+
+    std::vector<int32_t> sample_indices;
+    for (int i = 0; i < n_samples; i++) {
+        if (i % 7 != 3) {
+            sample_indices.push_back(i);
+        }
+    }
+    PgenReaderContext *const subset_context = OpenPgenReader(
+            fileName.c_str(),
+            nullptr,
+            allele_cts.data(),
+            static_cast<long>(allele_cts.size()),
+            sample,
+            sample_indices.data(),
+            static_cast<long>(sample_indices.size()));
+    RequireHaplotypesMatchReadAlleles(subset_context, 5, n_variants - 9, 4);
+    ClosePgenReader(subset_context);
+    RemovePgenFiles(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(TestRejectInvalidHaplotypeArguments) {
+    constexpr long n_variants = 15;
+    constexpr int n_samples = 20;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            kWriteFlagMultiAllelic | kWriteFlagPreservePhasing,
+            n_variants,
+            n_samples,
+            1,
+            allele_cts);
+    BOOST_REQUIRE(std::any_of(allele_cts.begin(), allele_cts.end(), [](int32_t allele_ct) { return allele_ct > 2; }));
+
+    PgenReaderContext *const reader_context = OpenPgenReader(fileName.c_str());
+    std::vector<int32_t> hap0_codes(n_variants * n_samples);
+    std::vector<int32_t> hap1_codes(n_variants * n_samples);
+    BOOST_REQUIRE_EXCEPTION(
+            ReadHaplotypes(reader_context, 0, n_variants + 1, 1, hap0_codes.data(), hap1_codes.data()),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid variant range: 0..16");
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            ReadHaplotypes(reader_context, 0, n_variants, 0, hap0_codes.data(), hap1_codes.data()),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid thread count (0)");
+            }
+    );
+    // without allele counts, the phase of the multi-allelic records can't be read
+    BOOST_REQUIRE_EXCEPTION(
+            ReadHaplotypes(reader_context, 0, n_variants, 2, hap0_codes.data(), hap1_codes.data()),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "no allele counts were provided");
+            }
+    );
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+BOOST_DATA_TEST_CASE(TestComputeScores, s_readerReadFlags) {
+    constexpr long n_variants = 600;
+    constexpr int n_samples = 151;
+    constexpr uint32_t score_ct = 3;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            kWriteFlagMultiAllelic | kWriteFlagPreservePhasing,
+            n_variants,
+            n_samples,
+            1,
+            allele_cts);
+
+    // every third variant, in reverse order, with every allele of some variants (including the reference allele)
+    std::vector<uint32_t> variant_indices;
+    std::vector<uint32_t> allele_indices;
+    std::vector<double> weights;
+    for (long v = n_variants - 1; v >= 0; v -= 3) {
+        const uint32_t first_allele = v % 5 == 0 ? 0 : 1;
+        const uint32_t last_allele = v % 5 == 0 ? allele_cts[v] : 2;
+        for (uint32_t a = first_allele; a < last_allele; a++) {
+            variant_indices.push_back(static_cast<uint32_t>(v));
+            allele_indices.push_back(a);
+            weights.push_back(static_cast<double>(v % 7) - 3.0);
+            weights.push_back(0.125 * (a + 1));
+            weights.push_back(v % 2 == 0 ? 0.0 : -1.5);
+        }
+    }
+
+    PgenReaderContext *const full_context =
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()), sample);
+    RequireScoresMatchReadAlleles(full_context, variant_indices, allele_indices, weights, score_ct, 4, 0);
+    RequireScoresMatchReadAlleles(
+            full_context, variant_indices, allele_indices, weights, score_ct, 1, kScoreFlagNoMeanImpute);
+    ClosePgenReader(full_context);
+
+    std::vector<int32_t> sample_indices;
+    for (int i = 0; i < n_samples; i++) {
+        if (i % 4 != 1) {
+            sample_indices.push_back(i);
+        }
+    }
+    PgenReaderContext *const subset_context = OpenPgenReader(
+            fileName.c_str(),
+            nullptr,
+            allele_cts.data(),
+            static_cast<long>(allele_cts.size()),
+            sample,
+            sample_indices.data(),
+            static_cast<long>(sample_indices.size()));
+    RequireScoresMatchReadAlleles(subset_context, variant_indices, allele_indices, weights, score_ct, 3, 0);
+    ClosePgenReader(subset_context);
+    RemovePgenFiles(fileName);
+}
+
+// a sample with a dosage contributes its dosage, and missing dosages are mean imputed just as ReadDosages imputes them
+BOOST_AUTO_TEST_CASE(TestComputeScoresWithDosages) {
+    constexpr long n_variants = 40;
+    constexpr int n_samples = 33;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    const PgenContext *const pgen_context = OpenPgen(
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            kWriteFlagDosage,
+            n_variants,
+            n_samples,
+            plink2::kPglMaxAltAlleleCt,
+            1);
+    constexpr double dosage_choices[7] = { 0.0, 0.5, 1.25, 2.0, -9.0, 1.0, 0.75 };
+    std::vector<double> dosages(n_samples);
+    for (long v = 0; v < n_variants; v++) {
+        for (int i = 0; i < n_samples; i++) {
+            dosages[i] = dosage_choices[(i * 3 + v) % 7];
+        }
+        AppendDosages(pgen_context, dosages.data());
+    }
+    ClosePgen(pgen_context, 0);
+
+    PgenReaderContext *const reader_context = OpenPgenReader(fileName.c_str());
+    std::vector<uint32_t> variant_indices;
+    std::vector<uint32_t> allele_indices;
+    std::vector<double> weights;
+    for (long v = 0; v < n_variants; v++) {
+        variant_indices.push_back(static_cast<uint32_t>(v));
+        allele_indices.push_back(1);
+        weights.push_back(0.5 + v);
+    }
+    std::vector<double> scores(n_samples);
+    ComputeScores(
+            reader_context,
+            variant_indices.data(),
+            allele_indices.data(),
+            weights.data(),
+            n_variants,
+            1,
+            3,
+            0,
+            scores.data());
+    std::vector<double> imputed_dosages(n_variants * n_samples);
+    ReadDosages(reader_context, 0, n_variants, kDosageFlagMeanImpute, imputed_dosages.data());
+    for (int i = 0; i < n_samples; i++) {
+        double expected_score = 0.0;
+        for (long v = 0; v < n_variants; v++) {
+            expected_score += weights[v] * imputed_dosages[v * n_samples + i];
+        }
+        BOOST_REQUIRE_LT(fabs(scores[i] - expected_score), 1e-9);
+    }
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(TestRejectInvalidScoreArguments) {
+    constexpr long n_variants = 15;
+    constexpr int n_samples = 20;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            kWriteFlagMultiAllelic | kWriteFlagPreservePhasing,
+            n_variants,
+            n_samples,
+            1,
+            allele_cts);
+
+    PgenReaderContext *const reader_context =
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()));
+    std::vector<double> scores(n_samples);
+    const double weight = 1.0;
+    const uint32_t bad_variant = n_variants;
+    const uint32_t allele = 1;
+    BOOST_REQUIRE_EXCEPTION(
+            ComputeScores(reader_context, &bad_variant, &allele, &weight, 1, 1, 1, 0, scores.data()),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid variant index: 15");
+            }
+    );
+    const uint32_t variant = 0;
+    const uint32_t bad_allele = static_cast<uint32_t>(allele_cts[0]);
+    BOOST_REQUIRE_EXCEPTION(
+            ComputeScores(reader_context, &variant, &bad_allele, &weight, 1, 1, 1, 0, scores.data()),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid allele index");
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            ComputeScores(reader_context, &variant, &allele, &weight, 1, 1, 0, 0, scores.data()),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid thread count (0)");
+            }
+    );
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+BOOST_DATA_TEST_CASE(TestComputeGrm, s_readerReadFlags) {
+    constexpr long n_variants = 500;
+    constexpr int n_samples = 97;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            kWriteFlagMultiAllelic | kWriteFlagPreservePhasing,
+            n_variants,
+            n_samples,
+            1,
+            allele_cts);
+
+    PgenReaderContext *const full_context =
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()), sample);
+    RequireGrmTileMatchesReadAlleles(full_context, 0, n_variants, 3, 0, n_samples, n_samples);
+    // a tile that's taller than it is wide, and one that's wider than it is tall
+    RequireGrmTileMatchesReadAlleles(full_context, 3, n_variants - 40, 4, 30, 91, 17);
+    RequireGrmTileMatchesReadAlleles(full_context, 0, 77, 2, 60, 65, n_samples);
+    ClosePgenReader(full_context);
+
+    std::vector<int32_t> sample_indices;
+    for (int i = 0; i < n_samples; i++) {
+        if (i % 5 != 2) {
+            sample_indices.push_back(i);
+        }
+    }
+    PgenReaderContext *const subset_context = OpenPgenReader(
+            fileName.c_str(),
+            nullptr,
+            allele_cts.data(),
+            static_cast<long>(allele_cts.size()),
+            sample,
+            sample_indices.data(),
+            static_cast<long>(sample_indices.size()));
+    const uint32_t subset_ct = static_cast<uint32_t>(sample_indices.size());
+    RequireGrmTileMatchesReadAlleles(subset_context, 0, n_variants, 5, 0, subset_ct, subset_ct);
+    ClosePgenReader(subset_context);
+    RemovePgenFiles(fileName);
+}
+
+// the .grm.bin holds the lower triangle of the full matrix, however many tiles it's computed in
+BOOST_AUTO_TEST_CASE(TestWriteGrmBin) {
+    constexpr long n_variants = 300;
+    constexpr int n_samples = 61;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            kWriteFlagMultiAllelic | kWriteFlagPreservePhasing,
+            n_variants,
+            n_samples,
+            1,
+            allele_cts);
+    const std::string grmFileName = CreateTempPgenFileName("test_read.grm.bin");
+
+    PgenReaderContext *const reader_context =
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()));
+    uint32_t expected_variant_ct;
+    const std::vector<double> expected_grm = ComputeExpectedGrm(reader_context, 0, n_variants, expected_variant_ct);
+    for (const uint32_t tile_row_ct : { 1u, 13u, static_cast<uint32_t>(n_samples), 1000u }) {
+        const uint32_t used_variant_ct = WriteGrmBin(reader_context, 0, n_variants, 3, tile_row_ct, grmFileName.c_str());
+        BOOST_REQUIRE_EQUAL(used_variant_ct, expected_variant_ct);
+
+        FILE *grm_file = fopen(grmFileName.c_str(), "rb");
+        BOOST_REQUIRE(grm_file != nullptr);
+        std::vector<float> triangle(n_samples * (n_samples + 1) / 2 + 1);
+        BOOST_REQUIRE_EQUAL(fread(triangle.data(), sizeof(float), triangle.size(), grm_file), triangle.size() - 1);
+        fclose(grm_file);
+        size_t triangle_idx = 0;
+        for (int j = 0; j < n_samples; j++) {
+            for (int k = 0; k <= j; k++) {
+                BOOST_REQUIRE_LT(fabs(triangle[triangle_idx++] - expected_grm[j * n_samples + k]), 1e-5);
+            }
+        }
+    }
+    ClosePgenReader(reader_context);
+    unlink(grmFileName.c_str());
+    RemovePgenFiles(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(TestRejectInvalidGrmArguments) {
+    constexpr long n_variants = 15;
+    constexpr int n_samples = 20;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(fileName.c_str(), READER_TEST_FILE_MODE_WRITE_AND_COPY, 0, n_variants, n_samples, 1, allele_cts);
+
+    PgenReaderContext *const reader_context = OpenPgenReader(fileName.c_str());
+    std::vector<double> grm(n_samples * n_samples);
+    BOOST_REQUIRE_EXCEPTION(
+            ComputeGrmTile(reader_context, 0, n_variants + 1, 1, 0, n_samples, n_samples, grm.data()),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid variant range: 0..16");
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            ComputeGrmTile(reader_context, 0, n_variants, 0, 0, n_samples, n_samples, grm.data()),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid thread count (0)");
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            ComputeGrmTile(reader_context, 0, n_variants, 1, 5, 4, n_samples, grm.data()),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid GRM tile: rows 5..4");
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            ComputeGrmTile(reader_context, 0, n_variants, 1, 0, n_samples, n_samples + 1, grm.data()),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid GRM tile: rows 0..20, columns 0..21");
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            WriteGrmBin(reader_context, 0, n_variants, 1, 0, "unused.grm.bin"),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid GRM thread count or tile row count (0)");
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            WriteGrmBin(reader_context, 0, n_variants, 1, 4, "/nonexistent/dir/test.grm.bin"),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Error opening GRM file");
+            }
+    );
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+// pairs of fully phased variants (every third generated pattern) use the haplotype counts, and the rest use the
+// allele count correlation
+BOOST_DATA_TEST_CASE(TestComputeWindowLd, s_readerReadFlags) {
+    constexpr long n_variants = 130;
+    constexpr int n_samples = 203;
+    constexpr uint32_t window_ct = 9;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            kWriteFlagMultiAllelic | kWriteFlagPreservePhasing,
+            n_variants,
+            n_samples,
+            1,
+            allele_cts);
+
+    PgenReaderContext *const reader_context =
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()), sample);
+    for (const uint32_t ld_flags : { 0u, kLdFlagIgnorePhase }) {
+        for (const double min_r2 : { 0.0, 0.05 }) {
+            const uint32_t variant_start = 4;
+            const uint32_t variant_end = n_variants - 3;
+            std::vector<std::pair<uint32_t, uint32_t>> candidate_pairs;
+            for (uint32_t a = variant_start; a < variant_end; a++) {
+                for (uint32_t b = a + 1; (b < variant_end) && (b - a <= window_ct); b++) {
+                    candidate_pairs.emplace_back(a, b);
+                }
+            }
+            std::vector<LdPair> pairs;
+            ComputeWindowLd(reader_context, variant_start, variant_end, window_ct, min_r2, 4, ld_flags, &pairs);
+            RequireLdPairsMatchReadAlleles(reader_context, pairs, candidate_pairs, min_r2, ld_flags);
+        }
+    }
+    // the phased pairs' estimates differ from the unphased ones
+    std::vector<LdPair> phased_pairs;
+    std::vector<LdPair> unphased_pairs;
+    ComputeWindowLd(reader_context, 0, n_variants, window_ct, 0.0, 2, 0, &phased_pairs);
+    ComputeWindowLd(reader_context, 0, n_variants, window_ct, 0.0, 2, kLdFlagIgnorePhase, &unphased_pairs);
+    BOOST_REQUIRE(!phased_pairs.empty());
+    BOOST_REQUIRE(std::any_of(phased_pairs.begin(), phased_pairs.end(), [&](const LdPair &pair) {
+        return std::none_of(unphased_pairs.begin(), unphased_pairs.end(), [&](const LdPair &unphased) {
+            return (unphased.variant_a == pair.variant_a) && (unphased.variant_b == pair.variant_b) &&
+                   (unphased.d_prime == pair.d_prime);
+        });
+    }));
+
+    // a window wider than the range
+    std::vector<std::pair<uint32_t, uint32_t>> candidate_pairs;
+    for (uint32_t a = 50; a < 60; a++) {
+        for (uint32_t b = a + 1; b < 60; b++) {
+            candidate_pairs.emplace_back(a, b);
+        }
+    }
+    std::vector<LdPair> pairs;
+    ComputeWindowLd(reader_context, 50, 60, UINT32_MAX, 0.0, 3, 0, &pairs);
+    RequireLdPairsMatchReadAlleles(reader_context, pairs, candidate_pairs, 0.0, 0);
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+// a fully phased multi-allelic variant with alt/alt hets (whose phase is also stored) uses the haplotype counts
+BOOST_AUTO_TEST_CASE(TestComputeWindowLdMultiallelicPhased) {
+    constexpr int n_samples = 8;
+    // 0|1, 1|0, 1|2, 2|1, 0|0, 0|2, 2|0, 1|1
+    const int32_t multiallelic_codes[n_samples * 2] = { 0, 1, 1, 0, 1, 2, 2, 1, 0, 0, 0, 2, 2, 0, 1, 1 };
+    // 0|1, 1|0, 1|1, 1|1, 0|0, 0|1, 0|1, 1|1
+    const int32_t biallelic_codes[n_samples * 2] = { 0, 1, 1, 0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 1, 1, 1 };
+    const std::vector<unsigned char> phase_bytes(n_samples, 1);
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    const PgenContext *const pgen_context = OpenPgen(
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            kWriteFlagMultiAllelic | kWriteFlagPreservePhasing,
+            2,
+            n_samples,
+            2);
+    AppendAlleles(pgen_context, multiallelic_codes, phase_bytes.data(), 3);
+    AppendAlleles(pgen_context, biallelic_codes, phase_bytes.data(), 2);
+    ClosePgen(pgen_context, 0);
+
+    std::vector<int32_t> allele_cts { 3, 2 };
+    PgenReaderContext *const reader_context =
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()));
+    const std::vector<std::pair<uint32_t, uint32_t>> candidate_pairs { { 0, 1 } };
+    std::vector<LdPair> phased_pairs;
+    ComputeWindowLd(reader_context, 0, 2, 1, 0.0, 1, 0, &phased_pairs);
+    RequireLdPairsMatchReadAlleles(reader_context, phased_pairs, candidate_pairs, 0.0, 0);
+    std::vector<LdPair> unphased_pairs;
+    ComputeWindowLd(reader_context, 0, 2, 1, 0.0, 1, kLdFlagIgnorePhase, &unphased_pairs);
+    BOOST_REQUIRE_EQUAL(phased_pairs.size(), 1);
+    BOOST_REQUIRE_EQUAL(unphased_pairs.size(), 1);
+    BOOST_REQUIRE_NE(phased_pairs[0].d_prime, unphased_pairs[0].d_prime);
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(TestComputeCrossLd) {
+    constexpr long n_variants = 90;
+    constexpr int n_samples = 77;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            kWriteFlagMultiAllelic | kWriteFlagPreservePhasing,
+            n_variants,
+            n_samples,
+            1,
+            allele_cts);
+
+    std::vector<int32_t> sample_indices;
+    for (int i = 0; i < n_samples; i++) {
+        if (i % 3 != 0) {
+            sample_indices.push_back(i);
+        }
+    }
+    PgenReaderContext *const reader_context = OpenPgenReader(
+            fileName.c_str(),
+            nullptr,
+            allele_cts.data(),
+            static_cast<long>(allele_cts.size()),
+            0,
+            sample_indices.data(),
+            static_cast<long>(sample_indices.size()));
+    // overlapping ranges, so some pairs are reported in both orders, and no variant is paired with itself
+    std::vector<std::pair<uint32_t, uint32_t>> candidate_pairs;
+    for (uint32_t a = 20; a < 35; a++) {
+        for (uint32_t b = 30; b < 70; b++) {
+            if (a != b) {
+                candidate_pairs.emplace_back(a, b);
+            }
+        }
+    }
+    std::vector<LdPair> pairs;
+    ComputeCrossLd(reader_context, 20, 35, 30, 70, 0.02, 3, 0, &pairs);
+    RequireLdPairsMatchReadAlleles(reader_context, pairs, candidate_pairs, 0.02, 0);
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(TestRejectInvalidLdArguments) {
+    constexpr long n_variants = 15;
+    constexpr int n_samples = 20;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(fileName.c_str(), READER_TEST_FILE_MODE_WRITE_AND_COPY, 0, n_variants, n_samples, 1, allele_cts);
+
+    PgenReaderContext *const reader_context = OpenPgenReader(fileName.c_str());
+    std::vector<LdPair> pairs;
+    BOOST_REQUIRE_EXCEPTION(
+            ComputeWindowLd(reader_context, 0, n_variants + 1, 5, 0.0, 1, 0, &pairs),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid variant range: 0..16");
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            ComputeWindowLd(reader_context, 0, n_variants, 5, 0.0, 0, 0, &pairs),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid thread count (0)");
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            ComputeCrossLd(reader_context, 0, 5, 10, n_variants + 2, 0.0, 1, 0, &pairs),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid variant range: 10..17");
+            }
+    );
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+// validate a pgen with each read mode, and then with invalid variant records and an invalid header
+BOOST_DATA_TEST_CASE(TestValidatePgen, s_readerReadFlags) {
+    constexpr long n_variants = 200;
+    constexpr int n_samples = 61;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            kWriteFlagMultiAllelic | kWriteFlagPreservePhasing,
+            n_variants,
+            n_samples,
+            1,
+            allele_cts);
+
+    PgenValidationResult result;
+    PgenReaderContext *reader_context = OpenPgenReader(
+            fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()), sample);
+    for (const uint32_t thread_ct : { 1u, 3u, 8u, 1000u }) {
+        BOOST_REQUIRE(ValidatePgen(reader_context, thread_ct, &result));
+    }
+
+    // set the (unused) trailing bits of the last genotype byte of two plain 2-bit records; the first one is reported
+    std::vector<uint32_t> corrupt_vidxs;
+    for (uint32_t vidx = n_variants / 2; (vidx < n_variants) && (corrupt_vidxs.size() < 2); ++vidx) {
+        if ((reader_context->pgfip->vrtypes[vidx] & 0xff) == 0) {
+            corrupt_vidxs.push_back(vidx);
+        }
+    }
+    BOOST_REQUIRE_EQUAL(corrupt_vidxs.size(), 2);
+    std::vector<uint64_t> corrupt_fpos;
+    for (const uint32_t vidx : corrupt_vidxs) {
+        corrupt_fpos.push_back(plink2::GetPgfiFpos(reader_context->pgfip, vidx));
+    }
+    ClosePgenReader(reader_context);
+    FILE *pgen_file = fopen(fileName.c_str(), "r+b");
+    BOOST_REQUIRE(pgen_file != nullptr);
+    for (const uint64_t fpos : corrupt_fpos) {
+        const uint64_t last_geno_byte_fpos = fpos + (n_samples + 3) / 4 - 1;
+        BOOST_REQUIRE_EQUAL(fseeko(pgen_file, static_cast<off_t>(last_geno_byte_fpos), SEEK_SET), 0);
+        const int last_geno_byte = fgetc(pgen_file);
+        BOOST_REQUIRE_EQUAL(fseeko(pgen_file, static_cast<off_t>(last_geno_byte_fpos), SEEK_SET), 0);
+        fputc(last_geno_byte | 0xc0, pgen_file);
+    }
+    fclose(pgen_file);
+
+    reader_context = OpenPgenReader(
+            fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()), sample);
+    for (const uint32_t thread_ct : { 1u, 3u, 8u }) {
+        BOOST_REQUIRE(!ValidatePgen(reader_context, thread_ct, &result));
+        BOOST_REQUIRE_EQUAL(result.variant_index, corrupt_vidxs[0]);
+        BOOST_REQUIRE_EQUAL(result.byte_offset, corrupt_fpos[0]);
+        BOOST_REQUIRE(strstr(result.message, "nonzero trailing bits"));
+    }
+    ClosePgenReader(reader_context);
+
+    // a .pgen with extra bytes at the end has an invalid header
+    pgen_file = fopen(fileName.c_str(), "ab");
+    BOOST_REQUIRE(pgen_file != nullptr);
+    fputc(0, pgen_file);
+    fclose(pgen_file);
+    reader_context = OpenPgenReader(
+            fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()), sample);
+    BOOST_REQUIRE(!ValidatePgen(reader_context, 2, &result));
+    BOOST_REQUIRE_EQUAL(result.variant_index, kValidateNoVariant);
+    BOOST_REQUIRE(strstr(result.message, "file size"));
+    BOOST_REQUIRE_EXCEPTION(
+            ValidatePgen(reader_context, 0, &result),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid thread count (0)");
+            }
+    );
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+// concatenate shards written with different write modes and flags, and require that every variant of the output
+// reads back as it does from its shard. The first shard ends one variant before the end of the first vblock, so the
+// second shard's LD-compressed records (which start at the second one) can't be copied as they are
+BOOST_DATA_TEST_CASE(TestConcatPgens, s_readerReadFlags) {
+    constexpr int n_samples = 13;
+    const long shard_variant_cts[] = { plink2::kPglVblockSize - 1, 100, 50 };
+    const uint32_t shard_file_modes[] = {
+        READER_TEST_FILE_MODE_BACKWARD_SEEK,
+        READER_TEST_FILE_MODE_WRITE_SEPARATE_INDEX,
+        READER_TEST_FILE_MODE_WRITE_AND_COPY
+    };
+    // the second shard is biallelic and unphased, and every variant is the same, so it's one long LD run
+    const uint32_t shard_write_flags[] = {
+        kWriteFlagMultiAllelic | kWriteFlagPreservePhasing,
+        0,
+        kWriteFlagMultiAllelic | kWriteFlagPreservePhasing
+    };
+    std::vector<std::string> shard_file_names;
+    std::vector<std::vector<int32_t>> shard_allele_cts(3);
+    std::vector<int32_t> allele_cts;
+    for (uint32_t shard_idx = 0; shard_idx != 3; ++shard_idx) {
+        shard_file_names.push_back(CreateTempPgenFileName("test_concat_shard.pgen"));
+        WriteReaderTestPgen(
+                shard_file_names.back().c_str(),
+                shard_file_modes[shard_idx],
+                shard_write_flags[shard_idx],
+                shard_variant_cts[shard_idx],
+                n_samples,
+                1,
+                shard_allele_cts[shard_idx]);
+        allele_cts.insert(allele_cts.end(), shard_allele_cts[shard_idx].begin(), shard_allele_cts[shard_idx].end());
+    }
+    std::vector<const char *> shard_c_file_names;
+    for (const std::string &shard_file_name : shard_file_names) {
+        shard_c_file_names.push_back(shard_file_name.c_str());
+    }
+    const std::string fileName = CreateTempPgenFileName("test_concat.pgen");
+    ConcatPgens(shard_c_file_names.data(), 3, fileName.c_str(), READER_TEST_FILE_MODE_BACKWARD_SEEK, sample);
+
+    PgenReaderContext *reader_context = OpenPgenReader(
+            fileName.c_str(), nullptr, allele_cts.data(), static_cast<long>(allele_cts.size()), sample);
+    BOOST_REQUIRE_EQUAL(GetReaderVariantCount(reader_context), allele_cts.size());
+    BOOST_REQUIRE_EQUAL(GetReaderRawSampleCount(reader_context), n_samples);
+    BOOST_REQUIRE(!plink2::VrtypeLdCompressed(reader_context->pgfip->vrtypes[plink2::kPglVblockSize]));
+    PgenValidationResult result;
+    BOOST_REQUIRE(ValidatePgen(reader_context, 4, &result));
+
+    std::vector<int32_t> allele_codes(n_samples * 2);
+    std::vector<unsigned char> phase_bytes(n_samples);
+    std::vector<int32_t> shard_allele_codes(n_samples * 2);
+    std::vector<unsigned char> shard_phase_bytes(n_samples);
+    uint32_t out_vidx = 0;
+    for (uint32_t shard_idx = 0; shard_idx != 3; ++shard_idx) {
+        PgenReaderContext *shard_reader_context = OpenPgenReader(
+                shard_file_names[shard_idx].c_str(),
+                nullptr,
+                shard_allele_cts[shard_idx].data(),
+                static_cast<long>(shard_allele_cts[shard_idx].size()));
+        if (shard_idx == 1) {
+            BOOST_REQUIRE(plink2::VrtypeLdCompressed(shard_reader_context->pgfip->vrtypes[1]));
+        }
+        for (uint32_t vidx = 0; vidx < shard_variant_cts[shard_idx]; ++vidx, ++out_vidx) {
+            BOOST_REQUIRE_EQUAL(
+                    ReadAlleles(reader_context, out_vidx, allele_codes.data(), phase_bytes.data()),
+                    ReadAlleles(shard_reader_context, vidx, shard_allele_codes.data(), shard_phase_bytes.data()));
+            BOOST_REQUIRE(allele_codes == shard_allele_codes);
+            BOOST_REQUIRE(phase_bytes == shard_phase_bytes);
+        }
+        ClosePgenReader(shard_reader_context);
+    }
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+
+    // the shards must have the same number of samples
+    const std::string otherFileName = CreateTempPgenFileName("test_concat_other.pgen");
+    std::vector<int32_t> other_allele_cts;
+    WriteReaderTestPgen(
+            otherFileName.c_str(), READER_TEST_FILE_MODE_BACKWARD_SEEK, 0, 10, n_samples + 1, 1, other_allele_cts);
+    const char *mismatched_file_names[] = { shard_c_file_names[2], otherFileName.c_str() };
+    BOOST_REQUIRE_EXCEPTION(
+            ConcatPgens(mismatched_file_names, 2, fileName.c_str(), READER_TEST_FILE_MODE_BACKWARD_SEEK, sample),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "must have the same samples");
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            ConcatPgens(mismatched_file_names, 0, fileName.c_str(), READER_TEST_FILE_MODE_BACKWARD_SEEK, sample),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "At least one pgen");
+            }
+    );
+    RemovePgenFiles(otherFileName);
+    for (const std::string &shard_file_name : shard_file_names) {
+        RemovePgenFiles(shard_file_name);
+    }
+}
+
+// require that each listed variant of the source reads back from the extracted pgen as it does from the source
+static void RequireExtractMatchesSource(
+        PgenReaderContext *const source_context,
+        PgenReaderContext *const extract_context,
+        const std::vector<uint32_t> &variant_indices) {
+    const uint32_t sample_ct = GetReaderSampleCount(source_context);
+    BOOST_REQUIRE_EQUAL(GetReaderVariantCount(extract_context), variant_indices.size());
+    BOOST_REQUIRE_EQUAL(GetReaderSampleCount(extract_context), sample_ct);
+    PgenValidationResult result;
+    BOOST_REQUIRE(ValidatePgen(extract_context, 2, &result));
+    std::vector<int32_t> allele_codes(sample_ct * 2);
+    std::vector<unsigned char> phase_bytes(sample_ct);
+    std::vector<int32_t> source_allele_codes(sample_ct * 2);
+    std::vector<unsigned char> source_phase_bytes(sample_ct);
+    for (uint32_t idx = 0; idx != variant_indices.size(); ++idx) {
+        BOOST_REQUIRE_EQUAL(
+                ReadAlleles(extract_context, idx, allele_codes.data(), phase_bytes.data()),
+                ReadAlleles(source_context, variant_indices[idx], source_allele_codes.data(), source_phase_bytes.data()));
+        BOOST_REQUIRE(allele_codes == source_allele_codes);
+        BOOST_REQUIRE(phase_bytes == source_phase_bytes);
+    }
+}
+
+// extract variants without a sample subset, so that their records are copied, from a pgen with runs of LD-compressed
+// records; an LD-compressed record can only be copied as it is when the record it's based on was copied before it
+BOOST_DATA_TEST_CASE(TestExtractPgenVariants, s_readerReadFlags) {
+    constexpr long n_variants = 100;
+    constexpr int n_samples = 40;
+    constexpr long run_length = 20;
+    const std::string sourceFileName = CreateTempPgenFileName("test_extract_source.pgen");
+    // each run of variants has its own genotype pattern, and each variant in a run differs from the first one in one
+    // sample, so the rest of the run is LD-compressed against its first variant
+    const PgenContext *const pgen_context = OpenPgen(
+            sourceFileName.c_str(), READER_TEST_FILE_MODE_WRITE_AND_COPY, 0, n_variants, n_samples, 2, 1);
+    std::vector<int32_t> allele_codes(n_samples * 2);
+    for (long v = 0; v < n_variants; v++) {
+        for (int i = 0; i < n_samples; i++) {
+            const int32_t alt_ct = ((i * 7 + v / run_length) + ((i == v % run_length) ? 1 : 0)) % 3;
+            allele_codes[2 * i] = alt_ct == 2 ? 1 : 0;
+            allele_codes[2 * i + 1] = alt_ct == 0 ? 0 : 1;
+        }
+        AppendAlleles(pgen_context, allele_codes.data(), nullptr, 2);
+    }
+    ClosePgen(pgen_context, 0);
+
+    PgenReaderContext *const source_context = OpenPgenReader(sourceFileName.c_str(), nullptr, nullptr, 0, sample);
+    const unsigned char *const source_vrtypes = source_context->pgfip->vrtypes;
+    BOOST_REQUIRE(!plink2::VrtypeLdCompressed(source_vrtypes[0]));
+    BOOST_REQUIRE(plink2::VrtypeLdCompressed(source_vrtypes[5]));
+    BOOST_REQUIRE(!plink2::VrtypeLdCompressed(source_vrtypes[20]));
+    BOOST_REQUIRE(plink2::VrtypeLdCompressed(source_vrtypes[21]));
+    // 5 and 9 are based on 0, across gaps; 21, 22 and 25 are based on 20, which isn't extracted; 45-47 are based on 40
+    const std::vector<uint32_t> variant_indices = { 0, 1, 2, 3, 5, 9, 21, 22, 25, 40, 45, 46, 47, 99 };
+    const std::string fileName = CreateTempPgenFileName("test_extract.pgen");
+    ExtractPgen(
+            source_context,
+            variant_indices.data(),
+            static_cast<uint32_t>(variant_indices.size()),
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_BACKWARD_SEEK,
+            2);
+    PgenReaderContext *const extract_context = OpenPgenReader(fileName.c_str(), nullptr, nullptr, 0, sample);
+    BOOST_REQUIRE(plink2::VrtypeLdCompressed(extract_context->pgfip->vrtypes[4]));
+    BOOST_REQUIRE(!plink2::VrtypeLdCompressed(extract_context->pgfip->vrtypes[6]));
+    BOOST_REQUIRE(!plink2::VrtypeLdCompressed(extract_context->pgfip->vrtypes[7]));
+    BOOST_REQUIRE(plink2::VrtypeLdCompressed(extract_context->pgfip->vrtypes[10]));
+    RequireExtractMatchesSource(source_context, extract_context, variant_indices);
+    ClosePgenReader(extract_context);
+    RemovePgenFiles(fileName);
+
+    const std::vector<uint32_t> unordered_indices = { 0, 5, 5 };
+    BOOST_REQUIRE_EXCEPTION(
+            ExtractPgen(source_context, unordered_indices.data(), 3, fileName.c_str(), 0, 1),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "strictly increasing");
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            ExtractPgen(source_context, unordered_indices.data(), 0, fileName.c_str(), 0, 1),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "At least one variant");
+            }
+    );
+    ClosePgenReader(source_context);
+    RemovePgenFiles(sourceFileName);
+}
+
+// extract variants and samples of a multiallelic, phased pgen, which decodes and re-encodes them
+BOOST_DATA_TEST_CASE(TestExtractPgenSamples, s_readerReadFlags) {
+    constexpr long n_variants = 300;
+    constexpr int n_samples = 157;
+    constexpr uint32_t write_flags = kWriteFlagMultiAllelic | kWriteFlagPreservePhasing;
+    const std::string sourceFileName = CreateTempPgenFileName("test_extract_source.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            sourceFileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            write_flags,
+            n_variants,
+            n_samples,
+            1,
+            allele_cts);
+    std::vector<int32_t> sample_indices;
+    for (int i = 0; i < n_samples; i++) {
+        if ((i % 3 == 1) || ((i > 64) && (i < 70)) || (i == n_samples - 1)) {
+            sample_indices.push_back(i);
+        }
+    }
+    std::vector<uint32_t> variant_indices;
+    std::vector<int32_t> extract_allele_cts;
+    for (uint32_t vidx = 1; vidx < n_variants; vidx += 3) {
+        variant_indices.push_back(vidx);
+        extract_allele_cts.push_back(allele_cts[vidx]);
+    }
+
+    PgenReaderContext *const source_context = OpenPgenReader(
+            sourceFileName.c_str(),
+            nullptr,
+            allele_cts.data(),
+            static_cast<long>(allele_cts.size()),
+            sample,
+            sample_indices.data(),
+            static_cast<long>(sample_indices.size()));
+    const std::string fileName = CreateTempPgenFileName("test_extract.pgen");
+    ExtractPgen(
+            source_context,
+            variant_indices.data(),
+            static_cast<uint32_t>(variant_indices.size()),
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            3);
+    PgenReaderContext *const extract_context = OpenPgenReader(
+            fileName.c_str(),
+            nullptr,
+            extract_allele_cts.data(),
+            static_cast<long>(extract_allele_cts.size()),
+            sample);
+    BOOST_REQUIRE_EQUAL(GetReaderRawSampleCount(extract_context), sample_indices.size());
+    RequireExtractMatchesSource(source_context, extract_context, variant_indices);
+    ClosePgenReader(extract_context);
+    RemovePgenFiles(fileName);
+    ClosePgenReader(source_context);
+
+    // multiallelic variants can't be decoded without their allele counts
+    PgenReaderContext *const no_allele_cts_context = OpenPgenReader(
+            sourceFileName.c_str(),
+            nullptr,
+            nullptr,
+            0,
+            sample,
+            sample_indices.data(),
+            static_cast<long>(sample_indices.size()));
+    BOOST_REQUIRE_EXCEPTION(
+            ExtractPgen(
+                    no_allele_cts_context,
+                    variant_indices.data(),
+                    static_cast<uint32_t>(variant_indices.size()),
+                    fileName.c_str(),
+                    READER_TEST_FILE_MODE_WRITE_AND_COPY,
+                    3),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "no allele counts were provided");
+            }
+    );
+    ClosePgenReader(no_allele_cts_context);
+    RemovePgenFiles(sourceFileName);
+}
+
+// require that the genotypes of each sample read from a sample major sidecar, over [variantStart, variantEnd), are
+// the non-reference allele counts of the genotypes read by ReadAlleles
+static void RequireSampleMajorMatchesReadAlleles(
+        PgenReaderContext *const reader_context,
+        SampleMajorReader *const sample_major_reader,
+        const uint32_t variantStart,
+        const uint32_t variantEnd) {
+    const uint32_t sample_ct = GetReaderSampleCount(reader_context);
+    const uint32_t variant_ct = variantEnd - variantStart;
+    BOOST_REQUIRE_EQUAL(GetSampleMajorSampleCount(sample_major_reader), sample_ct);
+    BOOST_REQUIRE_EQUAL(GetSampleMajorVariantCount(sample_major_reader), GetReaderVariantCount(reader_context));
+    // sample major
+    std::vector<int8_t> expected(static_cast<uintptr_t>(sample_ct) * variant_ct);
+    std::vector<int32_t> allele_codes(sample_ct * 2);
+    for (uint32_t vidx = variantStart; vidx != variantEnd; ++vidx) {
+        ReadAlleles(reader_context, vidx, allele_codes.data(), nullptr);
+        for (uint32_t i = 0; i < sample_ct; i++) {
+            const int32_t code0 = allele_codes[i * 2];
+            const int32_t code1 = allele_codes[i * 2 + 1];
+            expected[static_cast<uintptr_t>(i) * variant_ct + vidx - variantStart] =
+                    code0 == -9 ? -9 : static_cast<int8_t>((code0 != 0 ? 1 : 0) + (code1 != 0 ? 1 : 0));
+        }
+    }
+    std::vector<int8_t> genotypes(variant_ct);
+    for (uint32_t i = 0; i < sample_ct; i++) {
+        ReadSampleGenotypes(sample_major_reader, i, variantStart, variantEnd, genotypes.data());
+        BOOST_REQUIRE(std::equal(
+                genotypes.begin(), genotypes.end(), expected.begin() + static_cast<uintptr_t>(i) * variant_ct));
+    }
+}
+
+// write a sample major sidecar for a pgen with samples whose genotypes are mostly reference, mostly non-reference,
+// mostly missing and mixed (so their rows are stored both sparse and raw), over several variant blocks
+BOOST_DATA_TEST_CASE(TestSampleMajorSidecar, s_readerReadFlags) {
+    constexpr long n_variants = 9000;
+    constexpr int n_samples = 300;
+    const std::string fileName = CreateTempPgenFileName("test_sample_major.pgen");
+    const std::string sidecarFileName = fileName + kSampleMajorExtension;
+    const PgenContext *const pgen_context = OpenPgen(
+            fileName.c_str(), READER_TEST_FILE_MODE_WRITE_AND_COPY, 0, n_variants, n_samples, 2, 1);
+    std::vector<int32_t> allele_codes(n_samples * 2);
+    for (long v = 0; v < n_variants; v++) {
+        for (int i = 0; i < n_samples; i++) {
+            // a pseudo-random genotype for the mixed samples, and an occasional one for the others
+            const uint32_t hash = static_cast<uint32_t>((v * 2654435761u) ^ (i * 40503u)) % 97;
+            int32_t alt_ct = static_cast<int32_t>(hash % 4);
+            if ((i % 4 != 3) && (hash > 2)) {
+                alt_ct = i % 4;
+            }
+            allele_codes[2 * i] = alt_ct == 3 ? -9 : (alt_ct == 2 ? 1 : 0);
+            allele_codes[2 * i + 1] = alt_ct == 3 ? -9 : (alt_ct == 0 ? 0 : 1);
+        }
+        AppendAlleles(pgen_context, allele_codes.data(), nullptr, 2);
+    }
+    ClosePgen(pgen_context, 0);
+
+    PgenReaderContext *const reader_context = OpenPgenReader(fileName.c_str(), nullptr, nullptr, 0, sample);
+    WriteSampleMajorSidecar(reader_context, sidecarFileName.c_str(), 3);
+    SampleMajorReader *const sample_major_reader = OpenSampleMajorReader(sidecarFileName.c_str());
+    RequireSampleMajorMatchesReadAlleles(reader_context, sample_major_reader, 0, n_variants);
+    // ranges that start and end inside blocks, and within a word
+    RequireSampleMajorMatchesReadAlleles(reader_context, sample_major_reader, 4001, 8193);
+    RequireSampleMajorMatchesReadAlleles(reader_context, sample_major_reader, 8999, 9000);
+    RequireSampleMajorMatchesReadAlleles(reader_context, sample_major_reader, 37, 37);
+
+    std::vector<int8_t> genotypes(n_variants);
+    BOOST_REQUIRE_EXCEPTION(
+            ReadSampleGenotypes(sample_major_reader, n_samples, 0, 1, genotypes.data()),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid sample index (300) or variant range (0..1)");
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            ReadSampleGenotypes(sample_major_reader, 0, 10, n_variants + 1, genotypes.data()),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Invalid sample index (0) or variant range (10..9001)");
+            }
+    );
+    CloseSampleMajorReader(sample_major_reader);
+    ClosePgenReader(reader_context);
+
+    // a pgen isn't a sidecar
+    BOOST_REQUIRE_EXCEPTION(
+            OpenSampleMajorReader(fileName.c_str()),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "unrecognized header");
+            }
+    );
+    std::remove(sidecarFileName.c_str());
+    RemovePgenFiles(fileName);
+}
+
+// a sidecar of the multi-allelic hardcalls of a sample subset
+BOOST_DATA_TEST_CASE(TestSampleMajorSidecarSampleSubset, s_readerReadFlags) {
+    constexpr long n_variants = 1100;
+    constexpr int n_samples = 301;
+    const std::string fileName = CreateTempPgenFileName("test_sample_major.pgen");
+    const std::string sidecarFileName = fileName + kSampleMajorExtension;
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            kWriteFlagMultiAllelic | kWriteFlagPreservePhasing,
+            n_variants,
+            n_samples,
+            1,
+            allele_cts);
+    std::vector<int32_t> sample_indices;
+    for (int i = 0; i < n_samples; i++) {
+        if (i % 5 != 2) {
+            sample_indices.push_back(i);
+        }
+    }
+    PgenReaderContext *const subset_context = OpenPgenReader(
+            fileName.c_str(),
+            nullptr,
+            allele_cts.data(),
+            static_cast<long>(allele_cts.size()),
+            sample,
+            sample_indices.data(),
+            static_cast<long>(sample_indices.size()));
+    WriteSampleMajorSidecar(subset_context, sidecarFileName.c_str(), 4);
+    SampleMajorReader *const sample_major_reader = OpenSampleMajorReader(sidecarFileName.c_str());
+    RequireSampleMajorMatchesReadAlleles(subset_context, sample_major_reader, 0, n_variants);
+    CloseSampleMajorReader(sample_major_reader);
+    ClosePgenReader(subset_context);
+    std::remove(sidecarFileName.c_str());
+    RemovePgenFiles(fileName);
+}
+
+// with dosages, a genotype with a dosage but no hardcall is missing unless kMissingnessFlagDosage is used, and the
+// allele dosages are the dosage sums
+BOOST_AUTO_TEST_CASE(TestComputeStatsWithDosages) {
+    constexpr long n_variants = 40;
+    constexpr int n_samples = 30;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    const PgenContext *const pgen_context = OpenPgen(
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            kWriteFlagDosage,
+            n_variants,
+            n_samples,
+            plink2::kPglMaxAltAlleleCt,
+            1);
+    // sample i has dosage 0, 0.5 (no hardcall), 1.25 (no hardcall), 2 or missing, in rotation by variant
+    constexpr double dosage_choices[5] = { 0.0, 0.5, 1.25, 2.0, -9.0 };
+    std::vector<double> dosages(n_samples);
+    for (long v = 0; v < n_variants; v++) {
+        for (int i = 0; i < n_samples; i++) {
+            dosages[i] = dosage_choices[(i + v) % 5];
+        }
+        AppendDosages(pgen_context, dosages.data());
+    }
+    ClosePgen(pgen_context, 0);
+
+    PgenReaderContext *const reader_context = OpenPgenReader(fileName.c_str());
+    std::vector<uint32_t> hc_variant_missing_cts(n_variants);
+    std::vector<uint32_t> hc_sample_missing_cts(n_samples);
+    std::vector<uint32_t> dosage_variant_missing_cts(n_variants);
+    std::vector<uint32_t> dosage_sample_missing_cts(n_samples);
+    ComputeMissingness(
+            reader_context, 0, n_variants, 3, 0, hc_variant_missing_cts.data(), hc_sample_missing_cts.data());
+    ComputeMissingness(
+            reader_context,
+            0,
+            n_variants,
+            3,
+            kMissingnessFlagDosage,
+            dosage_variant_missing_cts.data(),
+            dosage_sample_missing_cts.data());
+    for (long v = 0; v < n_variants; v++) {
+        BOOST_REQUIRE_EQUAL(hc_variant_missing_cts[v], 3 * n_samples / 5);
+        BOOST_REQUIRE_EQUAL(dosage_variant_missing_cts[v], n_samples / 5);
+    }
+    for (int i = 0; i < n_samples; i++) {
+        BOOST_REQUIRE_EQUAL(hc_sample_missing_cts[i], 3 * n_variants / 5);
+        BOOST_REQUIRE_EQUAL(dosage_sample_missing_cts[i], n_variants / 5);
+    }
+
+    std::vector<uint32_t> genotype_counts(n_variants * 4);
+    std::vector<double> allele_dosages(n_variants * 2);
+    ComputeAlleleCounts(reader_context, 0, n_variants, 2, genotype_counts.data(), allele_dosages.data());
+    constexpr double alt_dosage_sum = (0.5 + 1.25 + 2.0) * n_samples / 5;
+    constexpr double ref_dosage_sum = 2.0 * 4 * n_samples / 5 - alt_dosage_sum;
+    for (long v = 0; v < n_variants; v++) {
+        BOOST_REQUIRE_EQUAL(genotype_counts[v * 4], n_samples / 5);
+        BOOST_REQUIRE_EQUAL(genotype_counts[v * 4 + 2], n_samples / 5);
+        BOOST_REQUIRE_EQUAL(genotype_counts[v * 4 + 3], 3 * n_samples / 5);
+        BOOST_REQUIRE_EQUAL(allele_dosages[v * 2], ref_dosage_sum);
+        BOOST_REQUIRE_EQUAL(allele_dosages[v * 2 + 1], alt_dosage_sum);
+    }
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(TestReadDosages) {
+    constexpr long n_variants = 25;
+    constexpr int n_samples = 30;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    const PgenContext *const pgen_context = OpenPgen(
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            kWriteFlagDosage,
+            n_variants,
+            n_samples,
+            plink2::kPglMaxAltAlleleCt,
+            1);
+    // sample i has dosage 0, 0.5 (no hardcall), 1.25 (no hardcall), 2 or missing, in rotation by variant, except
+    // that every sample is missing for the last variant
+    constexpr double dosage_choices[5] = { 0.0, 0.5, 1.25, 2.0, -9.0 };
+    std::vector<double> dosages(n_samples);
+    for (long v = 0; v < n_variants; v++) {
+        for (int i = 0; i < n_samples; i++) {
+            dosages[i] = v == n_variants - 1 ? -9.0 : dosage_choices[(i + v) % 5];
+        }
+        AppendDosages(pgen_context, dosages.data());
+    }
+    ClosePgen(pgen_context, 0);
+
+    // read every other sample
+    std::vector<int32_t> sample_indices;
+    for (int i = 0; i < n_samples; i += 2) {
+        sample_indices.push_back(i);
+    }
+    constexpr double mean_dosage = (0.0 + 0.5 + 1.25 + 2.0) / 4;
+    for (const bool subset : { false, true }) {
+        PgenReaderContext *const reader_context = subset ?
+            OpenPgenReader(
+                fileName.c_str(), nullptr, nullptr, 0, 0, sample_indices.data(), static_cast<long>(sample_indices.size())) :
+            OpenPgenReader(fileName.c_str());
+        const uint32_t sample_ct = GetReaderSampleCount(reader_context);
+        constexpr uint32_t variant_start = 3;
+        constexpr uint32_t variant_end = n_variants - 1;
+        std::vector<float> float_dosages((variant_end - variant_start) * sample_ct);
+        std::vector<double> double_dosages((variant_end - variant_start) * sample_ct);
+        std::vector<double> imputed_dosages((variant_end - variant_start) * sample_ct);
+        std::vector<float> imputed_float_dosages((variant_end - variant_start) * sample_ct);
+        ReadDosages(reader_context, variant_start, variant_end, 0, float_dosages.data());
+        ReadDosages(reader_context, variant_start, variant_end, 0, double_dosages.data());
+        ReadDosages(reader_context, variant_start, variant_end, kDosageFlagMeanImpute, imputed_dosages.data());
+        ReadDosages(reader_context, variant_start, variant_end, kDosageFlagMeanImpute, imputed_float_dosages.data());
+        for (uint32_t v = variant_start; v < variant_end; v++) {
+            for (uint32_t i = 0; i < sample_ct; i++) {
+                const uint32_t sample_idx = subset ? sample_indices[i] : i;
+                const double expected = dosage_choices[(sample_idx + v) % 5];
+                const uintptr_t offset = (v - variant_start) * sample_ct + i;
+                BOOST_REQUIRE_EQUAL(float_dosages[offset], static_cast<float>(expected));
+                BOOST_REQUIRE_EQUAL(double_dosages[offset], expected);
+                BOOST_REQUIRE_EQUAL(imputed_dosages[offset], expected == -9.0 ? mean_dosage : expected);
+                BOOST_REQUIRE_EQUAL(
+                    imputed_float_dosages[offset], static_cast<float>(expected == -9.0 ? mean_dosage : expected));
+            }
+        }
+
+        std::vector<double> last_dosages(sample_ct);
+        ReadDosages(reader_context, n_variants - 1, n_variants, 0, last_dosages.data());
+        BOOST_REQUIRE(std::all_of(last_dosages.begin(), last_dosages.end(), [](double d) { return d == -9.0; }));
+        const char* const expectedMessage = "can't be mean imputed";
+        BOOST_REQUIRE_EXCEPTION(
+                ReadDosages(reader_context, n_variants - 1, n_variants, kDosageFlagMeanImpute, last_dosages.data()),
+                PgenException,
+                [expectedMessage](PgenException ex) -> bool {
+                    return strstr(ex.what(), expectedMessage);
+                }
+        );
+        BOOST_REQUIRE_EXCEPTION(
+                ReadDosages(reader_context, 2, n_variants + 1, 0, last_dosages.data()),
+                PgenException,
+                [](PgenException ex) -> bool {
+                    return strstr(ex.what(), "Invalid variant range");
+                }
+        );
+        ClosePgenReader(reader_context);
+    }
+    RemovePgenFiles(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(TestRejectMultiAllelicReadWithoutAlleleCounts) {
+    constexpr long n_variants = 15;
+    constexpr int n_samples = 20;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(
+            fileName.c_str(),
+            READER_TEST_FILE_MODE_WRITE_AND_COPY,
+            kWriteFlagMultiAllelic | kWriteFlagPreservePhasing,
+            n_variants,
+            n_samples,
+            1,
+            allele_cts);
+    const uint32_t multiallelic_vidx = static_cast<uint32_t>(
+            std::find_if(allele_cts.begin(), allele_cts.end(), [](int32_t allele_ct) { return allele_ct > 2; }) -
+            allele_cts.begin());
+    BOOST_REQUIRE_LT(multiallelic_vidx, n_variants);
+
+    PgenReaderContext *const reader_context = OpenPgenReader(fileName.c_str());
+    std::vector<int32_t> allele_codes(n_samples * 2);
+    const char* const expectedMessage = "no allele counts were provided";
+    BOOST_REQUIRE_EXCEPTION(
+            ReadAlleles(reader_context, multiallelic_vidx, allele_codes.data()),
+            PgenException,
+            [expectedMessage](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedMessage);
+            }
+    );
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(TestRejectInvalidReaderArguments) {
+    constexpr long n_variants = 10;
+    constexpr int n_samples = 4;
+    const std::string fileName = CreateTempPgenFileName("test_read.pgen");
+    std::vector<int32_t> allele_cts;
+    WriteReaderTestPgen(fileName.c_str(), READER_TEST_FILE_MODE_WRITE_AND_COPY, 0, n_variants, n_samples, 1, allele_cts);
+
+    const char* const expectedLengthMessage = "doesn't match the number of variants";
+    BOOST_REQUIRE_EXCEPTION(
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), n_variants - 1),
+            PgenException,
+            [expectedLengthMessage](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedLengthMessage);
+            }
+    );
+    allele_cts[3] = 1;
+    const char* const expectedAlleleCountMessage = "Invalid allele count (1) for variant 3";
+    BOOST_REQUIRE_EXCEPTION(
+            OpenPgenReader(fileName.c_str(), nullptr, allele_cts.data(), n_variants),
+            PgenException,
+            [expectedAlleleCountMessage](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedAlleleCountMessage);
+            }
+    );
+
+    PgenReaderContext *const reader_context = OpenPgenReader(fileName.c_str());
+    std::vector<int32_t> allele_codes(n_samples * 2);
+    const char* const expectedIndexMessage = "Invalid variant index: 10";
+    BOOST_REQUIRE_EXCEPTION(
+            ReadAlleles(reader_context, n_variants, allele_codes.data()),
+            PgenException,
+            [expectedIndexMessage](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedIndexMessage);
+            }
+    );
+    ClosePgenReader(reader_context);
+    RemovePgenFiles(fileName);
+
+    // the file is gone now
+    const char* const expectedOpenMessage = "PgfiInitPhase1 failed";
+    BOOST_REQUIRE_EXCEPTION(
+            OpenPgenReader(fileName.c_str()),
+            PgenException,
+            [expectedOpenMessage](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedOpenMessage);
+            }
+    );
+}
+
+//******************* Local Test Utilities *******************
+
+// reserve a temp file name; the caller should remove the file (and any companion files) when it's done with it
+static std::string CreateTempPgenFileName(const char* const nameTemplate) {
+    //this is deprecated (and maybe a little sketchy), but works nicely to obtain a tmp dir location
+    std::string tmpPath = std::tmpnam(nullptr);
+    std::vector<char> outputFileName(tmpPath.size() + strlen(nameTemplate) + 32);
+    snprintf(outputFileName.data(), outputFileName.size(), "%s_pgenBoostXXXXXX%s", tmpPath.c_str(), nameTemplate);
+    int fDesc = mkstemps(outputFileName.data(), strlen(nameTemplate));
+    if (fDesc < 1) {
+        throw PgenException("Temp file creation failed");
+    }
+    close(fDesc);
+    return std::string(outputFileName.data());
+}
+
+// generate the allele codes for one variant, with a mix of allele counts, missing genotypes and phasing (fully
+// phased, unphased, and partially phased). het allele codes are deliberately written in both orders
+static void GenerateVariant(
+        const long variant,
+        const int n_samples,
+        std::vector<int32_t> &allele_codes,
+        std::vector<unsigned char> &phase_bytes,
+        int32_t &allele_ct) {
+    const long pattern = (variant / 3) % 13;
+    allele_ct = (pattern % 4 == 0) ? 2 + static_cast<int32_t>(pattern % 5) : 2;
+    for (int i = 0; i < n_samples; i++) {
+        if ((i + pattern) % 17 == 0) {
+            allele_codes[i * 2] = -9;
+            allele_codes[i * 2 + 1] = -9;
+        } else {
+            allele_codes[i * 2] = static_cast<int32_t>((i * 3 + pattern) % allele_ct);
+            allele_codes[i * 2 + 1] = static_cast<int32_t>((i * pattern + 1) % allele_ct);
+        }
+        phase_bytes[i] = static_cast<unsigned char>((pattern % 3 == 0) || ((pattern % 3 == 1) && (i % 2)));
+    }
+}
+
+// write n_variants generated variants, returning the allele count of each variant; without kWriteFlagMultiAllelic
+// every variant is written as biallelic
+static void WriteReaderTestPgen(
+        const char* const fileName,
+        const uint32_t pgen_file_mode,
+        const uint32_t write_flags,
+        const long n_variants,
+        const int n_samples,
+        const int thread_count,
+        std::vector<int32_t> &allele_cts) {
+    const PgenContext *const pgen_context = OpenPgen(
+            fileName, pgen_file_mode, write_flags, n_variants, n_samples, plink2::kPglMaxAltAlleleCt, thread_count);
+    std::vector<int32_t> allele_codes(n_samples * 2);
+    std::vector<unsigned char> phase_bytes(n_samples);
+    allele_cts.clear();
+    for (long v = 0; v < n_variants; v++) {
+        int32_t allele_ct;
+        GenerateVariant(write_flags & kWriteFlagMultiAllelic ? v : 0, n_samples, allele_codes, phase_bytes, allele_ct);
+        AppendAlleles(pgen_context, allele_codes.data(), phase_bytes.data(), allele_ct);
+        allele_cts.push_back(allele_ct);
+    }
+    ClosePgen(pgen_context, 0);
+}
+
+// read every variant, and require that the allele codes match the ones that were written. unphased hets are read
+// back in ascending allele code order, and the phase byte of every homozygous genotype is 1
+static void RequireReadAllelesMatchesWritten(
+        PgenReaderContext *const reader_context,
+        const uint32_t write_flags,
+        const long n_variants,
+        const int n_samples) {
+    std::vector<int32_t> expected_codes(n_samples * 2);
+    std::vector<unsigned char> written_phase_bytes(n_samples);
+    std::vector<int32_t> allele_codes(n_samples * 2);
+    std::vector<unsigned char> phase_bytes(n_samples);
+    for (long v = 0; v < n_variants; v++) {
+        int32_t expected_allele_ct;
+        GenerateVariant(write_flags & kWriteFlagMultiAllelic ? v : 0, n_samples, expected_codes, written_phase_bytes, expected_allele_ct);
+        const uint32_t allele_ct =
+                ReadAlleles(reader_context, static_cast<uint32_t>(v), allele_codes.data(), phase_bytes.data());
+        BOOST_REQUIRE_EQUAL(allele_ct, static_cast<uint32_t>(expected_allele_ct));
+        for (int i = 0; i < n_samples; i++) {
+            int32_t code0 = expected_codes[i * 2];
+            int32_t code1 = expected_codes[i * 2 + 1];
+            const bool is_het = code0 != code1;
+            const bool phased = is_het && (write_flags & kWriteFlagPreservePhasing) && written_phase_bytes[i];
+            if (is_het && !phased && (code0 > code1)) {
+                std::swap(code0, code1);
+            }
+            BOOST_REQUIRE_EQUAL(allele_codes[i * 2], code0);
+            BOOST_REQUIRE_EQUAL(allele_codes[i * 2 + 1], code1);
+            if (code0 != -9) {
+                BOOST_REQUIRE_EQUAL(phase_bytes[i], is_het ? static_cast<unsigned char>(phased) : 1);
+            }
+        }
+    }
+}
+
+// scan to the end, and require that the scan returns the expected variants, in order, with the same genotypes that
+// ReadAlleles returns
+static void RequireScanMatchesReadAlleles(
+        PgenReaderContext *const reader_context,
+        PgenScan *const scan,
+        const std::vector<uint32_t> &expected_variant_indices) {
+    const uint32_t sample_ct = GetReaderSampleCount(reader_context);
+    const uint32_t batch_ct = GetScanBatchVariantCount(scan);
+    std::vector<uint32_t> variant_indices(batch_ct);
+    std::vector<int32_t> allele_codes(batch_ct * sample_ct * 2);
+    std::vector<unsigned char> phase_bytes(batch_ct * sample_ct);
+    std::vector<uint32_t> allele_cts(batch_ct);
+    std::vector<int32_t> expected_codes(sample_ct * 2);
+    std::vector<unsigned char> expected_phase(sample_ct);
+    size_t scanned_ct = 0;
+    uint32_t variant_ct;
+    while ((variant_ct = ScanReadAlleles(
+            scan, variant_indices.data(), allele_codes.data(), phase_bytes.data(), allele_cts.data()))) {
+        BOOST_REQUIRE(variant_ct <= batch_ct);
+        for (uint32_t i = 0; i < variant_ct; i++) {
+            BOOST_REQUIRE(scanned_ct < expected_variant_indices.size());
+            BOOST_REQUIRE_EQUAL(variant_indices[i], expected_variant_indices[scanned_ct++]);
+            BOOST_REQUIRE_EQUAL(
+                    allele_cts[i],
+                    ReadAlleles(reader_context, variant_indices[i], expected_codes.data(), expected_phase.data()));
+            BOOST_REQUIRE(std::equal(
+                    expected_codes.begin(), expected_codes.end(), allele_codes.begin() + i * sample_ct * 2));
+            BOOST_REQUIRE(std::equal(
+                    expected_phase.begin(), expected_phase.end(), phase_bytes.begin() + i * sample_ct));
+        }
+    }
+    BOOST_REQUIRE_EQUAL(scanned_ct, expected_variant_indices.size());
+    // a finished scan stays finished
+    BOOST_REQUIRE_EQUAL(
+            ScanReadAlleles(scan, variant_indices.data(), allele_codes.data(), phase_bytes.data(), allele_cts.data()),
+            0);
+}
+
+// compute the genotype and allele counts for [variant_start, variant_end), and require that they match counts of
+// the genotypes returned by ReadAlleles
+static void RequireAlleleCountsMatchReadAlleles(
+        PgenReaderContext *const reader_context,
+        const uint32_t variant_start,
+        const uint32_t variant_end,
+        const uint32_t thread_count) {
+    const uint32_t sample_ct = GetReaderSampleCount(reader_context);
+    const uint64_t allele_idx_start = GetReaderAlleleIndexOffset(reader_context, variant_start);
+    std::vector<uint32_t> genotype_counts((variant_end - variant_start) * 4);
+    std::vector<double> allele_dosages(GetReaderAlleleIndexOffset(reader_context, variant_end) - allele_idx_start);
+    ComputeAlleleCounts(
+            reader_context, variant_start, variant_end, thread_count, genotype_counts.data(), allele_dosages.data());
+
+    std::vector<int32_t> allele_codes(sample_ct * 2);
+    for (uint32_t v = variant_start; v < variant_end; v++) {
+        const uint32_t allele_ct = ReadAlleles(reader_context, v, allele_codes.data());
+        uint32_t expected_genotype_counts[4] = { 0, 0, 0, 0 };
+        std::vector<double> expected_allele_counts(allele_ct);
+        for (uint32_t i = 0; i < sample_ct; i++) {
+            const int32_t code0 = allele_codes[i * 2];
+            const int32_t code1 = allele_codes[i * 2 + 1];
+            if (code0 == -9) {
+                expected_genotype_counts[3]++;
+                continue;
+            }
+            expected_genotype_counts[(code0 != 0) + (code1 != 0)]++;
+            expected_allele_counts[code0]++;
+            expected_allele_counts[code1]++;
+        }
+        for (int j = 0; j < 4; j++) {
+            BOOST_REQUIRE_EQUAL(genotype_counts[(v - variant_start) * 4 + j], expected_genotype_counts[j]);
+        }
+        const uint64_t allele_idx = GetReaderAlleleIndexOffset(reader_context, v) - allele_idx_start;
+        for (uint32_t a = 0; a < allele_ct; a++) {
+            BOOST_REQUIRE_EQUAL(allele_dosages[allele_idx + a], expected_allele_counts[a]);
+        }
+    }
+}
+
+// compute the missing counts for [variant_start, variant_end), and require that they match counts of the missing
+// genotypes returned by ReadAlleles
+static void RequireMissingnessMatchesReadAlleles(
+        PgenReaderContext *const reader_context,
+        const uint32_t variant_start,
+        const uint32_t variant_end,
+        const uint32_t thread_count) {
+    const uint32_t sample_ct = GetReaderSampleCount(reader_context);
+    std::vector<uint32_t> variant_missing_cts(variant_end - variant_start);
+    std::vector<uint32_t> sample_missing_cts(sample_ct);
+    ComputeMissingness(
+            reader_context,
+            variant_start,
+            variant_end,
+            thread_count,
+            0,
+            variant_missing_cts.data(),
+            sample_missing_cts.data());
+
+    std::vector<uint32_t> expected_sample_missing_cts(sample_ct);
+    std::vector<int32_t> allele_codes(sample_ct * 2);
+    for (uint32_t v = variant_start; v < variant_end; v++) {
+        ReadAlleles(reader_context, v, allele_codes.data());
+        uint32_t expected_variant_missing_ct = 0;
+        for (uint32_t i = 0; i < sample_ct; i++) {
+            if (allele_codes[i * 2] == -9) {
+                expected_variant_missing_ct++;
+                expected_sample_missing_cts[i]++;
+            }
+        }
+        BOOST_REQUIRE_EQUAL(variant_missing_cts[v - variant_start], expected_variant_missing_ct);
+    }
+    BOOST_REQUIRE(sample_missing_cts == expected_sample_missing_cts);
+}
+
+// a haplotype code is 0 for the reference allele, 1 for any alt allele, or -9 if missing, with the alleles in the
+// (phased, or for an unphased het, ascending) order that ReadAlleles returns them
+static void RequireHaplotypesMatchReadAlleles(
+        PgenReaderContext *const reader_context,
+        const uint32_t variant_start,
+        const uint32_t variant_end,
+        const uint32_t thread_count) {
+    const uint32_t sample_ct = GetReaderSampleCount(reader_context);
+    const uint32_t variant_ct = variant_end - variant_start;
+    std::vector<int32_t> hap0_codes(static_cast<size_t>(variant_ct) * sample_ct);
+    std::vector<int32_t> hap1_codes(static_cast<size_t>(variant_ct) * sample_ct);
+    ReadHaplotypes(reader_context, variant_start, variant_end, thread_count, hap0_codes.data(), hap1_codes.data());
+
+    std::vector<int32_t> allele_codes(sample_ct * 2);
+    for (uint32_t v = variant_start; v < variant_end; v++) {
+        ReadAlleles(reader_context, v, allele_codes.data());
+        for (uint32_t i = 0; i < sample_ct; i++) {
+            const size_t hap_idx = static_cast<size_t>(i) * variant_ct + (v - variant_start);
+            const int32_t code0 = allele_codes[i * 2];
+            const int32_t code1 = allele_codes[i * 2 + 1];
+            BOOST_REQUIRE_EQUAL(hap0_codes[hap_idx], code0 == -9 ? -9 : (code0 != 0 ? 1 : 0));
+            BOOST_REQUIRE_EQUAL(hap1_codes[hap_idx], code1 == -9 ? -9 : (code1 != 0 ? 1 : 0));
+        }
+    }
+}
+
+// each score is the weighted sum of the number of copies of each weighted allele in the allele codes; a missing
+// genotype contributes the mean allele count of the variant's other samples (or nothing, with kScoreFlagNoMeanImpute)
+static void RequireScoresMatchReadAlleles(
+        PgenReaderContext *const reader_context,
+        const std::vector<uint32_t> &variant_indices,
+        const std::vector<uint32_t> &allele_indices,
+        const std::vector<double> &weights,
+        const uint32_t score_ct,
+        const uint32_t thread_count,
+        const uint32_t score_flags) {
+    const uint32_t sample_ct = GetReaderSampleCount(reader_context);
+    const uint32_t weight_ct = static_cast<uint32_t>(variant_indices.size());
+    std::vector<double> scores(score_ct * sample_ct);
+    ComputeScores(
+            reader_context,
+            variant_indices.data(),
+            allele_indices.data(),
+            weights.data(),
+            weight_ct,
+            score_ct,
+            thread_count,
+            score_flags,
+            scores.data());
+
+    std::vector<double> expected_scores(score_ct * sample_ct);
+    std::vector<int32_t> allele_codes(sample_ct * 2);
+    std::vector<double> allele_dosages(sample_ct);
+    for (uint32_t w = 0; w < weight_ct; w++) {
+        ReadAlleles(reader_context, variant_indices[w], allele_codes.data());
+        const int32_t allele = static_cast<int32_t>(allele_indices[w]);
+        double dosage_sum = 0.0;
+        uint32_t nonmissing_ct = 0;
+        for (uint32_t i = 0; i < sample_ct; i++) {
+            if (allele_codes[i * 2] != -9) {
+                allele_dosages[i] = (allele_codes[i * 2] == allele) + (allele_codes[i * 2 + 1] == allele);
+                dosage_sum += allele_dosages[i];
+                nonmissing_ct++;
+            }
+        }
+        const double missing_dosage =
+                ((score_flags & kScoreFlagNoMeanImpute) || (nonmissing_ct == 0)) ? 0.0 : dosage_sum / nonmissing_ct;
+        for (uint32_t i = 0; i < sample_ct; i++) {
+            const double dosage = allele_codes[i * 2] == -9 ? missing_dosage : allele_dosages[i];
+            for (uint32_t s = 0; s < score_ct; s++) {
+                expected_scores[s * sample_ct + i] += weights[w * score_ct + s] * dosage;
+            }
+        }
+    }
+    for (uint32_t j = 0; j < score_ct * sample_ct; j++) {
+        BOOST_REQUIRE_LT(fabs(scores[j] - expected_scores[j]), 1e-9);
+    }
+}
+
+// compute a GRM tile, and require that it matches the corresponding entries of a GRM computed directly from the
+// allele codes
+static void RequireGrmTileMatchesReadAlleles(
+        PgenReaderContext *const reader_context,
+        const uint32_t variant_start,
+        const uint32_t variant_end,
+        const uint32_t thread_count,
+        const uint32_t row_start,
+        const uint32_t row_end,
+        const uint32_t column_end) {
+    const uint32_t sample_ct = GetReaderSampleCount(reader_context);
+    std::vector<double> grm(static_cast<size_t>(row_end - row_start) * column_end);
+    const uint32_t used_variant_ct = ComputeGrmTile(
+            reader_context, variant_start, variant_end, thread_count, row_start, row_end, column_end, grm.data());
+
+    uint32_t expected_variant_ct;
+    const std::vector<double> expected_grm =
+            ComputeExpectedGrm(reader_context, variant_start, variant_end, expected_variant_ct);
+    BOOST_REQUIRE_GT(expected_variant_ct, 0);
+    BOOST_REQUIRE_EQUAL(used_variant_ct, expected_variant_ct);
+    for (uint32_t j = row_start; j < row_end; j++) {
+        for (uint32_t k = 0; k < column_end; k++) {
+            BOOST_REQUIRE_LT(
+                    fabs(grm[(j - row_start) * column_end + k] - expected_grm[j * sample_ct + k]), 1e-9);
+        }
+    }
+}
+
+// the full GRM (sample_ct x sample_ct), from the standardized non-reference allele counts of the polymorphic variants
+static std::vector<double> ComputeExpectedGrm(
+        PgenReaderContext *const reader_context,
+        const uint32_t variant_start,
+        const uint32_t variant_end,
+        uint32_t &used_variant_ct) {
+    const uint32_t sample_ct = GetReaderSampleCount(reader_context);
+    std::vector<double> grm(static_cast<size_t>(sample_ct) * sample_ct);
+    std::vector<int32_t> allele_codes(sample_ct * 2);
+    std::vector<double> standardized(sample_ct);
+    used_variant_ct = 0;
+    for (uint32_t v = variant_start; v < variant_end; v++) {
+        ReadAlleles(reader_context, v, allele_codes.data());
+        double nonref_sum = 0.0;
+        uint32_t nonmissing_ct = 0;
+        for (uint32_t i = 0; i < sample_ct; i++) {
+            if (allele_codes[i * 2] != -9) {
+                nonref_sum += (allele_codes[i * 2] != 0) + (allele_codes[i * 2 + 1] != 0);
+                nonmissing_ct++;
+            }
+        }
+        if (nonmissing_ct == 0) {
+            continue;
+        }
+        const double freq = nonref_sum / (2.0 * nonmissing_ct);
+        if ((freq == 0.0) || (freq == 1.0)) {
+            continue;
+        }
+        used_variant_ct++;
+        const double sd = sqrt(2.0 * freq * (1.0 - freq));
+        for (uint32_t i = 0; i < sample_ct; i++) {
+            standardized[i] = allele_codes[i * 2] == -9 ?
+                    0.0 :
+                    ((allele_codes[i * 2] != 0) + (allele_codes[i * 2 + 1] != 0) - 2.0 * freq) / sd;
+        }
+        for (uint32_t j = 0; j < sample_ct; j++) {
+            for (uint32_t k = 0; k < sample_ct; k++) {
+                grm[j * sample_ct + k] += standardized[j] * standardized[k];
+            }
+        }
+    }
+    for (double &entry : grm) {
+        entry /= used_variant_ct;
+    }
+    return grm;
+}
+
+// require that the pairs are exactly the candidate pairs (in order) that have a defined r^2 of at least min_r2, with
+// r^2 and D' computed directly from the allele codes: from the haplotype counts if both variants are fully phased
+// (and phase isn't ignored), and otherwise from the non-reference allele count correlation
+static void RequireLdPairsMatchReadAlleles(
+        PgenReaderContext *const reader_context,
+        const std::vector<LdPair> &pairs,
+        const std::vector<std::pair<uint32_t, uint32_t>> &candidate_pairs,
+        const double min_r2,
+        const uint32_t ld_flags) {
+    const uint32_t sample_ct = GetReaderSampleCount(reader_context);
+    const uint32_t variant_ct = GetReaderVariantCount(reader_context);
+    // the alt allele (0 or 1) on each haplotype of each sample, -1 for missing, and whether each variant is phased
+    std::vector<std::vector<int>> haplotypes(variant_ct, std::vector<int>(sample_ct * 2));
+    std::vector<bool> phased(variant_ct);
+    std::vector<int32_t> allele_codes(sample_ct * 2);
+    std::vector<unsigned char> phase_bytes(sample_ct);
+    for (uint32_t v = 0; v < variant_ct; v++) {
+        ReadAlleles(reader_context, v, allele_codes.data(), phase_bytes.data());
+        phased[v] = !(ld_flags & kLdFlagIgnorePhase);
+        for (uint32_t i = 0; i < sample_ct; i++) {
+            const bool missing = allele_codes[i * 2] == -9;
+            haplotypes[v][i * 2] = missing ? -1 : allele_codes[i * 2] != 0;
+            haplotypes[v][i * 2 + 1] = missing ? -1 : allele_codes[i * 2 + 1] != 0;
+            if (!missing && (haplotypes[v][i * 2] != haplotypes[v][i * 2 + 1]) && !phase_bytes[i]) {
+                phased[v] = false;
+            }
+        }
+    }
+
+    size_t pair_idx = 0;
+    for (const std::pair<uint32_t, uint32_t> &candidate : candidate_pairs) {
+        const std::vector<int> &haps_a = haplotypes[candidate.first];
+        const std::vector<int> &haps_b = haplotypes[candidate.second];
+        double n = 0, sum_a = 0, sum_b = 0, sq_a = 0, sq_b = 0, cross = 0, alt_alt_haps = 0;
+        for (uint32_t i = 0; i < sample_ct; i++) {
+            if ((haps_a[i * 2] < 0) || (haps_b[i * 2] < 0)) {
+                continue;
+            }
+            const double x_a = haps_a[i * 2] + haps_a[i * 2 + 1];
+            const double x_b = haps_b[i * 2] + haps_b[i * 2 + 1];
+            n++;
+            sum_a += x_a;
+            sum_b += x_b;
+            sq_a += x_a * x_a;
+            sq_b += x_b * x_b;
+            cross += x_a * x_b;
+            alt_alt_haps += (haps_a[i * 2] & haps_b[i * 2]) + (haps_a[i * 2 + 1] & haps_b[i * 2 + 1]);
+        }
+        const double var_a = sq_a / n - (sum_a / n) * (sum_a / n);
+        const double var_b = sq_b / n - (sum_b / n) * (sum_b / n);
+        const double freq_a = sum_a / (2 * n);
+        const double freq_b = sum_b / (2 * n);
+        const bool both_phased = phased[candidate.first] && phased[candidate.second];
+        if ((n == 0) || (freq_a == 0) || (freq_a == 1) || (freq_b == 0) || (freq_b == 1) ||
+            (!both_phased && ((var_a <= 1e-12) || (var_b <= 1e-12)))) {
+            continue;
+        }
+        double d;
+        double r2;
+        if (both_phased) {
+            d = alt_alt_haps / (2 * n) - freq_a * freq_b;
+            r2 = d * d / (freq_a * (1 - freq_a) * freq_b * (1 - freq_b));
+        } else {
+            const double cov = cross / n - (sum_a / n) * (sum_b / n);
+            d = cov / 2;
+            r2 = cov * cov / (var_a * var_b);
+        }
+        if (r2 < min_r2 - 1e-12) {
+            continue;
+        }
+        const double d_max = d > 0 ?
+                std::min(freq_a * (1 - freq_b), (1 - freq_a) * freq_b) :
+                std::min(freq_a * freq_b, (1 - freq_a) * (1 - freq_b));
+        const double d_prime = std::max(-1.0, std::min(1.0, d / d_max));
+        BOOST_REQUIRE_LT(pair_idx, pairs.size());
+        BOOST_REQUIRE_EQUAL(pairs[pair_idx].variant_a, candidate.first);
+        BOOST_REQUIRE_EQUAL(pairs[pair_idx].variant_b, candidate.second);
+        BOOST_REQUIRE_LT(fabs(pairs[pair_idx].r2 - r2), 1e-9);
+        BOOST_REQUIRE_LT(fabs(pairs[pair_idx].d_prime - d_prime), 1e-9);
+        pair_idx++;
+    }
+    BOOST_REQUIRE_EQUAL(pair_idx, pairs.size());
+}
+
+static void RemovePgenFiles(const std::string &fileName) {
+    unlink(fileName.c_str());
+    unlink((fileName + ".pgi").c_str());
+}
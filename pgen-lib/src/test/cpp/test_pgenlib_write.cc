@@ -1,6 +1,10 @@
 #define BOOST_TEST_MODULE pgen_write
 #include <sys/stat.h>
 #include <stdio.h>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <vector>
 
 #include <boost/test/included/unit_test.hpp>
 #include <boost/test/data/test_case.hpp>
@@ -9,8 +13,13 @@
 #include "pgenMissingVariantsException.h"
 #include "pgenEmptyPgenException.h"
 #include "pgenContext.h"
+#include "pgenConvert.h"
 #include "pgenIO.h"
+#include "pgenMTWriter.h"
+#include "pgenReader.h"
+#include "pgenRecordCopy.h"
 #include "pgenUtils.h"
+#include "pgenWriterInternals.h"
 
 using namespace boost::unit_test;
 using namespace pgenlib;
@@ -31,6 +40,33 @@ long WriteTestPgen(
         const long n_variants,
         const int n_samples,
         long &writtenVariantCount);
+std::vector<char> ReadFileContents(const char* const fileName);
+int32_t RequireConvertAlleleCodesMatchesPlink2(
+        const int32_t* const allele_codes,
+        const unsigned char* const phase_bytes,
+        const uint32_t n_samples,
+        uint32_t &het_ct,
+        uint32_t &phased_het_ct);
+void WriteGeneratedPgen(
+        const char* const fileName,
+        const uint32_t pgen_file_mode,
+        const long declared_variants,
+        const long n_variants,
+        const int n_samples,
+        const int thread_count);
+void WriteGeneratedDosagePgen(
+        const char* const fileName,
+        const long n_variants,
+        const int n_samples,
+        const int thread_count,
+        const bool use_doubles);
+void WriteGeneratedMTPgen(
+        const char* const fileName,
+        const uint32_t declared_variants,
+        const uint32_t n_variants,
+        const uint32_t n_samples,
+        const uint32_t thread_count,
+        const uint64_t max_staged_chunk_bytes);
 // integer constants to parallel PgenFileMode, for use when calling jni callable functions, which can't
 // use the PgenFileMode enum provided by plink2
 constexpr uint32_t PGEN_FILE_MODE_BACKWARD_SEEK = static_cast<int>(plink2::PgenWriteMode::kPgenWriteBackwardSeek);
@@ -167,6 +203,308 @@ BOOST_AUTO_TEST_CASE(TestMultiallelicSomeAllelesNotObserved) {
     WriteTestPgen(allele_codes, nullptr, n_alleles, PGEN_FILE_MODE_WRITE_AND_COPY, 0, n_variants, n_samples, variantCount);
 }
 
+// write the same partially phased, multi-allelic variants once per-variant and once in batches, and verify that the
+// resulting files are identical
+BOOST_AUTO_TEST_CASE(TestAppendAllelesBatchMatchesAppendAlleles) {
+    constexpr uint32_t n_variants = 50;
+    constexpr int n_samples = 37;
+    constexpr uint32_t batch_size = 16; // deliberately not a divisor of n_variants, so the last batch is partial
+    const uint32_t write_flags = pgenlib::kWriteFlagMultiAllelic | pgenlib::kWriteFlagPreservePhasing;
+    std::vector<int32_t> allele_codes(n_variants * n_samples * 2);
+    std::vector<unsigned char> phase_bytes(n_variants * n_samples);
+    std::vector<int32_t> allele_cts(n_variants);
+    for (uint32_t v = 0; v < n_variants; v++) {
+        allele_cts[v] = 2 + (v % 3);
+        GenerateAlleleCodeDistribution(&allele_codes[v * n_samples * 2], n_samples, allele_cts[v]);
+        for (int i = 0; i < n_samples; i++) {
+            phase_bytes[v * n_samples + i] = static_cast<unsigned char>((i + v) % 2);
+        }
+    }
+
+    char single_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_single.pgen", single_file_name);
+    const pgenlib::PgenContext *const single_context = pgenlib::OpenPgen(
+            single_file_name, PGEN_FILE_MODE_WRITE_AND_COPY, write_flags, n_variants, n_samples, plink2::kPglMaxAltAlleleCt);
+    for (uint32_t v = 0; v < n_variants; v++) {
+        pgenlib::AppendAlleles(single_context, &allele_codes[v * n_samples * 2], &phase_bytes[v * n_samples], allele_cts[v]);
+    }
+    ClosePgen(single_context, 0);
+
+    char batch_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_batch.pgen", batch_file_name);
+    const pgenlib::PgenContext *const batch_context = pgenlib::OpenPgen(
+            batch_file_name, PGEN_FILE_MODE_WRITE_AND_COPY, write_flags, n_variants, n_samples, plink2::kPglMaxAltAlleleCt);
+    for (uint32_t v = 0; v < n_variants; v += batch_size) {
+        const uint32_t variant_ct = std::min(batch_size, n_variants - v);
+        pgenlib::AppendAllelesBatch(
+                batch_context, &allele_codes[v * n_samples * 2], &phase_bytes[v * n_samples], &allele_cts[v], variant_ct);
+    }
+    BOOST_REQUIRE_EQUAL(GetNumberOfVariantsWritten(batch_context), n_variants);
+    ClosePgen(batch_context, 0);
+
+    const std::vector<char> single_contents = ReadFileContents(single_file_name);
+    const std::vector<char> batch_contents = ReadFileContents(batch_file_name);
+    unlink(single_file_name);
+    unlink(batch_file_name);
+    BOOST_REQUIRE_NE(single_contents.size(), 0);
+    BOOST_REQUIRE(single_contents == batch_contents);
+}
+
+// hand batches off to the async writer, cycling through (queue depth + 1) batch buffers the way the Java writer
+// does, and verify that the output is identical to the output of synchronous appends
+BOOST_AUTO_TEST_CASE(TestAsyncAppendsMatchAppendAlleles) {
+    constexpr uint32_t n_variants = 5000;
+    constexpr int n_samples = 37;
+    constexpr uint32_t batch_size = 16;
+    constexpr int queue_depth = 2;
+    const uint32_t write_flags = pgenlib::kWriteFlagMultiAllelic | pgenlib::kWriteFlagPreservePhasing;
+    std::vector<int32_t> allele_codes(n_variants * n_samples * 2);
+    std::vector<unsigned char> phase_bytes(n_variants * n_samples);
+    std::vector<int32_t> allele_cts(n_variants);
+    for (uint32_t v = 0; v < n_variants; v++) {
+        allele_cts[v] = 2 + (v % 3);
+        GenerateAlleleCodeDistribution(&allele_codes[v * n_samples * 2], n_samples, allele_cts[v]);
+        for (int i = 0; i < n_samples; i++) {
+            phase_bytes[v * n_samples + i] = static_cast<unsigned char>((i + v) % 2);
+        }
+    }
+
+    char sync_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_sync.pgen", sync_file_name);
+    const pgenlib::PgenContext *const sync_context = pgenlib::OpenPgen(
+            sync_file_name, PGEN_FILE_MODE_WRITE_AND_COPY, write_flags, n_variants, n_samples, plink2::kPglMaxAltAlleleCt);
+    pgenlib::AppendAllelesBatch(sync_context, allele_codes.data(), phase_bytes.data(), allele_cts.data(), n_variants);
+    ClosePgen(sync_context, 0);
+
+    char async_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_async.pgen", async_file_name);
+    pgenlib::PgenContext *const async_context = pgenlib::OpenPgen(
+            async_file_name, PGEN_FILE_MODE_WRITE_AND_COPY, write_flags, n_variants, n_samples, plink2::kPglMaxAltAlleleCt);
+    pgenlib::StartAsyncAppends(async_context, queue_depth);
+    std::vector<std::vector<int32_t>> code_buffers(queue_depth + 1, std::vector<int32_t>(batch_size * n_samples * 2));
+    std::vector<std::vector<unsigned char>> phase_buffers(queue_depth + 1, std::vector<unsigned char>(batch_size * n_samples));
+    std::vector<std::vector<int32_t>> count_buffers(queue_depth + 1, std::vector<int32_t>(batch_size));
+    for (uint32_t v = 0, buffer_idx = 0; v < n_variants; v += batch_size, buffer_idx = (buffer_idx + 1) % (queue_depth + 1)) {
+        const uint32_t variant_ct = std::min(batch_size, n_variants - v);
+        std::copy_n(&allele_codes[v * n_samples * 2], variant_ct * n_samples * 2, code_buffers[buffer_idx].begin());
+        std::copy_n(&phase_bytes[v * n_samples], variant_ct * n_samples, phase_buffers[buffer_idx].begin());
+        std::copy_n(&allele_cts[v], variant_ct, count_buffers[buffer_idx].begin());
+        pgenlib::AppendAllelesBatchAsync(
+                async_context,
+                code_buffers[buffer_idx].data(),
+                phase_buffers[buffer_idx].data(),
+                count_buffers[buffer_idx].data(),
+                variant_ct);
+    }
+    BOOST_REQUIRE_EQUAL(GetNumberOfVariantsWritten(async_context), n_variants);
+    ClosePgen(async_context, 0);
+
+    const std::vector<char> sync_contents = ReadFileContents(sync_file_name);
+    const std::vector<char> async_contents = ReadFileContents(async_file_name);
+    unlink(sync_file_name);
+    unlink(async_file_name);
+    BOOST_REQUIRE_NE(sync_contents.size(), 0);
+    BOOST_REQUIRE(sync_contents == async_contents);
+}
+
+// an error appending an async batch is reported by the next call that waits for the queue, and again on close
+BOOST_AUTO_TEST_CASE(TestAsyncAppendErrorSurfacesOnDrainAndClose) {
+    constexpr long n_variants = 6;
+    constexpr int n_samples = 3;
+    constexpr int32_t allele_codes[] {0, 0, 0, -17, 0, 0};
+    constexpr int32_t allele_cts[] {2};
+    const char* const expectedMessageFragment = "Attempt to append invalid allele code";
+    char tmpFileName[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write.pgen", tmpFileName);
+    pgenlib::PgenContext *const pgenContext = pgenlib::OpenPgen(
+            tmpFileName, PGEN_FILE_MODE_WRITE_AND_COPY, 0, n_variants, n_samples, plink2::kPglMaxAltAlleleCt);
+    pgenlib::StartAsyncAppends(pgenContext, 1);
+    pgenlib::AppendAllelesBatchAsync(pgenContext, allele_codes, nullptr, allele_cts, 1);
+    BOOST_REQUIRE_EXCEPTION(
+            GetNumberOfVariantsWritten(pgenContext),
+            PgenException,
+            [expectedMessageFragment](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedMessageFragment);
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            ClosePgen(pgenContext, 0),
+            PgenException,
+            [expectedMessageFragment](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedMessageFragment);
+            }
+    );
+    unlink(tmpFileName);
+}
+
+// a batch that fails part way through has already appended the variants before the failed one, so the writer is
+// abandoned rather than closed, including with async batches still queued
+BOOST_AUTO_TEST_CASE(TestAbandonAfterFailedBatchAppend) {
+    constexpr long n_variants = 6;
+    constexpr int n_samples = 3;
+    constexpr int32_t allele_codes[] {0, 1, 1, 1, 0, 0, 0, 0, 0, -17, 0, 0};
+    constexpr int32_t allele_cts[] {2, 2};
+    char tmpFileName[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write.pgen", tmpFileName);
+    const pgenlib::PgenContext *const pgenContext = pgenlib::OpenPgen(
+            tmpFileName, PGEN_FILE_MODE_WRITE_AND_COPY, 0, n_variants, n_samples, plink2::kPglMaxAltAlleleCt);
+    BOOST_REQUIRE_THROW(
+            pgenlib::AppendAllelesBatch(pgenContext, allele_codes, nullptr, allele_cts, 2),
+            PgenException);
+    BOOST_REQUIRE_EQUAL(GetNumberOfVariantsWritten(pgenContext), 1);
+    pgenlib::AbandonPgen(pgenContext);
+
+    pgenlib::PgenContext *const asyncContext = pgenlib::OpenPgen(
+            tmpFileName, PGEN_FILE_MODE_WRITE_AND_COPY, 0, n_variants, n_samples, plink2::kPglMaxAltAlleleCt);
+    pgenlib::StartAsyncAppends(asyncContext, 2);
+    pgenlib::AppendAllelesBatchAsync(asyncContext, allele_codes, nullptr, allele_cts, 2);
+    pgenlib::AppendAllelesBatchAsync(asyncContext, allele_codes, nullptr, allele_cts, 1);
+    pgenlib::AbandonPgen(asyncContext);
+    unlink(tmpFileName);
+}
+
+// write enough variants of mixed phasing and allele counts to span several rounds of multi-threaded variant
+// blocks, with the last block partial, and verify that the multi-threaded output is identical to the single
+// threaded output
+BOOST_DATA_TEST_CASE(TestMultiThreadedMatchesSingleThreaded, s_pgenFileMode) {
+    constexpr long n_variants = 4 * plink2::kPglVblockSize + 1000;
+    constexpr int n_samples = 24;
+    char st_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_st.pgen", st_file_name);
+    WriteGeneratedPgen(st_file_name, sample, n_variants, n_variants, n_samples, 1);
+    const std::vector<char> st_contents = ReadFileContents(st_file_name);
+    unlink(st_file_name);
+    BOOST_REQUIRE_NE(st_contents.size(), 0);
+
+    for (int thread_count = 2; thread_count <= 3; thread_count++) {
+        char mt_file_name[TMP_FILENAME_SIZE];
+        CreateTempFile("test_write_mt.pgen", mt_file_name);
+        WriteGeneratedPgen(mt_file_name, sample, n_variants, n_variants, n_samples, thread_count);
+        const std::vector<char> mt_contents = ReadFileContents(mt_file_name);
+        unlink(mt_file_name);
+        BOOST_REQUIRE(st_contents == mt_contents);
+    }
+}
+
+// declare more variants than are written (as when the caller drops variants), and verify that the multi-threaded
+// output is still identical to the single threaded output. This exercises MpgwSetFinalVariantCt (see
+// pgenWriterInternals.h), including when the written variants end on a variant block boundary.
+constexpr boost::array<long, 2> s_droppedVariantsWritten {
+    plink2::kPglVblockSize + 10,
+    2 * plink2::kPglVblockSize
+};
+BOOST_DATA_TEST_CASE(TestMultiThreadedDroppedVariants, s_droppedVariantsWritten) {
+    const long n_variants = sample;
+    const long declared_variants = n_variants + 3 * plink2::kPglVblockSize;
+    constexpr int n_samples = 7;
+    char st_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_st.pgen", st_file_name);
+    WriteGeneratedPgen(st_file_name, PGEN_FILE_MODE_WRITE_AND_COPY, declared_variants, n_variants, n_samples, 1);
+    char mt_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_mt.pgen", mt_file_name);
+    WriteGeneratedPgen(mt_file_name, PGEN_FILE_MODE_WRITE_AND_COPY, declared_variants, n_variants, n_samples, 4);
+
+    const std::vector<char> st_contents = ReadFileContents(st_file_name);
+    const std::vector<char> mt_contents = ReadFileContents(mt_file_name);
+    unlink(st_file_name);
+    unlink(mt_file_name);
+    BOOST_REQUIRE_NE(st_contents.size(), 0);
+    BOOST_REQUIRE(st_contents == mt_contents);
+}
+
+// stage the variants of each block in chunks much smaller than the block (including one variant per chunk), and
+// verify that the output is identical to the output when each block is staged in one chunk
+constexpr boost::array<uint64_t, 2> s_stagedChunkBytes { 1, 4000 };
+BOOST_DATA_TEST_CASE(TestMultiThreadedChunkedStagingMatches, s_stagedChunkBytes) {
+    constexpr uint32_t n_variants = 2 * plink2::kPglVblockSize + 500;
+    constexpr uint32_t declared_variants = n_variants + plink2::kPglVblockSize;
+    constexpr uint32_t n_samples = 300;
+    char whole_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_mt.pgen", whole_file_name);
+    WriteGeneratedMTPgen(whole_file_name, declared_variants, n_variants, n_samples, 2, kMTWriterMaxStagedChunkBytes);
+    char chunked_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_mt_chunked.pgen", chunked_file_name);
+    WriteGeneratedMTPgen(chunked_file_name, declared_variants, n_variants, n_samples, 2, sample);
+
+    const std::vector<char> whole_contents = ReadFileContents(whole_file_name);
+    const std::vector<char> chunked_contents = ReadFileContents(chunked_file_name);
+    unlink(whole_file_name);
+    unlink(chunked_file_name);
+    BOOST_REQUIRE_NE(whole_contents.size(), 0);
+    BOOST_REQUIRE(whole_contents == chunked_contents);
+}
+
+// append plain 2-bit genotype records (across a vblock boundary) to a record writer through the raw record accessors in
+// pgenWriterInternals.h, as the record copier does, and verify that they read back as written; a phased vrtype must be
+// refused by an output without a phase track
+BOOST_AUTO_TEST_CASE(TestSpgwRawRecordAppend) {
+    constexpr uint32_t n_variants = plink2::kPglVblockSize + 10;
+    constexpr uint32_t n_samples = 37; // spans two genotype vector words, the second one partial
+    const uint32_t genovec_byte_ct = plink2::NypCtToByteCt(n_samples);
+    std::vector<uintptr_t> genovec(plink2::NypCtToWordCt(n_samples));
+    char tmpFileName[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_raw.pgen", tmpFileName);
+    PgenRecordWriter *const record_writer = pgenlib::OpenPgenRecordWriter(
+            tmpFileName, PGEN_FILE_MODE_WRITE_AND_COPY, n_variants, n_samples, 2, plink2::kfPgenGlobal0, 0);
+    plink2::STPgenWriter *const spgwp = record_writer->spgwp;
+    BOOST_REQUIRE_EQUAL(pgenlib::SpgwGetVariantCtLimit(spgwp), n_variants);
+    BOOST_REQUIRE(
+            pgenlib::SpgwAppendRecordIndexEntry(spgwp, genovec_byte_ct, 0x10, pgenlib::SpgwGetNextRecordFpos(spgwp)));
+    BOOST_REQUIRE_EQUAL(pgenlib::GetRecordWriterVariantCount(record_writer), 0);
+    for (uint32_t v = 0; v < n_variants; v++) {
+        std::fill(genovec.begin(), genovec.end(), 0);
+        for (uint32_t i = 0; i < n_samples; i++) {
+            const uintptr_t geno = (v * 3 + i * 5) % 4; // 3 is missing
+            genovec[i / plink2::kBitsPerWordD2] |= geno << (2 * (i % plink2::kBitsPerWordD2));
+        }
+        const uint64_t record_fpos = pgenlib::SpgwGetNextRecordFpos(spgwp);
+        const uintptr_t buffered_byte_ct = pgenlib::SpgwGetFwriteByteCt(spgwp);
+        BOOST_REQUIRE(!pgenlib::SpgwAppendRecordIndexEntry(spgwp, genovec_byte_ct, 0, record_fpos));
+        memcpy(pgenlib::SpgwGetFwriteBufp(spgwp), genovec.data(), genovec_byte_ct);
+        pgenlib::SpgwAdvanceFwriteBufp(spgwp, genovec_byte_ct);
+        BOOST_REQUIRE_EQUAL(pgenlib::SpgwGetFwriteByteCt(spgwp), buffered_byte_ct + genovec_byte_ct);
+        BOOST_REQUIRE_EQUAL(pgenlib::SpgwGetNextRecordFpos(spgwp), record_fpos + genovec_byte_ct);
+        BOOST_REQUIRE(!plink2::SpgwFlush(spgwp));
+    }
+    BOOST_REQUIRE_EQUAL(pgenlib::GetRecordWriterVariantCount(record_writer), n_variants);
+    pgenlib::ClosePgenRecordWriter(record_writer);
+
+    PgenReaderContext *const reader_context = pgenlib::OpenPgenReader(tmpFileName);
+    BOOST_REQUIRE_EQUAL(pgenlib::GetReaderVariantCount(reader_context), n_variants);
+    std::vector<int32_t> allele_codes(n_samples * 2);
+    for (uint32_t v = 0; v < n_variants; v++) {
+        pgenlib::ReadAlleles(reader_context, v, allele_codes.data());
+        for (uint32_t i = 0; i < n_samples; i++) {
+            const uint32_t geno = (v * 3 + i * 5) % 4;
+            BOOST_REQUIRE_EQUAL(allele_codes[i * 2], geno == 3 ? -9 : static_cast<int32_t>(geno == 2));
+            BOOST_REQUIRE_EQUAL(allele_codes[i * 2 + 1], geno == 3 ? -9 : static_cast<int32_t>(geno != 0));
+        }
+    }
+    pgenlib::ClosePgenReader(reader_context);
+    unlink(tmpFileName);
+}
+
+// the multi-threaded writer requires a known variant count
+BOOST_AUTO_TEST_CASE(TestRejectMultiThreadedUnknownVariantCount) {
+    const char* const expectedMessage = "requires a known variant count";
+    char tmpFileName[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write.pgen", tmpFileName);
+    unlink(tmpFileName);
+    BOOST_REQUIRE_EXCEPTION(
+            pgenlib::OpenPgen(tmpFileName,
+                              PGEN_FILE_MODE_WRITE_AND_COPY,
+                              0,
+                              static_cast<long>(pgenlib::kVariantCountUnknown),
+                              3,
+                              plink2::kPglMaxAltAlleleCt,
+                              2),
+            PgenException,
+            [expectedMessage](PgenException ex) -> bool  {
+                return strstr(ex.what(), expectedMessage);
+            }
+    );
+}
+
 // claim that we're going to write 10 variants, but don't write any)
 BOOST_AUTO_TEST_CASE(TestCloseNoWriteKnownVariantCount) {
     const char* const expectedNoWriteMessage = "closePgen called with number of variants written";
@@ -260,6 +598,496 @@ BOOST_AUTO_TEST_CASE(TestCloseTooFewWritesUnknownVariantCount) {
     delete[] allele_codes;
 }
 
+// write the same unphased biallelic genotypes as allele codes, as genotype bytes, and as a batch that mixes the
+// two, and verify that the output is identical
+constexpr boost::array<uint32_t, 2> s_biallelicWriteFlags { 0, pgenlib::kWriteFlagPreservePhasing };
+BOOST_DATA_TEST_CASE(TestGenotypeBytesMatchAlleleCodes, s_biallelicWriteFlags) {
+    constexpr uint32_t n_variants = 300;
+    constexpr int n_samples = 29; // not a multiple of 8, so the last genotype vector word is partial
+    std::vector<int32_t> allele_codes(n_variants * n_samples * 2);
+    std::vector<int8_t> genotype_bytes(n_variants * n_samples);
+    std::vector<unsigned char> phase_bytes(n_variants * n_samples, 0);
+    for (uint32_t v = 0; v < n_variants; v++) {
+        for (int i = 0; i < n_samples; i++) {
+            const int32_t alt_ct = static_cast<int32_t>((v * 5 + i * 3) % 4); // 3 is missing
+            allele_codes[(v * n_samples + i) * 2] = alt_ct == 3 ? -9 : (alt_ct == 2 ? 1 : 0);
+            allele_codes[(v * n_samples + i) * 2 + 1] = alt_ct == 3 ? -9 : (alt_ct >= 1 ? 1 : 0);
+            genotype_bytes[v * n_samples + i] = static_cast<int8_t>(alt_ct == 3 ? -9 : alt_ct);
+        }
+    }
+
+    char codes_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_codes.pgen", codes_file_name);
+    const pgenlib::PgenContext *const codes_context = pgenlib::OpenPgen(
+            codes_file_name, PGEN_FILE_MODE_WRITE_AND_COPY, sample, n_variants, n_samples, plink2::kPglMaxAltAlleleCt);
+    for (uint32_t v = 0; v < n_variants; v++) {
+        pgenlib::AppendAlleles(codes_context, &allele_codes[v * n_samples * 2], &phase_bytes[v * n_samples], 2);
+    }
+    ClosePgen(codes_context, 0);
+
+    char bytes_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_bytes.pgen", bytes_file_name);
+    const pgenlib::PgenContext *const bytes_context = pgenlib::OpenPgen(
+            bytes_file_name, PGEN_FILE_MODE_WRITE_AND_COPY, sample, n_variants, n_samples, plink2::kPglMaxAltAlleleCt);
+    for (uint32_t v = 0; v < n_variants; v++) {
+        pgenlib::AppendGenotypeBytes(bytes_context, &genotype_bytes[v * n_samples]);
+    }
+    ClosePgen(bytes_context, 0);
+
+    // in the batch, every other variant's allele code slot holds genotype bytes instead of allele codes
+    std::vector<int32_t> batch_allele_codes(allele_codes);
+    std::vector<int32_t> batch_allele_cts(n_variants, 2);
+    for (uint32_t v = 1; v < n_variants; v += 2) {
+        memcpy(&batch_allele_codes[v * n_samples * 2], &genotype_bytes[v * n_samples], n_samples);
+        batch_allele_cts[v] = pgenlib::kAlleleCtGenotypeBytes;
+    }
+    char batch_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_batch.pgen", batch_file_name);
+    const pgenlib::PgenContext *const batch_context = pgenlib::OpenPgen(
+            batch_file_name, PGEN_FILE_MODE_WRITE_AND_COPY, sample, n_variants, n_samples, plink2::kPglMaxAltAlleleCt);
+    pgenlib::AppendAllelesBatch(
+            batch_context, batch_allele_codes.data(), phase_bytes.data(), batch_allele_cts.data(), n_variants);
+    ClosePgen(batch_context, 0);
+
+    const std::vector<char> codes_contents = ReadFileContents(codes_file_name);
+    const std::vector<char> bytes_contents = ReadFileContents(bytes_file_name);
+    const std::vector<char> batch_contents = ReadFileContents(batch_file_name);
+    unlink(codes_file_name);
+    unlink(bytes_file_name);
+    unlink(batch_file_name);
+    BOOST_REQUIRE_NE(codes_contents.size(), 0);
+    BOOST_REQUIRE(codes_contents == bytes_contents);
+    BOOST_REQUIRE(codes_contents == batch_contents);
+}
+
+BOOST_AUTO_TEST_CASE(TestRejectInvalidGenotypeByte) {
+    constexpr int n_samples = 3;
+    constexpr int8_t genotype_bytes[] {0, 2, 3};
+    const char* const expectedMessage = "Attempt to append invalid genotype byte: 3 for sample 2";
+    char tmpFileName[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write.pgen", tmpFileName);
+    const pgenlib::PgenContext *const pgenContext = pgenlib::OpenPgen(
+            tmpFileName, PGEN_FILE_MODE_WRITE_AND_COPY, 0, 1, n_samples, plink2::kPglMaxAltAlleleCt);
+    BOOST_REQUIRE_EXCEPTION(
+            pgenlib::AppendGenotypeBytes(pgenContext, genotype_bytes),
+            PgenException,
+            [expectedMessage](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedMessage);
+            }
+    );
+    constexpr int8_t valid_genotype_bytes[] {0, 2, -9};
+    pgenlib::AppendGenotypeBytes(pgenContext, valid_genotype_bytes);
+    ClosePgen(pgenContext, 0);
+    unlink(tmpFileName);
+}
+
+// write the same biallelic genotypes as genotype bytes, and as sparse genotype lists (single and multi-threaded,
+// directly and batched), and verify that the output is identical. most variants are rare enough to be written as a
+// plink2 difflist, but some exceed MaxDifflistLen and are written densely
+constexpr boost::array<int, 2> s_sparseThreadCounts { 1, 2 };
+BOOST_DATA_TEST_CASE(TestSparseGenotypesMatchGenotypeBytes, s_sparseThreadCounts) {
+    constexpr uint32_t n_variants = plink2::kPglVblockSize + 50;
+    constexpr int n_samples = 203;
+    std::vector<int8_t> genotype_bytes(n_samples);
+    std::vector<uint32_t> sample_ids;
+    std::vector<int8_t> sparse_genotype_bytes;
+    // batched sparse lists are flushed in batches of batch_capacity variants
+    constexpr uint32_t batch_capacity = 64;
+    std::vector<int32_t> batch_allele_codes(batch_capacity * n_samples * 2);
+    std::vector<int32_t> batch_allele_cts(batch_capacity, pgenlib::kAlleleCtSparseGenotypes);
+
+    char bytes_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_bytes.pgen", bytes_file_name);
+    const pgenlib::PgenContext *const bytes_context = pgenlib::OpenPgen(
+            bytes_file_name, PGEN_FILE_MODE_WRITE_AND_COPY, 0, n_variants, n_samples, plink2::kPglMaxAltAlleleCt);
+    char sparse_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_sparse.pgen", sparse_file_name);
+    const pgenlib::PgenContext *const sparse_context = pgenlib::OpenPgen(
+            sparse_file_name, PGEN_FILE_MODE_WRITE_AND_COPY, 0, n_variants, n_samples, plink2::kPglMaxAltAlleleCt,
+            sample);
+    char batch_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_batch.pgen", batch_file_name);
+    const pgenlib::PgenContext *const batch_context = pgenlib::OpenPgen(
+            batch_file_name, PGEN_FILE_MODE_WRITE_AND_COPY, 0, n_variants, n_samples, plink2::kPglMaxAltAlleleCt,
+            sample);
+    for (uint32_t v = 0; v < n_variants; v++) {
+        // vary the number of carriers from 0 up to about 1/3 of the samples
+        const uint32_t carrier_stride = 3 + (v % 97);
+        sample_ids.clear();
+        sparse_genotype_bytes.clear();
+        for (uint32_t i = 0; i < n_samples; i++) {
+            int8_t genotype_byte = 0;
+            if (((i + v) % carrier_stride) == 0) {
+                genotype_byte = static_cast<int8_t>((i + v) % 4 == 3 ? -9 : 1 + ((i + v) % 2));
+                sample_ids.push_back(i);
+                sparse_genotype_bytes.push_back(genotype_byte);
+            }
+            genotype_bytes[i] = genotype_byte;
+        }
+        pgenlib::AppendGenotypeBytes(bytes_context, genotype_bytes.data());
+        pgenlib::AppendSparseGenotypes(
+                sparse_context, sample_ids.data(), sparse_genotype_bytes.data(),
+                static_cast<uint32_t>(sample_ids.size()));
+
+        // the batch slot holds the genotype count, then the sample ids, then the genotype bytes
+        int32_t *const slot = &batch_allele_codes[(v % batch_capacity) * n_samples * 2];
+        slot[0] = static_cast<int32_t>(sample_ids.size());
+        memcpy(&slot[1], sample_ids.data(), sample_ids.size() * sizeof(uint32_t));
+        memcpy(&slot[1 + sample_ids.size()], sparse_genotype_bytes.data(), sparse_genotype_bytes.size());
+        if (((v + 1) % batch_capacity == 0) || (v + 1 == n_variants)) {
+            pgenlib::AppendAllelesBatch(
+                    batch_context, batch_allele_codes.data(), nullptr, batch_allele_cts.data(),
+                    (v % batch_capacity) + 1);
+        }
+    }
+    ClosePgen(bytes_context, 0);
+    ClosePgen(sparse_context, 0);
+    ClosePgen(batch_context, 0);
+
+    const std::vector<char> bytes_contents = ReadFileContents(bytes_file_name);
+    const std::vector<char> sparse_contents = ReadFileContents(sparse_file_name);
+    const std::vector<char> batch_contents = ReadFileContents(batch_file_name);
+    unlink(bytes_file_name);
+    unlink(sparse_file_name);
+    unlink(batch_file_name);
+    BOOST_REQUIRE_NE(bytes_contents.size(), 0);
+    BOOST_REQUIRE(bytes_contents == sparse_contents);
+    BOOST_REQUIRE(bytes_contents == batch_contents);
+}
+
+// a sparse list with a non hom-ref default genotype, where the listed genotypes are more common than the default
+BOOST_AUTO_TEST_CASE(TestSparseGenotypesWithDefaultGenotype) {
+    constexpr int n_samples = 64;
+    std::vector<int8_t> genotype_bytes(n_samples, 2);
+    std::vector<uint32_t> sample_ids;
+    std::vector<int8_t> sparse_genotype_bytes;
+    for (uint32_t i = 0; i < n_samples; i += 5) {
+        genotype_bytes[i] = i % 2 ? -9 : 0;
+        sample_ids.push_back(i);
+        sparse_genotype_bytes.push_back(genotype_bytes[i]);
+    }
+
+    char bytes_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_bytes.pgen", bytes_file_name);
+    const pgenlib::PgenContext *const bytes_context = pgenlib::OpenPgen(
+            bytes_file_name, PGEN_FILE_MODE_WRITE_AND_COPY, 0, 1, n_samples, plink2::kPglMaxAltAlleleCt);
+    pgenlib::AppendGenotypeBytes(bytes_context, genotype_bytes.data());
+    ClosePgen(bytes_context, 0);
+    char sparse_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_sparse.pgen", sparse_file_name);
+    const pgenlib::PgenContext *const sparse_context = pgenlib::OpenPgen(
+            sparse_file_name, PGEN_FILE_MODE_WRITE_AND_COPY, 0, 1, n_samples, plink2::kPglMaxAltAlleleCt);
+    pgenlib::AppendSparseGenotypes(
+            sparse_context, sample_ids.data(), sparse_genotype_bytes.data(),
+            static_cast<uint32_t>(sample_ids.size()), 2);
+    ClosePgen(sparse_context, 0);
+
+    const std::vector<char> bytes_contents = ReadFileContents(bytes_file_name);
+    const std::vector<char> sparse_contents = ReadFileContents(sparse_file_name);
+    unlink(bytes_file_name);
+    unlink(sparse_file_name);
+    BOOST_REQUIRE_NE(bytes_contents.size(), 0);
+    BOOST_REQUIRE(bytes_contents == sparse_contents);
+}
+
+BOOST_AUTO_TEST_CASE(TestRejectInvalidSparseGenotypes) {
+    constexpr int n_samples = 16;
+    const uint32_t unordered_sample_ids[] {3, 2};
+    const uint32_t out_of_range_sample_ids[] {3, 16};
+    const uint32_t sample_ids[] {2, 3};
+    const int8_t default_genotype_bytes[] {1, 0};
+    const int8_t genotype_bytes[] {1, -9};
+    char tmpFileName[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write.pgen", tmpFileName);
+    const pgenlib::PgenContext *const pgenContext = pgenlib::OpenPgen(
+            tmpFileName, PGEN_FILE_MODE_WRITE_AND_COPY, 0, 1, n_samples, plink2::kPglMaxAltAlleleCt);
+    BOOST_REQUIRE_EXCEPTION(
+            pgenlib::AppendSparseGenotypes(pgenContext, unordered_sample_ids, genotype_bytes, 2),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "is out of order or out of range");
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            pgenlib::AppendSparseGenotypes(pgenContext, out_of_range_sample_ids, genotype_bytes, 2),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "is out of order or out of range");
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            pgenlib::AppendSparseGenotypes(pgenContext, sample_ids, default_genotype_bytes, 2),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Attempt to append invalid sparse genotype byte: 0 for sample 3");
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            pgenlib::AppendSparseGenotypes(pgenContext, sample_ids, genotype_bytes, 2, 3),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "Attempt to append invalid default genotype byte: 3");
+            }
+    );
+    pgenlib::AppendSparseGenotypes(pgenContext, sample_ids, genotype_bytes, 2);
+    ClosePgen(pgenContext, 0);
+    unlink(tmpFileName);
+}
+
+// write the same partially phased biallelic genotypes as allele codes, and as packed genotype vectors with
+// phasepresent/phaseinfo (single and multi-threaded), and verify that the output is identical
+constexpr boost::array<int, 2> s_genovecThreadCounts { 1, 2 };
+BOOST_DATA_TEST_CASE(TestGenovecMatchesAlleleCodes, s_genovecThreadCounts) {
+    constexpr uint32_t n_variants = plink2::kPglVblockSize + 50;
+    constexpr int n_samples = 37; // spans two genotype vector words, the second one partial
+    const uint32_t genovec_word_ct = plink2::NypCtToWordCt(n_samples);
+    const uint32_t bitvec_word_ct = plink2::BitCtToWordCt(n_samples);
+    std::vector<int32_t> allele_codes(n_samples * 2);
+    std::vector<unsigned char> phase_bytes(n_samples);
+    std::vector<uintptr_t> genovec(genovec_word_ct);
+    std::vector<uintptr_t> phasepresent(bitvec_word_ct);
+    std::vector<uintptr_t> phaseinfo(bitvec_word_ct);
+
+    char codes_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_codes.pgen", codes_file_name);
+    const pgenlib::PgenContext *const codes_context = pgenlib::OpenPgen(
+            codes_file_name, PGEN_FILE_MODE_WRITE_AND_COPY, pgenlib::kWriteFlagPreservePhasing, n_variants,
+            n_samples, plink2::kPglMaxAltAlleleCt);
+    char genovec_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_genovec.pgen", genovec_file_name);
+    const pgenlib::PgenContext *const genovec_context = pgenlib::OpenPgen(
+            genovec_file_name, PGEN_FILE_MODE_WRITE_AND_COPY, pgenlib::kWriteFlagPreservePhasing, n_variants,
+            n_samples, plink2::kPglMaxAltAlleleCt, sample);
+    for (uint32_t v = 0; v < n_variants; v++) {
+        std::fill(genovec.begin(), genovec.end(), 0);
+        std::fill(phasepresent.begin(), phasepresent.end(), 0);
+        std::fill(phaseinfo.begin(), phaseinfo.end(), 0);
+        for (int i = 0; i < n_samples; i++) {
+            const uintptr_t geno = (v * 3 + i * 5) % 4; // 3 is missing
+            const bool alt_first = ((v + i) % 2) != 0;
+            const bool phased = (geno == 1) && (((v * 7 + i) % 3) != 0);
+            allele_codes[i * 2] = geno == 3 ? -9 : static_cast<int32_t>(geno == 2 || (geno == 1 && alt_first));
+            allele_codes[i * 2 + 1] = geno == 3 ? -9 : static_cast<int32_t>(geno == 2 || (geno == 1 && !alt_first));
+            phase_bytes[i] = phased;
+            genovec[i / plink2::kBitsPerWordD2] |= geno << (2 * (i % plink2::kBitsPerWordD2));
+            if (phased) {
+                phasepresent[i / plink2::kBitsPerWord] |= plink2::k1LU << (i % plink2::kBitsPerWord);
+                if (alt_first) {
+                    phaseinfo[i / plink2::kBitsPerWord] |= plink2::k1LU << (i % plink2::kBitsPerWord);
+                }
+            }
+        }
+        pgenlib::AppendAlleles(codes_context, allele_codes.data(), phase_bytes.data(), 2);
+        pgenlib::AppendGenovec(genovec_context, genovec.data(), phasepresent.data(), phaseinfo.data());
+    }
+    ClosePgen(codes_context, 0);
+    ClosePgen(genovec_context, 0);
+
+    const std::vector<char> codes_contents = ReadFileContents(codes_file_name);
+    const std::vector<char> genovec_contents = ReadFileContents(genovec_file_name);
+    unlink(codes_file_name);
+    unlink(genovec_file_name);
+    BOOST_REQUIRE_NE(codes_contents.size(), 0);
+    BOOST_REQUIRE(codes_contents == genovec_contents);
+}
+
+BOOST_AUTO_TEST_CASE(TestRejectInvalidGenovec) {
+    constexpr int n_samples = 3;
+    // sample 0 is hom ref, sample 1 is het, sample 2 is hom alt
+    const uintptr_t genovec[] {0x24};
+    const uintptr_t trailing_genovec[] {0x24 | (plink2::k1LU << 6)};
+    const uintptr_t het_phasepresent[] {0x2};
+    const uintptr_t hom_phasepresent[] {0x6};
+    const uintptr_t phaseinfo[] {0x2};
+    char tmpFileName[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write.pgen", tmpFileName);
+    const pgenlib::PgenContext *const pgenContext = pgenlib::OpenPgen(
+            tmpFileName, PGEN_FILE_MODE_WRITE_AND_COPY, pgenlib::kWriteFlagPreservePhasing, 1, n_samples,
+            plink2::kPglMaxAltAlleleCt);
+    BOOST_REQUIRE_EXCEPTION(
+            pgenlib::AppendGenovec(pgenContext, trailing_genovec),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "trailing bits of the genotype vector");
+            }
+    );
+    BOOST_REQUIRE_EXCEPTION(
+            pgenlib::AppendGenovec(pgenContext, genovec, hom_phasepresent, phaseinfo),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "marks a call that is not heterozygous");
+            }
+    );
+    pgenlib::AppendGenovec(pgenContext, genovec, het_phasepresent, phaseinfo);
+    ClosePgen(pgenContext, 0);
+    unlink(tmpFileName);
+}
+
+BOOST_AUTO_TEST_CASE(TestRejectPhasedGenovecWithoutPhasingFlag) {
+    const uintptr_t genovec[] {0x24};
+    const uintptr_t phaseinfo[] {0x2};
+    char tmpFileName[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write.pgen", tmpFileName);
+    const pgenlib::PgenContext *const pgenContext = pgenlib::OpenPgen(
+            tmpFileName, PGEN_FILE_MODE_WRITE_AND_COPY, 0, 1, 3, plink2::kPglMaxAltAlleleCt);
+    BOOST_REQUIRE_EXCEPTION(
+            pgenlib::AppendGenovec(pgenContext, genovec, nullptr, phaseinfo),
+            PgenException,
+            [](PgenException ex) -> bool {
+                return strstr(ex.what(), "only be appended when kWriteFlagPreservePhasing is used");
+            }
+    );
+    pgenlib::AppendGenovec(pgenContext, genovec);
+    ClosePgen(pgenContext, 0);
+    unlink(tmpFileName);
+}
+
+// convert unphased, partially phased and fully phased (biallelic and multiallelic, with missing) allele codes with
+// ConvertAlleleCodes, and verify that the result is bit-identical to plink2::ConvertMultiAlleleCodesUnsafe, and that
+// the het/phased het counts are correct; the sample counts exercise both full and partial vector/word boundaries
+constexpr boost::array<uint32_t, 7> s_convertSampleCounts { 1, 15, 32, 33, 64, 95, 1001 };
+BOOST_DATA_TEST_CASE(TestConvertAlleleCodesMatchesPlink2, s_convertSampleCounts) {
+    const uint32_t n_samples = sample;
+    std::vector<int32_t> allele_codes(n_samples * 2);
+    std::vector<unsigned char> phase_bytes(n_samples);
+    for (uint32_t pattern = 0; pattern < 24; pattern++) {
+        const uint32_t max_allele_code = (pattern % 3 == 0) ? 5 : 1;
+        uint32_t expected_het_ct = 0;
+        uint32_t expected_phased_het_ct = 0;
+        for (uint32_t i = 0; i < n_samples; i++) {
+            const uint32_t r = (i * 2654435761U) ^ (pattern * 40503U);
+            int32_t first = static_cast<int32_t>((r >> 3) % (max_allele_code + 1));
+            int32_t second = static_cast<int32_t>((r >> 11) % (max_allele_code + 1));
+            if ((r >> 17) % 11 == 0) {
+                first = -9;
+                second = -9;
+            }
+            allele_codes[i * 2] = first;
+            allele_codes[i * 2 + 1] = second;
+            // pattern / 3 selects none, all, or some of the samples as phased
+            const uint32_t phase_mode = (pattern / 3) % 4;
+            phase_bytes[i] = phase_mode == 1 || (phase_mode == 2 && ((r >> 23) & 1)) || (phase_mode == 3 && first != second);
+            if (first != second) {
+                expected_het_ct++;
+                expected_phased_het_ct += phase_bytes[i];
+            }
+        }
+        const bool with_phase_bytes = pattern < 12 || (pattern % 2 == 0);
+        uint32_t het_ct;
+        uint32_t phased_het_ct;
+        RequireConvertAlleleCodesMatchesPlink2(
+                allele_codes.data(), with_phase_bytes ? phase_bytes.data() : nullptr, n_samples, het_ct, phased_het_ct);
+        BOOST_REQUIRE_EQUAL(het_ct, expected_het_ct);
+        if (with_phase_bytes) {
+            BOOST_REQUIRE_EQUAL(phased_het_ct, expected_phased_het_ct);
+        } else {
+            BOOST_REQUIRE_EQUAL(phased_het_ct, 0);
+        }
+    }
+}
+
+// convert biallelic allele codes (which take the vectorized path in ConvertAlleleCodes) with occasional multiallelic
+// and invalid codes mixed in (which fall back to the scalar path for their word), and verify that the result is
+// bit-identical to plink2::ConvertMultiAlleleCodesUnsafe
+constexpr boost::array<uint32_t, 6> s_biallelicConvertSampleCounts { 16, 32, 64, 65, 127, 2000 };
+BOOST_DATA_TEST_CASE(TestBiallelicConvertAlleleCodesMatchesPlink2, s_biallelicConvertSampleCounts) {
+    const uint32_t n_samples = sample;
+    // pairs that aren't (0/1, 0/1) or (-9, -9); all but the first make the variant invalid
+    const int32_t non_biallelic_pairs[][2] { {2, 1}, {-9, 0}, {1, -9}, {-5, -5}, {65537, 0}, {0, -65545} };
+    std::vector<int32_t> allele_codes(n_samples * 2);
+    std::vector<unsigned char> phase_bytes(n_samples);
+    for (uint32_t pattern = 0; pattern < 40; pattern++) {
+        for (uint32_t i = 0; i < n_samples; i++) {
+            const uint32_t r = (i * 2246822519U) ^ (pattern * 3266489917U);
+            const bool missing = (r >> 20) % 9 == 0;
+            allele_codes[i * 2] = missing ? -9 : static_cast<int32_t>((r >> 5) & 1);
+            allele_codes[i * 2 + 1] = missing ? -9 : static_cast<int32_t>((r >> 9) & 1);
+            phase_bytes[i] = (r >> 14) & 1;
+        }
+        if (pattern >= 16) {
+            // replace one sample's codes, at a position that moves across (and within) words
+            const int32_t *pair = non_biallelic_pairs[pattern % 6];
+            const uint32_t sample_idx = (pattern * 37) % n_samples;
+            allele_codes[sample_idx * 2] = pair[0];
+            allele_codes[sample_idx * 2 + 1] = pair[1];
+        }
+        uint32_t het_ct;
+        uint32_t phased_het_ct;
+        const int32_t allele_ct = RequireConvertAlleleCodesMatchesPlink2(
+                allele_codes.data(), phase_bytes.data(), n_samples, het_ct, phased_het_ct);
+        // only the {2, 1} replacement is valid, and it makes the variant triallelic
+        const int32_t expected_allele_ct = pattern < 16 ? 2 : (pattern % 6 == 0 ? 3 : -1);
+        BOOST_REQUIRE_EQUAL(allele_ct, expected_allele_ct);
+    }
+}
+
+// write dosages (interleaved with hardcall-only variants) as floats, as doubles, and using multiple threads, and
+// verify that the output is identical
+BOOST_AUTO_TEST_CASE(TestDosagesFloatDoubleAndMultiThreadedMatch) {
+    constexpr long n_variants = plink2::kPglVblockSize + 100;
+    constexpr int n_samples = 21;
+    char float_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_float.pgen", float_file_name);
+    WriteGeneratedDosagePgen(float_file_name, n_variants, n_samples, 1, false);
+    char double_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_double.pgen", double_file_name);
+    WriteGeneratedDosagePgen(double_file_name, n_variants, n_samples, 1, true);
+    char mt_file_name[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write_mt.pgen", mt_file_name);
+    WriteGeneratedDosagePgen(mt_file_name, n_variants, n_samples, 2, false);
+
+    const std::vector<char> float_contents = ReadFileContents(float_file_name);
+    const std::vector<char> double_contents = ReadFileContents(double_file_name);
+    const std::vector<char> mt_contents = ReadFileContents(mt_file_name);
+    unlink(float_file_name);
+    unlink(double_file_name);
+    unlink(mt_file_name);
+    BOOST_REQUIRE_NE(float_contents.size(), 0);
+    BOOST_REQUIRE(float_contents == double_contents);
+    BOOST_REQUIRE(float_contents == mt_contents);
+}
+
+BOOST_AUTO_TEST_CASE(TestRejectDosagesWithoutDosageFlag) {
+    constexpr int n_samples = 3;
+    constexpr float dosages[] {0.0f, 1.0f, 1.5f};
+    const char* const expectedMessage = "requires a PgenContext that was opened with kWriteFlagDosage";
+    char tmpFileName[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write.pgen", tmpFileName);
+    const pgenlib::PgenContext *const pgenContext = pgenlib::OpenPgen(
+            tmpFileName, PGEN_FILE_MODE_WRITE_AND_COPY, 0, 1, n_samples, plink2::kPglMaxAltAlleleCt);
+    BOOST_REQUIRE_EXCEPTION(
+            pgenlib::AppendDosages(pgenContext, dosages),
+            PgenException,
+            [expectedMessage](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedMessage);
+            }
+    );
+    int32_t allele_codes[n_samples * 2] {0};
+    pgenlib::AppendAlleles(pgenContext, allele_codes, nullptr, 2);
+    ClosePgen(pgenContext, 0);
+    unlink(tmpFileName);
+}
+
+BOOST_AUTO_TEST_CASE(TestRejectInvalidHardCallThreshold) {
+    constexpr int n_samples = 3;
+    constexpr double dosages[] {0.0, 1.0, 1.5};
+    const char* const expectedMessage = "Invalid hard call threshold";
+    char tmpFileName[TMP_FILENAME_SIZE];
+    CreateTempFile("test_write.pgen", tmpFileName);
+    const pgenlib::PgenContext *const pgenContext = pgenlib::OpenPgen(
+            tmpFileName, PGEN_FILE_MODE_WRITE_AND_COPY, pgenlib::kWriteFlagDosage, 1, n_samples, plink2::kPglMaxAltAlleleCt);
+    BOOST_REQUIRE_EXCEPTION(
+            pgenlib::AppendDosages(pgenContext, dosages, 0.75),
+            PgenException,
+            [expectedMessage](PgenException ex) -> bool {
+                return strstr(ex.what(), expectedMessage);
+            }
+    );
+    pgenlib::AppendDosages(pgenContext, dosages);
+    ClosePgen(pgenContext, 0);
+    unlink(tmpFileName);
+}
+
 BOOST_AUTO_TEST_CASE(TestRejectInvalidAlleleCode) {
     constexpr long n_variants = 6;
     constexpr int n_samples = 3;
@@ -413,3 +1241,217 @@ long WriteTestPgen(
     unlink(tmp_file_name);
     return file_size;
 }
+
+// read the entire contents of a (binary) file
+std::vector<char> ReadFileContents(const char* const fileName) {
+    std::ifstream inputStream(fileName, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(inputStream), std::istreambuf_iterator<char>());
+}
+
+// write n_variants generated variants with a mix of allele counts and phasing (fully phased, unphased, and
+// partially phased), closing the writer with (declared_variants - n_variants) dropped variants
+void WriteGeneratedPgen(
+        const char* const fileName,
+        const uint32_t pgen_file_mode,
+        const long declared_variants,
+        const long n_variants,
+        const int n_samples,
+        const int thread_count) {
+    const pgenlib::PgenContext *const pgen_context = pgenlib::OpenPgen(
+            fileName,
+            pgen_file_mode,
+            pgenlib::kWriteFlagMultiAllelic | pgenlib::kWriteFlagPreservePhasing,
+            declared_variants,
+            n_samples,
+            plink2::kPglMaxAltAlleleCt,
+            thread_count);
+    std::vector<int32_t> allele_codes(n_samples * 2);
+    std::vector<unsigned char> phase_bytes(n_samples);
+    for (long v = 0; v < n_variants; v++) {
+        // runs of identical variants exercise the LD compression, which is reset at variant block boundaries
+        const long pattern = (v / 3) % 11;
+        const int32_t allele_ct = (pattern % 4 == 0) ? 4 : 2;
+        for (int i = 0; i < n_samples; i++) {
+            allele_codes[i * 2] = static_cast<int32_t>((i + pattern) % allele_ct);
+            allele_codes[i * 2 + 1] = static_cast<int32_t>((i * pattern + 1) % allele_ct);
+            phase_bytes[i] = static_cast<unsigned char>((pattern % 3 == 0) || ((pattern % 3 == 1) && (i % 2)));
+        }
+        pgenlib::AppendAlleles(pgen_context, allele_codes.data(), phase_bytes.data(), allele_ct);
+    }
+    BOOST_REQUIRE_EQUAL(GetNumberOfVariantsWritten(pgen_context), n_variants);
+    ClosePgen(pgen_context, declared_variants - n_variants);
+}
+
+// write n_variants generated variants, where two out of every three variants are written as dosages (including
+// missing and non-hardcall dosages), and the rest as hardcalls. The dosages are multiples of 1/64, so they
+// convert identically from float and double.
+void WriteGeneratedDosagePgen(
+        const char* const fileName,
+        const long n_variants,
+        const int n_samples,
+        const int thread_count,
+        const bool use_doubles) {
+    const pgenlib::PgenContext *const pgen_context = pgenlib::OpenPgen(
+            fileName,
+            PGEN_FILE_MODE_WRITE_AND_COPY,
+            pgenlib::kWriteFlagDosage,
+            n_variants,
+            n_samples,
+            plink2::kPglMaxAltAlleleCt,
+            thread_count);
+    std::vector<int32_t> allele_codes(n_samples * 2);
+    std::vector<float> float_dosages(n_samples);
+    std::vector<double> double_dosages(n_samples);
+    for (long v = 0; v < n_variants; v++) {
+        if (v % 3 == 0) {
+            GenerateAlleleCodeDistribution(allele_codes.data(), n_samples, 2);
+            pgenlib::AppendAlleles(pgen_context, allele_codes.data(), nullptr, 2);
+            continue;
+        }
+        for (int i = 0; i < n_samples; i++) {
+            const long step = (v * 7 + i * 13) % 140;
+            // steps beyond 128 (i.e. dosages > 2) are missing
+            double_dosages[i] = step > 128 ? -9.0 : static_cast<double>(step) / 64.0;
+            float_dosages[i] = static_cast<float>(double_dosages[i]);
+        }
+        if (use_doubles) {
+            pgenlib::AppendDosages(pgen_context, double_dosages.data());
+        } else {
+            pgenlib::AppendDosages(pgen_context, float_dosages.data());
+        }
+    }
+    BOOST_REQUIRE_EQUAL(GetNumberOfVariantsWritten(pgen_context), n_variants);
+    ClosePgen(pgen_context, 0);
+}
+
+// write n_variants generated biallelic variants (of n_samples, with declared_variants declared) directly with a
+// PgenMTWriter: runs of identical (LD compressed) variants, partially phased variants, and difflists
+void WriteGeneratedMTPgen(
+        const char* const fileName,
+        const uint32_t declared_variants,
+        const uint32_t n_variants,
+        const uint32_t n_samples,
+        const uint32_t thread_count,
+        const uint64_t max_staged_chunk_bytes) {
+    uint32_t max_vrec_len;
+    PgenMTWriter *const mtpgwp = InitPgenMTWriter(
+            fileName,
+            plink2::kPgenWriteAndCopy,
+            plink2::kfPgenGlobalHardcallPhasePresent,
+            declared_variants,
+            n_samples,
+            2,
+            thread_count,
+            &max_vrec_len,
+            nullptr,
+            1,
+            max_staged_chunk_bytes);
+    std::vector<uintptr_t> genovec(plink2::NypCtToAlignedWordCt(n_samples), 0);
+    std::vector<uintptr_t> phasepresent(plink2::BitCtToAlignedWordCt(n_samples), 0);
+    std::vector<uintptr_t> phaseinfo(plink2::BitCtToAlignedWordCt(n_samples), 0);
+    std::vector<uintptr_t> raregeno(plink2::NypCtToAlignedWordCt(n_samples), 0);
+    std::vector<uint32_t> difflist_sample_ids(n_samples + 1);
+    for (uint32_t v = 0; v != n_variants; ++v) {
+        const uint32_t pattern = (v / 3) % 7;
+        if (pattern == 6) {
+            // a few samples differ from hom ref
+            const uint32_t difflist_len = 1 + v % 5;
+            std::fill(raregeno.begin(), raregeno.end(), 0);
+            for (uint32_t i = 0; i != difflist_len; ++i) {
+                plink2::AssignNyparrEntry(i, 1 + (i + v) % 3, raregeno.data());
+                difflist_sample_ids[i] = i * 17 + v % 11;
+            }
+            difflist_sample_ids[difflist_len] = n_samples;
+            MTWriterAppendDifflist(mtpgwp, raregeno.data(), difflist_sample_ids.data(), 0, difflist_len);
+            continue;
+        }
+        std::fill(genovec.begin(), genovec.end(), 0);
+        std::fill(phasepresent.begin(), phasepresent.end(), 0);
+        std::fill(phaseinfo.begin(), phaseinfo.end(), 0);
+        for (uint32_t i = 0; i != n_samples; ++i) {
+            const uint32_t geno = (i * pattern + i / 7) % 3;
+            plink2::AssignNyparrEntry(i, geno, genovec.data());
+            if ((geno == 1) && (i % 2)) {
+                plink2::SetBit(i, phasepresent.data());
+                if (i % 3) {
+                    plink2::SetBit(i, phaseinfo.data());
+                }
+            }
+        }
+        const bool phased = pattern % 2 == 1;
+        MTWriterAppend(mtpgwp,
+                       genovec.data(),
+                       nullptr,
+                       nullptr,
+                       nullptr,
+                       nullptr,
+                       phased ? phasepresent.data() : nullptr,
+                       phased ? phaseinfo.data() : nullptr,
+                       2,
+                       0,
+                       0);
+    }
+    try {
+        MTWriterFinish(mtpgwp);
+    } catch (const PgenException &) {
+        CleanupPgenMTWriter(mtpgwp);
+        throw;
+    }
+    CleanupPgenMTWriter(mtpgwp);
+}
+
+// convert allele codes with both pgenlib::ConvertAlleleCodes and plink2::ConvertMultiAlleleCodesUnsafe, require that
+// the results are identical, and return the allele count (and het counts) from ConvertAlleleCodes
+int32_t RequireConvertAlleleCodesMatchesPlink2(
+        const int32_t* const allele_codes,
+        const unsigned char* const phase_bytes,
+        const uint32_t n_samples,
+        uint32_t &het_ct,
+        uint32_t &phased_het_ct) {
+    // plink2::ConvertMultiAlleleCodesUnsafe may write whole vectors of phasepresent
+    const uint32_t bitvec_word_ct = plink2::BitCtToAlignedWordCt(n_samples);
+    const uint32_t genovec_word_ct = plink2::NypCtToAlignedWordCt(n_samples);
+    std::vector<uintptr_t> genovec[2];
+    std::vector<uintptr_t> patch_01_set[2];
+    std::vector<plink2::AlleleCode> patch_01_vals[2];
+    std::vector<uintptr_t> patch_10_set[2];
+    std::vector<plink2::AlleleCode> patch_10_vals[2];
+    std::vector<uintptr_t> phasepresent[2];
+    std::vector<uintptr_t> phaseinfo[2];
+    uint32_t patch_01_ct[2];
+    uint32_t patch_10_ct[2];
+    for (int j = 0; j < 2; j++) {
+        genovec[j].assign(genovec_word_ct, 0);
+        patch_01_set[j].assign(bitvec_word_ct, 0);
+        patch_01_vals[j].assign(n_samples, 0);
+        patch_10_set[j].assign(bitvec_word_ct, 0);
+        patch_10_vals[j].assign(n_samples * 2, 0);
+        phasepresent[j].assign(bitvec_word_ct, 0);
+        phaseinfo[j].assign(bitvec_word_ct, 0);
+    }
+    const int32_t expected_allele_ct = plink2::ConvertMultiAlleleCodesUnsafe(
+            allele_codes, phase_bytes, n_samples, genovec[0].data(), patch_01_set[0].data(),
+            patch_01_vals[0].data(), patch_10_set[0].data(), patch_10_vals[0].data(), &patch_01_ct[0],
+            &patch_10_ct[0], phasepresent[0].data(), phaseinfo[0].data());
+    const int32_t allele_ct = pgenlib::ConvertAlleleCodes(
+            allele_codes, phase_bytes, n_samples, genovec[1].data(), patch_01_set[1].data(),
+            patch_01_vals[1].data(), patch_10_set[1].data(), patch_10_vals[1].data(), &patch_01_ct[1],
+            &patch_10_ct[1], phasepresent[1].data(), phaseinfo[1].data(), &het_ct, &phased_het_ct);
+    BOOST_REQUIRE_EQUAL(allele_ct, expected_allele_ct);
+    if (allele_ct == -1) {
+        // the outputs are unspecified for invalid allele codes
+        return allele_ct;
+    }
+    BOOST_REQUIRE_EQUAL(patch_01_ct[1], patch_01_ct[0]);
+    BOOST_REQUIRE_EQUAL(patch_10_ct[1], patch_10_ct[0]);
+    BOOST_REQUIRE(genovec[1] == genovec[0]);
+    BOOST_REQUIRE(patch_01_set[1] == patch_01_set[0]);
+    BOOST_REQUIRE(patch_01_vals[1] == patch_01_vals[0]);
+    BOOST_REQUIRE(patch_10_set[1] == patch_10_set[0]);
+    BOOST_REQUIRE(patch_10_vals[1] == patch_10_vals[0]);
+    BOOST_REQUIRE(phaseinfo[1] == phaseinfo[0]);
+    if (phase_bytes) {
+        BOOST_REQUIRE(phasepresent[1] == phasepresent[0]);
+    }
+    return allele_ct;
+}
@@ -0,0 +1,60 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "pgenException.h"
+#include "pgenConcat.h"
+#include "pgenReader.h"
+#include "pgenlib_write.h"
+
+// pgen_concat: concatenate pgens with the same samples into one .pgen, copying their variant records without
+// decoding them. Only the .pgen is written; the .pvar (and .psam) of the inputs must be concatenated separately.
+// Exits with 0 on success and 1 on failure.
+using namespace pgenlib;
+
+static const int kExitSuccess = 0;
+static const int kExitFailure = 1;
+
+static int Usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [--separate-index] [--memory-map] <out.pgen> <in.pgen> [<in.pgen>...]\n"
+            "\n"
+            "Concatenate the variants of the input pgens (which must have the same samples) into out.pgen.\n"
+            "  --separate-index   write the index to out.pgen.pgi rather than into out.pgen\n"
+            "  --memory-map       map each input into memory rather than reading it\n",
+            program);
+    return kExitFailure;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t write_mode = plink2::kPgenWriteBackwardSeek;
+    uint32_t read_flags = 0;
+    int argi = 1;
+    for (; (argi < argc) && (argv[argi][0] == '-'); ++argi) {
+        if (strcmp(argv[argi], "--separate-index") == 0) {
+            write_mode = plink2::kPgenWriteSeparateIndex;
+        } else if (strcmp(argv[argi], "--memory-map") == 0) {
+            read_flags |= kReadFlagMemoryMap;
+        } else {
+            return Usage(argv[0]);
+        }
+    }
+    if (argc - argi < 2) {
+        return Usage(argv[0]);
+    }
+    const char *out_filename = argv[argi++];
+    std::vector<const char *> pgen_filenames(&argv[argi], &argv[argc]);
+    try {
+        ConcatPgens(
+                pgen_filenames.data(),
+                static_cast<uint32_t>(pgen_filenames.size()),
+                out_filename,
+                write_mode,
+                read_flags);
+    } catch (const PgenException &e) {
+        fprintf(stderr, "%s: %s\n", out_filename, e.what());
+        return kExitFailure;
+    }
+    printf("%s: concatenated %zu pgens\n", out_filename, pgen_filenames.size());
+    return kExitSuccess;
+}
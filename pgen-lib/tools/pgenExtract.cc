@@ -0,0 +1,123 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "pgenException.h"
+#include "pgenReader.h"
+#include "pgenExtract.h"
+#include "pgenlib_write.h"
+#include "toolUtils.h"
+
+// pgen_extract: write a subset of the variants (and optionally the samples) of a .pgen to a new .pgen. Without a
+// sample subset, the variant records are copied without being decoded. Only the .pgen is written; the .pvar and .psam
+// lines of the extracted variants and samples must be selected separately. Exits with 0 on success and 1 on failure.
+using namespace pgenlib;
+
+static const int kExitSuccess = 0;
+static const int kExitFailure = 1;
+
+static int Usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [--threads N] [--separate-index] [--memory-map] [--pvar <file.pvar>] --variants <file>\n"
+            "       [--samples <file>] <in.pgen> <out.pgen>\n"
+            "\n"
+            "Write the listed variants (and samples) of in.pgen to out.pgen.\n"
+            "  --variants FILE    the (zero based, increasing) indices of the variants to extract, one per line\n"
+            "  --samples FILE     the (zero based) indices of the samples to extract, one per line; by default every\n"
+            "                     sample is extracted, and the variant records are copied without being decoded\n"
+            "  --threads N        the number of threads to decode and re-encode a sample subset with (default: the\n"
+            "                     number of cores)\n"
+            "  --separate-index   write the index to out.pgen.pgi rather than into out.pgen\n"
+            "  --memory-map       map in.pgen into memory rather than reading each variant record\n"
+            "  --pvar FILE        read the allele counts from the ALT column of an (uncompressed) .pvar; required to\n"
+            "                     extract a sample subset of multiallelic variants\n",
+            program);
+    return kExitFailure;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t thread_ct = std::thread::hardware_concurrency();
+    if (thread_ct == 0) {
+        thread_ct = 1;
+    }
+    uint32_t write_mode = plink2::kPgenWriteBackwardSeek;
+    uint32_t read_flags = 0;
+    const char *variants_filename = nullptr;
+    const char *samples_filename = nullptr;
+    const char *pvar_filename = nullptr;
+    const char *in_filename = nullptr;
+    const char *out_filename = nullptr;
+    for (int argi = 1; argi < argc; ++argi) {
+        if (strcmp(argv[argi], "--threads") == 0) {
+            char *end = nullptr;
+            const long thread_arg = (argi + 1 < argc) ? strtol(argv[++argi], &end, 10) : 0;
+            if ((end == nullptr) || (*end != '\0') || (thread_arg < 1) || (thread_arg > 1024)) {
+                return Usage(argv[0]);
+            }
+            thread_ct = static_cast<uint32_t>(thread_arg);
+        } else if ((strcmp(argv[argi], "--variants") == 0) && (argi + 1 < argc)) {
+            variants_filename = argv[++argi];
+        } else if ((strcmp(argv[argi], "--samples") == 0) && (argi + 1 < argc)) {
+            samples_filename = argv[++argi];
+        } else if ((strcmp(argv[argi], "--pvar") == 0) && (argi + 1 < argc)) {
+            pvar_filename = argv[++argi];
+        } else if (strcmp(argv[argi], "--separate-index") == 0) {
+            write_mode = plink2::kPgenWriteSeparateIndex;
+        } else if (strcmp(argv[argi], "--memory-map") == 0) {
+            read_flags |= kReadFlagMemoryMap;
+        } else if ((argv[argi][0] == '-') || (out_filename != nullptr)) {
+            return Usage(argv[0]);
+        } else if (in_filename == nullptr) {
+            in_filename = argv[argi];
+        } else {
+            out_filename = argv[argi];
+        }
+    }
+    if ((out_filename == nullptr) || (variants_filename == nullptr)) {
+        return Usage(argv[0]);
+    }
+
+    std::vector<uint32_t> variant_indices;
+    std::vector<uint32_t> sample_indices;
+    std::vector<int32_t> allele_cts;
+    if (!ReadIndexList(variants_filename, variant_indices) ||
+        ((samples_filename != nullptr) && !ReadIndexList(samples_filename, sample_indices)) ||
+        ((pvar_filename != nullptr) && !ReadPvarAlleleCounts(pvar_filename, allele_cts))) {
+        return kExitFailure;
+    }
+    // the reader takes its sample indices as int32s
+    std::vector<int32_t> reader_sample_indices(sample_indices.begin(), sample_indices.end());
+
+    PgenReaderContext *reader_context = nullptr;
+    try {
+        reader_context = OpenPgenReader(
+                in_filename,
+                nullptr,
+                (pvar_filename != nullptr) ? allele_cts.data() : nullptr,
+                static_cast<long>(allele_cts.size()),
+                read_flags,
+                (samples_filename != nullptr) ? reader_sample_indices.data() : nullptr,
+                static_cast<long>(reader_sample_indices.size()));
+        ExtractPgen(
+                reader_context,
+                variant_indices.data(),
+                static_cast<uint32_t>(variant_indices.size()),
+                out_filename,
+                write_mode,
+                thread_ct);
+    } catch (const PgenException &e) {
+        fprintf(stderr, "%s: %s\n", out_filename, e.what());
+        if (reader_context != nullptr) {
+            ClosePgenReader(reader_context);
+        }
+        return kExitFailure;
+    }
+    printf("%s: extracted %zu variants, %u samples\n",
+           out_filename,
+           variant_indices.size(),
+           GetReaderSampleCount(reader_context));
+    ClosePgenReader(reader_context);
+    return kExitSuccess;
+}
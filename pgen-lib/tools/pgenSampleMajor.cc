@@ -0,0 +1,128 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pgenException.h"
+#include "pgenReader.h"
+#include "pgenSampleMajor.h"
+
+// pgen_sample_major: write the sample major sidecar of a .pgen (see pgenSampleMajor.h), or print the genotypes of one
+// sample from a sidecar. Exits with 0 on success and 1 on failure.
+using namespace pgenlib;
+
+static const int kExitSuccess = 0;
+static const int kExitFailure = 1;
+
+static int Usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [--threads N] [--memory-map] <in.pgen> [<out.smg>]\n"
+            "       %s --lookup <in.smg> <sample index> [<variant start> <variant end>]\n"
+            "\n"
+            "Write the sample major sidecar of in.pgen (by default to in.pgen.smg), or print the genotypes (the number\n"
+            "of non-reference alleles, or -9 if missing) of one sample over a variant range, one per line.\n"
+            "  --threads N        the number of threads to decode and transpose with (default: the number of cores)\n"
+            "  --memory-map       map in.pgen into memory rather than reading each variant record\n",
+            program,
+            program);
+    return kExitFailure;
+}
+
+static bool ParseIndex(const char *arg, uint32_t *index) {
+    char *end = nullptr;
+    const unsigned long long value = strtoull(arg, &end, 10);
+    if ((end == arg) || (*end != '\0') || (arg[0] == '-') || (value > UINT32_MAX)) {
+        return false;
+    }
+    *index = static_cast<uint32_t>(value);
+    return true;
+}
+
+static int Lookup(const char *program, const int argc, char *argv[]) {
+    uint32_t sample_idx;
+    uint32_t variant_start = 0;
+    uint32_t variant_end = 0;
+    if (((argc != 2) && (argc != 4)) || !ParseIndex(argv[1], &sample_idx) ||
+        ((argc == 4) && (!ParseIndex(argv[2], &variant_start) || !ParseIndex(argv[3], &variant_end)))) {
+        return Usage(program);
+    }
+    try {
+        SampleMajorReader *const reader = OpenSampleMajorReader(argv[0]);
+        if (argc == 2) {
+            variant_end = GetSampleMajorVariantCount(reader);
+        }
+        std::vector<int8_t> genotypes(variant_end > variant_start ? variant_end - variant_start : 0);
+        try {
+            ReadSampleGenotypes(reader, sample_idx, variant_start, variant_end, genotypes.data());
+        } catch (const PgenException &) {
+            CloseSampleMajorReader(reader);
+            throw;
+        }
+        CloseSampleMajorReader(reader);
+        for (const int8_t genotype : genotypes) {
+            printf("%d\n", genotype);
+        }
+    } catch (const PgenException &e) {
+        fprintf(stderr, "%s: %s\n", argv[0], e.what());
+        return kExitFailure;
+    }
+    return kExitSuccess;
+}
+
+int main(int argc, char *argv[]) {
+    if ((argc > 1) && (strcmp(argv[1], "--lookup") == 0)) {
+        return (argc > 2) ? Lookup(argv[0], argc - 2, &argv[2]) : Usage(argv[0]);
+    }
+    uint32_t thread_ct = std::thread::hardware_concurrency();
+    if (thread_ct == 0) {
+        thread_ct = 1;
+    }
+    uint32_t read_flags = 0;
+    const char *in_filename = nullptr;
+    const char *out_filename = nullptr;
+    for (int argi = 1; argi < argc; ++argi) {
+        if (strcmp(argv[argi], "--threads") == 0) {
+            char *end = nullptr;
+            const long thread_arg = (argi + 1 < argc) ? strtol(argv[++argi], &end, 10) : 0;
+            if ((end == nullptr) || (*end != '\0') || (thread_arg < 1) || (thread_arg > 1024)) {
+                return Usage(argv[0]);
+            }
+            thread_ct = static_cast<uint32_t>(thread_arg);
+        } else if (strcmp(argv[argi], "--memory-map") == 0) {
+            read_flags |= kReadFlagMemoryMap;
+        } else if ((argv[argi][0] == '-') || (out_filename != nullptr)) {
+            return Usage(argv[0]);
+        } else if (in_filename == nullptr) {
+            in_filename = argv[argi];
+        } else {
+            out_filename = argv[argi];
+        }
+    }
+    if (in_filename == nullptr) {
+        return Usage(argv[0]);
+    }
+    const std::string sidecar_filename =
+            out_filename != nullptr ? out_filename : std::string(in_filename) + kSampleMajorExtension;
+
+    try {
+        // only the hardcalls are read, which doesn't need the allele counts
+        PgenReaderContext *const pReaderContext = OpenPgenReader(in_filename, nullptr, nullptr, 0, read_flags, nullptr, 0);
+        try {
+            WriteSampleMajorSidecar(pReaderContext, sidecar_filename.c_str(), thread_ct);
+        } catch (const PgenException &) {
+            ClosePgenReader(pReaderContext);
+            throw;
+        }
+        printf("%s: wrote the sample major genotypes of %u variants and %u samples\n",
+               sidecar_filename.c_str(),
+               GetReaderVariantCount(pReaderContext),
+               GetReaderSampleCount(pReaderContext));
+        ClosePgenReader(pReaderContext);
+    } catch (const PgenException &e) {
+        fprintf(stderr, "%s: %s\n", in_filename, e.what());
+        return kExitFailure;
+    }
+    return kExitSuccess;
+}
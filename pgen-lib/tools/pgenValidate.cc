@@ -0,0 +1,114 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "pgenException.h"
+#include "pgenReader.h"
+#include "pgenValidate.h"
+#include "toolUtils.h"
+
+// pgen_validate: validate a .pgen (header, index and every variant record), as for plink2 --validate, with the variant
+// records split across threads. Exits with 0 if the .pgen is valid, 1 if it's invalid, and 2 if it couldn't be
+// validated (a bad command line, or a file that can't be opened or read).
+using namespace pgenlib;
+
+static const int kExitValid = 0;
+static const int kExitInvalid = 1;
+static const int kExitError = 2;
+
+static int Usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [--threads N] [--memory-map] [--pvar <file.pvar>] <file.pgen> [<file.pgen.pgi>]\n"
+            "\n"
+            "Validate the header, index and every variant record of a .pgen.\n"
+            "  --threads N    the number of threads to validate with (default: the number of cores)\n"
+            "  --memory-map   map the .pgen into memory rather than reading each variant record\n"
+            "  --pvar FILE    read the allele counts from the ALT column of an (uncompressed) .pvar; required to\n"
+            "                 validate multiallelic variants, unless the .pgen stores its allele counts\n",
+            program);
+    return kExitError;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t thread_ct = std::thread::hardware_concurrency();
+    if (thread_ct == 0) {
+        thread_ct = 1;
+    }
+    uint32_t read_flags = 0;
+    const char *pgen_filename = nullptr;
+    const char *pgi_filename = nullptr;
+    const char *pvar_filename = nullptr;
+    for (int argi = 1; argi < argc; ++argi) {
+        if (strcmp(argv[argi], "--threads") == 0) {
+            char *end = nullptr;
+            const long thread_arg = (argi + 1 < argc) ? strtol(argv[++argi], &end, 10) : 0;
+            if ((end == nullptr) || (*end != '\0') || (thread_arg < 1) || (thread_arg > 1024)) {
+                return Usage(argv[0]);
+            }
+            thread_ct = static_cast<uint32_t>(thread_arg);
+        } else if ((strcmp(argv[argi], "--pvar") == 0) && (argi + 1 < argc)) {
+            pvar_filename = argv[++argi];
+        } else if (strcmp(argv[argi], "--memory-map") == 0) {
+            read_flags |= kReadFlagMemoryMap;
+        } else if ((argv[argi][0] == '-') || (pgi_filename != nullptr)) {
+            return Usage(argv[0]);
+        } else if (pgen_filename == nullptr) {
+            pgen_filename = argv[argi];
+        } else {
+            pgi_filename = argv[argi];
+        }
+    }
+    if (pgen_filename == nullptr) {
+        return Usage(argv[0]);
+    }
+
+    std::vector<int32_t> allele_cts;
+    if ((pvar_filename != nullptr) && !ReadPvarAlleleCounts(pvar_filename, allele_cts)) {
+        return kExitError;
+    }
+
+    PgenReaderContext *reader_context;
+    try {
+        reader_context = OpenPgenReader(
+                pgen_filename,
+                pgi_filename,
+                (pvar_filename != nullptr) ? allele_cts.data() : nullptr,
+                static_cast<long>(allele_cts.size()),
+                read_flags);
+    } catch (const PgenException &e) {
+        // plink2 validates the parts of the header it needs to open the file, so a malformed header fails here
+        fprintf(stderr, "%s: can't be opened: %s\n", pgen_filename, e.what());
+        return kExitInvalid;
+    }
+    int exit_code;
+    try {
+        PgenValidationResult result;
+        if (ValidatePgen(reader_context, thread_ct, &result)) {
+            printf("%s: valid (%u variants, %u samples)\n",
+                   pgen_filename,
+                   GetReaderVariantCount(reader_context),
+                   GetReaderRawSampleCount(reader_context));
+            exit_code = kExitValid;
+        } else if (result.variant_index == kValidateNoVariant) {
+            printf("%s: invalid header or index (byte offset %llu): %s\n",
+                   pgen_filename,
+                   static_cast<unsigned long long>(result.byte_offset),
+                   result.message);
+            exit_code = kExitInvalid;
+        } else {
+            printf("%s: invalid variant record %u (byte offset %llu): %s\n",
+                   pgen_filename,
+                   result.variant_index,
+                   static_cast<unsigned long long>(result.byte_offset),
+                   result.message);
+            exit_code = kExitInvalid;
+        }
+    } catch (const PgenException &e) {
+        fprintf(stderr, "%s: %s\n", pgen_filename, e.what());
+        exit_code = kExitError;
+    }
+    ClosePgenReader(reader_context);
+    return exit_code;
+}
@@ -0,0 +1,106 @@
+//
+
+#ifndef PGEN_LIB_TOOLUTILS_H
+#define PGEN_LIB_TOOLUTILS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Input file helpers shared by the command line tools.
+
+// Read the allele count of each variant (1 + the number of comma separated ALT alleles) from a .pvar. Returns false,
+// with a message on stderr, if the .pvar can't be read.
+inline bool ReadPvarAlleleCounts(const char *pvarFilename, std::vector<int32_t> &alleleCounts) {
+    FILE *pvar_file = fopen(pvarFilename, "r");
+    if (pvar_file == nullptr) {
+        fprintf(stderr, "%s: can't be opened\n", pvarFilename);
+        return false;
+    }
+    // the ALT column is the fifth unless the #CHROM header line says otherwise
+    uint32_t alt_col_idx = 4;
+    std::string line;
+    bool ok = true;
+    int c;
+    do {
+        line.clear();
+        while (((c = fgetc(pvar_file)) != EOF) && (c != '\n')) {
+            if (c != '\r') {
+                line.push_back(static_cast<char>(c));
+            }
+        }
+        if (line.empty() || (line.compare(0, 2, "##") == 0)) {
+            continue;
+        }
+        std::vector<std::string> columns(1);
+        for (const char ch : line) {
+            if ((ch == '\t') || (ch == ' ')) {
+                if (!columns.back().empty()) {
+                    columns.emplace_back();
+                }
+            } else {
+                columns.back().push_back(ch);
+            }
+        }
+        if (line[0] == '#') {
+            for (uint32_t col_idx = 0; col_idx != columns.size(); ++col_idx) {
+                if (columns[col_idx] == "ALT") {
+                    alt_col_idx = col_idx;
+                }
+            }
+            continue;
+        }
+        if (columns.size() <= alt_col_idx) {
+            fprintf(stderr, "%s: variant line %zu has no ALT column\n", pvarFilename, alleleCounts.size() + 1);
+            ok = false;
+            break;
+        }
+        int32_t allele_ct = 2;
+        for (const char ch : columns[alt_col_idx]) {
+            allele_ct += (ch == ',') ? 1 : 0;
+        }
+        alleleCounts.push_back(allele_ct);
+    } while (c != EOF);
+    fclose(pvar_file);
+    return ok;
+}
+
+// Read a list of (zero based) indices, one per line, from a text file. Blank lines are skipped. Returns false, with a
+// message on stderr, if the file can't be read or has a line that isn't an index.
+inline bool ReadIndexList(const char *indexFilename, std::vector<uint32_t> &indices) {
+    FILE *index_file = fopen(indexFilename, "r");
+    if (index_file == nullptr) {
+        fprintf(stderr, "%s: can't be opened\n", indexFilename);
+        return false;
+    }
+    std::string line;
+    uint32_t line_idx = 0;
+    bool ok = true;
+    int c;
+    do {
+        line.clear();
+        while (((c = fgetc(index_file)) != EOF) && (c != '\n')) {
+            if ((c != '\r') && (c != ' ') && (c != '\t')) {
+                line.push_back(static_cast<char>(c));
+            }
+        }
+        ++line_idx;
+        if (line.empty()) {
+            continue;
+        }
+        char *end = nullptr;
+        const unsigned long index = strtoul(line.c_str(), &end, 10);
+        if ((*end != '\0') || (line[0] == '-') || (index > UINT32_MAX)) {
+            fprintf(stderr, "%s: line %u isn't an index: %s\n", indexFilename, line_idx, line.c_str());
+            ok = false;
+            break;
+        }
+        indices.push_back(static_cast<uint32_t>(index));
+    } while (c != EOF);
+    fclose(index_file);
+    return ok;
+}
+
+#endif //PGEN_LIB_TOOLUTILS_H
@@ -0,0 +1,869 @@
+/**
+ * Copyright (c) 2023, Broad Institute, Inc. All rights reserved.
+ */
+
+#include <cstring>
+#include <vector>
+
+#include "org_broadinstitute_pgen_PgenReader.h"
+
+#include "PgenJniUtils.h"
+#include "pgenExtract.h"
+#include "pgenGrm.h"
+#include "pgenHaplotypes.h"
+#include "pgenLd.h"
+#include "pgenReader.h"
+#include "pgenReaderContext.h"
+#include "pgenSampleMajor.h"
+#include "pgenScore.h"
+#include "pgenStats.h"
+#include "pgenValidate.h"
+#include "pgenException.h"
+
+using namespace pgenlib;
+
+// Implementation of the JNI access layer for the PGEN reader. As with the writer, this code should do as little as
+// possible, only converting to and from Java types, delegating as much as possible to the underlying C++ pgenlib
+// code.
+//
+// C++ exceptions from lower layers that are caught here are re-thrown as Java exceptions.
+
+// alleleCounts may be null if every variant in the pgen is biallelic; sampleIndices may be null to read all samples
+JNIEXPORT jlong JNICALL
+Java_org_broadinstitute_pgen_PgenReader_openPgenReader(JNIEnv *env, jclass object,
+                                                       jstring filename,
+                                                       jstring pgiFilename,
+                                                       jintArray alleleCounts,
+                                                       jint readFlags,
+                                                       jintArray sampleIndices) {
+    // the plink code makes a copy of the filenames, so these can be released before this function returns
+    const char* const cFilename = env->GetStringUTFChars(filename, nullptr);
+    const char* const cPgiFilename = pgiFilename != nullptr ? env->GetStringUTFChars(pgiFilename, nullptr) : nullptr;
+    jint* const allele_counts = alleleCounts != nullptr ? env->GetIntArrayElements(alleleCounts, nullptr) : nullptr;
+    const long allele_counts_length = alleleCounts != nullptr ? env->GetArrayLength(alleleCounts) : 0;
+    jint* const sample_indices = sampleIndices != nullptr ? env->GetIntArrayElements(sampleIndices, nullptr) : nullptr;
+    const long sample_indices_length = sampleIndices != nullptr ? env->GetArrayLength(sampleIndices) : 0;
+
+    jlong readerHandle;
+    try {
+        PgenReaderContext* const readerContext = OpenPgenReader(
+            cFilename,
+            cPgiFilename,
+            reinterpret_cast<const int32_t*>(allele_counts),
+            allele_counts_length,
+            static_cast<uint32_t>(readFlags),
+            reinterpret_cast<const int32_t*>(sample_indices),
+            sample_indices_length);
+        readerHandle = reinterpret_cast<jlong>(readerContext);
+    } catch (const PgenException& e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure opening pgen reader");
+        readerHandle = 0L;
+    }
+    env->ReleaseStringUTFChars(filename, cFilename);
+    if (cPgiFilename != nullptr) {
+        env->ReleaseStringUTFChars(pgiFilename, cPgiFilename);
+    }
+    if (allele_counts != nullptr) {
+        // the allele counts are only read, so there's nothing to copy back
+        env->ReleaseIntArrayElements(alleleCounts, allele_counts, JNI_ABORT);
+    }
+    if (sample_indices != nullptr) {
+        env->ReleaseIntArrayElements(sampleIndices, sample_indices, JNI_ABORT);
+    }
+    return readerHandle;
+}
+
+JNIEXPORT jlong JNICALL
+Java_org_broadinstitute_pgen_PgenReader_getReaderVariantCount(JNIEnv *env, jclass object, jlong readerHandle) {
+    return GetReaderVariantCount(reinterpret_cast<PgenReaderContext*>(readerHandle));
+}
+
+JNIEXPORT jint JNICALL
+Java_org_broadinstitute_pgen_PgenReader_getReaderSampleCount(JNIEnv *env, jclass object, jlong readerHandle) {
+    return GetReaderSampleCount(reinterpret_cast<PgenReaderContext*>(readerHandle));
+}
+
+// Returns the offset of a variant's first allele in per allele outputs, or 0 if an exception was thrown.
+JNIEXPORT jlong JNICALL
+Java_org_broadinstitute_pgen_PgenReader_getReaderAlleleIndexOffset(JNIEnv *env, jclass object,
+                                                                   jlong readerHandle,
+                                                                   jlong variantIndex) {
+    if ((variantIndex < 0) || (variantIndex > static_cast<jlong>(UINT32_MAX))) {
+        throwAsyncJavaException(
+            env,
+            "Invalid variant index in getReaderAlleleIndexOffset",
+            "org/broadinstitute/pgen/PgenException");
+        return 0;
+    }
+    try {
+        return static_cast<jlong>(GetReaderAlleleIndexOffset(
+            reinterpret_cast<PgenReaderContext*>(readerHandle), static_cast<uint32_t>(variantIndex)));
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in getReaderAlleleIndexOffset");
+        return 0;
+    }
+}
+
+// Shared implementation of readFloatDosages and readDoubleDosages. The (Float or Double) dosage buffer receives
+// sampleCount dosages per variant in [variantStart, variantEnd). Returns false if an exception was thrown.
+template <typename T>
+static jboolean ReadDosagesIntoBuffer(JNIEnv *env,
+                                      jlong readerHandle,
+                                      jlong variantStart,
+                                      jlong variantEnd,
+                                      jint dosageFlags,
+                                      jobject dosageBuffer) {
+    PgenReaderContext *readerContext = reinterpret_cast<PgenReaderContext*>(readerHandle);
+    if ((variantStart < 0) || (variantEnd < variantStart) || (variantEnd > GetReaderVariantCount(readerContext))) {
+        throwAsyncJavaException(
+            env,
+            "Invalid variant range in readDosages",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    T *dosages = reinterpret_cast<T*>(env->GetDirectBufferAddress(dosageBuffer));
+    if ( !dosages ) {
+        throwAsyncJavaException(
+            env,
+            "Native code failure getting address for dosages in readDosages",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    } else if (static_cast<uint64_t>(env->GetDirectBufferCapacity(dosageBuffer)) <
+               static_cast<uint64_t>(variantEnd - variantStart) * GetReaderSampleCount(readerContext)) {
+        // the capacity of a (non-byte) direct buffer is its number of elements
+        throwAsyncJavaException(
+            env,
+            "Dosage buffer is too small for the variant range and sample count in readDosages",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    try {
+        ReadDosages(
+            readerContext,
+            static_cast<uint32_t>(variantStart),
+            static_cast<uint32_t>(variantEnd),
+            static_cast<uint32_t>(dosageFlags),
+            dosages);
+        return true;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in readDosages");
+        return false;
+    }
+}
+
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenReader_readFloatDosages(JNIEnv *env, jclass object,
+                                                         jlong readerHandle,
+                                                         jlong variantStart,
+                                                         jlong variantEnd,
+                                                         jint dosageFlags,
+                                                         jobject dosageBuffer) {
+    return ReadDosagesIntoBuffer<float>(env, readerHandle, variantStart, variantEnd, dosageFlags, dosageBuffer);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenReader_readDoubleDosages(JNIEnv *env, jclass object,
+                                                          jlong readerHandle,
+                                                          jlong variantStart,
+                                                          jlong variantEnd,
+                                                          jint dosageFlags,
+                                                          jobject dosageBuffer) {
+    return ReadDosagesIntoBuffer<double>(env, readerHandle, variantStart, variantEnd, dosageFlags, dosageBuffer);
+}
+
+// Each haplotype buffer receives sampleCount * (variantEnd - variantStart) int32 haplotype codes, haplotype major
+// (see ReadHaplotypes). Returns false if an exception was thrown.
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenReader_readHaplotypes(JNIEnv *env, jclass object,
+                                                       jlong readerHandle,
+                                                       jlong variantStart,
+                                                       jlong variantEnd,
+                                                       jint threadCount,
+                                                       jobject hap0Buffer,
+                                                       jobject hap1Buffer) {
+    PgenReaderContext *readerContext = reinterpret_cast<PgenReaderContext*>(readerHandle);
+    if ((variantStart < 0) || (variantEnd < variantStart) || (variantEnd > GetReaderVariantCount(readerContext))) {
+        throwAsyncJavaException(
+            env,
+            "Invalid variant range in readHaplotypes",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    } else if (threadCount < 1) {
+        throwAsyncJavaException(
+            env,
+            "Invalid thread count in readHaplotypes",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    int32_t *hap0_codes = reinterpret_cast<int32_t*>(env->GetDirectBufferAddress(hap0Buffer));
+    int32_t *hap1_codes = reinterpret_cast<int32_t*>(env->GetDirectBufferAddress(hap1Buffer));
+    const uint64_t hap_bytes =
+        static_cast<uint64_t>(variantEnd - variantStart) * GetReaderSampleCount(readerContext) * sizeof(int32_t);
+    if ( !hap0_codes || !hap1_codes ) {
+        throwAsyncJavaException(
+            env,
+            "Native code failure getting haplotype buffer address in readHaplotypes",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    } else if ((static_cast<uint64_t>(env->GetDirectBufferCapacity(hap0Buffer)) < hap_bytes) ||
+               (static_cast<uint64_t>(env->GetDirectBufferCapacity(hap1Buffer)) < hap_bytes)) {
+        throwAsyncJavaException(
+            env,
+            "Haplotype buffer is too small for the variant range and sample count in readHaplotypes",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    try {
+        ReadHaplotypes(
+            readerContext,
+            static_cast<uint32_t>(variantStart),
+            static_cast<uint32_t>(variantEnd),
+            static_cast<uint32_t>(threadCount),
+            hap0_codes,
+            hap1_codes);
+        return true;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in readHaplotypes");
+        return false;
+    }
+}
+
+// The genotype count buffer receives 4 int32 counts per variant in [variantStart, variantEnd). The optional (may
+// be null) allele dosage buffer receives one double per allele of each variant in the range. Returns false if an
+// exception was thrown.
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenReader_computeAlleleCounts(JNIEnv *env, jclass object,
+                                                            jlong readerHandle,
+                                                            jlong variantStart,
+                                                            jlong variantEnd,
+                                                            jint threadCount,
+                                                            jobject genotypeCountBuffer,
+                                                            jobject alleleDosageBuffer) {
+    PgenReaderContext *readerContext = reinterpret_cast<PgenReaderContext*>(readerHandle);
+    if ((variantStart < 0) || (variantEnd < variantStart) || (variantEnd > GetReaderVariantCount(readerContext))) {
+        throwAsyncJavaException(
+            env,
+            "Invalid variant range in computeAlleleCounts",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    const uint32_t variant_start = static_cast<uint32_t>(variantStart);
+    const uint32_t variant_end = static_cast<uint32_t>(variantEnd);
+    uint32_t *genotype_counts = reinterpret_cast<uint32_t*>(env->GetDirectBufferAddress(genotypeCountBuffer));
+    if ( !genotype_counts ) {
+        throwAsyncJavaException(
+            env,
+            "Native code failure getting address for genotype counts in computeAlleleCounts",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    } else if (static_cast<uintptr_t>(env->GetDirectBufferCapacity(genotypeCountBuffer)) <
+               static_cast<uintptr_t>(variant_end - variant_start) * 4 * sizeof(uint32_t)) {
+        throwAsyncJavaException(
+            env,
+            "Genotype count buffer is too small for the variant range in computeAlleleCounts",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    double *allele_dosages = nullptr;
+    if (alleleDosageBuffer != nullptr) {
+        allele_dosages = reinterpret_cast<double*>(env->GetDirectBufferAddress(alleleDosageBuffer));
+        const uint64_t allele_ct = GetReaderAlleleIndexOffset(readerContext, variant_end) -
+                                   GetReaderAlleleIndexOffset(readerContext, variant_start);
+        if ( !allele_dosages ) {
+            throwAsyncJavaException(
+                env,
+                "Native code failure getting address for allele dosages in computeAlleleCounts",
+                "org/broadinstitute/pgen/PgenException");
+            return false;
+        } else if (static_cast<uint64_t>(env->GetDirectBufferCapacity(alleleDosageBuffer)) < allele_ct * sizeof(double)) {
+            throwAsyncJavaException(
+                env,
+                "Allele dosage buffer is too small for the variant range in computeAlleleCounts",
+                "org/broadinstitute/pgen/PgenException");
+            return false;
+        }
+    }
+    if (threadCount < 1) {
+        throwAsyncJavaException(
+            env,
+            "Invalid thread count in computeAlleleCounts",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    try {
+        ComputeAlleleCounts(
+            readerContext,
+            variant_start,
+            variant_end,
+            static_cast<uint32_t>(threadCount),
+            genotype_counts,
+            allele_dosages);
+        return true;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in computeAlleleCounts");
+        return false;
+    }
+}
+
+// The variant missing count buffer receives one int32 count per variant in [variantStart, variantEnd), and the sample
+// missing count buffer receives one int32 count per sample. Either buffer may be null. Returns false if an exception
+// was thrown.
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenReader_computeMissingness(JNIEnv *env, jclass object,
+                                                           jlong readerHandle,
+                                                           jlong variantStart,
+                                                           jlong variantEnd,
+                                                           jint threadCount,
+                                                           jint missingnessFlags,
+                                                           jobject variantMissingCountBuffer,
+                                                           jobject sampleMissingCountBuffer) {
+    PgenReaderContext *readerContext = reinterpret_cast<PgenReaderContext*>(readerHandle);
+    if ((variantStart < 0) || (variantEnd < variantStart) || (variantEnd > GetReaderVariantCount(readerContext))) {
+        throwAsyncJavaException(
+            env,
+            "Invalid variant range in computeMissingness",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    } else if (threadCount < 1) {
+        throwAsyncJavaException(
+            env,
+            "Invalid thread count in computeMissingness",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    uint32_t *variant_missing_cts = nullptr;
+    if (variantMissingCountBuffer != nullptr) {
+        variant_missing_cts = reinterpret_cast<uint32_t*>(env->GetDirectBufferAddress(variantMissingCountBuffer));
+        if ( !variant_missing_cts ) {
+            throwAsyncJavaException(
+                env,
+                "Native code failure getting address for variant missing counts in computeMissingness",
+                "org/broadinstitute/pgen/PgenException");
+            return false;
+        } else if (static_cast<uintptr_t>(env->GetDirectBufferCapacity(variantMissingCountBuffer)) <
+                   static_cast<uintptr_t>(variantEnd - variantStart) * sizeof(uint32_t)) {
+            throwAsyncJavaException(
+                env,
+                "Variant missing count buffer is too small for the variant range in computeMissingness",
+                "org/broadinstitute/pgen/PgenException");
+            return false;
+        }
+    }
+    uint32_t *sample_missing_cts = nullptr;
+    if (sampleMissingCountBuffer != nullptr) {
+        sample_missing_cts = reinterpret_cast<uint32_t*>(env->GetDirectBufferAddress(sampleMissingCountBuffer));
+        if ( !sample_missing_cts ) {
+            throwAsyncJavaException(
+                env,
+                "Native code failure getting address for sample missing counts in computeMissingness",
+                "org/broadinstitute/pgen/PgenException");
+            return false;
+        } else if (static_cast<uintptr_t>(env->GetDirectBufferCapacity(sampleMissingCountBuffer)) <
+                   static_cast<uintptr_t>(GetReaderSampleCount(readerContext)) * sizeof(uint32_t)) {
+            throwAsyncJavaException(
+                env,
+                "Sample missing count buffer is smaller than the sample count in computeMissingness",
+                "org/broadinstitute/pgen/PgenException");
+            return false;
+        }
+    }
+    try {
+        ComputeMissingness(
+            readerContext,
+            static_cast<uint32_t>(variantStart),
+            static_cast<uint32_t>(variantEnd),
+            static_cast<uint32_t>(threadCount),
+            static_cast<uint32_t>(missingnessFlags),
+            variant_missing_cts,
+            sample_missing_cts);
+        return true;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in computeMissingness");
+        return false;
+    }
+}
+
+// variantIndices and alleleIndices hold one entry per weighted variant, and weights holds scoreCount weights per
+// entry. The score buffer receives sampleCount doubles per score, score major (see ComputeScores). Returns false if
+// an exception was thrown.
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenReader_computeScores(JNIEnv *env, jclass object,
+                                                      jlong readerHandle,
+                                                      jintArray variantIndices,
+                                                      jintArray alleleIndices,
+                                                      jdoubleArray weights,
+                                                      jint scoreCount,
+                                                      jint threadCount,
+                                                      jint scoreFlags,
+                                                      jobject scoreBuffer) {
+    PgenReaderContext *readerContext = reinterpret_cast<PgenReaderContext*>(readerHandle);
+    const jsize weight_ct = env->GetArrayLength(variantIndices);
+    if ((scoreCount < 1) || (env->GetArrayLength(alleleIndices) != weight_ct) ||
+        (static_cast<uint64_t>(env->GetArrayLength(weights)) != static_cast<uint64_t>(weight_ct) * scoreCount)) {
+        throwAsyncJavaException(
+            env,
+            "The variant indices, allele indices and weights don't match the score count in computeScores",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    } else if (threadCount < 1) {
+        throwAsyncJavaException(
+            env,
+            "Invalid thread count in computeScores",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    double *scores = reinterpret_cast<double*>(env->GetDirectBufferAddress(scoreBuffer));
+    if ( !scores ) {
+        throwAsyncJavaException(
+            env,
+            "Native code failure getting score buffer address in computeScores",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    } else if (static_cast<uint64_t>(env->GetDirectBufferCapacity(scoreBuffer)) <
+               static_cast<uint64_t>(scoreCount) * GetReaderSampleCount(readerContext) * sizeof(double)) {
+        throwAsyncJavaException(
+            env,
+            "Score buffer is too small for the score count and sample count in computeScores",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+
+    jint* const variant_indices = env->GetIntArrayElements(variantIndices, nullptr);
+    jint* const allele_indices = env->GetIntArrayElements(alleleIndices, nullptr);
+    jdouble* const weight_values = env->GetDoubleArrayElements(weights, nullptr);
+    jboolean result;
+    try {
+        // negative indices wrap around to indices past the end of the pgen, which ComputeScores rejects
+        ComputeScores(
+            readerContext,
+            reinterpret_cast<const uint32_t*>(variant_indices),
+            reinterpret_cast<const uint32_t*>(allele_indices),
+            weight_values,
+            static_cast<uint32_t>(weight_ct),
+            static_cast<uint32_t>(scoreCount),
+            static_cast<uint32_t>(threadCount),
+            static_cast<uint32_t>(scoreFlags),
+            scores);
+        result = true;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in computeScores");
+        result = false;
+    }
+    // the arrays are only read, so there's nothing to copy back
+    env->ReleaseIntArrayElements(variantIndices, variant_indices, JNI_ABORT);
+    env->ReleaseIntArrayElements(alleleIndices, allele_indices, JNI_ABORT);
+    env->ReleaseDoubleArrayElements(weights, weight_values, JNI_ABORT);
+    return result;
+}
+
+// The GRM buffer receives (rowEnd - rowStart) * columnEnd doubles, row major (see ComputeGrmTile). Returns the number
+// of variants the matrix was computed from, or 0 if an exception was thrown.
+JNIEXPORT jint JNICALL
+Java_org_broadinstitute_pgen_PgenReader_computeGrmTile(JNIEnv *env, jclass object,
+                                                       jlong readerHandle,
+                                                       jlong variantStart,
+                                                       jlong variantEnd,
+                                                       jint threadCount,
+                                                       jint rowStart,
+                                                       jint rowEnd,
+                                                       jint columnEnd,
+                                                       jobject grmBuffer) {
+    PgenReaderContext *readerContext = reinterpret_cast<PgenReaderContext*>(readerHandle);
+    const jint sample_ct = static_cast<jint>(GetReaderSampleCount(readerContext));
+    if ((variantStart < 0) || (variantEnd < variantStart) || (variantEnd > GetReaderVariantCount(readerContext))) {
+        throwAsyncJavaException(
+            env,
+            "Invalid variant range in computeGrmTile",
+            "org/broadinstitute/pgen/PgenException");
+        return 0;
+    } else if ((rowStart < 0) || (rowEnd < rowStart) || (rowEnd > sample_ct) || (columnEnd < 0) || (columnEnd > sample_ct)) {
+        throwAsyncJavaException(
+            env,
+            "Invalid GRM tile in computeGrmTile",
+            "org/broadinstitute/pgen/PgenException");
+        return 0;
+    } else if (threadCount < 1) {
+        throwAsyncJavaException(
+            env,
+            "Invalid thread count in computeGrmTile",
+            "org/broadinstitute/pgen/PgenException");
+        return 0;
+    }
+    double *grm = reinterpret_cast<double*>(env->GetDirectBufferAddress(grmBuffer));
+    if ( !grm ) {
+        throwAsyncJavaException(
+            env,
+            "Native code failure getting GRM buffer address in computeGrmTile",
+            "org/broadinstitute/pgen/PgenException");
+        return 0;
+    } else if (static_cast<uint64_t>(env->GetDirectBufferCapacity(grmBuffer)) <
+               static_cast<uint64_t>(rowEnd - rowStart) * columnEnd * sizeof(double)) {
+        throwAsyncJavaException(
+            env,
+            "GRM buffer is too small for the tile in computeGrmTile",
+            "org/broadinstitute/pgen/PgenException");
+        return 0;
+    }
+    try {
+        return static_cast<jint>(ComputeGrmTile(
+            readerContext,
+            static_cast<uint32_t>(variantStart),
+            static_cast<uint32_t>(variantEnd),
+            static_cast<uint32_t>(threadCount),
+            static_cast<uint32_t>(rowStart),
+            static_cast<uint32_t>(rowEnd),
+            static_cast<uint32_t>(columnEnd),
+            grm));
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in computeGrmTile");
+        return 0;
+    }
+}
+
+// Returns the number of variants the matrix was computed from, or 0 if an exception was thrown.
+JNIEXPORT jint JNICALL
+Java_org_broadinstitute_pgen_PgenReader_writeGrmBin(JNIEnv *env, jclass object,
+                                                    jlong readerHandle,
+                                                    jlong variantStart,
+                                                    jlong variantEnd,
+                                                    jint threadCount,
+                                                    jint tileRowCount,
+                                                    jstring grmBinFilename) {
+    PgenReaderContext *readerContext = reinterpret_cast<PgenReaderContext*>(readerHandle);
+    if ((variantStart < 0) || (variantEnd < variantStart) || (variantEnd > GetReaderVariantCount(readerContext))) {
+        throwAsyncJavaException(
+            env,
+            "Invalid variant range in writeGrmBin",
+            "org/broadinstitute/pgen/PgenException");
+        return 0;
+    } else if ((threadCount < 1) || (tileRowCount < 1)) {
+        throwAsyncJavaException(
+            env,
+            "Invalid thread count or tile row count in writeGrmBin",
+            "org/broadinstitute/pgen/PgenException");
+        return 0;
+    }
+    const char* const cGrmBinFilename = env->GetStringUTFChars(grmBinFilename, nullptr);
+    jint used_variant_ct;
+    try {
+        used_variant_ct = static_cast<jint>(WriteGrmBin(
+            readerContext,
+            static_cast<uint32_t>(variantStart),
+            static_cast<uint32_t>(variantEnd),
+            static_cast<uint32_t>(threadCount),
+            static_cast<uint32_t>(tileRowCount),
+            cGrmBinFilename));
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in writeGrmBin");
+        used_variant_ct = 0;
+    }
+    env->ReleaseStringUTFChars(grmBinFilename, cGrmBinFilename);
+    return used_variant_ct;
+}
+
+// The LD pairs are returned to Java in two steps: computeWindowLd and computeCrossLd return a handle to the (native)
+// pairs, and readLdPairs copies them into a buffer sized with getLdPairCount, and releases them.
+static_assert(sizeof(LdPair) == 24, "LdPair must match the 24 byte pair layout read by PgenReader.readLdPairs");
+
+// Returns a handle to the pairs, or 0 if an exception was thrown.
+JNIEXPORT jlong JNICALL
+Java_org_broadinstitute_pgen_PgenReader_computeWindowLd(JNIEnv *env, jclass object,
+                                                        jlong readerHandle,
+                                                        jlong variantStart,
+                                                        jlong variantEnd,
+                                                        jint windowVariantCount,
+                                                        jdouble minR2,
+                                                        jint threadCount,
+                                                        jint ldFlags) {
+    PgenReaderContext *readerContext = reinterpret_cast<PgenReaderContext*>(readerHandle);
+    if ((variantStart < 0) || (variantEnd < variantStart) || (variantEnd > GetReaderVariantCount(readerContext))) {
+        throwAsyncJavaException(
+            env,
+            "Invalid variant range in computeWindowLd",
+            "org/broadinstitute/pgen/PgenException");
+        return 0L;
+    } else if ((windowVariantCount < 0) || (threadCount < 1)) {
+        throwAsyncJavaException(
+            env,
+            "Invalid window size or thread count in computeWindowLd",
+            "org/broadinstitute/pgen/PgenException");
+        return 0L;
+    }
+    std::vector<LdPair> *pairs = new std::vector<LdPair>();
+    try {
+        ComputeWindowLd(
+            readerContext,
+            static_cast<uint32_t>(variantStart),
+            static_cast<uint32_t>(variantEnd),
+            static_cast<uint32_t>(windowVariantCount),
+            minR2,
+            static_cast<uint32_t>(threadCount),
+            static_cast<uint32_t>(ldFlags),
+            pairs);
+        return reinterpret_cast<jlong>(pairs);
+    } catch (const PgenException &e) {
+        delete pairs;
+        reThrowAsAsyncJavaException(env, e, "Native code failure in computeWindowLd");
+        return 0L;
+    }
+}
+
+// Returns a handle to the pairs, or 0 if an exception was thrown.
+JNIEXPORT jlong JNICALL
+Java_org_broadinstitute_pgen_PgenReader_computeCrossLd(JNIEnv *env, jclass object,
+                                                       jlong readerHandle,
+                                                       jlong variantStartA,
+                                                       jlong variantEndA,
+                                                       jlong variantStartB,
+                                                       jlong variantEndB,
+                                                       jdouble minR2,
+                                                       jint threadCount,
+                                                       jint ldFlags) {
+    PgenReaderContext *readerContext = reinterpret_cast<PgenReaderContext*>(readerHandle);
+    const jlong variant_ct = static_cast<jlong>(GetReaderVariantCount(readerContext));
+    if ((variantStartA < 0) || (variantEndA < variantStartA) || (variantEndA > variant_ct) ||
+        (variantStartB < 0) || (variantEndB < variantStartB) || (variantEndB > variant_ct)) {
+        throwAsyncJavaException(
+            env,
+            "Invalid variant range in computeCrossLd",
+            "org/broadinstitute/pgen/PgenException");
+        return 0L;
+    } else if (threadCount < 1) {
+        throwAsyncJavaException(
+            env,
+            "Invalid thread count in computeCrossLd",
+            "org/broadinstitute/pgen/PgenException");
+        return 0L;
+    }
+    std::vector<LdPair> *pairs = new std::vector<LdPair>();
+    try {
+        ComputeCrossLd(
+            readerContext,
+            static_cast<uint32_t>(variantStartA),
+            static_cast<uint32_t>(variantEndA),
+            static_cast<uint32_t>(variantStartB),
+            static_cast<uint32_t>(variantEndB),
+            minR2,
+            static_cast<uint32_t>(threadCount),
+            static_cast<uint32_t>(ldFlags),
+            pairs);
+        return reinterpret_cast<jlong>(pairs);
+    } catch (const PgenException &e) {
+        delete pairs;
+        reThrowAsAsyncJavaException(env, e, "Native code failure in computeCrossLd");
+        return 0L;
+    }
+}
+
+JNIEXPORT jlong JNICALL
+Java_org_broadinstitute_pgen_PgenReader_getLdPairCount(JNIEnv *env, jclass object, jlong ldPairsHandle) {
+    return static_cast<jlong>(reinterpret_cast<std::vector<LdPair>*>(ldPairsHandle)->size());
+}
+
+// The pair buffer receives 24 bytes per pair: the int32 indices of the two variants, then r^2 and D' (doubles). The
+// pairs are released whether or not they're copied; the pair buffer may be null to only release them. Returns false
+// if an exception was thrown.
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenReader_readLdPairs(JNIEnv *env, jclass object,
+                                                    jlong ldPairsHandle,
+                                                    jobject pairBuffer) {
+    std::vector<LdPair> *pairs = reinterpret_cast<std::vector<LdPair>*>(ldPairsHandle);
+    jboolean result = true;
+    if (pairBuffer != nullptr) {
+        unsigned char *pair_bytes = reinterpret_cast<unsigned char*>(env->GetDirectBufferAddress(pairBuffer));
+        if ( !pair_bytes ) {
+            throwAsyncJavaException(
+                env,
+                "Native code failure getting LD pair buffer address in readLdPairs",
+                "org/broadinstitute/pgen/PgenException");
+            result = false;
+        } else if (static_cast<uint64_t>(env->GetDirectBufferCapacity(pairBuffer)) < pairs->size() * sizeof(LdPair)) {
+            throwAsyncJavaException(
+                env,
+                "LD pair buffer is smaller than the number of pairs in readLdPairs",
+                "org/broadinstitute/pgen/PgenException");
+            result = false;
+        } else if (!pairs->empty()) {
+            memcpy(pair_bytes, pairs->data(), pairs->size() * sizeof(LdPair));
+        }
+    }
+    delete pairs;
+    return result;
+}
+
+// The allele code buffer receives sampleCount * 2 allele codes (int32), with -9 for missing genotypes. The
+// optional (may be null) phase buffer receives sampleCount phase bytes. Returns the allele count of the variant,
+// or 0 if an exception was thrown.
+JNIEXPORT jint JNICALL
+Java_org_broadinstitute_pgen_PgenReader_readAlleles(JNIEnv *env, jclass object,
+                                                    jlong readerHandle,
+                                                    jlong variantIndex,
+                                                    jobject alleleBuffer,
+                                                    jobject phaseBuffer) {
+    PgenReaderContext *readerContext = reinterpret_cast<PgenReaderContext*>(readerHandle);
+    const uintptr_t sample_ct = GetReaderSampleCount(readerContext);
+    int32_t *allele_codes = reinterpret_cast<int32_t*>(env->GetDirectBufferAddress(alleleBuffer));
+    if ( !allele_codes ) {
+        throwAsyncJavaException(
+            env,
+            "Native code failure getting address for allele codes in readAlleles",
+            "org/broadinstitute/pgen/PgenException");
+        return 0;
+    } else if (static_cast<uintptr_t>(env->GetDirectBufferCapacity(alleleBuffer)) < sample_ct * 2 * sizeof(int32_t)) {
+        throwAsyncJavaException(
+            env,
+            "Allele code buffer is too small for the sample count in readAlleles",
+            "org/broadinstitute/pgen/PgenException");
+        return 0;
+    }
+    unsigned char *phase_bytes = nullptr;
+    if (phaseBuffer != nullptr) {
+        phase_bytes = reinterpret_cast<unsigned char*>(env->GetDirectBufferAddress(phaseBuffer));
+        if ( !phase_bytes ) {
+            throwAsyncJavaException(
+                env,
+                "Native code failure getting address for phaseBuffer in readAlleles",
+                "org/broadinstitute/pgen/PgenException");
+            return 0;
+        } else if (static_cast<uintptr_t>(env->GetDirectBufferCapacity(phaseBuffer)) < sample_ct) {
+            throwAsyncJavaException(
+                env,
+                "Phase buffer is smaller than the sample count in readAlleles",
+                "org/broadinstitute/pgen/PgenException");
+            return 0;
+        }
+    }
+    if ((variantIndex < 0) || (variantIndex > static_cast<jlong>(UINT32_MAX))) {
+        throwAsyncJavaException(
+            env,
+            "Invalid variant index in readAlleles",
+            "org/broadinstitute/pgen/PgenException");
+        return 0;
+    }
+    try {
+        return ReadAlleles(readerContext, static_cast<uint32_t>(variantIndex), allele_codes, phase_bytes);
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in readAlleles");
+        return 0;
+    }
+}
+
+// Returns true if the pgen is valid. If it's invalid, throws a PgenException that describes the first problem, and
+// returns false.
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenReader_validatePgen(JNIEnv *env, jclass object,
+                                                     jlong readerHandle,
+                                                     jint threadCount) {
+    PgenReaderContext *readerContext = reinterpret_cast<PgenReaderContext*>(readerHandle);
+    if (threadCount < 1) {
+        throwAsyncJavaException(
+            env,
+            "Invalid thread count in validatePgen",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    PgenValidationResult result;
+    try {
+        if (ValidatePgen(readerContext, static_cast<uint32_t>(threadCount), &result)) {
+            return true;
+        }
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in validatePgen");
+        return false;
+    }
+    std::vector<char> message(sizeof(result.message) + 128);
+    if (result.variant_index == kValidateNoVariant) {
+        snprintf(message.data(),
+                 message.size(),
+                 "Invalid pgen header or index (byte offset %llu): %s",
+                 static_cast<unsigned long long>(result.byte_offset),
+                 result.message);
+    } else {
+        snprintf(message.data(),
+                 message.size(),
+                 "Invalid pgen variant record %u (byte offset %llu): %s",
+                 result.variant_index,
+                 static_cast<unsigned long long>(result.byte_offset),
+                 result.message);
+    }
+    throwAsyncJavaException(env, message.data(), "org/broadinstitute/pgen/PgenException");
+    return false;
+}
+
+// Returns false if an exception was thrown.
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenReader_writeSampleMajorSidecar(JNIEnv *env, jclass object,
+                                                                jlong readerHandle,
+                                                                jstring sidecarFilename,
+                                                                jint threadCount) {
+    PgenReaderContext *readerContext = reinterpret_cast<PgenReaderContext*>(readerHandle);
+    if (threadCount < 1) {
+        throwAsyncJavaException(
+            env,
+            "Invalid thread count in writeSampleMajorSidecar",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    const char* const cSidecarFilename = env->GetStringUTFChars(sidecarFilename, nullptr);
+    jboolean result;
+    try {
+        WriteSampleMajorSidecar(readerContext, cSidecarFilename, static_cast<uint32_t>(threadCount));
+        result = true;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in writeSampleMajorSidecar");
+        result = false;
+    }
+    env->ReleaseStringUTFChars(sidecarFilename, cSidecarFilename);
+    return result;
+}
+
+// The variant indices must be strictly increasing. Only the .pgen is written; the .pvar and .psam are written in Java.
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenReader_extractPgen(JNIEnv *env, jclass object,
+                                                    jlong readerHandle,
+                                                    jintArray variantIndices,
+                                                    jstring filename,
+                                                    jint pgenWriteModeInt,
+                                                    jint threadCount) {
+    PgenReaderContext *readerContext = reinterpret_cast<PgenReaderContext*>(readerHandle);
+    if (threadCount < 1) {
+        throwAsyncJavaException(
+            env,
+            "Invalid thread count in extractPgen",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    const jsize variant_ct = env->GetArrayLength(variantIndices);
+    jint* const variant_indices = env->GetIntArrayElements(variantIndices, nullptr);
+    const char* const cFilename = env->GetStringUTFChars(filename, nullptr);
+    jboolean result;
+    try {
+        // negative indices wrap around to indices past the end of the pgen, which ExtractPgen rejects
+        ExtractPgen(
+            readerContext,
+            reinterpret_cast<const uint32_t*>(variant_indices),
+            static_cast<uint32_t>(variant_ct),
+            cFilename,
+            static_cast<uint32_t>(pgenWriteModeInt),
+            static_cast<uint32_t>(threadCount));
+        result = true;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in extractPgen");
+        result = false;
+    }
+    env->ReleaseStringUTFChars(filename, cFilename);
+    env->ReleaseIntArrayElements(variantIndices, variant_indices, JNI_ABORT);
+    return result;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenReader_closePgenReader(JNIEnv *env, jclass object, jlong readerHandle) {
+    PgenReaderContext *readerContext = reinterpret_cast<PgenReaderContext*>(readerHandle);
+    try {
+        ClosePgenReader(readerContext);
+        return true;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure closing pgen reader");
+        return false;
+    }
+}
@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2023, Broad Institute, Inc. All rights reserved.
+ */
+
+#include "org_broadinstitute_pgen_PgenSampleMajorReader.h"
+
+#include "PgenJniUtils.h"
+#include "pgenSampleMajor.h"
+#include "pgenException.h"
+
+using namespace pgenlib;
+
+// Implementation of the JNI access layer for sample major sidecar reads. As with the reader, this code only converts
+// to and from Java types, and delegates everything else to the underlying C++ pgenlib code.
+//
+// C++ exceptions from lower layers that are caught here are re-thrown as Java exceptions.
+
+// Returns a handle to the native reader, or 0 if an exception was thrown.
+JNIEXPORT jlong JNICALL
+Java_org_broadinstitute_pgen_PgenSampleMajorReader_openSampleMajorReader(JNIEnv *env, jclass object,
+                                                                         jstring filename) {
+    const char* const cFilename = env->GetStringUTFChars(filename, nullptr);
+    jlong readerHandle;
+    try {
+        readerHandle = reinterpret_cast<jlong>(OpenSampleMajorReader(cFilename));
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure opening sample major reader");
+        readerHandle = 0L;
+    }
+    env->ReleaseStringUTFChars(filename, cFilename);
+    return readerHandle;
+}
+
+JNIEXPORT jlong JNICALL
+Java_org_broadinstitute_pgen_PgenSampleMajorReader_getSampleMajorVariantCount(JNIEnv *env, jclass object,
+                                                                              jlong readerHandle) {
+    return GetSampleMajorVariantCount(reinterpret_cast<SampleMajorReader*>(readerHandle));
+}
+
+JNIEXPORT jint JNICALL
+Java_org_broadinstitute_pgen_PgenSampleMajorReader_getSampleMajorSampleCount(JNIEnv *env, jclass object,
+                                                                             jlong readerHandle) {
+    return static_cast<jint>(GetSampleMajorSampleCount(reinterpret_cast<SampleMajorReader*>(readerHandle)));
+}
+
+// The genotype buffer receives one byte per variant in [variantStart, variantEnd) (see ReadSampleGenotypes).
+// Returns false if an exception was thrown.
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenSampleMajorReader_readSampleGenotypes(JNIEnv *env, jclass object,
+                                                                       jlong readerHandle,
+                                                                       jint sampleIndex,
+                                                                       jlong variantStart,
+                                                                       jlong variantEnd,
+                                                                       jobject genotypeBuffer) {
+    SampleMajorReader *reader = reinterpret_cast<SampleMajorReader*>(readerHandle);
+    if ((sampleIndex < 0) || (variantStart < 0) || (variantEnd < variantStart) ||
+        (variantEnd > GetSampleMajorVariantCount(reader))) {
+        throwAsyncJavaException(
+            env,
+            "Invalid sample index or variant range in readSampleGenotypes",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    int8_t *genotypes = reinterpret_cast<int8_t*>(env->GetDirectBufferAddress(genotypeBuffer));
+    if ( !genotypes ) {
+        throwAsyncJavaException(
+            env,
+            "Native code failure getting genotype buffer address in readSampleGenotypes",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    } else if (env->GetDirectBufferCapacity(genotypeBuffer) < variantEnd - variantStart) {
+        throwAsyncJavaException(
+            env,
+            "Genotype buffer is too small for the variant range in readSampleGenotypes",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    try {
+        ReadSampleGenotypes(
+            reader,
+            static_cast<uint32_t>(sampleIndex),
+            static_cast<uint32_t>(variantStart),
+            static_cast<uint32_t>(variantEnd),
+            genotypes);
+        return true;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in readSampleGenotypes");
+        return false;
+    }
+}
+
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenSampleMajorReader_closeSampleMajorReader(JNIEnv *env, jclass object,
+                                                                          jlong readerHandle) {
+    try {
+        CloseSampleMajorReader(reinterpret_cast<SampleMajorReader*>(readerHandle));
+        return true;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure closing sample major reader");
+        return false;
+    }
+}
@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) 2023, Broad Institute, Inc. All rights reserved.
+ */
+
+#include <vector>
+
+#include "org_broadinstitute_pgen_PgenScanner.h"
+
+#include "PgenJniUtils.h"
+#include "pgenReaderContext.h"
+#include "pgenScan.h"
+#include "pgenException.h"
+
+using namespace pgenlib;
+
+// Implementation of the JNI access layer for parallel PGEN scans. As with the reader, this code only converts to and
+// from Java types, and delegates everything else to the underlying C++ pgenlib code.
+//
+// C++ exceptions from lower layers that are caught here are re-thrown as Java exceptions.
+
+// variantInclude may be null to scan every variant in [variantStart, variantEnd). Otherwise it's a bitset in the
+// layout returned by java.util.BitSet.toLongArray, which matches the plink2 bitarray layout on 64-bit platforms.
+JNIEXPORT jlong JNICALL
+Java_org_broadinstitute_pgen_PgenScanner_startPgenScan(JNIEnv *env, jclass object,
+                                                       jlong readerHandle,
+                                                       jlongArray variantInclude,
+                                                       jlong variantStart,
+                                                       jlong variantEnd,
+                                                       jint threadCount,
+                                                       jint batchSize) {
+    if ((variantStart < 0) || (variantEnd < variantStart) || (variantEnd > static_cast<jlong>(UINT32_MAX))) {
+        throwAsyncJavaException(
+            env,
+            "Invalid variant range in startPgenScan",
+            "org/broadinstitute/pgen/PgenException");
+        return 0L;
+    } else if ((threadCount < 1) || (batchSize < 1)) {
+        throwAsyncJavaException(
+            env,
+            "Invalid thread count or batch size in startPgenScan",
+            "org/broadinstitute/pgen/PgenException");
+        return 0L;
+    }
+    // the scan makes its own copy of the include mask, so this only needs to live until StartPgenScan returns
+    std::vector<uintptr_t> variant_include;
+    if (variantInclude != nullptr) {
+        variant_include.resize(env->GetArrayLength(variantInclude));
+        if (!variant_include.empty()) {
+            env->GetLongArrayRegion(
+                variantInclude,
+                0,
+                static_cast<jsize>(variant_include.size()),
+                reinterpret_cast<jlong*>(variant_include.data()));
+        }
+    }
+
+    try {
+        PgenScan* const scan = StartPgenScan(
+            reinterpret_cast<PgenReaderContext*>(readerHandle),
+            variantInclude != nullptr ? variant_include.data() : nullptr,
+            static_cast<uint32_t>(variant_include.size()),
+            static_cast<uint32_t>(variantStart),
+            static_cast<uint32_t>(variantEnd),
+            static_cast<uint32_t>(threadCount),
+            static_cast<uint32_t>(batchSize));
+        return reinterpret_cast<jlong>(scan);
+    } catch (const PgenException& e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure starting pgen scan");
+        return 0L;
+    }
+}
+
+// Each buffer must hold a full batch: batchSize int32 variant indices, batchSize * sampleCount * 2 int32 allele
+// codes, batchSize * sampleCount phase bytes (the phase buffer may be null), and batchSize int32 allele counts.
+// Returns the number of variants in the batch, 0 once the scan is complete, or 0 if an exception was thrown.
+JNIEXPORT jint JNICALL
+Java_org_broadinstitute_pgen_PgenScanner_scanReadAlleles(JNIEnv *env, jclass object,
+                                                         jlong scanHandle,
+                                                         jobject variantIndexBuffer,
+                                                         jobject alleleBuffer,
+                                                         jobject phaseBuffer,
+                                                         jobject alleleCountBuffer) {
+    PgenScan *scan = reinterpret_cast<PgenScan*>(scanHandle);
+    const uintptr_t batch_ct = GetScanBatchVariantCount(scan);
+    const uintptr_t sample_ct = GetScanSampleCount(scan);
+    uint32_t *variant_indices = reinterpret_cast<uint32_t*>(env->GetDirectBufferAddress(variantIndexBuffer));
+    int32_t *allele_codes = reinterpret_cast<int32_t*>(env->GetDirectBufferAddress(alleleBuffer));
+    uint32_t *allele_cts = reinterpret_cast<uint32_t*>(env->GetDirectBufferAddress(alleleCountBuffer));
+    if ( !variant_indices || !allele_codes || !allele_cts ) {
+        throwAsyncJavaException(
+            env,
+            "Native code failure getting buffer address in scanReadAlleles",
+            "org/broadinstitute/pgen/PgenException");
+        return 0;
+    } else if ((static_cast<uintptr_t>(env->GetDirectBufferCapacity(variantIndexBuffer)) < batch_ct * sizeof(int32_t)) ||
+               (static_cast<uintptr_t>(env->GetDirectBufferCapacity(alleleCountBuffer)) < batch_ct * sizeof(int32_t))) {
+        throwAsyncJavaException(
+            env,
+            "Variant index or allele count buffer is smaller than the batch size in scanReadAlleles",
+            "org/broadinstitute/pgen/PgenException");
+        return 0;
+    } else if (static_cast<uintptr_t>(env->GetDirectBufferCapacity(alleleBuffer)) < batch_ct * sample_ct * 2 * sizeof(int32_t)) {
+        throwAsyncJavaException(
+            env,
+            "Allele code buffer is too small for the batch size and sample count in scanReadAlleles",
+            "org/broadinstitute/pgen/PgenException");
+        return 0;
+    }
+    unsigned char *phase_bytes = nullptr;
+    if (phaseBuffer != nullptr) {
+        phase_bytes = reinterpret_cast<unsigned char*>(env->GetDirectBufferAddress(phaseBuffer));
+        if ( !phase_bytes ) {
+            throwAsyncJavaException(
+                env,
+                "Native code failure getting address for phaseBuffer in scanReadAlleles",
+                "org/broadinstitute/pgen/PgenException");
+            return 0;
+        } else if (static_cast<uintptr_t>(env->GetDirectBufferCapacity(phaseBuffer)) < batch_ct * sample_ct) {
+            throwAsyncJavaException(
+                env,
+                "Phase buffer is too small for the batch size and sample count in scanReadAlleles",
+                "org/broadinstitute/pgen/PgenException");
+            return 0;
+        }
+    }
+    try {
+        return ScanReadAlleles(scan, variant_indices, allele_codes, phase_bytes, allele_cts);
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in scanReadAlleles");
+        return 0;
+    }
+}
+
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenScanner_finishPgenScan(JNIEnv *env, jclass object, jlong scanHandle) {
+    try {
+        FinishPgenScan(reinterpret_cast<PgenScan*>(scanHandle));
+        return true;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure finishing pgen scan");
+        return false;
+    }
+}
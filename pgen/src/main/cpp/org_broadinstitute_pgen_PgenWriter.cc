@@ -5,9 +5,12 @@
 #include "org_broadinstitute_pgen_PgenWriter.h"
 
 #include <iostream>
+#include <string>
+#include <vector>
 #include "PgenJniUtils.h"
 #include "pgenIO.h"
 #include "pgenContext.h"
+#include "pgenConcat.h"
 #include "pgenException.h"
 #include "pgenMissingVariantsException.h"
 #include "pgenEmptyPgenException.h"
@@ -27,7 +30,8 @@ Java_org_broadinstitute_pgen_PgenWriter_openPgen (JNIEnv *env, jclass object,
                                                  jint writeFlags,
                                                  jlong numberOfVariants,
                                                  jint sampleCount,
-                                                 jint maxAltAlleles) {
+                                                 jint maxAltAlleles,
+                                                 jint threadCount) {
 
     // the plink code makes a copy of this filename, so this can be released before this function returns
     const char* const cFilename = env->GetStringUTFChars(filename, nullptr);
@@ -40,7 +44,8 @@ Java_org_broadinstitute_pgen_PgenWriter_openPgen (JNIEnv *env, jclass object,
             static_cast<uint32_t>(writeFlags),
             numberOfVariants,
             sampleCount,
-            maxAltAlleles);
+            maxAltAlleles,
+            threadCount);
         env->ReleaseStringUTFChars (filename, cFilename);
         pgenHandle = reinterpret_cast<jlong>(pgenContext);
     } catch (const PgenException& e) {
@@ -51,37 +56,204 @@ Java_org_broadinstitute_pgen_PgenWriter_openPgen (JNIEnv *env, jclass object,
     return pgenHandle;
 }
 
+// The genotype vector buffer holds a 2-bit packed genotype vector in the PgenContext::genovec layout (little-endian
+// 64-bit words, 32 samples per word). phasePresentBuffer and phaseInfoBuffer are optional (may be null) packed
+// bitarrays, 64 samples per word (see AppendGenovec). All three buffers must be 8-byte aligned.
+static const uintptr_t *GetWordBufferAddress(JNIEnv *env,
+                                             jobject wordBuffer,
+                                             const uintptr_t word_ct,
+                                             const char *const buffer_name) {
+    const uintptr_t *words = reinterpret_cast<uintptr_t*>(env->GetDirectBufferAddress(wordBuffer));
+    if ( !words ) {
+        const std::string message = std::string("Native code failure getting address for ") + buffer_name + " in appendGenovec";
+        throwAsyncJavaException(env, message.c_str(), "org/broadinstitute/pgen/PgenException");
+    } else if ((reinterpret_cast<uintptr_t>(words) % sizeof(uintptr_t)) ||
+               (static_cast<uintptr_t>(env->GetDirectBufferCapacity(wordBuffer)) < word_ct * sizeof(uintptr_t))) {
+        const std::string message = std::string("The ") + buffer_name + " in appendGenovec must be 8-byte aligned and hold at least " +
+            std::to_string(word_ct) + " words";
+        throwAsyncJavaException(env, message.c_str(), "org/broadinstitute/pgen/PgenException");
+        words = nullptr;
+    }
+    return words;
+}
+
 JNIEXPORT jboolean JNICALL
-Java_org_broadinstitute_pgen_PgenWriter_appendAlleles(JNIEnv *env, jclass object,
+Java_org_broadinstitute_pgen_PgenWriter_appendGenovec(JNIEnv *env, jclass object,
                                                       jlong pgenHandle,
-                                                      jobject alleleBuffer,
-                                                      jobject phaseBuffer,
-                                                      jint alleleCount) {
-    const int32_t *allele_codes = reinterpret_cast<int32_t*>(env->GetDirectBufferAddress(alleleBuffer));
-    if ( !allele_codes ) {
+                                                      jobject genovecBuffer,
+                                                      jobject phasePresentBuffer,
+                                                      jobject phaseInfoBuffer) {
+    PgenContext *pgenContext = reinterpret_cast<PgenContext*>(pgenHandle);
+    const uint32_t sample_ct = pgenContext->sample_count;
+    const uintptr_t *genovec = GetWordBufferAddress(
+        env, genovecBuffer, plink2::NypCtToWordCt(sample_ct), "genotype vector buffer");
+    if ( !genovec ) {
+        return false;
+    }
+    const uintptr_t *phasepresent = nullptr;
+    if (phasePresentBuffer != nullptr) {
+        phasepresent = GetWordBufferAddress(
+            env, phasePresentBuffer, plink2::BitCtToWordCt(sample_ct), "phase present buffer");
+        if ( !phasepresent ) {
+            return false;
+        }
+    }
+    const uintptr_t *phaseinfo = nullptr;
+    if (phaseInfoBuffer != nullptr) {
+        phaseinfo = GetWordBufferAddress(
+            env, phaseInfoBuffer, plink2::BitCtToWordCt(sample_ct), "phase info buffer");
+        if ( !phaseinfo ) {
+            return false;
+        }
+    }
+    try {
+        AppendGenovec(pgenContext, genovec, phasepresent, phaseinfo);
+        return true;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in appendGenovec");
+        return false;
+    }
+}
+
+// The batch buffer is laid out as three consecutive sections, each sized for batchCapacity variants (only the
+// first variantCount entries of each section are used):
+//
+//  allele counts: batchCapacity * int32_t
+//  allele codes:  batchCapacity * sampleCount * 2 * int32_t
+//  phase bytes:   batchCapacity * sampleCount * unsigned char
+//
+// A variant whose allele count is kAlleleCtGenotypeBytes (-1) holds sampleCount genotype bytes at the start of
+// its allele code slot instead of allele codes: the alt allele count (0, 1 or 2), or -9 for a missing call, of each
+// sample (see AppendGenotypeBytes). A variant whose allele count is
+// kAlleleCtSparseGenotypes (-2) holds a sparse genotype list instead (see AppendAllelesBatch).
+//
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenWriter_appendAllelesBatch(JNIEnv *env, jclass object,
+                                                           jlong pgenHandle,
+                                                           jobject batchBuffer,
+                                                           jint batchCapacity,
+                                                           jint variantCount) {
+    unsigned char *batch_buffer = reinterpret_cast<unsigned char*>(env->GetDirectBufferAddress(batchBuffer));
+    if ( !batch_buffer ) {
         throwAsyncJavaException(
             env,
-            "Native code failure getting address for allele codes in appendAlleles",
+            "Native code failure getting address for batch buffer in appendAllelesBatch",
             "org/broadinstitute/pgen/PgenException");
         return false;
-    } else {
-        const unsigned char *phase_buffer = reinterpret_cast<unsigned char*>(env->GetDirectBufferAddress(phaseBuffer));
-        if ( !phase_buffer ) {
-            throwAsyncJavaException(
-                env,
-                "Native code failure getting address for phaseBuffer in appendAlleles",
-                "org/broadinstitute/pgen/PgenException");
-            return false;
-        } else {
-            PgenContext *pgenContext = reinterpret_cast<PgenContext*>(pgenHandle);
-            try {
-                AppendAlleles(pgenContext, allele_codes, phase_buffer, alleleCount);
-                return true;
-            } catch (const PgenException &e) {
-                reThrowAsAsyncJavaException(env, e, "Native code failure in appendAlleles");
-                return false;
-            }
-        }
+    }
+    PgenContext *pgenContext = reinterpret_cast<PgenContext*>(pgenHandle);
+    const uintptr_t capacity = static_cast<uintptr_t>(batchCapacity);
+    const uintptr_t sample_ct = pgenContext->sample_count;
+    const uintptr_t allele_codes_offset = capacity * sizeof(int32_t);
+    const uintptr_t phase_bytes_offset = allele_codes_offset + (capacity * sample_ct * 2 * sizeof(int32_t));
+    if ((variantCount < 0) || (variantCount > batchCapacity) ||
+        (static_cast<uintptr_t>(env->GetDirectBufferCapacity(batchBuffer)) < phase_bytes_offset + (capacity * sample_ct))) {
+        throwAsyncJavaException(
+            env,
+            "Batch buffer is too small for the requested batch capacity in appendAllelesBatch",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    try {
+        AppendAllelesBatch(
+            pgenContext,
+            reinterpret_cast<int32_t*>(&batch_buffer[allele_codes_offset]),
+            &batch_buffer[phase_bytes_offset],
+            reinterpret_cast<int32_t*>(batch_buffer),
+            static_cast<uint32_t>(variantCount));
+        return true;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in appendAllelesBatch");
+        return false;
+    }
+}
+
+// The dosage buffer holds one float alt allele dosage per sample.
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenWriter_appendFloatDosages(JNIEnv *env, jclass object,
+                                                           jlong pgenHandle,
+                                                           jobject dosageBuffer,
+                                                           jdouble hardCallThreshold) {
+    const float *dosages = reinterpret_cast<float*>(env->GetDirectBufferAddress(dosageBuffer));
+    PgenContext *pgenContext = reinterpret_cast<PgenContext*>(pgenHandle);
+    if ( !dosages ) {
+        throwAsyncJavaException(
+            env,
+            "Native code failure getting address for dosages in appendFloatDosages",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    } else if (static_cast<uintptr_t>(env->GetDirectBufferCapacity(dosageBuffer)) <
+               pgenContext->sample_count * sizeof(float)) {
+        throwAsyncJavaException(
+            env,
+            "Dosage buffer is too small for the sample count in appendFloatDosages",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    try {
+        AppendDosages(pgenContext, dosages, hardCallThreshold);
+        return true;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in appendFloatDosages");
+        return false;
+    }
+}
+
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenWriter_startAsyncAppends(JNIEnv *env, jclass object,
+                                                          jlong pgenHandle,
+                                                          jint queueDepth) {
+    PgenContext *pgenContext = reinterpret_cast<PgenContext*>(pgenHandle);
+    try {
+        StartAsyncAppends(pgenContext, queueDepth);
+        return true;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure starting async appends");
+        return false;
+    }
+}
+
+// Same batch buffer layout as appendAllelesBatch. The batch is only queued for the native writer thread, so the
+// caller must not modify the buffer until queueDepth further batches have been submitted (or the writer is closed).
+// Errors from previously queued batches are thrown from here.
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenWriter_appendAllelesBatchAsync(JNIEnv *env, jclass object,
+                                                                jlong pgenHandle,
+                                                                jobject batchBuffer,
+                                                                jint batchCapacity,
+                                                                jint variantCount) {
+    unsigned char *batch_buffer = reinterpret_cast<unsigned char*>(env->GetDirectBufferAddress(batchBuffer));
+    if ( !batch_buffer ) {
+        throwAsyncJavaException(
+            env,
+            "Native code failure getting address for batch buffer in appendAllelesBatchAsync",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    PgenContext *pgenContext = reinterpret_cast<PgenContext*>(pgenHandle);
+    const uintptr_t capacity = static_cast<uintptr_t>(batchCapacity);
+    const uintptr_t sample_ct = pgenContext->sample_count;
+    const uintptr_t allele_codes_offset = capacity * sizeof(int32_t);
+    const uintptr_t phase_bytes_offset = allele_codes_offset + (capacity * sample_ct * 2 * sizeof(int32_t));
+    if ((variantCount < 0) || (variantCount > batchCapacity) ||
+        (static_cast<uintptr_t>(env->GetDirectBufferCapacity(batchBuffer)) < phase_bytes_offset + (capacity * sample_ct))) {
+        throwAsyncJavaException(
+            env,
+            "Batch buffer is too small for the requested batch capacity in appendAllelesBatchAsync",
+            "org/broadinstitute/pgen/PgenException");
+        return false;
+    }
+    try {
+        AppendAllelesBatchAsync(
+            pgenContext,
+            reinterpret_cast<int32_t*>(&batch_buffer[allele_codes_offset]),
+            &batch_buffer[phase_bytes_offset],
+            reinterpret_cast<int32_t*>(batch_buffer),
+            static_cast<uint32_t>(variantCount));
+        return true;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure in appendAllelesBatchAsync");
+        return false;
     }
 }
 
@@ -115,11 +287,57 @@ Java_org_broadinstitute_pgen_PgenWriter_closePgen(JNIEnv *env, jclass object, jl
     }
 }
 
+// Release the native writer without finishing the pgen, after an append has failed. Doesn't throw.
+JNIEXPORT void JNICALL
+Java_org_broadinstitute_pgen_PgenWriter_abandonPgen(JNIEnv *env, jclass object, jlong pgenHandle) {
+    AbandonPgen(reinterpret_cast<PgenContext*>(pgenHandle));
+}
+
 JNIEXPORT jlong JNICALL
 Java_org_broadinstitute_pgen_PgenWriter_getPgenVariantCount(JNIEnv *env, jclass object, jlong pgenHandle) {
     PgenContext *pgenContext = reinterpret_cast<PgenContext*>(pgenHandle);
-    const long varCount = GetNumberOfVariantsWritten(pgenContext);
-    return varCount;
+    try {
+        // with async appends, this waits for queued batches and reports any error from them
+        const long varCount = GetNumberOfVariantsWritten(pgenContext);
+        return varCount;
+    } catch (const PgenException &e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure getting pgen variant count");
+        return 0L;
+    }
+}
+
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_pgen_PgenWriter_concatPgens(JNIEnv *env, jclass object,
+                                                    jobjectArray shardFiles,
+                                                    jstring filename,
+                                                    jint pgenWriteModeInt) {
+    const jsize shardCount = env->GetArrayLength(shardFiles);
+    std::vector<jstring> shardFilenames(shardCount);
+    std::vector<const char*> cShardFilenames(shardCount);
+    for (jsize i = 0; i < shardCount; i++) {
+        shardFilenames[i] = static_cast<jstring>(env->GetObjectArrayElement(shardFiles, i));
+        cShardFilenames[i] = env->GetStringUTFChars(shardFilenames[i], nullptr);
+    }
+    const char* const cFilename = env->GetStringUTFChars(filename, nullptr);
+
+    bool concatenated;
+    try {
+        ConcatPgens(
+            cShardFilenames.data(),
+            static_cast<uint32_t>(shardCount),
+            cFilename,
+            static_cast<uint32_t>(pgenWriteModeInt));
+        concatenated = true;
+    } catch (const PgenException& e) {
+        reThrowAsAsyncJavaException(env, e, "Native code failure concatenating pgens");
+        concatenated = false;
+    }
+    env->ReleaseStringUTFChars(filename, cFilename);
+    for (jsize i = 0; i < shardCount; i++) {
+        env->ReleaseStringUTFChars(shardFilenames[i], cShardFilenames[i]);
+        env->DeleteLocalRef(shardFilenames[i]);
+    }
+    return concatenated;
 }
 
 JNIEXPORT jobject JNICALL
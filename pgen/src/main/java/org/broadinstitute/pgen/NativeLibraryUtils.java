@@ -24,8 +24,31 @@ import java.nio.file.Path;
  */
 public final class NativeLibraryUtils {
 
+    // If this java property is set/exists, the native PGEN component will be loaded from java.libary.path,
+    // otherwise it is assumed to be included as a resource at the top level of a jar on the classpath.
+    private static final String LOAD_PGEN_FROM_LIBRARY_PATH = "LOAD_PGEN_FROM_LIBRARY_PATH";
+    private static boolean pgenLibraryLoaded = false;
+
     private NativeLibraryUtils(){}
 
+    /**
+     * Load the native PGEN component (shared by {@link PgenWriter} and {@link PgenReader}) if it hasn't already been
+     * loaded.
+     */
+    static synchronized void loadPgenLibrary() {
+        if (pgenLibraryLoaded) {
+            return;
+        }
+        if (System.getProperty(LOAD_PGEN_FROM_LIBRARY_PATH) != null) {
+            // for local testing within the IDE
+            System.loadLibrary("pgen");
+        } else {
+            // otherwise, load it from a jar file on the classpath
+            loadLibraryFromClasspath(runningOnMac() ? "/libpgen.dylib" : "/libpgen.so");
+        }
+        pgenLibraryLoaded = true;
+    }
+
     private record Resource(String path, Class<?> relativeClass) {
         /**
          * Get the contents of this resource as an InputStream
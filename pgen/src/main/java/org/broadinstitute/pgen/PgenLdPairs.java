@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) 2023, Broad Institute, Inc. All rights reserved.
+ */
+
+package org.broadinstitute.pgen;
+
+import java.nio.ByteBuffer;
+
+/**
+ * A sparse set of pairs of variants in linkage disequilibrium, as computed by {@link PgenReader#computeWindowLd} or
+ * {@link PgenReader#computeCrossLd}: the indices of the two variants of each pair, with their r^2 and (signed) D'.
+ * Pairs are ordered by their first and then their second variant.
+ */
+public class PgenLdPairs {
+    // the layout of each pair in the buffer filled by the native code (pgenlib::LdPair)
+    static final int PAIR_BYTES = 24;
+    private static final int VARIANT_B_OFFSET = 4;
+    private static final int R2_OFFSET = 8;
+    private static final int D_PRIME_OFFSET = 16;
+
+    private final int[] variantIndicesA;
+    private final int[] variantIndicesB;
+    private final double[] r2;
+    private final double[] dPrime;
+
+    // pairBuffer is a native byte order buffer of pairCount pairs, in the pgenlib::LdPair layout
+    PgenLdPairs(final ByteBuffer pairBuffer, final int pairCount) {
+        variantIndicesA = new int[pairCount];
+        variantIndicesB = new int[pairCount];
+        r2 = new double[pairCount];
+        dPrime = new double[pairCount];
+        for (int i = 0; i < pairCount; i++) {
+            final int offset = i * PAIR_BYTES;
+            variantIndicesA[i] = pairBuffer.getInt(offset);
+            variantIndicesB[i] = pairBuffer.getInt(offset + VARIANT_B_OFFSET);
+            r2[i] = pairBuffer.getDouble(offset + R2_OFFSET);
+            dPrime[i] = pairBuffer.getDouble(offset + D_PRIME_OFFSET);
+        }
+    }
+
+    /**
+     * @return the number of pairs
+     */
+    public int getPairCount() {
+        return r2.length;
+    }
+
+    /**
+     * @return the index of the first variant of each pair
+     */
+    public int[] getVariantIndicesA() {
+        return variantIndicesA;
+    }
+
+    /**
+     * @return the index of the second variant of each pair
+     */
+    public int[] getVariantIndicesB() {
+        return variantIndicesB;
+    }
+
+    /**
+     * @return the r^2 of each pair
+     */
+    public double[] getR2() {
+        return r2;
+    }
+
+    /**
+     * @return the D' of each pair, with the sign of D
+     */
+    public double[] getDPrime() {
+        return dPrime;
+    }
+}
@@ -0,0 +1,925 @@
+/**
+ * Copyright (c) 2023, Broad Institute, Inc. All rights reserved.
+ */
+
+package org.broadinstitute.pgen;
+
+import com.github.luben.zstd.ZstdInputStream;
+import com.github.luben.zstd.ZstdOutputStream;
+import htsjdk.io.HtsPath;
+import htsjdk.samtools.util.RuntimeIOException;
+import htsjdk.variant.vcf.VCFConstants;
+
+import java.io.BufferedReader;
+import java.io.BufferedWriter;
+import java.io.IOException;
+import java.io.InputStreamReader;
+import java.io.OutputStreamWriter;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.DoubleBuffer;
+import java.nio.FloatBuffer;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.util.Arrays;
+import java.util.BitSet;
+import java.util.EnumSet;
+import java.util.HashSet;
+import java.util.Set;
+
+/**
+ * A reader for [plink2](https://www.cog-genomics.org/plink/2.0) PGEN files, such as those written by {@link PgenWriter}.
+ * Variants are decoded by the native plink2 pgenlib reader into direct buffers of allele codes and phase bytes, which
+ * have the same layout as the buffers used by the writer: two int32 allele codes per sample (with
+ * {@link PgenWriter#PLINK2_NO_CALL_VALUE} for missing genotypes) and one phase byte per sample. Variants can be read
+ * in any order.
+ *
+ * plink2 doesn't store allele counts in the .pgen; they're implied by the ALT column of the companion .pvar. A PGEN
+ * that contains multi-allelic variants can only be read if the allele counts are known, either because they're read
+ * from the .pvar, or because they're provided by the caller.
+ */
+public class PgenReader implements AutoCloseable {
+    private final HtsPath pgenFile;
+    private final long variantCount;
+    private final int sampleCount;
+    // the samples the reader was opened with (in PGEN order), or null if it reads every sample
+    private final int[] sampleIndices;
+    private long pgenReaderHandle;
+    // pgenlib::kMissingnessFlagDosage
+    private static final int MISSINGNESS_FLAG_DOSAGE = 0x1;
+    // pgenlib::kDosageFlagMeanImpute
+    private static final int DOSAGE_FLAG_MEAN_IMPUTE = 0x1;
+    // pgenlib::kScoreFlagNoMeanImpute
+    private static final int SCORE_FLAG_NO_MEAN_IMPUTE = 0x1;
+    // pgenlib::kLdFlagIgnorePhase
+    private static final int LD_FLAG_IGNORE_PHASE = 0x1;
+    // scanners that are still open; the reader can't be closed until they're all closed
+    private final Set<PgenScanner> openScanners = new HashSet<>();
+
+    /**
+     * Enum for supported read mode flags.
+     */
+    public enum PgenReadFlag {
+        // This enum, and the corresponding enum values must be kept in sync with the corresponding constants
+        // in pgenlib (pgenReader.h).
+        MEMORY_MAP(0x1);    // pgenlib::kReadFlagMemoryMap
+
+        private final int flag;
+        private PgenReadFlag(final int flag) { this.flag = flag; }
+        public int value() { return this.flag; }
+
+        /**
+         * Convert an EnumSet<PgenReadFlag> into the corresponding pgenlib bitwise/integer flags.
+         */
+        private static int toIntFlags(final EnumSet<PgenReadFlag> flagsSet) {
+            return flagsSet.contains(MEMORY_MAP) ? MEMORY_MAP.value() : 0;
+        }
+    }
+
+    // ******************** Native JNI methods  ********************
+    private static native long openPgenReader(String file, String pgiFile, int[] alleleCounts, int readFlags, int[] sampleIndices);
+    private static native long getReaderVariantCount(long pgenReaderHandle);
+    private static native int getReaderSampleCount(long pgenReaderHandle);
+    private static native long getReaderAlleleIndexOffset(long pgenReaderHandle, long variantIndex);
+    private static native int readAlleles(long pgenReaderHandle, long variantIndex, ByteBuffer alleles, ByteBuffer phasing);
+    private static native boolean readFloatDosages(
+            long pgenReaderHandle, long variantStart, long variantEnd, int dosageFlags, FloatBuffer dosages);
+    private static native boolean readDoubleDosages(
+            long pgenReaderHandle, long variantStart, long variantEnd, int dosageFlags, DoubleBuffer dosages);
+    private static native boolean readHaplotypes(
+            long pgenReaderHandle, long variantStart, long variantEnd, int threadCount, ByteBuffer hap0Codes, ByteBuffer hap1Codes);
+    private static native boolean computeAlleleCounts(
+            long pgenReaderHandle, long variantStart, long variantEnd, int threadCount, ByteBuffer genotypeCounts, ByteBuffer alleleDosages);
+    private static native boolean computeMissingness(
+            long pgenReaderHandle, long variantStart, long variantEnd, int threadCount, int missingnessFlags,
+            ByteBuffer variantMissingCounts, ByteBuffer sampleMissingCounts);
+    private static native boolean computeScores(
+            long pgenReaderHandle, int[] variantIndices, int[] alleleIndices, double[] weights, int scoreCount,
+            int threadCount, int scoreFlags, ByteBuffer scores);
+    private static native int computeGrmTile(
+            long pgenReaderHandle, long variantStart, long variantEnd, int threadCount, int rowStart, int rowEnd,
+            int columnEnd, ByteBuffer grm);
+    private static native int writeGrmBin(
+            long pgenReaderHandle, long variantStart, long variantEnd, int threadCount, int tileRowCount, String grmBinFile);
+    private static native long computeWindowLd(
+            long pgenReaderHandle, long variantStart, long variantEnd, int windowVariantCount, double minR2,
+            int threadCount, int ldFlags);
+    private static native long computeCrossLd(
+            long pgenReaderHandle, long variantStartA, long variantEndA, long variantStartB, long variantEndB,
+            double minR2, int threadCount, int ldFlags);
+    private static native long getLdPairCount(long ldPairsHandle);
+    private static native boolean validatePgen(long pgenReaderHandle, int threadCount);
+    private static native boolean writeSampleMajorSidecar(long pgenReaderHandle, String sidecarFile, int threadCount);
+    private static native boolean extractPgen(
+            long pgenReaderHandle, int[] variantIndices, String file, int pgenWriteMode, int threadCount);
+    private static native boolean readLdPairs(long ldPairsHandle, ByteBuffer pairs);
+    private static native boolean closePgenReader(long pgenReaderHandle);
+    // ******************** End Native JNI methods  ********************
+
+    static {
+        NativeLibraryUtils.loadPgenLibrary();
+    }
+
+    /**
+     * Open a PGEN file for reading. If the companion .pvar (see {@link PgenWriter#PVAR_EXTENSION}) exists, the allele
+     * counts of the variants are read from it, otherwise every variant is assumed to be biallelic. If the PGEN has a
+     * separate index, the .pgen.pgi file must be next to the .pgen.
+     *
+     * @param pgenFile the PGEN file to read (must end in .pgen)
+     */
+    public PgenReader(final HtsPath pgenFile) {
+        this(pgenFile, EnumSet.noneOf(PgenReadFlag.class));
+    }
+
+    /**
+     * Open a PGEN file for reading, with the allele counts read from the companion .pvar as described for
+     * {@link #PgenReader(HtsPath)}.
+     *
+     * @param pgenFile the PGEN file to read (must end in .pgen)
+     * @param readFlags the read flags to use - see {@code PgenReadFlag}. Include {@link PgenReadFlag#MEMORY_MAP} to
+     *                  memory map the PGEN and decode variants in place, which is much faster for scattered (random
+     *                  access) reads than reading each variant from the file.
+     */
+    public PgenReader(final HtsPath pgenFile, final EnumSet<PgenReadFlag> readFlags) {
+        this(pgenFile, readAlleleCountsFromPvar(pgenFile), readFlags);
+    }
+
+    /**
+     * Open a PGEN file for reading, using the allele counts provided by the caller.
+     *
+     * @param pgenFile the PGEN file to read (must end in .pgen)
+     * @param alleleCounts the number of alleles (including the reference allele) for each variant in the PGEN. may be
+     *                     null if every variant is biallelic; in that case reading a multi-allelic variant throws.
+     */
+    public PgenReader(final HtsPath pgenFile, final int[] alleleCounts) {
+        this(pgenFile, alleleCounts, EnumSet.noneOf(PgenReadFlag.class));
+    }
+
+    /**
+     * Open a PGEN file for reading, using the allele counts provided by the caller. See
+     * {@link #PgenReader(HtsPath, int[])} and {@link #PgenReader(HtsPath, EnumSet)} for a description of the
+     * parameters.
+     */
+    public PgenReader(final HtsPath pgenFile, final int[] alleleCounts, final EnumSet<PgenReadFlag> readFlags) {
+        this(pgenFile, alleleCounts, null, readFlags);
+    }
+
+    /**
+     * Open a PGEN file for reading only a subset of the samples. The genotypes are subset by the native reader as
+     * they're decoded, and every variant that is read contains only the subset samples (so buffers are sized, and
+     * indexed, by position in {@code sampleIndices}). See {@link #PgenReader(HtsPath, EnumSet)} for a description of
+     * the other parameters.
+     *
+     * @param alleleCounts the allele counts for each variant (see {@link #readAlleleCountsFromPvar}). may be null if
+     *                     every variant is biallelic.
+     * @param sampleIndices the (zero based) indices, in the PGEN, of the samples to read, in strictly increasing order.
+     *                      may be null to read all samples.
+     */
+    public PgenReader(
+            final HtsPath pgenFile,
+            final int[] alleleCounts,
+            final int[] sampleIndices,
+            final EnumSet<PgenReadFlag> readFlags) {
+        if (!pgenFile.hasExtension(PgenWriter.PGEN_EXTENSION)) {
+            throw new PgenException(
+                String.format("Invalid PGEN file name: %s. PGEN files must use the .pgen extension", pgenFile.getRawInputString()));
+        }
+        if (!pgenFile.getScheme().equals("file")) {
+            throw new PgenException(String.format("Invalid PGEN file name: %s. PGEN files must be local files", pgenFile));
+        }
+        this.pgenFile = pgenFile;
+        this.sampleIndices = sampleIndices == null ? null : sampleIndices.clone();
+        pgenReaderHandle = openPgenReader(
+            pgenFile.toPath().toAbsolutePath().toString(),
+            null,
+            alleleCounts,
+            PgenReadFlag.toIntFlags(readFlags),
+            sampleIndices);
+        if (pgenReaderHandle == 0) {
+            //openPgenReader threw an async Java exception
+            variantCount = 0;
+            sampleCount = 0;
+            return;
+        }
+        variantCount = getReaderVariantCount(pgenReaderHandle);
+        sampleCount = getReaderSampleCount(pgenReaderHandle);
+    }
+
+    /**
+     * @return the number of variants in the PGEN
+     */
+    public long getVariantCount() {
+        return variantCount;
+    }
+
+    /**
+     * @return the number of samples in each variant that is read; this is the number of subset samples if the reader
+     * was opened with a sample subset, otherwise the number of samples in the PGEN
+     */
+    public int getSampleCount() {
+        return sampleCount;
+    }
+
+    /**
+     * @return a new direct buffer, in native byte order, large enough to hold one variant's worth of allele codes
+     */
+    public ByteBuffer createAlleleCodeBuffer() {
+        return ByteBuffer.allocateDirect(sampleCount * 2 * Integer.BYTES).order(ByteOrder.nativeOrder());
+    }
+
+    /**
+     * @return a new direct buffer large enough to hold one variant's worth of phase bytes
+     */
+    public ByteBuffer createPhaseBuffer() {
+        return ByteBuffer.allocateDirect(sampleCount);
+    }
+
+    /**
+     * Decode the genotypes of one variant.
+     *
+     * @param variantIndex the (zero based) index of the variant to read
+     * @param alleleCodes a direct buffer (see {@link #createAlleleCodeBuffer}) that receives two int32 allele codes
+     *                    per sample, in native byte order. The allele codes of unphased heterozygous genotypes are in
+     *                    ascending order. Missing genotypes are {@link PgenWriter#PLINK2_NO_CALL_VALUE}.
+     * @param phaseBytes a direct buffer (see {@link #createPhaseBuffer}) that receives one phase byte per sample: 1 for
+     *                   a phased heterozygous genotype or a homozygous genotype, otherwise 0. may be null.
+     * @return the number of alleles (including the reference allele) for the variant
+     */
+    public int readAlleles(final long variantIndex, final ByteBuffer alleleCodes, final ByteBuffer phaseBytes) {
+        if (pgenReaderHandle == 0) {
+            throw new PgenException(String.format("The PGEN reader for %s is closed", pgenFile.getRawInputString()));
+        }
+        if (variantIndex < 0 || variantIndex >= variantCount) {
+            throw new PgenException(
+                String.format("Invalid variant index (%d). The PGEN contains %d variants", variantIndex, variantCount));
+        }
+        return readAlleles(pgenReaderHandle, variantIndex, alleleCodes, phaseBytes);
+    }
+
+    /**
+     * @return a new direct buffer, in native byte order, large enough to hold the float dosages read by
+     * {@link #readDosages(long, long, boolean, FloatBuffer)} for the variants in [variantStart, variantEnd)
+     */
+    public FloatBuffer createFloatDosageBuffer(final long variantStart, final long variantEnd) {
+        requireValidRange(variantStart, variantEnd);
+        return ByteBuffer.allocateDirect(Math.toIntExact((variantEnd - variantStart) * sampleCount * Float.BYTES))
+            .order(ByteOrder.nativeOrder())
+            .asFloatBuffer();
+    }
+
+    /**
+     * @return a new direct buffer, in native byte order, large enough to hold the double dosages read by
+     * {@link #readDosages(long, long, boolean, DoubleBuffer)} for the variants in [variantStart, variantEnd)
+     */
+    public DoubleBuffer createDoubleDosageBuffer(final long variantStart, final long variantEnd) {
+        requireValidRange(variantStart, variantEnd);
+        return ByteBuffer.allocateDirect(Math.toIntExact((variantEnd - variantStart) * sampleCount * Double.BYTES))
+            .order(ByteOrder.nativeOrder())
+            .asDoubleBuffer();
+    }
+
+    /**
+     * Read the dosages of the variants in [variantStart, variantEnd). Each dosage is the ALT allele dosage (for a
+     * multi-allelic variant, the dosage of all non-reference alleles) of one sample, taken from the PGEN's dosage
+     * track if the sample has a dosage, otherwise from its hardcall.
+     *
+     * @param variantStart the index of the first variant to read
+     * @param variantEnd one past the index of the last variant to read
+     * @param meanImpute if true, missing dosages are replaced by the mean dosage of the variant's non-missing
+     *                   samples (a variant with no non-missing samples is an error), otherwise they're
+     *                   {@link PgenWriter#PLINK2_NO_CALL_VALUE}
+     * @param dosages a direct buffer (see {@link #createFloatDosageBuffer}) that receives {@link #getSampleCount}
+     *                dosages for each variant, one variant after the other
+     */
+    public void readDosages(
+            final long variantStart,
+            final long variantEnd,
+            final boolean meanImpute,
+            final FloatBuffer dosages) {
+        requireValidRange(variantStart, variantEnd);
+        readFloatDosages(pgenReaderHandle, variantStart, variantEnd, meanImpute ? DOSAGE_FLAG_MEAN_IMPUTE : 0, dosages);
+    }
+
+    /**
+     * Read the dosages of the variants in [variantStart, variantEnd) as doubles. Identical to
+     * {@link #readDosages(long, long, boolean, FloatBuffer)}, except for the dosage type.
+     */
+    public void readDosages(
+            final long variantStart,
+            final long variantEnd,
+            final boolean meanImpute,
+            final DoubleBuffer dosages) {
+        requireValidRange(variantStart, variantEnd);
+        readDoubleDosages(pgenReaderHandle, variantStart, variantEnd, meanImpute ? DOSAGE_FLAG_MEAN_IMPUTE : 0, dosages);
+    }
+
+    /**
+     * @return a new direct buffer, in native byte order, large enough to hold one of the haplotype matrices read by
+     * {@link #readHaplotypes} for the variants in [variantStart, variantEnd)
+     */
+    public ByteBuffer createHaplotypeBuffer(final long variantStart, final long variantEnd) {
+        requireValidRange(variantStart, variantEnd);
+        return ByteBuffer.allocateDirect(Math.toIntExact((variantEnd - variantStart) * sampleCount * Integer.BYTES))
+            .order(ByteOrder.nativeOrder());
+    }
+
+    /**
+     * Read the haplotypes of the variants in [variantStart, variantEnd) into two haplotype matrices, one for each
+     * haplotype of each sample, on {@code threadCount} native threads. The matrices are haplotype major: the int32
+     * codes for sample i start at int32 offset {@code i * (variantEnd - variantStart)}, with one code per variant. A
+     * code is 0 for the reference allele, 1 for an alt allele (any alt allele, for a multi-allelic variant), or
+     * {@link PgenWriter#PLINK2_NO_CALL_VALUE} for a missing genotype. The alleles of a phased heterozygous genotype
+     * are placed as phased; an unphased heterozygous genotype has the reference allele on haplotype 0.
+     *
+     * @param variantStart the index of the first variant to read
+     * @param variantEnd one past the index of the last variant to read
+     * @param threadCount the number of native threads to read with
+     * @param hap0Codes a direct buffer (see {@link #createHaplotypeBuffer}) that receives the haplotype 0 matrix
+     * @param hap1Codes a direct buffer (see {@link #createHaplotypeBuffer}) that receives the haplotype 1 matrix
+     */
+    public void readHaplotypes(
+            final long variantStart,
+            final long variantEnd,
+            final int threadCount,
+            final ByteBuffer hap0Codes,
+            final ByteBuffer hap1Codes) {
+        requireValidRange(variantStart, variantEnd);
+        if (threadCount < 1) {
+            throw new PgenException(String.format("Invalid thread count (%d); must be at least 1", threadCount));
+        }
+        readHaplotypes(pgenReaderHandle, variantStart, variantEnd, threadCount, hap0Codes, hap1Codes);
+    }
+
+    /**
+     * @return the total number of alleles of the variants before {@code variantIndex} (which may be the variant count).
+     * This is the offset of the variant's first allele in per allele outputs, such as the allele dosages computed by
+     * {@link #computeAlleleCounts}.
+     */
+    public long getAlleleIndexOffset(final long variantIndex) {
+        requireValidRange(variantIndex, variantIndex);
+        return getReaderAlleleIndexOffset(pgenReaderHandle, variantIndex);
+    }
+
+    /**
+     * @return a new direct buffer, in native byte order, large enough to hold the genotype counts computed by
+     * {@link #computeAlleleCounts} for the variants in [variantStart, variantEnd)
+     */
+    public ByteBuffer createGenotypeCountBuffer(final long variantStart, final long variantEnd) {
+        requireValidRange(variantStart, variantEnd);
+        return ByteBuffer.allocateDirect(Math.toIntExact((variantEnd - variantStart) * 4 * Integer.BYTES))
+            .order(ByteOrder.nativeOrder());
+    }
+
+    /**
+     * @return a new direct buffer, in native byte order, large enough to hold the allele dosages computed by
+     * {@link #computeAlleleCounts} for the variants in [variantStart, variantEnd)
+     */
+    public ByteBuffer createAlleleDosageBuffer(final long variantStart, final long variantEnd) {
+        requireValidRange(variantStart, variantEnd);
+        final long alleleCount = getAlleleIndexOffset(variantEnd) - getAlleleIndexOffset(variantStart);
+        return ByteBuffer.allocateDirect(Math.toIntExact(alleleCount * Double.BYTES)).order(ByteOrder.nativeOrder());
+    }
+
+    /**
+     * Count the genotypes and alleles of each variant in [variantStart, variantEnd) without decoding the variants:
+     * the native reader counts directly from the compressed variant records, on {@code threadCount} threads. Only the
+     * reader's samples (see {@link #getSampleCount}) are counted.
+     *
+     * @param variantStart the index of the first variant to count
+     * @param variantEnd one past the index of the last variant to count
+     * @param threadCount the number of native threads to count with
+     * @param genotypeCounts a direct buffer (see {@link #createGenotypeCountBuffer}) that receives four int32 counts
+     *                       per variant: hom ref genotypes, hets with one ref allele, genotypes with two alt alleles,
+     *                       and missing genotypes
+     * @param alleleDosages a direct buffer (see {@link #createAlleleDosageBuffer}) that receives the total dosage (a
+     *                      double, in allele copies) of each allele of each variant, starting with the reference
+     *                      allele. The first allele of variant v is at double offset
+     *                      {@code getAlleleIndexOffset(v) - getAlleleIndexOffset(variantStart)}. These are hardcall
+     *                      allele counts unless the PGEN has dosages. may be null.
+     */
+    public void computeAlleleCounts(
+            final long variantStart,
+            final long variantEnd,
+            final int threadCount,
+            final ByteBuffer genotypeCounts,
+            final ByteBuffer alleleDosages) {
+        requireValidRange(variantStart, variantEnd);
+        if (threadCount < 1) {
+            throw new PgenException(String.format("Invalid thread count (%d); must be at least 1", threadCount));
+        }
+        computeAlleleCounts(pgenReaderHandle, variantStart, variantEnd, threadCount, genotypeCounts, alleleDosages);
+    }
+
+    /**
+     * @return a new direct buffer, in native byte order, large enough to hold the per variant missing counts computed
+     * by {@link #computeMissingness} for the variants in [variantStart, variantEnd)
+     */
+    public ByteBuffer createVariantMissingCountBuffer(final long variantStart, final long variantEnd) {
+        requireValidRange(variantStart, variantEnd);
+        return ByteBuffer.allocateDirect(Math.toIntExact((variantEnd - variantStart) * Integer.BYTES))
+            .order(ByteOrder.nativeOrder());
+    }
+
+    /**
+     * @return a new direct buffer, in native byte order, large enough to hold the per sample missing counts computed
+     * by {@link #computeMissingness}
+     */
+    public ByteBuffer createSampleMissingCountBuffer() {
+        return ByteBuffer.allocateDirect(sampleCount * Integer.BYTES).order(ByteOrder.nativeOrder());
+    }
+
+    /**
+     * Count the missing genotypes of each variant, and of each sample, in [variantStart, variantEnd) without decoding
+     * the variants: the native reader reads only the missingness of each variant, on {@code threadCount} threads. Only
+     * the reader's samples (see {@link #getSampleCount}) are counted.
+     *
+     * @param variantStart the index of the first variant to count
+     * @param variantEnd one past the index of the last variant to count
+     * @param threadCount the number of native threads to count with
+     * @param dosageIsCalled if false, a genotype is missing if it has no hardcall (as for plink2 --missing). if true, a
+     *                       genotype with a dosage, but no hardcall, isn't missing.
+     * @param variantMissingCounts a direct buffer (see {@link #createVariantMissingCountBuffer}) that receives the
+     *                             int32 number of missing genotypes of each variant. may be null.
+     * @param sampleMissingCounts a direct buffer (see {@link #createSampleMissingCountBuffer}) that receives the int32
+     *                            number of variants in the range for which each sample is missing. may be null.
+     */
+    public void computeMissingness(
+            final long variantStart,
+            final long variantEnd,
+            final int threadCount,
+            final boolean dosageIsCalled,
+            final ByteBuffer variantMissingCounts,
+            final ByteBuffer sampleMissingCounts) {
+        requireValidRange(variantStart, variantEnd);
+        if (threadCount < 1) {
+            throw new PgenException(String.format("Invalid thread count (%d); must be at least 1", threadCount));
+        }
+        computeMissingness(
+            pgenReaderHandle,
+            variantStart,
+            variantEnd,
+            threadCount,
+            dosageIsCalled ? MISSINGNESS_FLAG_DOSAGE : 0,
+            variantMissingCounts,
+            sampleMissingCounts);
+    }
+
+    /**
+     * Compute one or more polygenic scores for each of the reader's samples (see {@link #getSampleCount}). The native
+     * reader splits the weighted variants across {@code threadCount} threads, and accumulates each variant's
+     * contribution to the scores with per genotype lookup tables, so the genotypes are never decoded into allele
+     * codes. Dosages are used for samples that have them.
+     *
+     * @param scoreWeights the weighted alleles of each score (see {@link PgenScoreWeights#read})
+     * @param threadCount the number of native threads to score with
+     * @param meanImpute if true, a missing genotype contributes the variant's mean dosage of the weighted allele (as
+     *                   for plink2 --score). if false, it contributes nothing.
+     * @return the scores, indexed by score and then by sample
+     */
+    public double[][] computeScores(final PgenScoreWeights scoreWeights, final int threadCount, final boolean meanImpute) {
+        requireValidRange(0, variantCount);
+        if (threadCount < 1) {
+            throw new PgenException(String.format("Invalid thread count (%d); must be at least 1", threadCount));
+        }
+        final int scoreCount = scoreWeights.getScoreCount();
+        final ByteBuffer scoreBuffer = ByteBuffer.allocateDirect(Math.toIntExact((long) scoreCount * sampleCount * Double.BYTES))
+            .order(ByteOrder.nativeOrder());
+        computeScores(
+            pgenReaderHandle,
+            scoreWeights.getVariantIndices(),
+            scoreWeights.getAlleleIndices(),
+            scoreWeights.getWeights(),
+            scoreCount,
+            threadCount,
+            meanImpute ? 0 : SCORE_FLAG_NO_MEAN_IMPUTE,
+            scoreBuffer);
+        final DoubleBuffer scoreValues = scoreBuffer.asDoubleBuffer();
+        final double[][] scores = new double[scoreCount][sampleCount];
+        for (int i = 0; i < scoreCount; i++) {
+            scoreValues.get(scores[i]);
+        }
+        return scores;
+    }
+
+    /**
+     * @return a new direct buffer, in native byte order, large enough to hold the GRM tile computed by
+     * {@link #computeGrmTile} for the rows [rowStart, rowEnd) and the columns [0, columnEnd)
+     */
+    public ByteBuffer createGrmTileBuffer(final int rowStart, final int rowEnd, final int columnEnd) {
+        requireValidGrmTile(rowStart, rowEnd, columnEnd);
+        return ByteBuffer.allocateDirect(Math.toIntExact((long) (rowEnd - rowStart) * columnEnd * Double.BYTES))
+            .order(ByteOrder.nativeOrder());
+    }
+
+    /**
+     * Compute a tile of the genomic relationship matrix (GRM) of the reader's samples (see {@link #getSampleCount})
+     * over the variants in [variantStart, variantEnd), as for plink2 --make-rel: the mean, over the polymorphic
+     * variants, of the product of two samples' standardized non-reference allele counts, with missing genotypes mean
+     * imputed. The rows of the tile are split across {@code threadCount} native threads. Use {@link #writeGrmBin} to
+     * write a matrix that's too large to hold in memory.
+     *
+     * @param variantStart the index of the first variant to include
+     * @param variantEnd one past the index of the last variant to include
+     * @param threadCount the number of native threads to compute with
+     * @param rowStart the first row (sample) of the tile
+     * @param rowEnd one past the last row of the tile
+     * @param columnEnd one past the last column of the tile, which starts at column 0
+     * @param grm a direct buffer (see {@link #createGrmTileBuffer}) that receives the tile as doubles, row major: the
+     *            entry for samples j and k is at double offset {@code (j - rowStart) * columnEnd + k}
+     * @return the number of (polymorphic) variants the matrix was computed from
+     */
+    public int computeGrmTile(
+            final long variantStart,
+            final long variantEnd,
+            final int threadCount,
+            final int rowStart,
+            final int rowEnd,
+            final int columnEnd,
+            final ByteBuffer grm) {
+        requireValidRange(variantStart, variantEnd);
+        requireValidGrmTile(rowStart, rowEnd, columnEnd);
+        if (threadCount < 1) {
+            throw new PgenException(String.format("Invalid thread count (%d); must be at least 1", threadCount));
+        }
+        return computeGrmTile(pgenReaderHandle, variantStart, variantEnd, threadCount, rowStart, rowEnd, columnEnd, grm);
+    }
+
+    /**
+     * Write the genomic relationship matrix (see {@link #computeGrmTile}) of the reader's samples, over the variants
+     * in [variantStart, variantEnd), as a plink2/GCTA .grm.bin: the lower triangle of the matrix, including the
+     * diagonal, as native byte order 32-bit floats. The matrix is computed {@code tileRowCount} rows at a time, so at
+     * most {@code tileRowCount * getSampleCount()} doubles are held in memory. The sample IDs for the companion
+     * .grm.id are those of the reader's samples in the .psam.
+     *
+     * @param variantStart the index of the first variant to include
+     * @param variantEnd one past the index of the last variant to include
+     * @param threadCount the number of native threads to compute each tile with
+     * @param tileRowCount the maximum number of rows in each tile
+     * @param grmBinFile the .grm.bin file to write
+     * @return the number of (polymorphic) variants the matrix was computed from
+     */
+    public int writeGrmBin(
+            final long variantStart,
+            final long variantEnd,
+            final int threadCount,
+            final int tileRowCount,
+            final HtsPath grmBinFile) {
+        requireValidRange(variantStart, variantEnd);
+        if (threadCount < 1 || tileRowCount < 1) {
+            throw new PgenException(String.format(
+                "Invalid GRM thread count (%d) or tile row count (%d); both must be at least 1", threadCount, tileRowCount));
+        }
+        return writeGrmBin(
+            pgenReaderHandle, variantStart, variantEnd, threadCount, tileRowCount, grmBinFile.toPath().toString());
+    }
+
+    /**
+     * Find the pairs of variants in [variantStart, variantEnd), no more than {@code windowVariantCount} variants
+     * apart, with an r^2 of at least {@code minR2}, as for LD pruning. Variants are compared by their non-reference
+     * hardcalls, over the samples that are non-missing for both. For a pair of fully phased variants, r^2 and D' are
+     * computed from the haplotype counts; otherwise r^2 is the squared allele count correlation (as for plink 1.9
+     * --r2), and D' is computed from the composite (allele count covariance) estimate of D. The first variant of
+     * each pair is split across {@code threadCount} native threads.
+     *
+     * @param variantStart the index of the first variant to include
+     * @param variantEnd one past the index of the last variant to include
+     * @param windowVariantCount the maximum distance (in variants) between the two variants of a pair
+     * @param minR2 the minimum r^2 of a returned pair
+     * @param threadCount the number of native threads to compute with
+     * @param usePhase if false, the unphased estimates are used even for pairs of phased variants
+     * @return the pairs, in which the first variant of each pair precedes the second
+     */
+    public PgenLdPairs computeWindowLd(
+            final long variantStart,
+            final long variantEnd,
+            final int windowVariantCount,
+            final double minR2,
+            final int threadCount,
+            final boolean usePhase) {
+        requireValidRange(variantStart, variantEnd);
+        if (windowVariantCount < 0 || threadCount < 1) {
+            throw new PgenException(String.format(
+                "Invalid LD window size (%d) or thread count (%d)", windowVariantCount, threadCount));
+        }
+        return readLdPairs(computeWindowLd(
+            pgenReaderHandle,
+            variantStart,
+            variantEnd,
+            windowVariantCount,
+            minR2,
+            threadCount,
+            usePhase ? 0 : LD_FLAG_IGNORE_PHASE));
+    }
+
+    /**
+     * Find the pairs of variants, one from [variantStartA, variantEndA) and one from [variantStartB, variantEndB),
+     * with an r^2 of at least {@code minR2} (see {@link #computeWindowLd}), such as the pairs of an index variant and
+     * the variants around it, for clumping. A variant is never paired with itself; if the ranges overlap, a pair of
+     * variants in both ranges is returned in both orders. The genotypes of the second range are held in native
+     * memory while the pairs are computed.
+     *
+     * @param variantStartA the index of the first variant of the first range
+     * @param variantEndA one past the index of the last variant of the first range
+     * @param variantStartB the index of the first variant of the second range
+     * @param variantEndB one past the index of the last variant of the second range
+     * @param minR2 the minimum r^2 of a returned pair
+     * @param threadCount the number of native threads to compute with
+     * @param usePhase if false, the unphased estimates are used even for pairs of phased variants
+     * @return the pairs, in which the first variant of each pair is from the first range
+     */
+    public PgenLdPairs computeCrossLd(
+            final long variantStartA,
+            final long variantEndA,
+            final long variantStartB,
+            final long variantEndB,
+            final double minR2,
+            final int threadCount,
+            final boolean usePhase) {
+        requireValidRange(variantStartA, variantEndA);
+        requireValidRange(variantStartB, variantEndB);
+        if (threadCount < 1) {
+            throw new PgenException(String.format("Invalid thread count (%d); must be at least 1", threadCount));
+        }
+        return readLdPairs(computeCrossLd(
+            pgenReaderHandle,
+            variantStartA,
+            variantEndA,
+            variantStartB,
+            variantEndB,
+            minR2,
+            threadCount,
+            usePhase ? 0 : LD_FLAG_IGNORE_PHASE));
+    }
+
+    /**
+     * Start a parallel scan over a range of variants (see {@link PgenScanner}). The scanner reads from the same file,
+     * with the same allele counts and sample subset, as this reader, which can still be used while the scan is in
+     * progress. The scanner must be closed before this reader is closed.
+     *
+     * @param variantStart the index of the first variant in the range to scan
+     * @param variantEnd one past the index of the last variant in the range to scan
+     * @param variantInclude the variants in the range to include in the scan. may be null to include every variant
+     *                       in the range.
+     * @param threadCount the number of native threads used to decode each batch
+     * @param batchSize the maximum number of variants returned by each call to {@link PgenScanner#nextBatch}
+     * @return a new PgenScanner
+     */
+    public PgenScanner scan(
+            final long variantStart,
+            final long variantEnd,
+            final BitSet variantInclude,
+            final int threadCount,
+            final int batchSize) {
+        if (pgenReaderHandle == 0) {
+            throw new PgenException(String.format("The PGEN reader for %s is closed", pgenFile.getRawInputString()));
+        }
+        if (variantStart < 0 || variantStart > variantEnd || variantEnd > variantCount) {
+            throw new PgenException(String.format(
+                "Invalid scan range: %d..%d. The PGEN contains %d variants", variantStart, variantEnd, variantCount));
+        }
+        if (threadCount < 1 || batchSize < 1) {
+            throw new PgenException(String.format(
+                "Invalid scan thread count (%d) or batch size (%d); both must be at least 1", threadCount, batchSize));
+        }
+        // the batch buffers are Java direct buffers, so they're limited to 2GB
+        if ((long) batchSize * sampleCount * 2 * Integer.BYTES > Integer.MAX_VALUE) {
+            throw new PgenException(String.format(
+                "Scan batch size (%d) is too large for %d samples; the allele codes for a batch must fit in 2GB",
+                batchSize, sampleCount));
+        }
+        final PgenScanner scanner = new PgenScanner(
+            this,
+            pgenReaderHandle,
+            variantInclude == null ? null : variantInclude.toLongArray(),
+            variantStart,
+            variantEnd,
+            threadCount,
+            batchSize);
+        openScanners.add(scanner);
+        return scanner;
+    }
+
+    // called by PgenScanner.close
+    void scannerClosed(final PgenScanner scanner) {
+        openScanners.remove(scanner);
+    }
+
+    @Override
+    public void close() {
+        if (!openScanners.isEmpty()) {
+            throw new PgenException(String.format(
+                "The PGEN reader for %s can't be closed while it has %d open scanner(s)",
+                pgenFile.getRawInputString(), openScanners.size()));
+        }
+        // closePgenReader releases the native reader even if it throws (as an async Java exception), so the handle
+        // is never valid after this
+        if (pgenReaderHandle != 0) {
+            final long handle = pgenReaderHandle;
+            pgenReaderHandle = 0;
+            closePgenReader(handle);
+        }
+    }
+
+    /**
+     * Validate the .pgen: its header, variant record index and every variant record, as for plink2 --validate, with
+     * the variant records split across {@code threadCount} native threads. Multiallelic variant records can only be
+     * validated if the reader was opened with the allele counts (see {@link #readAlleleCountsFromPvar}).
+     *
+     * @param threadCount the number of native threads to validate with
+     * @throws PgenException describing the first problem found (with the index and byte offset of the first invalid
+     * variant record), if the .pgen is invalid
+     */
+    public void validate(final int threadCount) {
+        requireValidRange(0, variantCount);
+        if (threadCount < 1) {
+            throw new PgenException(String.format("Invalid thread count (%d); must be at least 1", threadCount));
+        }
+        validatePgen(pgenReaderHandle, threadCount);
+    }
+
+    /**
+     * Write the sample major sidecar of the hardcalls of every variant in the PGEN, for the reader's samples (see
+     * {@link PgenSampleMajorReader}). The variants are decoded a block at a time on {@code threadCount} native
+     * threads, and each block is transposed to sample major order.
+     *
+     * @param sidecarFile the sidecar file to write (see {@link PgenSampleMajorReader#getDefaultSidecarPath})
+     * @param threadCount the number of native threads to decode and transpose with
+     */
+    public void writeSampleMajorSidecar(final HtsPath sidecarFile, final int threadCount) {
+        requireValidRange(0, variantCount);
+        if (threadCount < 1) {
+            throw new PgenException(String.format("Invalid thread count (%d); must be at least 1", threadCount));
+        }
+        writeSampleMajorSidecar(pgenReaderHandle, sidecarFile.toPath().toAbsolutePath().toString(), threadCount);
+    }
+
+    /**
+     * Extract a subset of the variants, and the reader's samples (see
+     * {@link #PgenReader(HtsPath, int[], int[], EnumSet)}), into a new PGEN file set. If the reader reads every sample,
+     * the .pgen variant records are copied natively without being decoded; otherwise the variants are decoded on
+     * {@code threadCount} native threads, and re-encoded with only the reader's samples. Extracting a sample subset
+     * of a PGEN with dosages isn't supported. The .pvar keeps the header and the extracted variant lines of this
+     * PGEN's .pvar, and the .psam keeps the header and the extracted sample lines of its .psam; either is only written
+     * if this PGEN has one.
+     *
+     * @param variantIndices the (zero based) indices of the variants to extract, in strictly increasing order
+     * @param pgenFile the .pgen file to create (must end in .pgen)
+     * @param pgenWriteMode the PGEN write mode to use for the output .pgen (see {@code PgenWriteMode})
+     * @param threadCount the number of native threads to decode with
+     */
+    public void extract(
+            final int[] variantIndices,
+            final HtsPath pgenFile,
+            final PgenWriter.PgenWriteMode pgenWriteMode,
+            final int threadCount) {
+        requireValidRange(0, variantCount);
+        if (threadCount < 1) {
+            throw new PgenException(String.format("Invalid thread count (%d); must be at least 1", threadCount));
+        }
+        // extractPgen returns false if it had to throw an async Java exception
+        if (!extractPgen(
+                pgenReaderHandle,
+                variantIndices,
+                pgenFile.toPath().toAbsolutePath().toString(),
+                pgenWriteMode.value(),
+                threadCount)) {
+            return;
+        }
+        // the native code has checked that the indices are strictly increasing and in range
+        writeCompanionSubset(
+            PgenWriter.getCompanionPath(this.pgenFile, PgenWriter.PVAR_EXTENSION),
+            PgenWriter.getCompanionPath(pgenFile, PgenWriter.PVAR_EXTENSION),
+            variantIndices,
+            true);
+        writeCompanionSubset(
+            PgenWriter.getCompanionPath(this.pgenFile, PgenWriter.PSAM_EXTENSION),
+            PgenWriter.getCompanionPath(pgenFile, PgenWriter.PSAM_EXTENSION),
+            sampleIndices,
+            false);
+    }
+
+    // Copy the header lines (those starting with '#') of a .pvar or .psam, and the lines after the header whose
+    // indices are in {@code lineIndices} (in increasing order), or every line if {@code lineIndices} is null. Nothing
+    // is written if {@code sourcePath} doesn't exist.
+    private static void writeCompanionSubset(
+            final Path sourcePath,
+            final Path outputPath,
+            final int[] lineIndices,
+            final boolean zstdCompressed) {
+        if (!Files.exists(sourcePath)) {
+            return;
+        }
+        try (final BufferedReader sourceReader = new BufferedReader(new InputStreamReader(
+                zstdCompressed ? new ZstdInputStream(Files.newInputStream(sourcePath)) : Files.newInputStream(sourcePath),
+                StandardCharsets.UTF_8));
+             final BufferedWriter outputWriter = new BufferedWriter(new OutputStreamWriter(
+                zstdCompressed ? new ZstdOutputStream(Files.newOutputStream(outputPath)) : Files.newOutputStream(outputPath),
+                StandardCharsets.UTF_8))) {
+            String line;
+            int lineIndex = 0;
+            int nextIndex = 0;
+            while ((line = sourceReader.readLine()) != null) {
+                if (lineIndex == 0 && line.startsWith(VCFConstants.HEADER_INDICATOR)) {
+                    outputWriter.write(line);
+                    outputWriter.write('\n');
+                    continue;
+                }
+                if (lineIndices == null || (nextIndex < lineIndices.length && lineIndices[nextIndex] == lineIndex)) {
+                    outputWriter.write(line);
+                    outputWriter.write('\n');
+                    nextIndex++;
+                    if (lineIndices != null && nextIndex == lineIndices.length) {
+                        break;
+                    }
+                }
+                lineIndex++;
+            }
+        } catch (final IOException e) {
+            throw new RuntimeIOException(String.format("Error writing %s from %s", outputPath, sourcePath), e);
+        }
+    }
+
+    // copy the native pairs for a handle returned by computeWindowLd or computeCrossLd, and release them
+    private PgenLdPairs readLdPairs(final long ldPairsHandle) {
+        final long pairCount = getLdPairCount(ldPairsHandle);
+        // the pair buffer is a Java direct buffer, so it's limited to 2GB
+        if (pairCount * PgenLdPairs.PAIR_BYTES > Integer.MAX_VALUE) {
+            readLdPairs(ldPairsHandle, null);
+            throw new PgenException(String.format(
+                "Too many LD pairs (%d) to return; use a higher r^2 threshold or a smaller range", pairCount));
+        }
+        final ByteBuffer pairBuffer = ByteBuffer.allocateDirect((int) pairCount * PgenLdPairs.PAIR_BYTES)
+            .order(ByteOrder.nativeOrder());
+        readLdPairs(ldPairsHandle, pairBuffer);
+        return new PgenLdPairs(pairBuffer, (int) pairCount);
+    }
+
+    private void requireValidGrmTile(final int rowStart, final int rowEnd, final int columnEnd) {
+        if (rowStart < 0 || rowStart > rowEnd || rowEnd > sampleCount || columnEnd < 0 || columnEnd > sampleCount) {
+            throw new PgenException(String.format(
+                "Invalid GRM tile: rows %d..%d, columns 0..%d. The reader has %d samples",
+                rowStart, rowEnd, columnEnd, sampleCount));
+        }
+    }
+
+    private void requireValidRange(final long variantStart, final long variantEnd) {
+        if (pgenReaderHandle == 0) {
+            throw new PgenException(String.format("The PGEN reader for %s is closed", pgenFile.getRawInputString()));
+        }
+        if (variantStart < 0 || variantStart > variantEnd || variantEnd > variantCount) {
+            throw new PgenException(String.format(
+                "Invalid variant range: %d..%d. The PGEN contains %d variants", variantStart, variantEnd, variantCount));
+        }
+    }
+
+    /**
+     * Read the allele count (1 + the number of ALT alleles) of each variant from the .pvar that accompanies
+     * {@code pgenFile}. A missing ALT allele ('.') counts as one ALT allele, as it does for plink2.
+     *
+     * @return the allele counts, or null if there is no .pvar
+     */
+    public static int[] readAlleleCountsFromPvar(final HtsPath pgenFile) {
+        final String pgenFilePrefix = PgenWriter.getAbsoluteFileNameWithoutExtension(pgenFile.toPath(), PgenWriter.PGEN_EXTENSION);
+        final Path pVarPath = pgenFile.toPath().resolveSibling(pgenFilePrefix + PgenWriter.PVAR_EXTENSION);
+        if (!Files.exists(pVarPath)) {
+            return null;
+        }
+        int[] alleleCounts = new int[1024];
+        int variantCount = 0;
+        try (final BufferedReader pVarReader = new BufferedReader(new InputStreamReader(
+                new ZstdInputStream(Files.newInputStream(pVarPath)), StandardCharsets.UTF_8))) {
+            String line;
+            while ((line = pVarReader.readLine()) != null) {
+                if (line.startsWith(VCFConstants.HEADER_INDICATOR) || line.isEmpty()) {
+                    continue;
+                }
+                // the ALT allele(s) are in the 5th column
+                int altStart = 0;
+                for (int i = 0; i < 4; i++) {
+                    altStart = line.indexOf(VCFConstants.FIELD_SEPARATOR_CHAR, altStart) + 1;
+                    if (altStart == 0) {
+                        throw new PgenException(String.format("Malformed .pvar line in %s: %s", pVarPath, line));
+                    }
+                }
+                int altEnd = line.indexOf(VCFConstants.FIELD_SEPARATOR_CHAR, altStart);
+                if (altEnd < 0) {
+                    altEnd = line.length();
+                }
+                int alleleCount = 2;
+                for (int i = altStart; i < altEnd; i++) {
+                    if (line.charAt(i) == ',') {
+                        alleleCount++;
+                    }
+                }
+                if (variantCount == alleleCounts.length) {
+                    alleleCounts = Arrays.copyOf(alleleCounts, alleleCounts.length * 2);
+                }
+                alleleCounts[variantCount++] = alleleCount;
+            }
+        } catch (final IOException e) {
+            throw new RuntimeIOException(String.format("Error reading allele counts from the .pvar file %s", pVarPath), e);
+        }
+        return Arrays.copyOf(alleleCounts, variantCount);
+    }
+}
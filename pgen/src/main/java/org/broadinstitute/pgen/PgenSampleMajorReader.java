@@ -0,0 +1,135 @@
+/**
+ * Copyright (c) 2023, Broad Institute, Inc. All rights reserved.
+ */
+
+package org.broadinstitute.pgen;
+
+import htsjdk.io.HtsPath;
+
+import java.nio.ByteBuffer;
+
+/**
+ * A reader for the sample major sidecar of a PGEN (see {@link PgenReader#writeSampleMajorSidecar}), which returns all
+ * of the genotypes of one sample over a range of variants without decoding the variant records of the PGEN. Each
+ * genotype is the number of non-reference alleles (0, 1 or 2; a multi-allelic genotype counts any alt allele), or -9
+ * for a missing genotype. The sample indices are those of the samples the sidecar was written for. A reader isn't
+ * thread safe.
+ */
+public class PgenSampleMajorReader implements AutoCloseable {
+    // the file name extension (appended to the .pgen file name) of a sidecar in the default location; must be kept
+    // in sync with pgenlib::kSampleMajorExtension
+    public static String SAMPLE_MAJOR_EXTENSION = ".smg";
+
+    private final HtsPath sidecarFile;
+    private final long variantCount;
+    private final int sampleCount;
+    private long sampleMajorReaderHandle;
+
+    // ******************** Native JNI methods  ********************
+    private static native long openSampleMajorReader(String file);
+    private static native long getSampleMajorVariantCount(long sampleMajorReaderHandle);
+    private static native int getSampleMajorSampleCount(long sampleMajorReaderHandle);
+    private static native boolean readSampleGenotypes(
+            long sampleMajorReaderHandle, int sampleIndex, long variantStart, long variantEnd, ByteBuffer genotypes);
+    private static native boolean closeSampleMajorReader(long sampleMajorReaderHandle);
+    // ******************** End Native JNI methods  ********************
+
+    static {
+        NativeLibraryUtils.loadPgenLibrary();
+    }
+
+    /**
+     * @return the default location of the sidecar for {@code pgenFile}: the .pgen file name with
+     * {@link #SAMPLE_MAJOR_EXTENSION} appended
+     */
+    public static HtsPath getDefaultSidecarPath(final HtsPath pgenFile) {
+        return new HtsPath(pgenFile.toPath().toAbsolutePath() + SAMPLE_MAJOR_EXTENSION);
+    }
+
+    /**
+     * Open a sample major sidecar for reading.
+     *
+     * @param sidecarFile the sidecar file to read (must be a local file)
+     */
+    public PgenSampleMajorReader(final HtsPath sidecarFile) {
+        if (!sidecarFile.getScheme().equals("file")) {
+            throw new PgenException(String.format("Invalid sidecar file name: %s. Sidecar files must be local files", sidecarFile));
+        }
+        this.sidecarFile = sidecarFile;
+        sampleMajorReaderHandle = openSampleMajorReader(sidecarFile.toPath().toAbsolutePath().toString());
+        if (sampleMajorReaderHandle == 0) {
+            //openSampleMajorReader threw an async Java exception
+            variantCount = 0;
+            sampleCount = 0;
+            return;
+        }
+        variantCount = getSampleMajorVariantCount(sampleMajorReaderHandle);
+        sampleCount = getSampleMajorSampleCount(sampleMajorReaderHandle);
+    }
+
+    /**
+     * @return the number of variants in the sidecar
+     */
+    public long getVariantCount() {
+        return variantCount;
+    }
+
+    /**
+     * @return the number of samples in the sidecar
+     */
+    public int getSampleCount() {
+        return sampleCount;
+    }
+
+    /**
+     * @return a new direct buffer large enough to hold the genotypes read by {@link #readSampleGenotypes} for the
+     * variants in [variantStart, variantEnd)
+     */
+    public ByteBuffer createGenotypeBuffer(final long variantStart, final long variantEnd) {
+        requireValidRange(variantStart, variantEnd);
+        return ByteBuffer.allocateDirect(Math.toIntExact(variantEnd - variantStart));
+    }
+
+    /**
+     * Read the genotypes of one sample for each variant in [variantStart, variantEnd).
+     *
+     * @param sampleIndex the (zero based) index of the sample
+     * @param variantStart the index of the first variant to read
+     * @param variantEnd one past the index of the last variant to read
+     * @param genotypes a direct buffer (see {@link #createGenotypeBuffer}) that receives one genotype byte per
+     *                  variant: the number of non-reference alleles, or -9 if the genotype is missing
+     */
+    public void readSampleGenotypes(
+            final int sampleIndex,
+            final long variantStart,
+            final long variantEnd,
+            final ByteBuffer genotypes) {
+        requireValidRange(variantStart, variantEnd);
+        if (sampleIndex < 0 || sampleIndex >= sampleCount) {
+            throw new PgenException(String.format(
+                "Invalid sample index: %d. The sidecar contains %d samples", sampleIndex, sampleCount));
+        }
+        readSampleGenotypes(sampleMajorReaderHandle, sampleIndex, variantStart, variantEnd, genotypes);
+    }
+
+    @Override
+    public void close() {
+        // closeSampleMajorReader releases the native reader even if it throws (as an async Java exception), so the
+        // handle is never valid after this
+        if (sampleMajorReaderHandle != 0) {
+            final long handle = sampleMajorReaderHandle;
+            sampleMajorReaderHandle = 0;
+            closeSampleMajorReader(handle);
+        }
+    }
+
+    private void requireValidRange(final long variantStart, final long variantEnd) {
+        if (sampleMajorReaderHandle == 0) {
+            throw new PgenException(String.format("The sample major reader for %s is closed", sidecarFile.getRawInputString()));
+        }
+        if (variantStart < 0 || variantStart > variantEnd || variantEnd > variantCount) {
+            throw new PgenException(String.format(
+                "Invalid variant range: %d..%d. The sidecar contains %d variants", variantStart, variantEnd, variantCount));
+        }
+    }
+}
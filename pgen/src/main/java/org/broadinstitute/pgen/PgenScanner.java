@@ -0,0 +1,126 @@
+/**
+ * Copyright (c) 2023, Broad Institute, Inc. All rights reserved.
+ */
+
+package org.broadinstitute.pgen;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+/**
+ * A parallel, in order scan over the variants of a {@link PgenReader} (see {@link PgenReader#scan}). Variants are
+ * returned in batches; the native scanner decodes each batch on several threads, and loads the records for the next
+ * batch from the PGEN while the current batch is being decoded, so a scan is much faster than reading the same
+ * variants one at a time with {@link PgenReader#readAlleles}.
+ *
+ * Each batch has the same layout as a series of calls to {@link PgenReader#readAlleles}, one variant after the other.
+ * The buffers passed to {@link #nextBatch} must be large enough to hold a full batch; use the {@code create...Buffer}
+ * methods to allocate them. The scanner must be closed before the reader is closed.
+ */
+public class PgenScanner implements AutoCloseable {
+    private final PgenReader pgenReader;
+    private final int batchSize;
+    private final int sampleCount;
+    private long pgenScanHandle;
+
+    // ******************** Native JNI methods  ********************
+    private static native long startPgenScan(
+            long pgenReaderHandle, long[] variantInclude, long variantStart, long variantEnd, int threadCount, int batchSize);
+    private static native int scanReadAlleles(
+            long pgenScanHandle, ByteBuffer variantIndices, ByteBuffer alleles, ByteBuffer phasing, ByteBuffer alleleCounts);
+    private static native boolean finishPgenScan(long pgenScanHandle);
+    // ******************** End Native JNI methods  ********************
+
+    static {
+        NativeLibraryUtils.loadPgenLibrary();
+    }
+
+    // called by PgenReader.scan, which validates the arguments
+    PgenScanner(
+            final PgenReader pgenReader,
+            final long pgenReaderHandle,
+            final long[] variantInclude,
+            final long variantStart,
+            final long variantEnd,
+            final int threadCount,
+            final int batchSize) {
+        this.pgenReader = pgenReader;
+        this.batchSize = batchSize;
+        this.sampleCount = pgenReader.getSampleCount();
+        // if startPgenScan throws an async Java exception, it's raised as soon as startPgenScan returns, so the
+        // scanner is never returned
+        pgenScanHandle = startPgenScan(pgenReaderHandle, variantInclude, variantStart, variantEnd, threadCount, batchSize);
+    }
+
+    /**
+     * @return the maximum number of variants in each batch
+     */
+    public int getBatchSize() {
+        return batchSize;
+    }
+
+    /**
+     * @return a new direct buffer, in native byte order, large enough to hold the variant indices for one batch
+     */
+    public ByteBuffer createVariantIndexBuffer() {
+        return ByteBuffer.allocateDirect(batchSize * Integer.BYTES).order(ByteOrder.nativeOrder());
+    }
+
+    /**
+     * @return a new direct buffer, in native byte order, large enough to hold the allele codes for one batch
+     */
+    public ByteBuffer createAlleleCodeBuffer() {
+        return ByteBuffer.allocateDirect(batchSize * sampleCount * 2 * Integer.BYTES).order(ByteOrder.nativeOrder());
+    }
+
+    /**
+     * @return a new direct buffer large enough to hold the phase bytes for one batch
+     */
+    public ByteBuffer createPhaseBuffer() {
+        return ByteBuffer.allocateDirect(batchSize * sampleCount);
+    }
+
+    /**
+     * @return a new direct buffer, in native byte order, large enough to hold the allele counts for one batch
+     */
+    public ByteBuffer createAlleleCountBuffer() {
+        return ByteBuffer.allocateDirect(batchSize * Integer.BYTES).order(ByteOrder.nativeOrder());
+    }
+
+    /**
+     * Decode the next batch of variants.
+     *
+     * @param variantIndices a direct buffer (see {@link #createVariantIndexBuffer}) that receives the int32 index of
+     *                       each variant in the batch
+     * @param alleleCodes a direct buffer (see {@link #createAlleleCodeBuffer}) that receives the allele codes for each
+     *                    variant in the batch, in the format described for {@link PgenReader#readAlleles}. The codes
+     *                    for the i-th variant in the batch start at int32 offset {@code i * sampleCount * 2}.
+     * @param phaseBytes a direct buffer (see {@link #createPhaseBuffer}) that receives the phase bytes for each
+     *                   variant in the batch, starting at offset {@code i * sampleCount}. may be null.
+     * @param alleleCounts a direct buffer (see {@link #createAlleleCountBuffer}) that receives the int32 allele count
+     *                     of each variant in the batch
+     * @return the number of variants in the batch, which is less than the batch size only for the last batch, or 0
+     * once the scan is complete
+     */
+    public int nextBatch(
+            final ByteBuffer variantIndices,
+            final ByteBuffer alleleCodes,
+            final ByteBuffer phaseBytes,
+            final ByteBuffer alleleCounts) {
+        if (pgenScanHandle == 0) {
+            throw new PgenException("The PGEN scanner is closed");
+        }
+        return scanReadAlleles(pgenScanHandle, variantIndices, alleleCodes, phaseBytes, alleleCounts);
+    }
+
+    @Override
+    public void close() {
+        if (pgenScanHandle != 0) {
+            // the native scan is released even if finishPgenScan throws (as an async Java exception), so the handle
+            // is never valid after this
+            finishPgenScan(pgenScanHandle);
+            pgenScanHandle = 0;
+            pgenReader.scannerClosed(this);
+        }
+    }
+}
@@ -0,0 +1,224 @@
+/**
+ * Copyright (c) 2023, Broad Institute, Inc. All rights reserved.
+ */
+
+package org.broadinstitute.pgen;
+
+import htsjdk.io.HtsPath;
+import htsjdk.samtools.util.RuntimeIOException;
+
+import java.io.BufferedReader;
+import java.io.IOException;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Files;
+import java.util.Arrays;
+import java.util.List;
+
+/**
+ * The weighted alleles for one or more polygenic scores, computed by {@link PgenReader#computeScores}. Each entry is
+ * a (variant index, allele index) pair with one weight per score; a sample's score is the sum, over the entries, of
+ * the entry's weight times the sample's dosage of the entry's allele. An allele (or variant) may appear in more than
+ * one entry.
+ *
+ * Weights are usually read from a whitespace delimited weight file (see {@link #read}), with one entry per line:
+ * <pre>
+ * #VARIANT  ALLELE  SCORE_A  SCORE_B
+ * 0         1       0.25     -0.1
+ * 7         2       1.5      0.0
+ * </pre>
+ * The variant index is the 0-based index of the variant in the PGEN, and the allele index is the 0-based index of the
+ * allele within the variant (0 is REF). The optional first line, which starts with '#', names the score columns;
+ * any other line that starts with '#', and any empty line, is ignored.
+ */
+public class PgenScoreWeights {
+    private static final String HEADER_INDICATOR = "#";
+
+    private final int[] variantIndices;
+    private final int[] alleleIndices;
+    private final double[] weights;
+    private final String[] scoreNames;
+
+    /**
+     * @param variantIndices the 0-based variant index of each entry
+     * @param alleleIndices the 0-based allele index of each entry
+     * @param weights {@code scoreNames.length} weights for each entry, one entry after the other
+     * @param scoreNames the name of each score
+     */
+    public PgenScoreWeights(
+            final int[] variantIndices,
+            final int[] alleleIndices,
+            final double[] weights,
+            final String[] scoreNames) {
+        if (scoreNames.length == 0) {
+            throw new PgenException("Score weights must contain at least one score");
+        }
+        if (alleleIndices.length != variantIndices.length ||
+                weights.length != (long) variantIndices.length * scoreNames.length) {
+            throw new PgenException(String.format(
+                "Score weights must have one allele index and %d weights per variant index; got %d variant indices, " +
+                    "%d allele indices and %d weights",
+                scoreNames.length, variantIndices.length, alleleIndices.length, weights.length));
+        }
+        this.variantIndices = variantIndices;
+        this.alleleIndices = alleleIndices;
+        this.weights = weights;
+        this.scoreNames = scoreNames;
+    }
+
+    /**
+     * Read the weights for every score column in a weight file.
+     *
+     * @param weightFile the weight file; see the class description for its format
+     */
+    public static PgenScoreWeights read(final HtsPath weightFile) {
+        return read(weightFile, null);
+    }
+
+    /**
+     * Read the weights for a subset of the score columns in a weight file.
+     *
+     * @param weightFile the weight file; see the class description for its format
+     * @param scoreColumns the names of the score columns to read, in the order in which the scores should be
+     *                     computed. If null, every score column is read. Columns that aren't named by a header
+     *                     line are named SCORE1, SCORE2, ...
+     */
+    public static PgenScoreWeights read(final HtsPath weightFile, final List<String> scoreColumns) {
+        String[] columnNames = null;
+        int[] columns = null;
+        int[] variantIndices = new int[1024];
+        int[] alleleIndices = new int[1024];
+        double[] weights = null;
+        int entryCount = 0;
+        try (final BufferedReader reader = Files.newBufferedReader(weightFile.toPath(), StandardCharsets.UTF_8)) {
+            String line;
+            int lineNumber = 0;
+            while ((line = reader.readLine()) != null) {
+                lineNumber++;
+                final String trimmed = line.trim();
+                if (trimmed.startsWith(HEADER_INDICATOR)) {
+                    if (lineNumber == 1) {
+                        final String[] fields = trimmed.substring(HEADER_INDICATOR.length()).trim().split("\\s+");
+                        if (fields.length < 3) {
+                            throw new PgenException(String.format(
+                                "The header line of the weight file %s names no score columns: %s",
+                                weightFile.getRawInputString(), line));
+                        }
+                        columnNames = Arrays.copyOfRange(fields, 2, fields.length);
+                    }
+                    continue;
+                } else if (trimmed.isEmpty()) {
+                    continue;
+                }
+                final String[] fields = trimmed.split("\\s+");
+                if (columnNames == null) {
+                    // there's no header line, so the first entry determines the number of score columns
+                    columnNames = new String[Math.max(fields.length - 2, 0)];
+                    for (int i = 0; i < columnNames.length; i++) {
+                        columnNames[i] = "SCORE" + (i + 1);
+                    }
+                }
+                if (columns == null) {
+                    columns = selectScoreColumns(weightFile, columnNames, scoreColumns);
+                    weights = new double[variantIndices.length * columns.length];
+                }
+                if (fields.length != columnNames.length + 2) {
+                    throw new PgenException(String.format(
+                        "Line %d of the weight file %s has %d fields; expected a variant index, an allele index " +
+                            "and %d weights",
+                        lineNumber, weightFile.getRawInputString(), fields.length, columnNames.length));
+                }
+                if (entryCount == variantIndices.length) {
+                    variantIndices = Arrays.copyOf(variantIndices, variantIndices.length * 2);
+                    alleleIndices = Arrays.copyOf(alleleIndices, alleleIndices.length * 2);
+                    weights = Arrays.copyOf(weights, variantIndices.length * columns.length);
+                }
+                try {
+                    variantIndices[entryCount] = Integer.parseInt(fields[0]);
+                    alleleIndices[entryCount] = Integer.parseInt(fields[1]);
+                    for (int i = 0; i < columns.length; i++) {
+                        weights[entryCount * columns.length + i] = Double.parseDouble(fields[columns[i] + 2]);
+                    }
+                } catch (final NumberFormatException e) {
+                    throw new PgenException(String.format(
+                        "Malformed line %d in the weight file %s: %s",
+                        lineNumber, weightFile.getRawInputString(), line));
+                }
+                entryCount++;
+            }
+        } catch (final IOException e) {
+            throw new RuntimeIOException(
+                String.format("Error reading the weight file %s", weightFile.getRawInputString()), e);
+        }
+        if (columns == null) {
+            throw new PgenException(String.format(
+                "The weight file %s contains no weighted variants", weightFile.getRawInputString()));
+        }
+        final String[] scoreNames = new String[columns.length];
+        for (int i = 0; i < columns.length; i++) {
+            scoreNames[i] = columnNames[columns[i]];
+        }
+        return new PgenScoreWeights(
+            Arrays.copyOf(variantIndices, entryCount),
+            Arrays.copyOf(alleleIndices, entryCount),
+            Arrays.copyOf(weights, entryCount * columns.length),
+            scoreNames);
+    }
+
+    /**
+     * @return the number of weighted (variant, allele) entries
+     */
+    public int getEntryCount() {
+        return variantIndices.length;
+    }
+
+    /**
+     * @return the number of scores
+     */
+    public int getScoreCount() {
+        return scoreNames.length;
+    }
+
+    /**
+     * @return the name of each score
+     */
+    public String[] getScoreNames() {
+        return scoreNames;
+    }
+
+    int[] getVariantIndices() {
+        return variantIndices;
+    }
+
+    int[] getAlleleIndices() {
+        return alleleIndices;
+    }
+
+    double[] getWeights() {
+        return weights;
+    }
+
+    // the index, among the score columns of the weight file, of each selected score
+    private static int[] selectScoreColumns(
+            final HtsPath weightFile,
+            final String[] columnNames,
+            final List<String> scoreColumns) {
+        if (scoreColumns == null) {
+            final int[] columns = new int[columnNames.length];
+            for (int i = 0; i < columns.length; i++) {
+                columns[i] = i;
+            }
+            return columns;
+        }
+        final List<String> names = Arrays.asList(columnNames);
+        final int[] columns = new int[scoreColumns.size()];
+        for (int i = 0; i < columns.length; i++) {
+            columns[i] = names.indexOf(scoreColumns.get(i));
+            if (columns[i] < 0) {
+                throw new PgenException(String.format(
+                    "The weight file %s has no score column named %s; its score columns are %s",
+                    weightFile.getRawInputString(), scoreColumns.get(i), names));
+            }
+        }
+        return columns;
+    }
+}
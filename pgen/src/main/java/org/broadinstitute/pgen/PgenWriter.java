@@ -4,28 +4,32 @@
 
 package org.broadinstitute.pgen;
 
+import com.github.luben.zstd.ZstdInputStream;
 import com.github.luben.zstd.ZstdOutputStream;
-
 import htsjdk.io.HtsPath;
 import htsjdk.samtools.util.Log;
 import htsjdk.samtools.util.RuntimeIOException;
 import htsjdk.variant.variantcontext.Allele;
 import htsjdk.variant.variantcontext.Genotype;
 import htsjdk.variant.variantcontext.VariantContext;
-import htsjdk.variant.variantcontext.writer.Options;
 import htsjdk.variant.variantcontext.writer.VariantContextWriter;
-import htsjdk.variant.variantcontext.writer.VariantContextWriterBuilder;
+import htsjdk.variant.vcf.VCFConstants;
 import htsjdk.variant.vcf.VCFHeader;
 import htsjdk.variant.vcf.VCFHeaderLine;
 
+import java.io.BufferedInputStream;
+import java.io.BufferedOutputStream;
 import java.io.BufferedWriter;
 import java.io.IOException;
+import java.io.InputStream;
 import java.io.OutputStream;
 import java.nio.BufferOverflowException;
 import java.nio.ByteBuffer;
 import java.nio.ByteOrder;
 import java.nio.file.Files;
 import java.nio.file.Path;
+import java.nio.file.StandardCopyOption;
+import java.util.ArrayList;
 import java.util.EnumSet;
 import java.util.HashMap;
 import java.util.List;
@@ -97,7 +101,8 @@ public class PgenWriter implements VariantContextWriter {
         // This enum, and the corresponding enum values must be kept in sync with the corresponding constants
         // in pgenlib::PgenWriteFlags.
         PRESERVE_PHASING(0x1),  // pgenlib::kWriteFlagPreservePhasing
-        MULTI_ALLELIC(0x2);     // pgenlib::kWriteFlagMultiAllelic
+        MULTI_ALLELIC(0x2),     // pgenlib::kWriteFlagMultiAllelic
+        DOSAGE(0x4);            // pgenlib::kWriteFlagDosage
 
         private final int flag;
         private PgenWriteFlag(final int flag) { this.flag = flag; }
@@ -108,7 +113,8 @@ public class PgenWriter implements VariantContextWriter {
          */
         private static int toIntFlags(final EnumSet<PgenWriteFlag> flagsSet) {
             return (flagsSet.contains(PRESERVE_PHASING) ? PRESERVE_PHASING.value() : 0) |
-                   (flagsSet.contains(MULTI_ALLELIC) ? MULTI_ALLELIC.value() : 0);
+                   (flagsSet.contains(MULTI_ALLELIC) ? MULTI_ALLELIC.value() : 0) |
+                   (flagsSet.contains(DOSAGE) ? DOSAGE.value() : 0);
         }
     }
 
@@ -153,7 +159,32 @@ public class PgenWriter implements VariantContextWriter {
     private static final int HAPLOID_PLOIDY = 1;
     private static final int DIPLOID_PLOIDY = 2;
 
+    // Variants are staged in a native batch buffer and handed to the native writer in batches, to amortize the JNI
+    // call overhead across many variants. The batch capacity is derived from the number of samples, so that narrow
+    // cohorts get large batches, but the batch buffer for wide cohorts doesn't grow without bound.
+    private static final long MAX_BATCH_BUFFER_BYTES = 16L * 1024L * 1024L;
+    private static final int MAX_BATCH_VARIANTS = 1024;
+
+    // the buffer size for copying the .pvar lines of each shard when concatenating PGEN file sets
+    private static final int PVAR_COPY_BUFFER_BYTES = 1024 * 1024;
+
+    // When the DOSAGE write flag is used, biallelic variants with DS or GP genotype fields are written as dosages.
+    // Dosages within this distance of 0, 1 or 2 are also written with a hardcall (see pgenlib::kDefaultHardCallThreshold).
+    private static final double HARD_CALL_THRESHOLD = 0.1;
+    private static final String DOSAGE_KEY = "DS";
+    private static final String GENOTYPE_PROBABILITIES_KEY = "GP";
+    private static final float MISSING_DOSAGE = -9.0f;
+    private static final int GENOTYPE_BYTES_ALLELE_COUNT = -1; // pgenlib::kAlleleCtGenotypeBytes
+    private static final byte GENOTYPE_BYTE_NO_CALL = (byte) PLINK2_NO_CALL_VALUE;
+    // Biallelic variants with at most numberOfSamples / SPARSE_GENOTYPE_DIVISOR non hom-ref genotypes are staged as a
+    // sparse genotype list, so the native writer can write them as a plink2 difflist (which is limited to
+    // 2 * (numberOfSamples / plink2::kPglMaxDifflistLenDivisor) entries).
+    private static final int SPARSE_GENOTYPE_ALLELE_COUNT = -2; // pgenlib::kAlleleCtSparseGenotypes
+    private static final int SPARSE_GENOTYPE_DIVISOR = 8;
+
     private final int maxAltAlleles;
+    private final boolean writeDosages;
+    private final boolean preservePhasing;
     private final boolean lenientPloidyValidation;
     private final List<String> sampleNames;
     private final String xChromosomeName;
@@ -163,39 +194,51 @@ public class PgenWriter implements VariantContextWriter {
     private HtsPath pVarFile;
     private HtsPath pSamFile;
     private HtsPath logFile;
-    private VariantContextWriter pVarWriter;
+    private PvarWriter pVarWriter;
     private BufferedWriter logFileWriter;
     private long pgenContextHandle;
-    private ByteBuffer alleleBuffer;
-    private ByteBuffer phasingBuffer;
+    // Set once a native append fails. A failed batch may have been partly written to the .pgen, but none of its
+    // variants are added to the .pvar (and with async appends, a queued batch's variants are added to the .pvar
+    // before it is written), so the writer can't be used further, and the .pgen is never finished.
+    private boolean appendFailed;
+    // With async appends, the native writer thread may still be reading up to asyncQueueDepth submitted batch
+    // buffers, so asyncQueueDepth + 1 batch buffers are used in rotation; otherwise there is only one.
+    private boolean asyncAppends;
+    private ByteBuffer[] batchBuffers;
+    private ByteBuffer[][] batchAlleleSlots;
+    private ByteBuffer[][] batchPhasingSlots;
+    private int currentBatch;
+    private ByteBuffer batchBuffer;     // the batch buffer currently being filled
+    private ByteBuffer[] alleleSlots;   // the allele slots in the current batch buffer
+    private ByteBuffer[] phasingSlots;  // the phasing slots in the current batch buffer
+    private int batchCapacity;
+    private final List<VariantContext> pendingVariants = new ArrayList<>();
+    private ByteBuffer alleleBuffer;    // the allele slot in the batch buffer for the variant currently being added
+    private ByteBuffer phasingBuffer;   // the phasing slot in the batch buffer for the variant currently being added
+    private ByteBuffer dosageBuffer;    // one float alt allele dosage per sample, when writing dosages
+    private final int[] sparseSampleIndices;        // the non hom-ref samples for the variant currently being added
+    private final byte[] sparseGenotypeBytes;       // and their genotype bytes
     private long expectedVariantCount = 0L;
     private long droppedVariantCount = 0L;
     private long droppedSampleCount = 0L;
 
     // ******************** Native JNI methods  ********************
-    private static native long openPgen(String file, int pgenWriteModeInt, int writeFlags, long numberOfVariants, int numberOfSamples, int maxAltAlleles);
+    private static native long openPgen(String file, int pgenWriteModeInt, int writeFlags, long numberOfVariants, int numberOfSamples, int maxAltAlleles, int writerThreads);
     private static native boolean closePgen(long pgenContextHandle, long numDroppedVariants);
+    private static native void abandonPgen(long pgenContextHandle);
     private static native long getPgenVariantCount(long pgenContextHandle);
-    private static native boolean appendAlleles(long pgenContextHandle, ByteBuffer alleles, ByteBuffer phasing, int alleleCount);
+    private static native boolean appendAllelesBatch(long pgenContextHandle, ByteBuffer batch, int batchCapacity, int variantCount);
+    private static native boolean appendGenovec(long pgenContextHandle, ByteBuffer genovec, ByteBuffer phasePresent, ByteBuffer phaseInfo);
+    private static native boolean appendFloatDosages(long pgenContextHandle, ByteBuffer dosages, double hardCallThreshold);
+    private static native boolean startAsyncAppends(long pgenContextHandle, int queueDepth);
+    private static native boolean appendAllelesBatchAsync(long pgenContextHandle, ByteBuffer batch, int batchCapacity, int variantCount);
+    private static native boolean concatPgens(String[] shardFiles, String file, int pgenWriteModeInt);
     private static native ByteBuffer createBuffer(int length);
     private static native boolean destroyByteBuffer(ByteBuffer buffer);
    // ******************** End Native JNI methods  ********************
  
-    // If this java property is set/exists, the native PGEN writer component will be loaded from java.libary.path,
-    // otherwise it is assumed to be included as a resource at the top level of a jar on the classpath.
-    private static final String LOAD_PGEN_FROM_LIBRARY_PATH = "LOAD_PGEN_FROM_LIBRARY_PATH";
     static {
-        if (System.getProperty(LOAD_PGEN_FROM_LIBRARY_PATH) != null) {
-            // for local testing within the IDE
-            System.loadLibrary("pgen");
-        } else {
-            // otherwise, load it from a jar file on the classpath
-            NativeLibraryUtils.loadLibraryFromClasspath(
-                NativeLibraryUtils.runningOnMac() ?
-                    "/libpgen.dylib" :
-                    "/libpgen.so"
-            );
-        }
+        NativeLibraryUtils.loadPgenLibrary();
     }
  
    /**
@@ -213,6 +256,8 @@ public class PgenWriter implements VariantContextWriter {
      * @param pgenWriteMode the PGEN write mode to use (see {@code PgenWriteMode})
      * @param writeFlags the write flags to use - see {@code PgenWriteFlag}. If phase information is present for the source genotypes, include
      * the {@link PgenWriteFlag#PRESERVE_PHASING} flag. If multi allelic variants are present, include the {@link PgenWriteFlag#MULTI_ALLELIC} flag.
+     * To write dosages, include the {@link PgenWriteFlag#DOSAGE} flag; biallelic variants with DS (or GP) genotype fields are then written as
+     * (unphased) dosages, and all other variants as hardcalls.
      * @param chromosomeCode the plink2 chromosome coding scheme to use - see {@link PgenChromosomeCode}
      * @param lenientPloidyValidation PGEN requires individual sample to be diploid (except for sex chromsomes, which may be haploid - these are accepted
      * and recoded for pgen as heterozygous/diploid). By default, any ploidy failure will result in an exception to be thrown. Use tru for this value to
@@ -233,6 +278,63 @@ public class PgenWriter implements VariantContextWriter {
         final long numberOfVariants,
         final int maxAltAlleles,
         final String logFile) {
+        this(pgenFileName, vcfHeader, pgenWriteMode, writeFlags, chromosomeCode, lenientPloidyValidation, numberOfVariants, maxAltAlleles, logFile, 1);
+    }
+
+    /**
+     * Create a PGEN writer that compresses variants using {@code writerThreads} native threads. See
+     * {@link #PgenWriter(HtsPath, VCFHeader, PgenWriteMode, EnumSet, PgenChromosomeCode, boolean, long, int, String)}
+     * for a description of the other parameters.
+     *
+     * When {@code writerThreads} is greater than 1, variants are compressed in blocks of 64k variants per thread, which
+     * requires a known {@code numberOfVariants} ({@link PgenWriter#VARIANT_COUNT_UNKNOWN} may not be used), and up to
+     * {@code writerThreads} blocks of variants are buffered in native memory. The resulting .pgen is identical to the
+     * one written using a single thread. The same number of zstd worker threads is used to compress the .pvar.
+     *
+     * @param writerThreads the number of native threads to use to compress variants. must be at least 1.
+     **/
+    public PgenWriter(
+        final HtsPath pgenFileName,
+        final VCFHeader vcfHeader,
+        final PgenWriteMode pgenWriteMode,
+        final EnumSet<PgenWriteFlag> writeFlags,
+        final PgenChromosomeCode chromosomeCode,
+        final boolean lenientPloidyValidation,
+        final long numberOfVariants,
+        final int maxAltAlleles,
+        final String logFile,
+        final int writerThreads) {
+        this(pgenFileName, vcfHeader, pgenWriteMode, writeFlags, chromosomeCode, lenientPloidyValidation, numberOfVariants, maxAltAlleles, logFile, writerThreads, 0);
+    }
+
+    /**
+     * Create a PGEN writer that hands batches of variants off to a native writer thread, rather than waiting for each
+     * batch to be written. See
+     * {@link #PgenWriter(HtsPath, VCFHeader, PgenWriteMode, EnumSet, PgenChromosomeCode, boolean, long, int, String, int)}
+     * for a description of the other parameters.
+     *
+     * When {@code asyncQueueDepth} is greater than 0, up to {@code asyncQueueDepth} batches can be queued for the native
+     * writer thread while the next batch is being staged, and {@code asyncQueueDepth + 1} batch buffers are allocated in
+     * native memory. Errors from the native writer are reported on a subsequent call to {@link #add},
+     * {@link #getWrittenVariantCount} or {@link #close}. The variants of a queued batch are written to the .pvar when
+     * the batch is queued, so after such an error the writer can't be used further, and {@link #close} leaves the
+     * .pgen unfinished.
+     *
+     * @param asyncQueueDepth the maximum number of batches that can be queued for the native writer thread. 0 disables
+     *                        asynchronous writes.
+     **/
+    public PgenWriter(
+        final HtsPath pgenFileName,
+        final VCFHeader vcfHeader,
+        final PgenWriteMode pgenWriteMode,
+        final EnumSet<PgenWriteFlag> writeFlags,
+        final PgenChromosomeCode chromosomeCode,
+        final boolean lenientPloidyValidation,
+        final long numberOfVariants,
+        final int maxAltAlleles,
+        final String logFile,
+        final int writerThreads,
+        final int asyncQueueDepth) {
 
         if (!pgenFileName.hasExtension(PGEN_EXTENSION)) {
             throw new PgenException(
@@ -247,9 +349,16 @@ public class PgenWriter implements VariantContextWriter {
                     maxAltAlleles,
                     PLINK2_MAX_ALTERNATE_ALLELES));
         }
+        if (asyncQueueDepth < 0) {
+            throw new PgenException(String.format("Invalid async queue depth (%d). The queue depth must not be negative", asyncQueueDepth));
+        }
         this.maxAltAlleles = maxAltAlleles;
+        this.writeDosages = writeFlags.contains(PgenWriteFlag.DOSAGE);
+        this.preservePhasing = writeFlags.contains(PgenWriteFlag.PRESERVE_PHASING);
         this.expectedVariantCount = numberOfVariants;
         this.sampleNames = vcfHeader.getGenotypeSamples();
+        this.sparseSampleIndices = new int[sampleNames.size() / SPARSE_GENOTYPE_DIVISOR];
+        this.sparseGenotypeBytes = new byte[sparseSampleIndices.length];
 
         switch(chromosomeCode) {
             // at the moment, the only difference between the two supported codes is the name of the mitochondrial chromosome, but capture the
@@ -281,28 +390,35 @@ public class PgenWriter implements VariantContextWriter {
             PgenWriteFlag.toIntFlags(writeFlags),
             numberOfVariants,
             vcfHeader.getNGenotypeSamples(),
-            maxAltAlleles);
+            maxAltAlleles,
+            writerThreads);
         if (pgenContextHandle == 0) {
             //openPgen threw an async Java exception
             return;
         }
         
-        alleleBuffer = createBuffer(vcfHeader.getNGenotypeSamples() * DIPLOID_PLOIDY * 4); //samples * ploidy * bytes in int32_t (sizeof AlleleCode)
-        if (alleleBuffer == null) {
+        if (!createBatchBuffers(vcfHeader.getNGenotypeSamples(), asyncQueueDepth + 1)) {
             //createBuffer threw an async Java exception
             return;
         }
-        alleleBuffer.order(ByteOrder.LITTLE_ENDIAN);
- 
-        phasingBuffer = createBuffer(vcfHeader.getNGenotypeSamples());
-        if (phasingBuffer == null) {
-            //createBuffer threw an async Java exception
-            return;
+        if (writeDosages) {
+            dosageBuffer = createBuffer(vcfHeader.getNGenotypeSamples() * Float.BYTES);
+            if (dosageBuffer == null) {
+                //createBuffer threw an async Java exception
+                return;
+            }
+            dosageBuffer.order(ByteOrder.LITTLE_ENDIAN);
+        }
+        if (asyncQueueDepth > 0) {
+            if (!startAsyncAppends(pgenContextHandle, asyncQueueDepth)) {
+                //startAsyncAppends threw an async Java exception
+                return;
+            }
+            asyncAppends = true;
         }
-        phasingBuffer.order(ByteOrder.LITTLE_ENDIAN);
 
         // create the .pvar, and write the entire psam
-        pVarFile = createPVAR(pgenFileName, vcfHeader);
+        pVarFile = createPVAR(pgenFileName, vcfHeader, writerThreads);
         pSamFile = writePSAM(pgenFileName, vcfHeader);
     }
 
@@ -318,16 +434,27 @@ public class PgenWriter implements VariantContextWriter {
 
     @Override
     public void close() {
-        pVarWriter.close();
-        pVarWriter = null;
-
-        if (logFileWriter != null) {
+        if (!appendFailed) {
             try {
-                logFileWriter.close();
-            } catch (IOException e) {
-                throw new RuntimeIOException(String.format("Error closing dropped variants log file %s", logFile), e);
+                flushPendingVariants();
+                if (asyncAppends) {
+                    // wait for the queued batches here, so a failure writing one of them (whose variants are already
+                    // in the .pvar) is handled as a failed append, rather than by closePgen
+                    getNativeVariantCount();
+                }
+            } catch (final RuntimeException e) {
+                if (appendFailed) {
+                    abandonWriter();
+                }
+                throw e;
             }
         }
+        if (appendFailed) {
+            // fail rather than leave a file set that looks complete
+            abandonWriter();
+            throw new PgenException("The PGEN file set is incomplete and not valid, because a variant failed to be written");
+        }
+        closeTextOutputs();
 
         // closePgen returns false if it had to throw an async Java exception, so test for that, and if it failed,
         // don't do anything else that might throw.
@@ -337,12 +464,7 @@ public class PgenWriter implements VariantContextWriter {
         // writer is opened)
        if (closePgen(pgenContextHandle, droppedVariantCount)) {
             pgenContextHandle = 0;
-            //destroyByteBuffer might return false if for some reason it has to throw an async Java exception, but
-            // we don't need to test for that here since we're only nulling out a variable on return
-            destroyByteBuffer(alleleBuffer);
-            alleleBuffer = null;    
-            destroyByteBuffer(phasingBuffer);
-            phasingBuffer = null;    
+            destroyBuffers();
        }
     }
 
@@ -353,6 +475,7 @@ public class PgenWriter implements VariantContextWriter {
 
     @Override
     public void add(final VariantContext vc) {
+        checkNotFailed();
         if (vc.getNAlleles() > maxAltAlleles) {
             droppedVariantCount++;
             if (logFileWriter != null) {
@@ -364,9 +487,19 @@ public class PgenWriter implements VariantContextWriter {
             }
             return;
         }
-        
+        if (writeDosages && vc.isBiallelic() && hasDosages(vc)) {
+            addDosages(vc);
+            return;
+        }
+
+        alleleBuffer = alleleSlots[pendingVariants.size()];
+        phasingBuffer = phasingSlots[pendingVariants.size()];
         alleleBuffer.clear();
         phasingBuffer.clear();
+        if (vc.isBiallelic() && addGenotypeBytes(vc)) {
+            return;
+        }
+        alleleBuffer.clear();
         final Map<Allele, Integer> alleleMap = buildAlleleMap(vc);
     
         // Because there may be missing genotyopes, it is significantly simpler to have the primary iteration be
@@ -455,10 +588,52 @@ public class PgenWriter implements VariantContextWriter {
                     phasingBuffer.limit()));
         }
 
-        alleleBuffer.rewind();
-        phasingBuffer.rewind();
-        final boolean appendRet = appendAlleles(pgenContextHandle, alleleBuffer, phasingBuffer, alleleMap.size() - 1);
-        if (appendRet) { // only add to the pvar if appendAlleles succeeded
+        // record the allele count for this variant in the allele count section at the start of the batch buffer
+        batchBuffer.putInt(pendingVariants.size() * Integer.BYTES, alleleMap.size() - 1);
+        pendingVariants.add(vc);
+        if (pendingVariants.size() == batchCapacity) {
+            flushPendingVariants();
+        }
+    }
+
+    /**
+     * Add a biallelic variant whose genotypes are already packed in the native 2-bit genotype vector layout, bypassing
+     * the per-sample genotype conversion done by {@link #add}. Only the site level information in {@code vc} is used
+     * (it's written to the .pvar); any genotypes it contains are ignored.
+     *
+     * All buffers must be direct, 8-byte aligned, and hold little-endian 64-bit words:
+     * <ul>
+     *     <li>{@code genovec}: 2 bits per sample, 32 samples per word, with sample i in bits 2*(i%32) of word i/32.
+     *     Each value is the alt allele count (0, 1 or 2), or 3 for a missing genotype. Unused trailing bits must be 0.</li>
+     *     <li>{@code phasePresent}: 1 bit per sample, 64 samples per word, set for the het calls that are phased. May
+     *     be null if all het calls are phased. Only het calls may be set.</li>
+     *     <li>{@code phaseInfo}: 1 bit per sample, 64 samples per word, set for phased het calls where the alt allele
+     *     is first (1|0). May be null if the variant is unphased. Requires {@link PgenWriteFlag#PRESERVE_PHASING}.</li>
+     * </ul>
+     *
+     * Packed variants are written directly (rather than batched), so any staged variants are flushed first to
+     * preserve the variant order.
+     *
+     * @param vc the variant, which must be biallelic
+     * @param genovec the packed genotypes
+     * @param phasePresent the phased het calls, or null
+     * @param phaseInfo the phase of the phased het calls, or null
+     */
+    public void addPackedGenotypes(
+            final VariantContext vc,
+            final ByteBuffer genovec,
+            final ByteBuffer phasePresent,
+            final ByteBuffer phaseInfo) {
+        if (!vc.isBiallelic()) {
+            throw new PgenException(
+                String.format("Packed genotypes can only be added for biallelic variants (%s)", vc.toStringWithoutGenotypes()));
+        }
+        checkNotFailed();
+        flushPendingVariants();
+        // appendFailed is only cleared if the variant is accepted (appendGenovec throws if it fails)
+        appendFailed = true;
+        if (appendGenovec(pgenContextHandle, genovec, phasePresent, phaseInfo)) {
+            appendFailed = false;
             pVarWriter.add(vc);
         }
     }
@@ -479,9 +654,100 @@ public class PgenWriter implements VariantContextWriter {
      /**
      * @return the number of variants actually written to the PGEN
      * 
-     * Delegates to the pgenlib code to get the actual number recorded by the pgen library code.
+     * Delegates to the pgenlib code to get the actual number recorded by the pgen library code. Any variants that are
+     * staged in the batch buffer are flushed to the native writer first.
+     */
+    public long getWrittenVariantCount() {
+        checkNotFailed();
+        flushPendingVariants();
+        return getNativeVariantCount();
+    }
+
+    /**
+     * Concatenate PGEN file sets that have the same samples (for instance, the shards of a conversion that was split
+     * by genomic region across several writers) into a new PGEN file set, with the variants of each shard following
+     * those of the previous shard. The .pgen variant records are copied natively without being decoded, and only the
+     * .pgen header and index are rebuilt, so the .pgen is concatenated at close to disk speed. The .pvar keeps the
+     * header of the first shard and the variant lines of every shard, and the .psam is copied from the first shard.
+     *
+     * @param shardPgenFiles the .pgen files of the shards, in output order. each must have its .pvar and .psam
+     *                       companion files, and the .psam files must be identical.
+     * @param pgenFile the .pgen file to create (must end in .pgen)
+     * @param pgenWriteMode the PGEN write mode to use for the output .pgen (see {@code PgenWriteMode})
      */
-    public long getWrittenVariantCount() { return getPgenVariantCount(pgenContextHandle); }
+    public static void concatenate(
+            final List<HtsPath> shardPgenFiles,
+            final HtsPath pgenFile,
+            final PgenWriteMode pgenWriteMode) {
+        if (shardPgenFiles.isEmpty()) {
+            throw new IllegalArgumentException("At least one PGEN shard is required for concatenation");
+        }
+        // the native code only checks that the shards have the same number of samples
+        final Path pSamPath = getCompanionPath(shardPgenFiles.get(0), PSAM_EXTENSION);
+        for (final HtsPath shardPgenFile : shardPgenFiles) {
+            final Path shardPSamPath = getCompanionPath(shardPgenFile, PSAM_EXTENSION);
+            try {
+                if (Files.mismatch(pSamPath, shardPSamPath) != -1L) {
+                    throw new PgenException(String.format(
+                            "The samples in %s don't match the samples in %s", shardPSamPath, pSamPath));
+                }
+            } catch (final IOException e) {
+                throw new RuntimeIOException(String.format("Error reading the .psam file %s", shardPSamPath), e);
+            }
+        }
+
+        final String[] shardFiles = new String[shardPgenFiles.size()];
+        for (int i = 0; i < shardFiles.length; i++) {
+            shardFiles[i] = shardPgenFiles.get(i).toPath().toAbsolutePath().toString();
+        }
+        // concatPgens returns false if it had to throw an async Java exception
+        if (!concatPgens(shardFiles, pgenFile.toPath().toAbsolutePath().toString(), pgenWriteMode.value())) {
+            return;
+        }
+
+        final Path pVarPath = getCompanionPath(pgenFile, PVAR_EXTENSION);
+        try (final OutputStream pVarStream = new BufferedOutputStream(
+                new ZstdOutputStream(Files.newOutputStream(pVarPath)), PVAR_COPY_BUFFER_BYTES)) {
+            for (int i = 0; i < shardPgenFiles.size(); i++) {
+                final Path shardPVarPath = getCompanionPath(shardPgenFiles.get(i), PVAR_EXTENSION);
+                try (final InputStream shardPVarStream = new BufferedInputStream(
+                        new ZstdInputStream(Files.newInputStream(shardPVarPath)), PVAR_COPY_BUFFER_BYTES)) {
+                    if (i > 0) {
+                        skipPvarHeader(shardPVarStream);
+                    }
+                    shardPVarStream.transferTo(pVarStream);
+                }
+            }
+        } catch (final IOException e) {
+            throw new RuntimeIOException(String.format("Error writing the .pvar file %s", pVarPath), e);
+        }
+        final Path outputPSamPath = getCompanionPath(pgenFile, PSAM_EXTENSION);
+        try {
+            Files.copy(pSamPath, outputPSamPath, StandardCopyOption.REPLACE_EXISTING);
+        } catch (final IOException e) {
+            throw new RuntimeIOException(String.format("Error writing the .psam file %s", outputPSamPath), e);
+        }
+    }
+
+    // skip the header lines (the lines starting with '#') at the start of a .pvar stream
+    private static void skipPvarHeader(final InputStream pVarStream) throws IOException {
+        while (true) {
+            pVarStream.mark(1);
+            if (pVarStream.read() != VCFConstants.HEADER_INDICATOR.charAt(0)) {
+                pVarStream.reset();
+                return;
+            }
+            int c;
+            while (((c = pVarStream.read()) != -1) && (c != '\n')) {
+            }
+        }
+    }
+
+    // the companion file of {@code pgenFile} that has {@code extension}
+    static Path getCompanionPath(final HtsPath pgenFile, final String extension) {
+        final String pgenFilePrefix = getAbsoluteFileNameWithoutExtension(pgenFile.toPath(), PGEN_EXTENSION);
+        return pgenFile.toPath().resolveSibling(pgenFilePrefix + extension);
+    }
 
     /**
      * given a Path, return the absolute path of the file, without the trailing extension
@@ -493,26 +759,90 @@ public class PgenWriter implements VariantContextWriter {
     }
     
     /**
-     * Create a .pvar companion file for {@code pgenFile}.
+     * Allocate {@code bufferCount} native batch buffers, and create the per-variant allele and phasing slot views on
+     * each of them. The layout of each batch buffer must match the layout expected by the native appendAllelesBatch
+     * method:
+     *
+     *  allele counts: batchCapacity * int32
+     *  allele codes:  batchCapacity * numberOfSamples * ploidy * int32
+     *  phase bytes:   batchCapacity * numberOfSamples * byte
+     *
+     * @return false if createBuffer threw an async Java exception
      */
-    private HtsPath createPVAR(final HtsPath pgenFile, final VCFHeader vcfHeader) {
+    private boolean createBatchBuffers(final int numberOfSamples, final int bufferCount) {
+        final int alleleSlotBytes = numberOfSamples * DIPLOID_PLOIDY * Integer.BYTES; //samples * ploidy * bytes in int32_t (sizeof AlleleCode)
+        final int phasingSlotBytes = numberOfSamples;
+        final long bytesPerVariant = Integer.BYTES + (long) alleleSlotBytes + phasingSlotBytes;
+        batchCapacity = (int) Math.max(1L, Math.min(MAX_BATCH_VARIANTS, MAX_BATCH_BUFFER_BYTES / bytesPerVariant));
+
+        batchBuffers = new ByteBuffer[bufferCount];
+        batchAlleleSlots = new ByteBuffer[bufferCount][batchCapacity];
+        batchPhasingSlots = new ByteBuffer[bufferCount][batchCapacity];
+        final int alleleSectionOffset = batchCapacity * Integer.BYTES;
+        final int phasingSectionOffset = alleleSectionOffset + (batchCapacity * alleleSlotBytes);
+        for (int b = 0; b < bufferCount; b++) {
+            final ByteBuffer buffer = createBuffer((int) (batchCapacity * bytesPerVariant));
+            if (buffer == null) {
+                return false;
+            }
+            buffer.order(ByteOrder.LITTLE_ENDIAN);
+            batchBuffers[b] = buffer;
+            for (int i = 0; i < batchCapacity; i++) {
+                batchAlleleSlots[b][i] = buffer.slice(alleleSectionOffset + (i * alleleSlotBytes), alleleSlotBytes).order(ByteOrder.LITTLE_ENDIAN);
+                batchPhasingSlots[b][i] = buffer.slice(phasingSectionOffset + (i * phasingSlotBytes), phasingSlotBytes).order(ByteOrder.LITTLE_ENDIAN);
+            }
+        }
+        selectBatchBuffer(0);
+        return true;
+    }
+
+    /**
+     * Make batch buffer {@code index} the one that variants are staged in.
+     */
+    private void selectBatchBuffer(final int index) {
+        currentBatch = index;
+        batchBuffer = batchBuffers[index];
+        alleleSlots = batchAlleleSlots[index];
+        phasingSlots = batchPhasingSlots[index];
+    }
+
+    /**
+     * Hand any variants staged in the batch buffer to the native writer, and add them to the .pvar. With async
+     * appends the batch is only queued, and staging moves on to the next batch buffer, since the native writer
+     * thread may still be reading this one.
+     *
+     * If the batch fails, the variants before the failed one have already been written to the .pgen, but none are
+     * added to the .pvar, so the writer is marked as failed.
+     */
+    private void flushPendingVariants() {
+        if (pendingVariants.isEmpty()) {
+            return;
+        }
+        // appendFailed is only cleared if the batch is accepted (the native append throws if it fails)
+        appendFailed = true;
+        final boolean appendRet = asyncAppends ?
+            appendAllelesBatchAsync(pgenContextHandle, batchBuffer, batchCapacity, pendingVariants.size()) :
+            appendAllelesBatch(pgenContextHandle, batchBuffer, batchCapacity, pendingVariants.size());
+        if (appendRet) { // only add to the pvar if the batch was accepted
+            appendFailed = false;
+            for (final VariantContext vc : pendingVariants) {
+                pVarWriter.add(vc);
+            }
+        }
+        pendingVariants.clear();
+        if (asyncAppends) {
+            selectBatchBuffer((currentBatch + 1) % batchBuffers.length);
+        }
+    }
+
+    /**
+     * Create a .pvar companion file for {@code pgenFile}, compressed using {@code compressionThreads} zstd workers.
+     */
+    private HtsPath createPVAR(final HtsPath pgenFile, final VCFHeader vcfHeader, final int compressionThreads) {
         final String pgenFilePrefix = getAbsoluteFileNameWithoutExtension(pgenFile.toPath(), PGEN_EXTENSION);
         final HtsPath pVarFile = new HtsPath(pgenFile.toPath()
             .resolveSibling(pgenFilePrefix + PgenWriter.PVAR_EXTENSION)
             .toAbsolutePath().toString());
-        final OutputStream pVarOutputStream = pVarFile.getOutputStream();
-        ZstdOutputStream zstdStream;
-        try {
-            zstdStream = new ZstdOutputStream(pVarOutputStream);
-        } catch (final IOException e) {
-            throw new RuntimeIOException(String.format("Error creating the zstd output stream for the .pvar file %s", pVarFile.getRawInputString()), e);
-        }
-        // technically we're writing a PVAR, not a VCF, but we can do so by composing the VCFWriter with a ZstdOutputStream
-        pVarWriter = new VariantContextWriterBuilder()
-            .clearOptions()
-            .setOptions(EnumSet.of(Options.DO_NOT_WRITE_GENOTYPES, Options.ALLOW_MISSING_FIELDS_IN_HEADER))
-            .setOutputStream(zstdStream)
-           .build();
 
         // Ideally there would be a way to record the provenance/origin of a PGEN file right in the file itself, so we can identify
         // files written by this writer, but there isn't. So instead add a "source=..." VCF header line to the .pvar, similar to the
@@ -525,7 +855,8 @@ public class PgenWriter implements VariantContextWriter {
                     implementationVersion == null ?
                         "no version found in jar manifest" :
                         implementationVersion)));
-        pVarWriter.writeHeader(vcfHeader);
+        // technically we're writing a PVAR, not a VCF, but the PVAR is a sites-only VCF
+        pVarWriter = new PvarWriter(pVarFile, vcfHeader, compressionThreads);
         return pVarFile;
     }
 
@@ -556,6 +887,72 @@ public class PgenWriter implements VariantContextWriter {
         return pSamFile;
     }
 
+    /**
+     * Stage a biallelic variant as one genotype byte (alt allele count, or -9 for missing) per sample, which is a
+     * quarter of the size of the allele code representation and is converted natively without a multiallelic scan.
+     * If there are few enough non hom-ref genotypes, they are staged as a sparse genotype list instead (the genotype
+     * count, followed by the sample indices and the genotype bytes).
+     * Returns false, leaving the variant unstaged, if any genotype can't be represented this way (non-diploid
+     * calls other than haploid X/Y, partial no-calls, or phased hets when phasing is being preserved), in which case
+     * the caller must fall back to allele codes.
+     */
+    private boolean addGenotypeBytes(final VariantContext vc) {
+        final Allele refAllele = vc.getReference();
+        final boolean haploidContig = vc.getContig().equals(xChromosomeName) || vc.getContig().equals(yChromosomeName);
+        int sparseGenotypeCount = 0;
+        for (int sampleIndex = 0; sampleIndex < sampleNames.size(); sampleIndex++) {
+            final Genotype g = vc.getGenotype(sampleNames.get(sampleIndex));
+            byte genotypeByte = GENOTYPE_BYTE_NO_CALL;
+            if (g != null) {
+                final int ploidy = g.getPloidy();
+                if (ploidy == HAPLOID_PLOIDY && haploidContig) {
+                    final Allele allele = g.getAllele(0);
+                    if (allele.isCalled()) {
+                        // convert the haploid call to a homozygous diploid call to satisfy plink
+                        genotypeByte = (byte) (allele.equals(refAllele) ? 0 : 2);
+                    }
+                } else if (ploidy != DIPLOID_PLOIDY) {
+                    return false;
+                } else if (g.isCalled() && !g.isMixed()) {
+                    if (preservePhasing && g.isPhased() && g.isHet()) {
+                        return false;
+                    }
+                    genotypeByte = (byte) ((g.getAllele(0).equals(refAllele) ? 0 : 1) + (g.getAllele(1).equals(refAllele) ? 0 : 1));
+                } else if (!g.isNoCall()) {
+                    // htsjdk considers partial no-calls (MIXED genotypes) to be called, so they're rejected here
+                    return false;
+                }
+            }
+            alleleBuffer.put(genotypeByte);
+            if (genotypeByte != 0) {
+                if (sparseGenotypeCount < sparseSampleIndices.length) {
+                    sparseSampleIndices[sparseGenotypeCount] = sampleIndex;
+                    sparseGenotypeBytes[sparseGenotypeCount] = genotypeByte;
+                }
+                sparseGenotypeCount++;
+            }
+        }
+
+        // the genotype byte/sparse genotype marker replaces the allele count, and tells the native writer how to read
+        // the slot
+        if (sparseGenotypeCount <= sparseSampleIndices.length) {
+            alleleBuffer.clear();
+            alleleBuffer.putInt(sparseGenotypeCount);
+            for (int i = 0; i < sparseGenotypeCount; i++) {
+                alleleBuffer.putInt(sparseSampleIndices[i]);
+            }
+            alleleBuffer.put(sparseGenotypeBytes, 0, sparseGenotypeCount);
+            batchBuffer.putInt(pendingVariants.size() * Integer.BYTES, SPARSE_GENOTYPE_ALLELE_COUNT);
+        } else {
+            batchBuffer.putInt(pendingVariants.size() * Integer.BYTES, GENOTYPE_BYTES_ALLELE_COUNT);
+        }
+        pendingVariants.add(vc);
+        if (pendingVariants.size() == batchCapacity) {
+            flushPendingVariants();
+        }
+        return true;
+    }
+
     private void updateAlleleBuffer(final VariantContext vc, final Genotype genotype, final Allele allele, final Integer alleleCode) {
         try {
             alleleBuffer.putInt(alleleCode);
@@ -587,6 +984,150 @@ public class PgenWriter implements VariantContextWriter {
         }
     }
 
+    private static boolean hasDosages(final VariantContext vc) {
+        for (final Genotype g : vc.getGenotypes()) {
+            if (g.hasExtendedAttribute(DOSAGE_KEY) || g.hasExtendedAttribute(GENOTYPE_PROBABILITIES_KEY)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Write a biallelic variant as dosages. Dosages are written directly (rather than batched), so any staged
+     * hardcall variants are flushed first to preserve the variant order.
+     */
+    private void addDosages(final VariantContext vc) {
+        flushPendingVariants();
+        dosageBuffer.clear();
+        for (final String sampleName : sampleNames) {
+            dosageBuffer.putFloat(getAltDosage(vc.getGenotype(sampleName)));
+        }
+        // appendFailed is only cleared if the variant is accepted (appendFloatDosages throws if it fails)
+        appendFailed = true;
+        if (appendFloatDosages(pgenContextHandle, dosageBuffer, HARD_CALL_THRESHOLD)) {
+            appendFailed = false;
+            pVarWriter.add(vc);
+        }
+    }
+
+    // With async appends, getPgenVariantCount waits for the queued batches, and throws if any of them failed. Their
+    // variants were added to the .pvar when they were queued, so that is a failed append.
+    private long getNativeVariantCount() {
+        appendFailed = asyncAppends;
+        final long variantCount = getPgenVariantCount(pgenContextHandle);
+        appendFailed = false;
+        return variantCount;
+    }
+
+    // throw if a previous append failed, since the .pgen no longer matches the .pvar
+    private void checkNotFailed() {
+        if (appendFailed) {
+            throw new PgenException("The PGEN writer can't be used after a variant failed to be written");
+        }
+    }
+
+    // release the native writer without finishing the .pgen, which doesn't match the .pvar after a failed append
+    private void abandonWriter() {
+        final long handle = pgenContextHandle;
+        pgenContextHandle = 0;
+        abandonPgen(handle);
+        destroyBuffers();
+        closeTextOutputs();
+    }
+
+    private void closeTextOutputs() {
+        pVarWriter.close();
+        pVarWriter = null;
+
+        if (logFileWriter != null) {
+            try {
+                logFileWriter.close();
+            } catch (IOException e) {
+                throw new RuntimeIOException(String.format("Error closing dropped variants log file %s", logFile), e);
+            }
+        }
+    }
+
+    // free the native batch and dosage buffers once the native writer has been released
+    private void destroyBuffers() {
+        //destroyByteBuffer might return false if for some reason it has to throw an async Java exception, but
+        // we don't need to test for that here since we're only nulling out a variable on return
+        // the allele and phasing slots are views on the batch buffers, so only the batch buffers themselves are
+        // freed. the native writer thread, if any, has already finished with them
+        for (final ByteBuffer buffer : batchBuffers) {
+            destroyByteBuffer(buffer);
+        }
+        batchBuffers = null;
+        if (dosageBuffer != null) {
+            destroyByteBuffer(dosageBuffer);
+            dosageBuffer = null;
+        }
+        batchAlleleSlots = null;
+        batchPhasingSlots = null;
+        batchBuffer = null;
+        alleleSlots = null;
+        phasingSlots = null;
+        alleleBuffer = null;
+        phasingBuffer = null;
+    }
+
+    /**
+     * @return the alt allele dosage for a biallelic genotype, taken from the DS field if present, otherwise computed
+     * from the GP field if present, and otherwise derived from the hardcall. Haploid genotypes are treated as
+     * homozygous, as for hardcall variants, so a haploid DS (0 to 1) is doubled, and a haploid (2-entry) GP gives
+     * twice the alt probability. Returns MISSING_DOSAGE if no dosage can be determined.
+     */
+    private static float getAltDosage(final Genotype g) {
+        if (g == null) {
+            return MISSING_DOSAGE;
+        }
+        if (g.hasExtendedAttribute(DOSAGE_KEY)) {
+            final double[] ds = parseDoubles(g.getExtendedAttribute(DOSAGE_KEY));
+            if (ds.length != 1 || Double.isNaN(ds[0])) {
+                return MISSING_DOSAGE;
+            }
+            return g.getPloidy() == HAPLOID_PLOIDY ? (float) (2.0 * ds[0]) : (float) ds[0];
+        }
+        if (g.hasExtendedAttribute(GENOTYPE_PROBABILITIES_KEY)) {
+            final double[] gp = parseDoubles(g.getExtendedAttribute(GENOTYPE_PROBABILITIES_KEY));
+            if (gp.length == 2) {
+                return !Double.isNaN(gp[1]) ? (float) (2.0 * gp[1]) : MISSING_DOSAGE;
+            }
+            return gp.length == 3 && !Double.isNaN(gp[1]) && !Double.isNaN(gp[2]) ? (float) (gp[1] + 2.0 * gp[2]) : MISSING_DOSAGE;
+        }
+        if (!g.isCalled() || (g.getPloidy() != HAPLOID_PLOIDY && g.getPloidy() != DIPLOID_PLOIDY)) {
+            return MISSING_DOSAGE;
+        }
+        int altCount = 0;
+        for (final Allele allele : g.getAlleles()) {
+            if (allele.isNoCall()) {
+                return MISSING_DOSAGE;
+            } else if (allele.isNonReference()) {
+                altCount++;
+            }
+        }
+        return g.getPloidy() == HAPLOID_PLOIDY ? 2.0f * altCount : altCount;
+    }
+
+    // parse a (possibly comma separated) numeric genotype field value, with missing (".") values returned as NaN
+    private static double[] parseDoubles(final Object value) {
+        if (value instanceof Number) {
+            return new double[] { ((Number) value).doubleValue() };
+        }
+        final List<?> values = value instanceof List ? (List<?>) value : List.of(value.toString().split(","));
+        final double[] parsed = new double[values.size()];
+        for (int i = 0; i < parsed.length; i++) {
+            final String s = values.get(i).toString();
+            try {
+                parsed[i] = s.equals(VCFConstants.MISSING_VALUE_v4) ? Double.NaN : Double.parseDouble(s);
+            } catch (final NumberFormatException e) {
+                throw new PgenException(String.format("Invalid dosage value (%s)", s));
+            }
+        }
+        return parsed;
+    }
+
     private static Map<Allele, Integer> buildAlleleMap(final VariantContext vc) {
         final Map<Allele, Integer> alleleMap = new HashMap<>(vc.getAlleles().size() + 1);
         alleleMap.put(Allele.NO_CALL, PLINK2_NO_CALL_VALUE); // convenience for lookup
@@ -0,0 +1,188 @@
+/**
+ * Copyright (c) 2023, Broad Institute, Inc. All rights reserved.
+ */
+
+package org.broadinstitute.pgen;
+
+import com.github.luben.zstd.ZstdOutputStream;
+import htsjdk.io.HtsPath;
+import htsjdk.samtools.util.RuntimeIOException;
+import htsjdk.variant.variantcontext.VariantContext;
+import htsjdk.variant.variantcontext.writer.Options;
+import htsjdk.variant.variantcontext.writer.VariantContextWriter;
+import htsjdk.variant.variantcontext.writer.VariantContextWriterBuilder;
+import htsjdk.variant.vcf.VCFConstants;
+import htsjdk.variant.vcf.VCFEncoder;
+import htsjdk.variant.vcf.VCFHeader;
+import htsjdk.variant.vcf.VCFHeaderLineCount;
+import htsjdk.variant.vcf.VCFInfoHeaderLine;
+
+import java.io.BufferedOutputStream;
+import java.io.ByteArrayOutputStream;
+import java.io.Closeable;
+import java.io.IOException;
+import java.io.OutputStream;
+import java.nio.charset.StandardCharsets;
+import java.util.ArrayList;
+import java.util.Collections;
+import java.util.EnumSet;
+import java.util.List;
+import java.util.Map;
+import java.util.TreeMap;
+
+/**
+ * Writes the zstd compressed .pvar companion file for a PGEN. The .pvar is a sites-only VCF, and its contents are the
+ * same as those written by an htsjdk VariantContextWriter using {@link Options#DO_NOT_WRITE_GENOTYPES}. However, only
+ * the header is written through htsjdk; each variant line (CHROM, POS, ID, REF, ALT, QUAL, FILTER and INFO) is
+ * formatted directly into a reused buffer, which avoids the per-variant VariantContext copy and genotype handling done
+ * by the htsjdk writer, and the output is compressed using multiple zstd worker threads when requested.
+ */
+final class PvarWriter implements Closeable {
+    // large enough that each write to the zstd stream hands it a substantial chunk of lines
+    private static final int OUTPUT_BUFFER_BYTES = 1 << 20;
+
+    // these mirror the QUAL formatting used by htsjdk's VCFEncoder
+    private static final String QUAL_FORMAT_STRING = "%.2f";
+    private static final String QUAL_FORMAT_EXTENSION_TO_TRIM = ".00";
+
+    private final HtsPath pVarFile;
+    private final VCFHeader sitesOnlyHeader;
+    private final OutputStream outputStream;
+    private final StringBuilder line = new StringBuilder(256);
+    private final Map<String, String> infoFields = new TreeMap<>();
+
+    /**
+     * Create the .pvar file and write its header.
+     *
+     * @param pVarFile the .pvar.zst file to create
+     * @param vcfHeader the VCF header for the variants; any genotype samples it contains are not written
+     * @param compressionThreads the number of zstd worker threads to use. values less than 2 compress on the calling
+     *                           thread.
+     */
+    PvarWriter(final HtsPath pVarFile, final VCFHeader vcfHeader, final int compressionThreads) {
+        this.pVarFile = pVarFile;
+        this.sitesOnlyHeader = new VCFHeader(vcfHeader.getMetaDataInSortedOrder());
+        try {
+            final ZstdOutputStream zstdStream = new ZstdOutputStream(pVarFile.getOutputStream());
+            if (compressionThreads > 1) {
+                zstdStream.setWorkers(compressionThreads);
+            }
+            outputStream = new BufferedOutputStream(zstdStream, OUTPUT_BUFFER_BYTES);
+            outputStream.write(getHeaderBytes(vcfHeader));
+        } catch (final IOException e) {
+            throw new RuntimeIOException(String.format("Error creating the .pvar file %s", pVarFile.getRawInputString()), e);
+        }
+    }
+
+    /**
+     * Write the site level information for {@code vc} to the .pvar. Any genotypes it contains are ignored.
+     */
+    void add(final VariantContext vc) {
+        line.setLength(0);
+        line.append(vc.getContig()).append(VCFConstants.FIELD_SEPARATOR);
+        line.append(vc.getStart()).append(VCFConstants.FIELD_SEPARATOR);
+        line.append(vc.getID()).append(VCFConstants.FIELD_SEPARATOR);
+        line.append(vc.getReference().getDisplayString()).append(VCFConstants.FIELD_SEPARATOR);
+        if (vc.isVariant()) {
+            for (int i = 0; i < vc.getAlternateAlleles().size(); i++) {
+                if (i > 0) {
+                    line.append(',');
+                }
+                line.append(vc.getAlternateAllele(i).getDisplayString());
+            }
+        } else {
+            line.append(VCFConstants.EMPTY_ALTERNATE_ALLELE_FIELD);
+        }
+        line.append(VCFConstants.FIELD_SEPARATOR);
+        appendQual(vc);
+        line.append(VCFConstants.FIELD_SEPARATOR);
+        appendFilters(vc);
+        line.append(VCFConstants.FIELD_SEPARATOR);
+        appendInfo(vc);
+        line.append('\n');
+        try {
+            outputStream.write(line.toString().getBytes(StandardCharsets.UTF_8));
+        } catch (final IOException e) {
+            throw new RuntimeIOException(String.format("Error writing to the .pvar file %s", pVarFile.getRawInputString()), e);
+        }
+    }
+
+    @Override
+    public void close() {
+        try {
+            outputStream.close();
+        } catch (final IOException e) {
+            throw new RuntimeIOException(String.format("Error closing the .pvar file %s", pVarFile.getRawInputString()), e);
+        }
+    }
+
+    /**
+     * Render the sites-only header using the htsjdk writer, so it is identical to the header htsjdk would write.
+     */
+    private static byte[] getHeaderBytes(final VCFHeader vcfHeader) {
+        final ByteArrayOutputStream headerStream = new ByteArrayOutputStream();
+        try (final VariantContextWriter headerWriter = new VariantContextWriterBuilder()
+                .clearOptions()
+                .setOptions(EnumSet.of(Options.DO_NOT_WRITE_GENOTYPES, Options.ALLOW_MISSING_FIELDS_IN_HEADER))
+                .setOutputStream(headerStream)
+                .build()) {
+            headerWriter.writeHeader(vcfHeader);
+        }
+        return headerStream.toByteArray();
+    }
+
+    private void appendQual(final VariantContext vc) {
+        if (!vc.hasLog10PError()) {
+            line.append(VCFConstants.MISSING_VALUE_v4);
+            return;
+        }
+        final String qual = String.format(QUAL_FORMAT_STRING, vc.getPhredScaledQual());
+        line.append(qual, 0, qual.endsWith(QUAL_FORMAT_EXTENSION_TO_TRIM) ?
+                qual.length() - QUAL_FORMAT_EXTENSION_TO_TRIM.length() :
+                qual.length());
+    }
+
+    private void appendFilters(final VariantContext vc) {
+        if (vc.isFiltered()) {
+            final List<String> filters = new ArrayList<>(vc.getFilters());
+            Collections.sort(filters);
+            line.append(String.join(VCFConstants.FILTER_CODE_SEPARATOR, filters));
+        } else if (vc.filtersWereApplied()) {
+            line.append(VCFConstants.PASSES_FILTERS_v4);
+        } else {
+            line.append(VCFConstants.UNFILTERED);
+        }
+    }
+
+    // INFO fields are written in key order, and flag fields (which have an integer count of 0) are written without a
+    // value, as they are by htsjdk's VCFEncoder
+    private void appendInfo(final VariantContext vc) {
+        infoFields.clear();
+        for (final Map.Entry<String, Object> field : vc.getAttributes().entrySet()) {
+            final String value = VCFEncoder.formatVCFField(field.getValue());
+            if (value != null) {
+                infoFields.put(field.getKey(), value);
+            }
+        }
+        if (infoFields.isEmpty()) {
+            line.append(VCFConstants.EMPTY_INFO_FIELD);
+            return;
+        }
+        boolean isFirst = true;
+        for (final Map.Entry<String, String> field : infoFields.entrySet()) {
+            if (!isFirst) {
+                line.append(VCFConstants.INFO_FIELD_SEPARATOR);
+            }
+            isFirst = false;
+            line.append(field.getKey());
+            if (!field.getValue().isEmpty()) {
+                final VCFInfoHeaderLine headerLine = sitesOnlyHeader.getInfoHeaderLine(field.getKey());
+                if (headerLine == null ||
+                        headerLine.getCountType() != VCFHeaderLineCount.INTEGER ||
+                        headerLine.getCount() != 0) {
+                    line.append('=').append(field.getValue());
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,873 @@
+/**
+ * Copyright (c) 2023, Broad Institute, Inc. All rights reserved.
+ */
+
+package org.broadinstitute.pgen;
+
+import htsjdk.io.HtsPath;
+import htsjdk.samtools.util.CloseableIterator;
+import htsjdk.variant.variantcontext.Allele;
+import htsjdk.variant.variantcontext.Genotype;
+import htsjdk.variant.variantcontext.VariantContext;
+import htsjdk.variant.vcf.VCFFileReader;
+
+import org.broadinstitute.pgen.PgenReader.PgenReadFlag;
+import org.broadinstitute.pgen.PgenWriter.PgenChromosomeCode;
+import org.broadinstitute.pgen.PgenWriter.PgenWriteFlag;
+import org.broadinstitute.pgen.PgenWriter.PgenWriteMode;
+import org.broadinstitute.pgen.TestUtils.PgenFileSet;
+import org.testng.Assert;
+import org.testng.annotations.DataProvider;
+import org.testng.annotations.Test;
+
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.DoubleBuffer;
+import java.nio.FloatBuffer;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.nio.file.Paths;
+import java.nio.file.StandardOpenOption;
+import java.util.BitSet;
+import java.util.EnumSet;
+import java.util.List;
+import java.util.stream.IntStream;
+
+public class PgenReadTest {
+
+    @DataProvider(name="roundTripReadProvider")
+    public Object[][] roundTripReadProvider() {
+        return new Object[][] {
+            // biallelic, unphased
+            { Paths.get("testdata/CEUtrioTest.vcf").toAbsolutePath(), PgenWriteMode.PGEN_FILE_MODE_BACKWARD_SEEK, PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT, EnumSet.noneOf(PgenWriteFlag.class), EnumSet.noneOf(PgenReadFlag.class) },
+            { Paths.get("testdata/CEUtrioTest.vcf").toAbsolutePath(), PgenWriteMode.PGEN_FILE_MODE_WRITE_SEPARATE_INDEX, PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT, EnumSet.noneOf(PgenWriteFlag.class), EnumSet.noneOf(PgenReadFlag.class) },
+            { Paths.get("testdata/CEUtrioTest.vcf").toAbsolutePath(), PgenWriteMode.PGEN_FILE_MODE_WRITE_SEPARATE_INDEX, PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT, EnumSet.noneOf(PgenWriteFlag.class), EnumSet.of(PgenReadFlag.MEMORY_MAP) },
+
+            // phased
+            { Paths.get("testdata/1kg_phase3_chr21_start.vcf.gz").toAbsolutePath(), PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY, PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT, EnumSet.of(PgenWriteFlag.PRESERVE_PHASING), EnumSet.noneOf(PgenReadFlag.class) },
+            { Paths.get("testdata/1kg_phase3_chr21_start.vcf.gz").toAbsolutePath(), PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY, PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT, EnumSet.of(PgenWriteFlag.PRESERVE_PHASING), EnumSet.of(PgenReadFlag.MEMORY_MAP) },
+
+            // multi-allelic
+            { Paths.get("testdata/hg38_trio.pik3ca.vcf").toAbsolutePath(), PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY, PgenChromosomeCode.PLINK_CHROMOSOME_CODE_CHRM, EnumSet.noneOf(PgenWriteFlag.class), EnumSet.noneOf(PgenReadFlag.class) },
+            { Paths.get("testdata/hg38_trio.pik3ca.vcf").toAbsolutePath(), PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY, PgenChromosomeCode.PLINK_CHROMOSOME_CODE_CHRM, EnumSet.noneOf(PgenWriteFlag.class), EnumSet.of(PgenReadFlag.MEMORY_MAP) },
+        };
+    }
+
+    @Test(dataProvider = "roundTripReadProvider")
+    public void testRoundTripRead(
+            final Path originalVCF,
+            final PgenWriteMode pgenWriteMode,
+            final PgenChromosomeCode chromosomeCode,
+            final EnumSet<PgenWriteFlag> writeFlags,
+            final EnumSet<PgenReadFlag> readFlags) throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(originalVCF, pgenWriteMode, chromosomeCode, true, writeFlags);
+        final boolean preservePhasing = writeFlags.contains(PgenWriteFlag.PRESERVE_PHASING);
+
+        try (final PgenReader pgenReader = new PgenReader(new HtsPath(pgenFileSet.pGenPath().toString()), readFlags);
+             final VCFFileReader vcfReader = new VCFFileReader(originalVCF, false);
+             final CloseableIterator<VariantContext> vcIt = vcfReader.iterator()) {
+            final List<String> sampleNames = vcfReader.getFileHeader().getGenotypeSamples();
+            Assert.assertEquals(pgenReader.getSampleCount(), sampleNames.size());
+
+            final ByteBuffer alleleCodes = pgenReader.createAlleleCodeBuffer();
+            final ByteBuffer phaseBytes = pgenReader.createPhaseBuffer();
+            long variantIndex = 0;
+            while (vcIt.hasNext()) {
+                final VariantContext vc = vcIt.next();
+                final int alleleCount = pgenReader.readAlleles(variantIndex, alleleCodes, phaseBytes);
+                Assert.assertEquals(alleleCount, vc.getNAlleles(), vc.toStringWithoutGenotypes());
+                for (int i = 0; i < sampleNames.size(); i++) {
+                    assertGenotypeMatches(
+                        vc,
+                        vc.getGenotype(sampleNames.get(i)),
+                        alleleCodes.getInt(i * 2 * Integer.BYTES),
+                        alleleCodes.getInt((i * 2 + 1) * Integer.BYTES),
+                        phaseBytes.get(i),
+                        preservePhasing);
+                }
+                variantIndex++;
+            }
+            Assert.assertEquals(pgenReader.getVariantCount(), variantIndex);
+        }
+    }
+
+    @DataProvider(name="sampleSubsetReadProvider")
+    public Object[][] sampleSubsetReadProvider() {
+        return new Object[][] {
+            { EnumSet.noneOf(PgenReadFlag.class) },
+            { EnumSet.of(PgenReadFlag.MEMORY_MAP) },
+        };
+    }
+
+    @Test(dataProvider = "sampleSubsetReadProvider")
+    public void testSampleSubsetRead(final EnumSet<PgenReadFlag> readFlags) throws IOException, InterruptedException {
+        final Path originalVCF = Paths.get("testdata/1kg_phase3_chr21_start.vcf.gz").toAbsolutePath();
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            originalVCF,
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+            true,
+            EnumSet.of(PgenWriteFlag.PRESERVE_PHASING));
+        final HtsPath pgenPath = new HtsPath(pgenFileSet.pGenPath().toString());
+
+        try (final VCFFileReader vcfReader = new VCFFileReader(originalVCF, false);
+             final CloseableIterator<VariantContext> vcIt = vcfReader.iterator()) {
+            final List<String> sampleNames = vcfReader.getFileHeader().getGenotypeSamples();
+            // every third sample, plus the last one
+            final int[] sampleIndices = IntStream.range(0, sampleNames.size())
+                .filter(i -> i % 3 == 0 || i == sampleNames.size() - 1)
+                .toArray();
+            try (final PgenReader pgenReader = new PgenReader(
+                    pgenPath, PgenReader.readAlleleCountsFromPvar(pgenPath), sampleIndices, readFlags)) {
+                Assert.assertEquals(pgenReader.getSampleCount(), sampleIndices.length);
+
+                final ByteBuffer alleleCodes = pgenReader.createAlleleCodeBuffer();
+                final ByteBuffer phaseBytes = pgenReader.createPhaseBuffer();
+                Assert.assertEquals(alleleCodes.capacity(), sampleIndices.length * 2 * Integer.BYTES);
+                long variantIndex = 0;
+                while (vcIt.hasNext()) {
+                    final VariantContext vc = vcIt.next();
+                    pgenReader.readAlleles(variantIndex++, alleleCodes, phaseBytes);
+                    for (int i = 0; i < sampleIndices.length; i++) {
+                        assertGenotypeMatches(
+                            vc,
+                            vc.getGenotype(sampleNames.get(sampleIndices[i])),
+                            alleleCodes.getInt(i * 2 * Integer.BYTES),
+                            alleleCodes.getInt((i * 2 + 1) * Integer.BYTES),
+                            phaseBytes.get(i),
+                            true);
+                    }
+                }
+            }
+        }
+    }
+
+    @Test(dataProvider = "sampleSubsetReadProvider")
+    public void testScanMatchesReadAlleles(final EnumSet<PgenReadFlag> readFlags) throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/1kg_phase3_chr21_start.vcf.gz").toAbsolutePath(),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+            true,
+            EnumSet.of(PgenWriteFlag.PRESERVE_PHASING));
+
+        try (final PgenReader pgenReader = new PgenReader(new HtsPath(pgenFileSet.pGenPath().toString()), readFlags)) {
+            final int sampleCount = pgenReader.getSampleCount();
+            final long variantStart = 1;
+            final long variantEnd = pgenReader.getVariantCount();
+            // skip every fifth variant
+            final BitSet variantInclude = new BitSet();
+            for (int i = 0; i < variantEnd; i++) {
+                if (i % 5 != 0) {
+                    variantInclude.set(i);
+                }
+            }
+            final ByteBuffer expectedAlleleCodes = pgenReader.createAlleleCodeBuffer();
+            final ByteBuffer expectedPhaseBytes = pgenReader.createPhaseBuffer();
+
+            // a batch size that doesn't divide the number of variants, so the last batch is partial
+            try (final PgenScanner scanner = pgenReader.scan(variantStart, variantEnd, variantInclude, 3, 7)) {
+                final ByteBuffer variantIndices = scanner.createVariantIndexBuffer();
+                final ByteBuffer alleleCodes = scanner.createAlleleCodeBuffer();
+                final ByteBuffer phaseBytes = scanner.createPhaseBuffer();
+                final ByteBuffer alleleCounts = scanner.createAlleleCountBuffer();
+                int expectedVariantIndex = variantInclude.nextSetBit((int) variantStart);
+                int batchCount;
+                while ((batchCount = scanner.nextBatch(variantIndices, alleleCodes, phaseBytes, alleleCounts)) != 0) {
+                    for (int i = 0; i < batchCount; i++) {
+                        final int variantIndex = variantIndices.getInt(i * Integer.BYTES);
+                        Assert.assertEquals(variantIndex, expectedVariantIndex);
+                        Assert.assertEquals(
+                            alleleCounts.getInt(i * Integer.BYTES),
+                            pgenReader.readAlleles(variantIndex, expectedAlleleCodes, expectedPhaseBytes));
+                        for (int j = 0; j < sampleCount * 2; j++) {
+                            Assert.assertEquals(
+                                alleleCodes.getInt((i * sampleCount * 2 + j) * Integer.BYTES),
+                                expectedAlleleCodes.getInt(j * Integer.BYTES));
+                        }
+                        for (int j = 0; j < sampleCount; j++) {
+                            Assert.assertEquals(phaseBytes.get(i * sampleCount + j), expectedPhaseBytes.get(j));
+                        }
+                        expectedVariantIndex = variantInclude.nextSetBit(expectedVariantIndex + 1);
+                    }
+                }
+                // every included variant was returned
+                Assert.assertTrue(expectedVariantIndex < 0 || expectedVariantIndex >= variantEnd);
+            }
+        }
+    }
+
+    @Test(dataProvider = "sampleSubsetReadProvider")
+    public void testComputeAlleleCounts(final EnumSet<PgenReadFlag> readFlags) throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/hg38_trio.pik3ca.vcf").toAbsolutePath(),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_CHRM,
+            true,
+            EnumSet.noneOf(PgenWriteFlag.class));
+
+        try (final PgenReader pgenReader = new PgenReader(new HtsPath(pgenFileSet.pGenPath().toString()), readFlags)) {
+            final int sampleCount = pgenReader.getSampleCount();
+            final long variantStart = 1;
+            final long variantEnd = pgenReader.getVariantCount();
+            final ByteBuffer genotypeCounts = pgenReader.createGenotypeCountBuffer(variantStart, variantEnd);
+            final ByteBuffer alleleDosages = pgenReader.createAlleleDosageBuffer(variantStart, variantEnd);
+            pgenReader.computeAlleleCounts(variantStart, variantEnd, 3, genotypeCounts, alleleDosages);
+
+            final ByteBuffer alleleCodes = pgenReader.createAlleleCodeBuffer();
+            final long alleleIndexStart = pgenReader.getAlleleIndexOffset(variantStart);
+            for (long v = variantStart; v < variantEnd; v++) {
+                final int alleleCount = pgenReader.readAlleles(v, alleleCodes, null);
+                final int[] expectedGenotypeCounts = new int[4];
+                final double[] expectedAlleleCounts = new double[alleleCount];
+                for (int i = 0; i < sampleCount; i++) {
+                    final int code1 = alleleCodes.getInt(i * 2 * Integer.BYTES);
+                    final int code2 = alleleCodes.getInt((i * 2 + 1) * Integer.BYTES);
+                    if (code1 == PgenWriter.PLINK2_NO_CALL_VALUE) {
+                        expectedGenotypeCounts[3]++;
+                        continue;
+                    }
+                    expectedGenotypeCounts[(code1 != 0 ? 1 : 0) + (code2 != 0 ? 1 : 0)]++;
+                    expectedAlleleCounts[code1]++;
+                    expectedAlleleCounts[code2]++;
+                }
+                for (int j = 0; j < 4; j++) {
+                    Assert.assertEquals(
+                        genotypeCounts.getInt((int) ((v - variantStart) * 4 + j) * Integer.BYTES), expectedGenotypeCounts[j]);
+                }
+                final long alleleIndex = pgenReader.getAlleleIndexOffset(v) - alleleIndexStart;
+                Assert.assertEquals(pgenReader.getAlleleIndexOffset(v + 1) - pgenReader.getAlleleIndexOffset(v), alleleCount);
+                for (int a = 0; a < alleleCount; a++) {
+                    Assert.assertEquals(alleleDosages.getDouble((int) (alleleIndex + a) * Double.BYTES), expectedAlleleCounts[a]);
+                }
+            }
+        }
+    }
+
+    @Test(dataProvider = "sampleSubsetReadProvider")
+    public void testReadDosages(final EnumSet<PgenReadFlag> readFlags) throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/CEUtrioTest.vcf").toAbsolutePath(),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+            true,
+            EnumSet.noneOf(PgenWriteFlag.class));
+
+        try (final PgenReader pgenReader = new PgenReader(new HtsPath(pgenFileSet.pGenPath().toString()), readFlags)) {
+            final int sampleCount = pgenReader.getSampleCount();
+            final long variantStart = 2;
+            final long variantEnd = pgenReader.getVariantCount();
+            final FloatBuffer floatDosages = pgenReader.createFloatDosageBuffer(variantStart, variantEnd);
+            final DoubleBuffer doubleDosages = pgenReader.createDoubleDosageBuffer(variantStart, variantEnd);
+            pgenReader.readDosages(variantStart, variantEnd, false, floatDosages);
+            pgenReader.readDosages(variantStart, variantEnd, false, doubleDosages);
+
+            // the PGEN has no dosage track, so each dosage is the number of non-reference alleles in the hardcall
+            final ByteBuffer alleleCodes = pgenReader.createAlleleCodeBuffer();
+            for (long v = variantStart; v < variantEnd; v++) {
+                pgenReader.readAlleles(v, alleleCodes, null);
+                for (int i = 0; i < sampleCount; i++) {
+                    final int code1 = alleleCodes.getInt(i * 2 * Integer.BYTES);
+                    final int code2 = alleleCodes.getInt((i * 2 + 1) * Integer.BYTES);
+                    final double expectedDosage = code1 == PgenWriter.PLINK2_NO_CALL_VALUE ?
+                        PgenWriter.PLINK2_NO_CALL_VALUE :
+                        (code1 != 0 ? 1 : 0) + (code2 != 0 ? 1 : 0);
+                    final int offset = (int) (v - variantStart) * sampleCount + i;
+                    Assert.assertEquals(floatDosages.get(offset), (float) expectedDosage);
+                    Assert.assertEquals(doubleDosages.get(offset), expectedDosage);
+                }
+            }
+        }
+    }
+
+    @Test
+    public void testReadDosagesMeanImpute() throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/CEUtrioTest.vcf").toAbsolutePath(),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+            true,
+            EnumSet.noneOf(PgenWriteFlag.class));
+
+        try (final PgenReader pgenReader = new PgenReader(new HtsPath(pgenFileSet.pGenPath().toString()))) {
+            final int sampleCount = pgenReader.getSampleCount();
+            final long variantCount = pgenReader.getVariantCount();
+            final DoubleBuffer dosages = pgenReader.createDoubleDosageBuffer(0, variantCount);
+            final DoubleBuffer imputedDosages = pgenReader.createDoubleDosageBuffer(0, variantCount);
+            final FloatBuffer imputedFloatDosages = pgenReader.createFloatDosageBuffer(0, variantCount);
+            pgenReader.readDosages(0, variantCount, false, dosages);
+            for (long v = 0; v < variantCount; v++) {
+                double dosageSum = 0.0;
+                int nonMissingCount = 0;
+                for (int i = 0; i < sampleCount; i++) {
+                    final double dosage = dosages.get((int) v * sampleCount + i);
+                    if (dosage != PgenWriter.PLINK2_NO_CALL_VALUE) {
+                        dosageSum += dosage;
+                        nonMissingCount++;
+                    }
+                }
+                if (nonMissingCount == 0) {
+                    continue;
+                }
+                pgenReader.readDosages(v, v + 1, true, imputedDosages);
+                pgenReader.readDosages(v, v + 1, true, imputedFloatDosages);
+                for (int i = 0; i < sampleCount; i++) {
+                    final double dosage = dosages.get((int) v * sampleCount + i);
+                    final double expectedDosage =
+                        dosage == PgenWriter.PLINK2_NO_CALL_VALUE ? dosageSum / nonMissingCount : dosage;
+                    Assert.assertEquals(imputedDosages.get(i), expectedDosage, 1e-12);
+                    Assert.assertEquals(imputedFloatDosages.get(i), (float) expectedDosage, 1e-6);
+                }
+            }
+        }
+    }
+
+    @Test(dataProvider = "sampleSubsetReadProvider")
+    public void testReadHaplotypes(final EnumSet<PgenReadFlag> readFlags) throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/hg38_trio.pik3ca.vcf").toAbsolutePath(),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_CHRM,
+            true,
+            EnumSet.of(PgenWriteFlag.PRESERVE_PHASING));
+
+        try (final PgenReader pgenReader = new PgenReader(new HtsPath(pgenFileSet.pGenPath().toString()), readFlags)) {
+            final int sampleCount = pgenReader.getSampleCount();
+            final long variantStart = 1;
+            final long variantEnd = pgenReader.getVariantCount();
+            final int variantCount = (int) (variantEnd - variantStart);
+            final ByteBuffer hap0Codes = pgenReader.createHaplotypeBuffer(variantStart, variantEnd);
+            final ByteBuffer hap1Codes = pgenReader.createHaplotypeBuffer(variantStart, variantEnd);
+            pgenReader.readHaplotypes(variantStart, variantEnd, 2, hap0Codes, hap1Codes);
+
+            final ByteBuffer alleleCodes = pgenReader.createAlleleCodeBuffer();
+            for (long v = variantStart; v < variantEnd; v++) {
+                pgenReader.readAlleles(v, alleleCodes, null);
+                for (int i = 0; i < sampleCount; i++) {
+                    final int hapOffset = (i * variantCount + (int) (v - variantStart)) * Integer.BYTES;
+                    final int code0 = alleleCodes.getInt(i * 2 * Integer.BYTES);
+                    final int code1 = alleleCodes.getInt((i * 2 + 1) * Integer.BYTES);
+                    Assert.assertEquals(hap0Codes.getInt(hapOffset), toHaplotypeCode(code0));
+                    Assert.assertEquals(hap1Codes.getInt(hapOffset), toHaplotypeCode(code1));
+                }
+            }
+        }
+    }
+
+    private static int toHaplotypeCode(final int alleleCode) {
+        return alleleCode == PgenWriter.PLINK2_NO_CALL_VALUE ? alleleCode : (alleleCode != 0 ? 1 : 0);
+    }
+
+    @Test(dataProvider = "sampleSubsetReadProvider")
+    public void testComputeMissingness(final EnumSet<PgenReadFlag> readFlags) throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/CEUtrioTest.vcf").toAbsolutePath(),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+            true,
+            EnumSet.noneOf(PgenWriteFlag.class));
+
+        try (final PgenReader pgenReader = new PgenReader(new HtsPath(pgenFileSet.pGenPath().toString()), readFlags)) {
+            final int sampleCount = pgenReader.getSampleCount();
+            final long variantCount = pgenReader.getVariantCount();
+            final ByteBuffer variantMissingCounts = pgenReader.createVariantMissingCountBuffer(0, variantCount);
+            final ByteBuffer sampleMissingCounts = pgenReader.createSampleMissingCountBuffer();
+            pgenReader.computeMissingness(0, variantCount, 2, false, variantMissingCounts, sampleMissingCounts);
+
+            final ByteBuffer alleleCodes = pgenReader.createAlleleCodeBuffer();
+            final int[] expectedSampleMissingCounts = new int[sampleCount];
+            for (long v = 0; v < variantCount; v++) {
+                pgenReader.readAlleles(v, alleleCodes, null);
+                int expectedVariantMissingCount = 0;
+                for (int i = 0; i < sampleCount; i++) {
+                    if (alleleCodes.getInt(i * 2 * Integer.BYTES) == PgenWriter.PLINK2_NO_CALL_VALUE) {
+                        expectedVariantMissingCount++;
+                        expectedSampleMissingCounts[i]++;
+                    }
+                }
+                Assert.assertEquals(variantMissingCounts.getInt((int) v * Integer.BYTES), expectedVariantMissingCount);
+            }
+            for (int i = 0; i < sampleCount; i++) {
+                Assert.assertEquals(sampleMissingCounts.getInt(i * Integer.BYTES), expectedSampleMissingCounts[i]);
+            }
+        }
+    }
+
+    @Test(dataProvider = "sampleSubsetReadProvider")
+    public void testComputeScores(final EnumSet<PgenReadFlag> readFlags) throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/CEUtrioTest.vcf").toAbsolutePath(),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+            true,
+            EnumSet.noneOf(PgenWriteFlag.class));
+
+        try (final PgenReader pgenReader = new PgenReader(new HtsPath(pgenFileSet.pGenPath().toString()), readFlags)) {
+            final int sampleCount = pgenReader.getSampleCount();
+            final int variantCount = (int) pgenReader.getVariantCount();
+            // weight the ALT allele of every variant for the first score, and the REF allele of every other variant
+            // for the second
+            final StringBuilder weightLines = new StringBuilder("#VARIANT\tALLELE\tALT_SCORE\tREF_SCORE\n");
+            for (int v = 0; v < variantCount; v++) {
+                weightLines.append(String.format("%d\t1\t%s\t0\n", v, 0.5 * (v + 1)));
+                if (v % 2 == 0) {
+                    weightLines.append(String.format("%d\t0\t0\t%s\n", v, -0.25 * (v + 1)));
+                }
+            }
+            final Path weightFile = Files.createTempFile("testComputeScores", ".txt");
+            weightFile.toFile().deleteOnExit();
+            Files.write(weightFile, weightLines.toString().getBytes(StandardCharsets.UTF_8));
+            final PgenScoreWeights scoreWeights = PgenScoreWeights.read(new HtsPath(weightFile.toString()));
+            Assert.assertEquals(scoreWeights.getScoreNames(), new String[] { "ALT_SCORE", "REF_SCORE" });
+            Assert.assertEquals(scoreWeights.getEntryCount(), variantCount + (variantCount + 1) / 2);
+
+            final double[][] expectedScores = new double[2][sampleCount];
+            final double[][] expectedImputedScores = new double[2][sampleCount];
+            final ByteBuffer alleleCodes = pgenReader.createAlleleCodeBuffer();
+            final int[] altDosages = new int[sampleCount];
+            for (int v = 0; v < variantCount; v++) {
+                pgenReader.readAlleles(v, alleleCodes, null);
+                int altDosageSum = 0;
+                int nonMissingCount = 0;
+                for (int i = 0; i < sampleCount; i++) {
+                    final int code0 = alleleCodes.getInt(i * 2 * Integer.BYTES);
+                    final int code1 = alleleCodes.getInt((i * 2 + 1) * Integer.BYTES);
+                    altDosages[i] = code0 == PgenWriter.PLINK2_NO_CALL_VALUE ? -1 : code0 + code1;
+                    if (altDosages[i] >= 0) {
+                        altDosageSum += altDosages[i];
+                        nonMissingCount++;
+                    }
+                }
+                final double meanAltDosage = nonMissingCount == 0 ? 0.0 : (double) altDosageSum / nonMissingCount;
+                for (int i = 0; i < sampleCount; i++) {
+                    final double altDosage = altDosages[i] >= 0 ? altDosages[i] : meanAltDosage;
+                    if (altDosages[i] >= 0) {
+                        expectedScores[0][i] += 0.5 * (v + 1) * altDosage;
+                        if (v % 2 == 0) {
+                            expectedScores[1][i] += -0.25 * (v + 1) * (2 - altDosage);
+                        }
+                    }
+                    expectedImputedScores[0][i] += 0.5 * (v + 1) * altDosage;
+                    if (v % 2 == 0) {
+                        expectedImputedScores[1][i] += -0.25 * (v + 1) * (2 - altDosage);
+                    }
+                }
+            }
+
+            final double[][] scores = pgenReader.computeScores(scoreWeights, 2, false);
+            final double[][] imputedScores = pgenReader.computeScores(scoreWeights, 3, true);
+            for (int s = 0; s < 2; s++) {
+                for (int i = 0; i < sampleCount; i++) {
+                    Assert.assertEquals(scores[s][i], expectedScores[s][i], 1e-9);
+                    Assert.assertEquals(imputedScores[s][i], expectedImputedScores[s][i], 1e-9);
+                }
+            }
+        }
+    }
+
+    @Test(dataProvider = "sampleSubsetReadProvider")
+    public void testComputeGrm(final EnumSet<PgenReadFlag> readFlags) throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/CEUtrioTest.vcf").toAbsolutePath(),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+            true,
+            EnumSet.noneOf(PgenWriteFlag.class));
+
+        try (final PgenReader pgenReader = new PgenReader(new HtsPath(pgenFileSet.pGenPath().toString()), readFlags)) {
+            final int sampleCount = pgenReader.getSampleCount();
+            final long variantCount = pgenReader.getVariantCount();
+
+            // the GRM computed directly from the standardized ALT allele counts of the polymorphic variants
+            final double[][] expectedGrm = new double[sampleCount][sampleCount];
+            final double[] standardized = new double[sampleCount];
+            int expectedVariantCount = 0;
+            final ByteBuffer alleleCodes = pgenReader.createAlleleCodeBuffer();
+            for (long v = 0; v < variantCount; v++) {
+                pgenReader.readAlleles(v, alleleCodes, null);
+                int altCount = 0;
+                int nonMissingCount = 0;
+                for (int i = 0; i < sampleCount; i++) {
+                    final int code0 = alleleCodes.getInt(i * 2 * Integer.BYTES);
+                    if (code0 != PgenWriter.PLINK2_NO_CALL_VALUE) {
+                        altCount += code0 + alleleCodes.getInt((i * 2 + 1) * Integer.BYTES);
+                        nonMissingCount++;
+                    }
+                }
+                final double freq = nonMissingCount == 0 ? 0.0 : altCount / (2.0 * nonMissingCount);
+                if (freq == 0.0 || freq == 1.0) {
+                    continue;
+                }
+                expectedVariantCount++;
+                final double sd = Math.sqrt(2.0 * freq * (1.0 - freq));
+                for (int i = 0; i < sampleCount; i++) {
+                    final int code0 = alleleCodes.getInt(i * 2 * Integer.BYTES);
+                    standardized[i] = code0 == PgenWriter.PLINK2_NO_CALL_VALUE ?
+                        0.0 :
+                        (code0 + alleleCodes.getInt((i * 2 + 1) * Integer.BYTES) - 2.0 * freq) / sd;
+                }
+                for (int j = 0; j < sampleCount; j++) {
+                    for (int k = 0; k < sampleCount; k++) {
+                        expectedGrm[j][k] += standardized[j] * standardized[k];
+                    }
+                }
+            }
+            Assert.assertTrue(expectedVariantCount > 0);
+
+            final ByteBuffer grm = pgenReader.createGrmTileBuffer(0, sampleCount, sampleCount);
+            Assert.assertEquals(pgenReader.computeGrmTile(0, variantCount, 2, 0, sampleCount, sampleCount, grm),
+                expectedVariantCount);
+            final Path grmBinFile = Files.createTempFile("testComputeGrm", ".grm.bin");
+            grmBinFile.toFile().deleteOnExit();
+            Assert.assertEquals(pgenReader.writeGrmBin(0, variantCount, 2, 1, new HtsPath(grmBinFile.toString())),
+                expectedVariantCount);
+            final ByteBuffer triangle = ByteBuffer.wrap(Files.readAllBytes(grmBinFile)).order(ByteOrder.nativeOrder());
+            Assert.assertEquals(triangle.capacity(), sampleCount * (sampleCount + 1) / 2 * Float.BYTES);
+            for (int j = 0; j < sampleCount; j++) {
+                for (int k = 0; k < sampleCount; k++) {
+                    final double expected = expectedGrm[j][k] / expectedVariantCount;
+                    Assert.assertEquals(grm.getDouble((j * sampleCount + k) * Double.BYTES), expected, 1e-9);
+                    if (k <= j) {
+                        Assert.assertEquals(triangle.getFloat(), (float) expected, 1e-5);
+                    }
+                }
+            }
+        }
+    }
+
+    @Test(dataProvider = "sampleSubsetReadProvider")
+    public void testComputeLd(final EnumSet<PgenReadFlag> readFlags) throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/CEUtrioTest.vcf").toAbsolutePath(),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+            true,
+            EnumSet.noneOf(PgenWriteFlag.class));
+
+        try (final PgenReader pgenReader = new PgenReader(new HtsPath(pgenFileSet.pGenPath().toString()), readFlags)) {
+            final int sampleCount = pgenReader.getSampleCount();
+            final int variantCount = (int) pgenReader.getVariantCount();
+
+            // the ALT allele counts of each variant, or -1 for a missing call
+            final int[][] altCounts = new int[variantCount][sampleCount];
+            final ByteBuffer alleleCodes = pgenReader.createAlleleCodeBuffer();
+            for (int v = 0; v < variantCount; v++) {
+                pgenReader.readAlleles(v, alleleCodes, null);
+                for (int i = 0; i < sampleCount; i++) {
+                    final int code0 = alleleCodes.getInt(i * 2 * Integer.BYTES);
+                    altCounts[v][i] = code0 == PgenWriter.PLINK2_NO_CALL_VALUE ?
+                        -1 :
+                        Math.min(code0, 1) + Math.min(alleleCodes.getInt((i * 2 + 1) * Integer.BYTES), 1);
+                }
+            }
+
+            // with phase ignored, r^2 is the squared correlation of the allele counts over the jointly called samples
+            final int windowVariantCount = 3;
+            final PgenLdPairs pairs = pgenReader.computeWindowLd(0, variantCount, windowVariantCount, 0.0, 2, false);
+            int pairIndex = 0;
+            for (int a = 0; a < variantCount; a++) {
+                for (int b = a + 1; b < Math.min(variantCount, a + windowVariantCount + 1); b++) {
+                    double n = 0, sumA = 0, sumB = 0, sumAA = 0, sumBB = 0, sumAB = 0;
+                    for (int i = 0; i < sampleCount; i++) {
+                        if (altCounts[a][i] >= 0 && altCounts[b][i] >= 0) {
+                            n++;
+                            sumA += altCounts[a][i];
+                            sumB += altCounts[b][i];
+                            sumAA += altCounts[a][i] * altCounts[a][i];
+                            sumBB += altCounts[b][i] * altCounts[b][i];
+                            sumAB += altCounts[a][i] * altCounts[b][i];
+                        }
+                    }
+                    final double varA = n * sumAA - sumA * sumA;
+                    final double varB = n * sumBB - sumB * sumB;
+                    if (varA <= 0.0 || varB <= 0.0) {
+                        continue;
+                    }
+                    final double cov = n * sumAB - sumA * sumB;
+                    Assert.assertTrue(pairIndex < pairs.getPairCount());
+                    Assert.assertEquals(pairs.getVariantIndicesA()[pairIndex], a);
+                    Assert.assertEquals(pairs.getVariantIndicesB()[pairIndex], b);
+                    Assert.assertEquals(pairs.getR2()[pairIndex], cov * cov / (varA * varB), 1e-9);
+                    Assert.assertTrue(Math.abs(pairs.getDPrime()[pairIndex]) <= 1.0);
+                    pairIndex++;
+                }
+            }
+            Assert.assertEquals(pairIndex, pairs.getPairCount());
+
+            // every window pair is found by the cross query of its first variant against the rest
+            for (int p = 0; p < pairs.getPairCount(); p++) {
+                final int a = pairs.getVariantIndicesA()[p];
+                final PgenLdPairs crossPairs = pgenReader.computeCrossLd(a, a + 1, 0, variantCount, 0.0, 3, false);
+                boolean found = false;
+                for (int q = 0; q < crossPairs.getPairCount(); q++) {
+                    Assert.assertEquals(crossPairs.getVariantIndicesA()[q], a);
+                    Assert.assertNotEquals(crossPairs.getVariantIndicesB()[q], a);
+                    if (crossPairs.getVariantIndicesB()[q] == pairs.getVariantIndicesB()[p]) {
+                        Assert.assertEquals(crossPairs.getR2()[q], pairs.getR2()[p], 1e-12);
+                        Assert.assertEquals(crossPairs.getDPrime()[q], pairs.getDPrime()[p], 1e-12);
+                        found = true;
+                    }
+                }
+                Assert.assertTrue(found);
+            }
+
+            // a threshold above every r^2 leaves no pairs
+            Assert.assertEquals(pgenReader.computeWindowLd(0, variantCount, windowVariantCount, 1.1, 2, true)
+                .getPairCount(), 0);
+        }
+    }
+
+    @Test(dataProvider = "sampleSubsetReadProvider")
+    public void testValidate(final EnumSet<PgenReadFlag> readFlags) throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/1kg_phase3_chr21_start.vcf.gz").toAbsolutePath(),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+            true,
+            EnumSet.of(PgenWriteFlag.PRESERVE_PHASING));
+        final HtsPath pgenPath = new HtsPath(pgenFileSet.pGenPath().toString());
+
+        try (final PgenReader pgenReader =
+                 new PgenReader(pgenPath, PgenReader.readAlleleCountsFromPvar(pgenPath), readFlags)) {
+            pgenReader.validate(1);
+            pgenReader.validate(4);
+        }
+
+        // a .pgen with trailing bytes doesn't match the record index in its header
+        Files.write(pgenFileSet.pGenPath(), new byte[] { 0 }, StandardOpenOption.APPEND);
+        try (final PgenReader pgenReader =
+                 new PgenReader(pgenPath, PgenReader.readAlleleCountsFromPvar(pgenPath), readFlags)) {
+            pgenReader.validate(3);
+            Assert.fail("expected the corrupted pgen to be rejected");
+        } catch (final PgenException e) {
+            Assert.assertTrue(e.getMessage().contains("Invalid pgen header or index"), e.getMessage());
+        }
+    }
+
+    @Test(dataProvider = "sampleSubsetReadProvider")
+    public void testSampleMajorSidecar(final EnumSet<PgenReadFlag> readFlags) throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/1kg_phase3_chr21_start.vcf.gz").toAbsolutePath(),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+            true,
+            EnumSet.of(PgenWriteFlag.PRESERVE_PHASING));
+        final HtsPath pgenPath = new HtsPath(pgenFileSet.pGenPath().toString());
+        final HtsPath sidecarPath = PgenSampleMajorReader.getDefaultSidecarPath(pgenPath);
+        sidecarPath.toPath().toFile().deleteOnExit();
+
+        try (final PgenReader pgenReader =
+                 new PgenReader(pgenPath, PgenReader.readAlleleCountsFromPvar(pgenPath), readFlags)) {
+            pgenReader.writeSampleMajorSidecar(sidecarPath, 3);
+            final long variantCount = pgenReader.getVariantCount();
+            try (final PgenSampleMajorReader sampleMajorReader = new PgenSampleMajorReader(sidecarPath)) {
+                Assert.assertEquals(sampleMajorReader.getVariantCount(), variantCount);
+                Assert.assertEquals(sampleMajorReader.getSampleCount(), pgenReader.getSampleCount());
+
+                // the genotypes of every sample, one variant at a time
+                final int sampleCount = pgenReader.getSampleCount();
+                final byte[][] expected = new byte[sampleCount][Math.toIntExact(variantCount)];
+                final ByteBuffer alleleCodes = pgenReader.createAlleleCodeBuffer();
+                final ByteBuffer phaseBytes = pgenReader.createPhaseBuffer();
+                for (int v = 0; v < variantCount; v++) {
+                    pgenReader.readAlleles(v, alleleCodes, phaseBytes);
+                    for (int i = 0; i < sampleCount; i++) {
+                        final int code0 = alleleCodes.getInt(i * 2 * Integer.BYTES);
+                        final int code1 = alleleCodes.getInt((i * 2 + 1) * Integer.BYTES);
+                        expected[i][v] = (byte) (code0 == -9 ? -9 : (code0 != 0 ? 1 : 0) + (code1 != 0 ? 1 : 0));
+                    }
+                }
+                final long variantStart = variantCount / 3;
+                final ByteBuffer genotypes = sampleMajorReader.createGenotypeBuffer(variantStart, variantCount);
+                for (int i = 0; i < sampleCount; i += 7) {
+                    sampleMajorReader.readSampleGenotypes(i, variantStart, variantCount, genotypes);
+                    for (int v = (int) variantStart; v < variantCount; v++) {
+                        Assert.assertEquals(genotypes.get((int) (v - variantStart)), expected[i][v]);
+                    }
+                }
+            }
+        }
+    }
+
+    @DataProvider(name = "extractProvider")
+    public Object[][] getExtractTestCases() {
+        return new Object[][] {
+            // every sample, so the records are copied
+            { false, PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY },
+            { false, PgenWriteMode.PGEN_FILE_MODE_WRITE_SEPARATE_INDEX },
+            // a sample subset, so the records are re-encoded
+            { true, PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY },
+            { true, PgenWriteMode.PGEN_FILE_MODE_WRITE_SEPARATE_INDEX },
+        };
+    }
+
+    @Test(dataProvider = "extractProvider")
+    public void testExtract(final boolean subsetSamples, final PgenWriteMode pgenWriteMode) throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/1kg_phase3_chr21_start.vcf.gz").toAbsolutePath(),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+            true,
+            EnumSet.of(PgenWriteFlag.PRESERVE_PHASING));
+        final HtsPath pgenPath = new HtsPath(pgenFileSet.pGenPath().toString());
+        final int[] alleleCounts = PgenReader.readAlleleCountsFromPvar(pgenPath);
+        final int[] variantIndices = IntStream.range(0, alleleCounts.length).filter(i -> i % 3 != 1).toArray();
+        final List<String> pSamLines = Files.readAllLines(pgenFileSet.pSamPath());
+        final int[] sampleIndices = subsetSamples ?
+            IntStream.range(0, pSamLines.size() - 1).filter(i -> i % 4 == 2).toArray() :
+            null;
+
+        final PgenFileSet extractFileSet = PgenFileSet.createTempPgenFileSet("testExtract");
+        final HtsPath extractPath = new HtsPath(extractFileSet.pGenPath().toString());
+        try (final PgenReader pgenReader = new PgenReader(
+                pgenPath, alleleCounts, sampleIndices, EnumSet.noneOf(PgenReadFlag.class))) {
+            pgenReader.extract(variantIndices, extractPath, pgenWriteMode, 3);
+
+            final int[] extractAlleleCounts = PgenReader.readAlleleCountsFromPvar(extractPath);
+            Assert.assertEquals(extractAlleleCounts.length, variantIndices.length);
+            try (final PgenReader extractReader = new PgenReader(extractPath, extractAlleleCounts)) {
+                Assert.assertEquals(extractReader.getVariantCount(), variantIndices.length);
+                Assert.assertEquals(extractReader.getSampleCount(), pgenReader.getSampleCount());
+                extractReader.validate(2);
+                final ByteBuffer alleleCodes = pgenReader.createAlleleCodeBuffer();
+                final ByteBuffer phaseBytes = pgenReader.createPhaseBuffer();
+                final ByteBuffer extractAlleleCodes = extractReader.createAlleleCodeBuffer();
+                final ByteBuffer extractPhaseBytes = extractReader.createPhaseBuffer();
+                for (int i = 0; i < variantIndices.length; i++) {
+                    Assert.assertEquals(extractAlleleCounts[i], alleleCounts[variantIndices[i]]);
+                    Assert.assertEquals(
+                        extractReader.readAlleles(i, extractAlleleCodes, extractPhaseBytes),
+                        pgenReader.readAlleles(variantIndices[i], alleleCodes, phaseBytes));
+                    Assert.assertEquals(extractAlleleCodes.rewind(), alleleCodes.rewind());
+                    Assert.assertEquals(extractPhaseBytes.rewind(), phaseBytes.rewind());
+                }
+            }
+        }
+        // the .psam keeps its header line, and the extracted samples
+        final List<String> extractPSamLines = Files.readAllLines(extractFileSet.pSamPath());
+        Assert.assertEquals(extractPSamLines.get(0), pSamLines.get(0));
+        if (subsetSamples) {
+            Assert.assertEquals(extractPSamLines.size(), sampleIndices.length + 1);
+            for (int i = 0; i < sampleIndices.length; i++) {
+                Assert.assertEquals(extractPSamLines.get(i + 1), pSamLines.get(sampleIndices[i] + 1));
+            }
+        } else {
+            Assert.assertEquals(extractPSamLines, pSamLines);
+        }
+    }
+
+    @Test(expectedExceptions = PgenException.class)
+    public void testRejectUnorderedExtract() throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/CEUtrioTest.vcf"),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+            false,
+            EnumSet.noneOf(PgenWriteFlag.class));
+        final PgenFileSet extractFileSet = PgenFileSet.createTempPgenFileSet("testRejectUnorderedExtract");
+        try (final PgenReader pgenReader = new PgenReader(new HtsPath(pgenFileSet.pGenPath().toString()))) {
+            pgenReader.extract(
+                new int[] { 2, 1 },
+                new HtsPath(extractFileSet.pGenPath().toString()),
+                PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+                1);
+        }
+    }
+
+    @Test(expectedExceptions = PgenException.class)
+    public void testRejectCloseWithOpenScanner() throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/CEUtrioTest.vcf").toAbsolutePath(),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+            true,
+            EnumSet.noneOf(PgenWriteFlag.class));
+        final PgenReader pgenReader = new PgenReader(new HtsPath(pgenFileSet.pGenPath().toString()));
+        final PgenScanner scanner = pgenReader.scan(0, pgenReader.getVariantCount(), null, 2, 16);
+        try {
+            pgenReader.close();
+        } finally {
+            scanner.close();
+            pgenReader.close();
+        }
+    }
+
+    @Test(expectedExceptions = PgenException.class)
+    public void testRejectUnorderedSampleSubset() throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/CEUtrioTest.vcf").toAbsolutePath(),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+            true,
+            EnumSet.noneOf(PgenWriteFlag.class));
+        try (final PgenReader unused = new PgenReader(
+                new HtsPath(pgenFileSet.pGenPath().toString()), null, new int[] { 2, 0 }, EnumSet.noneOf(PgenReadFlag.class))) {
+            Assert.fail("expected an exception for out of order sample indices");
+        }
+    }
+
+    @Test(expectedExceptions = PgenException.class)
+    public void testRejectMultiAllelicReadWithoutAlleleCounts() throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/hg38_trio.pik3ca.vcf").toAbsolutePath(),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_CHRM,
+            true,
+            EnumSet.noneOf(PgenWriteFlag.class));
+        // without the allele counts from the .pvar, the reader can't decode the multi-allelic variants
+        Files.delete(pgenFileSet.pVarPath());
+        try (final PgenReader pgenReader = new PgenReader(new HtsPath(pgenFileSet.pGenPath().toString()))) {
+            final ByteBuffer alleleCodes = pgenReader.createAlleleCodeBuffer();
+            for (long i = 0; i < pgenReader.getVariantCount(); i++) {
+                pgenReader.readAlleles(i, alleleCodes, null);
+            }
+        }
+    }
+
+    @Test(expectedExceptions = PgenException.class)
+    public void testRejectInvalidVariantIndex() throws IOException, InterruptedException {
+        final PgenFileSet pgenFileSet = TestUtils.vcfToPgen_jni(
+            Paths.get("testdata/CEUtrioTest.vcf").toAbsolutePath(),
+            PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+            PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+            true,
+            EnumSet.noneOf(PgenWriteFlag.class));
+        try (final PgenReader pgenReader = new PgenReader(new HtsPath(pgenFileSet.pGenPath().toString()))) {
+            pgenReader.readAlleles(pgenReader.getVariantCount(), pgenReader.createAlleleCodeBuffer(), null);
+        }
+    }
+
+    // plink2 stores a genotype with any missing allele as missing, and stores the alleles of unphased hets in
+    // ascending order
+    private static void assertGenotypeMatches(
+            final VariantContext vc,
+            final Genotype g,
+            final int actualCode1,
+            final int actualCode2,
+            final byte actualPhase,
+            final boolean preservePhasing) {
+        final String context = String.format("%s %s", vc.toStringWithoutGenotypes(), g);
+        final List<Allele> alleles = g.getAlleles();
+        if (g.isNoCall() || alleles.stream().anyMatch(Allele::isNoCall)) {
+            Assert.assertEquals(actualCode1, PgenWriter.PLINK2_NO_CALL_VALUE, context);
+            Assert.assertEquals(actualCode2, PgenWriter.PLINK2_NO_CALL_VALUE, context);
+            return;
+        }
+        int expectedCode1 = vc.getAlleleIndex(alleles.get(0));
+        int expectedCode2 = vc.getAlleleIndex(alleles.get(1));
+        final boolean isHet = expectedCode1 != expectedCode2;
+        final boolean isPhasedHet = isHet && preservePhasing && g.isPhased();
+        if (!isPhasedHet && expectedCode1 > expectedCode2) {
+            final int tmp = expectedCode1;
+            expectedCode1 = expectedCode2;
+            expectedCode2 = tmp;
+        }
+        Assert.assertEquals(actualCode1, expectedCode1, context);
+        Assert.assertEquals(actualCode2, expectedCode2, context);
+        if (isHet) {
+            Assert.assertEquals(actualPhase, isPhasedHet ? (byte) 1 : (byte) 0, context);
+        }
+    }
+}
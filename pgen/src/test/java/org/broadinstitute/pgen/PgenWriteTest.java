@@ -4,13 +4,18 @@
 
 package org.broadinstitute.pgen;
 
+import com.github.luben.zstd.ZstdInputStream;
 import htsjdk.io.HtsPath;
 import htsjdk.variant.variantcontext.Allele;
 import htsjdk.variant.variantcontext.Genotype;
 import htsjdk.variant.variantcontext.GenotypeBuilder;
 import htsjdk.variant.variantcontext.VariantContext;
 import htsjdk.variant.variantcontext.VariantContextBuilder;
+import htsjdk.variant.variantcontext.writer.Options;
+import htsjdk.variant.variantcontext.writer.VariantContextWriter;
+import htsjdk.variant.variantcontext.writer.VariantContextWriterBuilder;
 import htsjdk.variant.vcf.VCFFileReader;
+import htsjdk.variant.vcf.VCFHeader;
 
 import org.broadinstitute.pgen.PgenWriter.PgenChromosomeCode;
 import org.broadinstitute.pgen.PgenWriter.PgenWriteFlag;
@@ -19,13 +24,20 @@ import org.broadinstitute.pgen.TestUtils.PgenFileSet;
 import org.testng.Assert;
 import org.testng.annotations.*;
 
+import java.io.ByteArrayOutputStream;
 import java.io.File;
 import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
 import java.nio.file.Files;
 import java.nio.file.Path;
 import java.nio.file.Paths;
 import java.util.ArrayList;
+import java.util.Collections;
 import java.util.EnumSet;
+import java.util.HashMap;
+import java.util.Iterator;
 import java.util.List;
 import java.util.Map;
 
@@ -315,6 +327,334 @@ public class PgenWriteTest {
         }
     }
 
+    // ensure the PgenWriter constructor rejects attempts to use VARIANT_COUNT_UNKNOWN with more than one writer thread,
+    // since the multi-threaded writer requires a known variant count
+    @Test(expectedExceptions = PgenException.class)
+    public void testRejectMultiThreadedWriterWithUnknownVariantCount() throws IOException {
+        final PgenFileSet pfs = PgenFileSet.createTempPgenFileSet("testRejectMultiThreadedWriterWithUnknownVariantCount");
+        final TestUtils.VcfMetaData vcfMetaData = TestUtils.getVcfMetaData(Paths.get("testdata/CEUtrioTest.vcf"));
+
+        try (final PgenWriter pgenWriter = new PgenWriter(
+                new HtsPath(pfs.pGenPath().toAbsolutePath().toString()),
+                vcfMetaData.vcfHeader(),
+                PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+                EnumSet.noneOf(PgenWriteFlag.class),
+                PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,  // doesn't matter
+                false,
+                PgenWriter.VARIANT_COUNT_UNKNOWN,
+                PgenWriter.PLINK2_MAX_ALTERNATE_ALLELES,
+                null,
+                2))
+        {
+            // do nothing...
+        } catch (final PgenException e) {
+            Assert.assertTrue(e.getMessage().contains("requires a known variant count"));
+            throw e;
+        }
+    }
+
+    @Test
+    public void testAsyncWriterMatchesSynchronousWriter() throws IOException {
+        final Path vcfPath = Paths.get("testdata/1kg_phase3_chr21_start.vcf.gz");
+        final TestUtils.VcfMetaData vcfMetaData = TestUtils.getVcfMetaData(vcfPath);
+        final PgenFileSet syncFileSet = PgenFileSet.createTempPgenFileSet("testAsyncWriterMatchesSynchronousWriterSync");
+        final PgenFileSet asyncFileSet = PgenFileSet.createTempPgenFileSet("testAsyncWriterMatchesSynchronousWriterAsync");
+
+        for (final PgenFileSet pfs : List.of(syncFileSet, asyncFileSet)) {
+            try (final VCFFileReader reader = new VCFFileReader(vcfPath, false);
+                 final PgenWriter writer = new PgenWriter(
+                         new HtsPath(pfs.pGenPath().toAbsolutePath().toString()),
+                         vcfMetaData.vcfHeader(),
+                         PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+                         EnumSet.of(PgenWriteFlag.PRESERVE_PHASING),
+                         PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+                         false,
+                         vcfMetaData.nVariants(),
+                         PgenWriter.PLINK2_MAX_ALTERNATE_ALLELES,
+                         null,
+                         1,
+                         pfs == asyncFileSet ? 2 : 0)) {
+                reader.forEach(vc -> writer.add(vc));
+                Assert.assertEquals(writer.getWrittenVariantCount(), vcfMetaData.nVariants());
+            }
+        }
+
+        Assert.assertEquals(Files.readAllBytes(asyncFileSet.pGenPath()), Files.readAllBytes(syncFileSet.pGenPath()));
+    }
+
+    @Test
+    public void testPackedGenotypesMatchAdd() throws IOException {
+        final Path vcfPath = Paths.get("testdata/1kg_phase3_chr21_start.vcf.gz");
+        final TestUtils.VcfMetaData vcfMetaData = TestUtils.getVcfMetaData(vcfPath);
+        final List<String> sampleNames = vcfMetaData.vcfHeader().getGenotypeSamples();
+        final long nBiallelicVariants;
+        try (final VCFFileReader reader = new VCFFileReader(vcfPath, false)) {
+            nBiallelicVariants = reader.iterator().stream().filter(VariantContext::isBiallelic).count();
+        }
+        final PgenFileSet addFileSet = PgenFileSet.createTempPgenFileSet("testPackedGenotypesMatchAddAdd");
+        final PgenFileSet packedFileSet = PgenFileSet.createTempPgenFileSet("testPackedGenotypesMatchAddPacked");
+        final ByteBuffer genovec = ByteBuffer.allocateDirect(((sampleNames.size() + 31) / 32) * Long.BYTES).order(ByteOrder.LITTLE_ENDIAN);
+
+        for (final PgenFileSet pfs : List.of(addFileSet, packedFileSet)) {
+            try (final VCFFileReader reader = new VCFFileReader(vcfPath, false);
+                 final PgenWriter writer = new PgenWriter(
+                         new HtsPath(pfs.pGenPath().toAbsolutePath().toString()),
+                         vcfMetaData.vcfHeader(),
+                         PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+                         EnumSet.noneOf(PgenWriteFlag.class),
+                         PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+                         false,
+                         nBiallelicVariants,
+                         PgenWriter.PLINK2_MAX_ALTERNATE_ALLELES,
+                         null)) {
+                reader.iterator().stream().filter(VariantContext::isBiallelic).forEach(vc -> {
+                    if (pfs == addFileSet) {
+                        writer.add(vc);
+                    } else {
+                        // pack the alt allele count (or 3 for missing) for each sample, 32 samples per 64-bit word
+                        for (int i = 0; i < genovec.capacity(); i++) {
+                            genovec.put(i, (byte) 0);
+                        }
+                        for (int i = 0; i < sampleNames.size(); i++) {
+                            final Genotype g = vc.getGenotype(sampleNames.get(i));
+                            final long altCount = g.isNoCall() || !g.isCalled() ?
+                                3L :
+                                g.getAlleles().stream().filter(a -> !a.isReference()).count();
+                            final int wordOffset = (i / 32) * Long.BYTES;
+                            genovec.putLong(wordOffset, genovec.getLong(wordOffset) | (altCount << (2 * (i % 32))));
+                        }
+                        writer.addPackedGenotypes(vc, genovec, null, null);
+                    }
+                });
+                Assert.assertEquals(writer.getWrittenVariantCount(), nBiallelicVariants);
+            }
+        }
+
+        Assert.assertEquals(Files.readAllBytes(packedFileSet.pGenPath()), Files.readAllBytes(addFileSet.pGenPath()));
+    }
+
+    @DataProvider(name="pvarMatchesHtsjdkProvider")
+    public Object[][] getPvarMatchesHtsjdkTestCases() {
+        return new Object[][] {
+            // original vcf, writer threads
+            { Paths.get("testdata/CEUtrioTest.vcf"), 1 },
+            { Paths.get("testdata/hg38_trio.pik3ca.vcf"), 1 },
+            { Paths.get("testdata/hg38_trio.pik3ca.vcf"), 2 },
+        };
+    }
+
+    // the .pvar lines are formatted directly rather than by htsjdk, so make sure the result is the same as the sites-only
+    // VCF htsjdk writes
+    @Test(dataProvider = "pvarMatchesHtsjdkProvider")
+    public void testPvarMatchesHtsjdkSitesOnlyWriter(final Path vcfPath, final int writerThreads) throws IOException {
+        final TestUtils.VcfMetaData vcfMetaData = TestUtils.getVcfMetaData(vcfPath);
+        final PgenFileSet pfs = PgenFileSet.createTempPgenFileSet("testPvarMatchesHtsjdkSitesOnlyWriter");
+        try (final VCFFileReader reader = new VCFFileReader(vcfPath, false);
+             final PgenWriter writer = new PgenWriter(
+                     new HtsPath(pfs.pGenPath().toAbsolutePath().toString()),
+                     vcfMetaData.vcfHeader(),
+                     PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+                     EnumSet.of(PgenWriteFlag.MULTI_ALLELIC, PgenWriteFlag.PRESERVE_PHASING),
+                     PgenChromosomeCode.PLINK_CHROMOSOME_CODE_CHRM,
+                     false,
+                     vcfMetaData.nVariants(),
+                     PgenWriter.PLINK2_MAX_ALTERNATE_ALLELES,
+                     null,
+                     writerThreads)) {
+            reader.forEach(vc -> writer.add(vc));
+        }
+
+        // the PgenWriter adds a source line to the header, so the expected .pvar is written after it using the same header
+        final ByteArrayOutputStream expectedPvar = new ByteArrayOutputStream();
+        try (final VCFFileReader reader = new VCFFileReader(vcfPath, false);
+             final VariantContextWriter sitesOnlyWriter = new VariantContextWriterBuilder()
+                     .clearOptions()
+                     .setOptions(EnumSet.of(Options.DO_NOT_WRITE_GENOTYPES, Options.ALLOW_MISSING_FIELDS_IN_HEADER))
+                     .setOutputStream(expectedPvar)
+                     .build()) {
+            sitesOnlyWriter.writeHeader(vcfMetaData.vcfHeader());
+            reader.forEach(vc -> sitesOnlyWriter.add(vc));
+        }
+        try (final ZstdInputStream pvarStream = new ZstdInputStream(Files.newInputStream(pfs.pVarPath()))) {
+            Assert.assertEquals(
+                new String(pvarStream.readAllBytes(), StandardCharsets.UTF_8),
+                expectedPvar.toString(StandardCharsets.UTF_8));
+        }
+    }
+
+    @Test
+    public void testWriteDosages() throws IOException, InterruptedException {
+        final PgenFileSet pfs = PgenFileSet.createTempPgenFileSet("testWriteDosages");
+        final TestUtils.VcfMetaData vcfMetaData = TestUtils.getVcfMetaData(Paths.get("testdata/CEUtrioTest.vcf"));
+        final List<String> sampleNames = vcfMetaData.vcfHeader().getGenotypeSamples();
+        final Map<String, Integer> expectedAltCounts = new HashMap<>();
+        try (final VCFFileReader reader = new VCFFileReader(new File("testdata/CEUtrioTest.vcf"), false);
+             final PgenWriter writer = new PgenWriter(
+                    new HtsPath(pfs.pGenPath().toAbsolutePath().toString()),
+                    vcfMetaData.vcfHeader(),
+                    PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+                    EnumSet.of(PgenWriteFlag.DOSAGE),
+                    PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+                    false,
+                    vcfMetaData.nVariants(),
+                    PgenWriter.PLINK2_MAX_ALTERNATE_ALLELES,
+                    null)) {
+            for (final VariantContext vc : reader) {
+                Assert.assertTrue(vc.isBiallelic());
+                // the first sample gets a dosage close enough to 0 to be hardcalled, the second gets a dosage that is
+                // too far from any hardcall, and the third has no dosage, so its dosage is derived from its hardcall
+                final List<Genotype> genotypes = new ArrayList<>();
+                genotypes.add(new GenotypeBuilder(vc.getGenotype(sampleNames.get(0))).attribute("DS", "0.05").make());
+                genotypes.add(new GenotypeBuilder(vc.getGenotype(sampleNames.get(1))).attribute("GP", "0.25,0.5,0.25").attribute("DS", "1.5").make());
+                genotypes.add(vc.getGenotype(sampleNames.get(2)));
+                expectedAltCounts.put(vc.getContig() + ":" + vc.getStart(), vc.getGenotype(sampleNames.get(2)).countAllele(vc.getAlternateAllele(0)));
+                writer.add(new VariantContextBuilder(vc).genotypes(genotypes).make());
+            }
+        }
+        TestUtils.validatePgen_plink2(pfs);
+
+        // round trip the hardcalls back to a VCF
+        final Path plinkGeneratedVCF = TestUtils.pgenToVCF_plink2(pfs, "dosages", "--output-chr MT");
+        try (final VCFFileReader reader = new VCFFileReader(plinkGeneratedVCF, false)) {
+            for (final VariantContext vc : reader) {
+                Assert.assertTrue(vc.getGenotype(sampleNames.get(0)).isHomRef());
+                Assert.assertTrue(vc.getGenotype(sampleNames.get(1)).isNoCall());
+                Assert.assertEquals(
+                    vc.getGenotype(sampleNames.get(2)).countAllele(vc.getAlternateAllele(0)),
+                    (int) expectedAltCounts.get(vc.getContig() + ":" + vc.getStart()));
+            }
+        }
+    }
+
+    // haploid dosages are on a 0 to 1 scale (a haploid GP has 2 entries), and are doubled, as haploid hardcalls are
+    @Test
+    public void testWriteHaploidDosages() throws IOException, InterruptedException {
+        final PgenFileSet pfs = PgenFileSet.createTempPgenFileSet("testWriteHaploidDosages");
+        final TestUtils.VcfMetaData vcfMetaData = TestUtils.getVcfMetaData(Paths.get("testdata/CEUtrioTest.vcf"));
+        final List<String> sampleNames = vcfMetaData.vcfHeader().getGenotypeSamples();
+        try (final VCFFileReader reader = new VCFFileReader(new File("testdata/CEUtrioTest.vcf"), false);
+             final PgenWriter writer = new PgenWriter(
+                    new HtsPath(pfs.pGenPath().toAbsolutePath().toString()),
+                    vcfMetaData.vcfHeader(),
+                    PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+                    EnumSet.of(PgenWriteFlag.DOSAGE),
+                    PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+                    false,
+                    vcfMetaData.nVariants(),
+                    PgenWriter.PLINK2_MAX_ALTERNATE_ALLELES,
+                    null)) {
+            for (final VariantContext vc : reader) {
+                // the first two samples have dosages of 1.96 (from DS) and 1.92 (from GP), which are hardcalled as
+                // hom alt, and the third has a dosage of 1.0 (from DS), which is hardcalled as het
+                final Allele alt = vc.getAlternateAllele(0);
+                final List<Genotype> genotypes = new ArrayList<>();
+                genotypes.add(new GenotypeBuilder(sampleNames.get(0), List.of(alt)).attribute("DS", "0.98").make());
+                genotypes.add(new GenotypeBuilder(sampleNames.get(1), List.of(vc.getReference())).attribute("GP", "0.04,0.96").make());
+                genotypes.add(new GenotypeBuilder(sampleNames.get(2), List.of(alt)).attribute("DS", "0.5").make());
+                writer.add(new VariantContextBuilder(vc).genotypes(genotypes).make());
+            }
+        }
+        TestUtils.validatePgen_plink2(pfs);
+
+        final Path plinkGeneratedVCF = TestUtils.pgenToVCF_plink2(pfs, "haploid_dosages", "--output-chr MT");
+        try (final VCFFileReader reader = new VCFFileReader(plinkGeneratedVCF, false)) {
+            for (final VariantContext vc : reader) {
+                Assert.assertTrue(vc.getGenotype(sampleNames.get(0)).isHomVar());
+                Assert.assertTrue(vc.getGenotype(sampleNames.get(1)).isHomVar());
+                Assert.assertTrue(vc.getGenotype(sampleNames.get(2)).isHet());
+            }
+        }
+    }
+
+    @DataProvider(name = "concatenateShardsProvider")
+    public Object[][] concatenateShardsProvider() {
+        return new Object[][] {
+            { PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY },
+            { PgenWriteMode.PGEN_FILE_MODE_BACKWARD_SEEK },
+        };
+    }
+
+    // write a VCF as three PGEN shards, concatenate them, and make sure the result matches the PGEN for the whole VCF
+    @Test(dataProvider = "concatenateShardsProvider")
+    public void testConcatenateShards(final PgenWriteMode pgenWriteMode) throws IOException, InterruptedException {
+        final Path vcfPath = Paths.get("testdata/hg38_trio.pik3ca.vcf").toAbsolutePath();
+        final EnumSet<PgenWriteFlag> writeFlags = EnumSet.of(PgenWriteFlag.MULTI_ALLELIC, PgenWriteFlag.PRESERVE_PHASING);
+        final TestUtils.VcfMetaData vcfMetaData = TestUtils.getVcfMetaData(vcfPath);
+        final int shardCount = 3;
+        final long shardSize = (vcfMetaData.nVariants() + shardCount - 1) / shardCount;
+
+        final List<PgenFileSet> shards = new ArrayList<>();
+        for (int i = 0; i < shardCount; i++) {
+            shards.add(PgenFileSet.createTempPgenFileSet("testConcatenateShards_shard" + i));
+        }
+        try (final VCFFileReader reader = new VCFFileReader(vcfPath.toFile(), false)) {
+            final Iterator<VariantContext> vcIt = reader.iterator();
+            for (final PgenFileSet shard : shards) {
+                try (final PgenWriter writer = new PgenWriter(
+                        new HtsPath(shard.pGenPath().toAbsolutePath().toString()),
+                        vcfMetaData.vcfHeader(),
+                        PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+                        writeFlags,
+                        PgenChromosomeCode.PLINK_CHROMOSOME_CODE_CHRM,
+                        false,
+                        PgenWriter.VARIANT_COUNT_UNKNOWN,
+                        PgenWriter.PLINK2_MAX_ALTERNATE_ALLELES,
+                        null)) {
+                    for (long j = 0; j < shardSize && vcIt.hasNext(); j++) {
+                        writer.add(vcIt.next());
+                    }
+                }
+            }
+        }
+
+        final PgenFileSet concatenatedFileSet = PgenFileSet.createTempPgenFileSet("testConcatenateShards");
+        final List<HtsPath> shardPgenFiles = new ArrayList<>();
+        shards.forEach(shard -> shardPgenFiles.add(new HtsPath(shard.pGenPath().toAbsolutePath().toString())));
+        PgenWriter.concatenate(
+                shardPgenFiles,
+                new HtsPath(concatenatedFileSet.pGenPath().toAbsolutePath().toString()),
+                pgenWriteMode);
+        TestUtils.validatePgen_plink2(concatenatedFileSet);
+
+        final PgenFileSet wholeFileSet = TestUtils.vcfToPgen_jni(
+                vcfPath,
+                PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+                PgenChromosomeCode.PLINK_CHROMOSOME_CODE_CHRM,
+                false,
+                writeFlags);
+        TestUtils.pgenDiff_plink2(concatenatedFileSet, wholeFileSet);
+        // the concatenated .pvar has only the header of the first shard
+        try (final ZstdInputStream concatenatedPvarStream = new ZstdInputStream(Files.newInputStream(concatenatedFileSet.pVarPath()));
+             final ZstdInputStream wholePvarStream = new ZstdInputStream(Files.newInputStream(wholeFileSet.pVarPath()))) {
+            Assert.assertEquals(
+                new String(concatenatedPvarStream.readAllBytes(), StandardCharsets.UTF_8),
+                new String(wholePvarStream.readAllBytes(), StandardCharsets.UTF_8));
+        }
+        Assert.assertEquals(Files.mismatch(concatenatedFileSet.pSamPath(), wholeFileSet.pSamPath()), -1L);
+    }
+
+    @Test(expectedExceptions = PgenException.class)
+    public void testConcatenateShardsWithDifferentSamples() throws IOException, InterruptedException {
+        final PgenFileSet trioFileSet = TestUtils.vcfToPgen_jni(
+                Paths.get("testdata/CEUtrioTest.vcf"),
+                PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+                PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+                false,
+                EnumSet.noneOf(PgenWriteFlag.class));
+        final PgenFileSet otherFileSet = TestUtils.vcfToPgen_jni(
+                Paths.get("testdata/hg38_trio.pik3ca.vcf"),
+                PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY,
+                PgenChromosomeCode.PLINK_CHROMOSOME_CODE_CHRM,
+                false,
+                EnumSet.noneOf(PgenWriteFlag.class));
+        final PgenFileSet concatenatedFileSet = PgenFileSet.createTempPgenFileSet("testConcatenateShardsWithDifferentSamples");
+        PgenWriter.concatenate(
+                List.of(new HtsPath(trioFileSet.pGenPath().toAbsolutePath().toString()),
+                        new HtsPath(otherFileSet.pGenPath().toAbsolutePath().toString())),
+                new HtsPath(concatenatedFileSet.pGenPath().toAbsolutePath().toString()),
+                PgenWriteMode.PGEN_FILE_MODE_WRITE_AND_COPY);
+    }
+
     @Test
     public void testAcceptNoWritesWithKnownVariantCount() throws IOException {
         // this test is basically to ensure that the pgen-lib C++ code correctly handles closing in the case where
@@ -602,4 +942,75 @@ public class PgenWriteTest {
         }    
     }
 
+    @DataProvider(name="partialNoCalls")
+    public Object[][] partialNoCallsProvider() {
+        return new Object[][] {
+            // the alleles of a partial no-call genotype
+            { List.of(Allele.NO_CALL, Allele.REF_A) },
+            { List.of(Allele.NO_CALL, Allele.ALT_C) },
+            { List.of(Allele.ALT_C, Allele.NO_CALL) },
+        };
+    }
+
+    // htsjdk considers partial no-calls (./0, ./1) to be called, but they can't be represented as PGEN hardcalls, so
+    // verify that a variant with fully called and fully missing genotypes reads back unchanged, and that a variant
+    // with a partial no-call is rejected rather than written as a het or hom-alt call
+    @Test(dataProvider = "partialNoCalls")
+    public void testPartialNoCalls(final List<Allele> partialNoCallAlleles) throws IOException {
+        final List<String> sampleNames = List.of("s1", "s2", "s3", "s4");
+        final VCFHeader vcfHeader = new VCFHeader(Collections.emptySet(), sampleNames);
+        final List<Allele> alleles = List.of(Allele.REF_A, Allele.ALT_C);
+        final VariantContext calledVC = new VariantContextBuilder("test", "chr1", 1, 1, alleles).genotypes(List.of(
+            new GenotypeBuilder("s1", List.of(Allele.REF_A, Allele.REF_A)).make(),
+            new GenotypeBuilder("s2", List.of(Allele.REF_A, Allele.ALT_C)).make(),
+            new GenotypeBuilder("s3", List.of(Allele.ALT_C, Allele.ALT_C)).make(),
+            new GenotypeBuilder("s4", List.of(Allele.NO_CALL, Allele.NO_CALL)).make())).make();
+        final VariantContext partialNoCallVC = new VariantContextBuilder("test", "chr1", 2, 2, alleles).genotypes(List.of(
+            new GenotypeBuilder("s1", List.of(Allele.REF_A, Allele.REF_A)).make(),
+            new GenotypeBuilder("s2", partialNoCallAlleles).make(),
+            new GenotypeBuilder("s3", List.of(Allele.ALT_C, Allele.ALT_C)).make(),
+            new GenotypeBuilder("s4", List.of(Allele.REF_A, Allele.ALT_C)).make())).make();
+        Assert.assertTrue(partialNoCallVC.getGenotype("s2").isMixed());
+
+        final PgenFileSet calledFileSet = PgenFileSet.createTempPgenFileSet("testPartialNoCallsCalled");
+        try (final PgenWriter pgenWriter = new PgenWriter(
+                new HtsPath(calledFileSet.pGenPath().toAbsolutePath().toString()),
+                vcfHeader,
+                PgenWriteMode.PGEN_FILE_MODE_WRITE_SEPARATE_INDEX,
+                EnumSet.noneOf(PgenWriteFlag.class),
+                PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+                false,
+                1,
+                PgenWriter.PLINK2_MAX_ALTERNATE_ALLELES,
+                null)) {
+            pgenWriter.add(calledVC);
+        }
+        try (final PgenReader pgenReader = new PgenReader(new HtsPath(calledFileSet.pGenPath().toString()))) {
+            final ByteBuffer alleleCodes = pgenReader.createAlleleCodeBuffer();
+            Assert.assertEquals(pgenReader.readAlleles(0, alleleCodes, null), 2);
+            final int noCall = PgenWriter.PLINK2_NO_CALL_VALUE;
+            final int[] expectedAlleleCodes = { 0, 0, 0, 1, 1, 1, noCall, noCall };
+            for (int i = 0; i < expectedAlleleCodes.length; i++) {
+                Assert.assertEquals(alleleCodes.getInt(i * Integer.BYTES), expectedAlleleCodes[i]);
+            }
+        }
+
+        final PgenFileSet partialFileSet = PgenFileSet.createTempPgenFileSet("testPartialNoCallsPartial");
+        Assert.assertThrows(PgenException.class, () -> {
+            try (final PgenWriter pgenWriter = new PgenWriter(
+                    new HtsPath(partialFileSet.pGenPath().toAbsolutePath().toString()),
+                    vcfHeader,
+                    PgenWriteMode.PGEN_FILE_MODE_WRITE_SEPARATE_INDEX,
+                    EnumSet.noneOf(PgenWriteFlag.class),
+                    PgenChromosomeCode.PLINK_CHROMOSOME_CODE_MT,
+                    false,
+                    2,
+                    PgenWriter.PLINK2_MAX_ALTERNATE_ALLELES,
+                    null)) {
+                pgenWriter.add(calledVC);
+                pgenWriter.add(partialNoCallVC);
+            }
+        });
+    }
+
 }